@@ -0,0 +1,298 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Annex B start code scanner and access unit splitter for H.264 and HEVC.
+ *
+ * ffnv_annexb_find_startcode() locates the next 00 00 01 prefix using
+ * AVX2, SSE2 or NEON compares. On top of it, FFNVAnnexBSplitter cuts a
+ * byte stream into whole access units following the first-VCL-NAL and
+ * prefix non-VCL rules of H.264 7.4.1.2.3 and HEVC 7.4.2.4.4, so that each
+ * one can be passed to cuvidParseVideoData() as a single packet with
+ * CUVID_PKT_ENDOFPICTURE set.
+ */
+
+#ifndef FFNV_CUVID_ANNEXB_H
+#define FFNV_CUVID_ANNEXB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dynlink_cuda.h"
+#include "dynlink_nvcuvid.h"
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+# if defined(_MSC_VER)
+#  include <intrin.h>
+# endif
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define FFNV_ANNEXB_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#endif
+
+#if defined(__AVX2__)
+static inline unsigned ffnv_annexb_ctz(unsigned m)
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return i;
+#else
+    return __builtin_ctz(m);
+#endif
+}
+#endif
+
+/**
+ * Return the offset of the first 00 00 01 sequence in buf[0..size), or
+ * size if there is none.
+ */
+static inline size_t ffnv_annexb_find_startcode(const uint8_t *buf, size_t size)
+{
+    size_t i = 0;
+
+    if (size < 3)
+        return size;
+
+#if defined(__AVX2__)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one  = _mm256_set1_epi8(1);
+        for (; i + 34 <= size; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(buf + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(buf + i + 1));
+            __m256i c = _mm256_loadu_si256((const __m256i*)(buf + i + 2));
+            unsigned m = (unsigned)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+                                                  _mm256_cmpeq_epi8(b, zero)),
+                                 _mm256_cmpeq_epi8(c, one)));
+            if (m)
+                return i + ffnv_annexb_ctz(m);
+        }
+    }
+#elif defined(FFNV_ANNEXB_SSE2)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one  = _mm_set1_epi8(1);
+        for (; i + 18 <= size; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(buf + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(buf + i + 1));
+            __m128i c = _mm_loadu_si128((const __m128i*)(buf + i + 2));
+            int m = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero),
+                                                                  _mm_cmpeq_epi8(b, zero)),
+                                                    _mm_cmpeq_epi8(c, one)));
+            if (m) {
+                while (!(m & 1)) {
+                    m >>= 1;
+                    i++;
+                }
+                return i;
+            }
+        }
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    {
+        const uint8x16_t zero = vdupq_n_u8(0);
+        const uint8x16_t one  = vdupq_n_u8(1);
+        for (; i + 18 <= size; i += 16) {
+            uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(buf + i), zero),
+                                             vceqq_u8(vld1q_u8(buf + i + 1), zero)),
+                                    vceqq_u8(vld1q_u8(buf + i + 2), one));
+            uint8x8_t r = vorr_u8(vget_low_u8(m), vget_high_u8(m));
+            if (vget_lane_u64(vreinterpret_u64_u8(r), 0))
+                break;
+        }
+    }
+#endif
+
+    for (; i + 3 <= size; i++) {
+        /* skip ahead quickly while the middle byte cannot be part of a start code */
+        if (buf[i + 2] > 1) {
+            i += 2;
+            continue;
+        }
+        if (!buf[i] && !buf[i + 1] && buf[i + 2] == 1)
+            return i;
+    }
+
+    return size;
+}
+
+typedef struct FFNVAnnexBNAL {
+    size_t offset;      /**< offset of the 00 00 01 prefix */
+    size_t data_offset; /**< offset of the NAL header */
+    int type;           /**< nal_unit_type */
+} FFNVAnnexBNAL;
+
+/**
+ * Find the next NAL unit starting at or after *pos. Returns 1 and advances
+ * *pos past the start code if one is found with at least header_size
+ * bytes after it, 0 otherwise.
+ */
+static inline int ffnv_annexb_next_nal(cudaVideoCodec codec, const uint8_t *buf, size_t size,
+                                       size_t *pos, FFNVAnnexBNAL *nal)
+{
+    const size_t header_size = codec == cudaVideoCodec_HEVC ? 2 : 1;
+    size_t sc;
+
+    if (*pos >= size)
+        return 0;
+
+    sc = *pos + ffnv_annexb_find_startcode(buf + *pos, size - *pos);
+    if (sc + 3 + header_size > size)
+        return 0;
+
+    nal->offset      = sc;
+    nal->data_offset = sc + 3;
+    if (codec == cudaVideoCodec_HEVC)
+        nal->type = (buf[sc + 3] >> 1) & 0x3f;
+    else
+        nal->type = buf[sc + 3] & 0x1f;
+
+    *pos = sc + 3;
+    return 1;
+}
+
+/* NAL classes used to detect access unit boundaries */
+#define FFNV_ANNEXB_NAL_OTHER     0
+#define FFNV_ANNEXB_NAL_AU_PREFIX 1 /* starts a new AU if a VCL NAL was seen */
+#define FFNV_ANNEXB_NAL_VCL       2
+
+static inline int ffnv_annexb_nal_class(cudaVideoCodec codec, int type)
+{
+    if (codec == cudaVideoCodec_HEVC) {
+        if (type < 32)
+            return FFNV_ANNEXB_NAL_VCL;
+        if ((type >= 32 && type <= 35) || type == 39 ||
+            (type >= 41 && type <= 44) || (type >= 48 && type <= 55))
+            return FFNV_ANNEXB_NAL_AU_PREFIX;
+        return FFNV_ANNEXB_NAL_OTHER;
+    }
+
+    if (type >= 1 && type <= 5)
+        return FFNV_ANNEXB_NAL_VCL;
+    if ((type >= 6 && type <= 9) || (type >= 14 && type <= 18))
+        return FFNV_ANNEXB_NAL_AU_PREFIX;
+    return FFNV_ANNEXB_NAL_OTHER;
+}
+
+/**
+ * Whether the slice NAL whose header starts at nal is the first slice of
+ * a picture: first_mb_in_slice == 0 for H.264,
+ * first_slice_segment_in_pic_flag for HEVC. Requires 2 (H.264) or
+ * 3 (HEVC) readable bytes.
+ */
+static inline int ffnv_annexb_first_slice(cudaVideoCodec codec, const uint8_t *nal)
+{
+    if (codec == cudaVideoCodec_HEVC)
+        return (nal[0] >> 1 & 0x3f) < 32 && !(nal[1] >> 3) && (nal[2] & 0x80);
+    return !!(nal[1] & 0x80);
+}
+
+typedef struct FFNVAnnexBSplitter {
+    cudaVideoCodec codec;
+    size_t pos;
+    int seen_vcl;
+} FFNVAnnexBSplitter;
+
+static inline void ffnv_annexb_splitter_init(FFNVAnnexBSplitter *s, cudaVideoCodec codec)
+{
+    memset(s, 0, sizeof(*s));
+    s->codec = codec;
+}
+
+/**
+ * Return the size of the access unit at the start of buf, or 0 if buf
+ * does not yet hold a complete one. buf must begin at the first byte of
+ * the pending access unit: after a non-zero return n, the next call must
+ * pass buf + n. Until then, the caller may append data to buf and call
+ * again without rescanning what was already scanned. With eof set, the
+ * remaining data is returned as the last access unit.
+ */
+static inline size_t ffnv_annexb_next_au(FFNVAnnexBSplitter *s, const uint8_t *buf, size_t size, int eof)
+{
+    const size_t need = s->codec == cudaVideoCodec_HEVC ? 3 : 2;
+    size_t pos = s->pos;
+
+    for (;;) {
+        size_t sc = pos + ffnv_annexb_find_startcode(buf + pos, size - pos);
+        const uint8_t *nal = buf + sc + 3;
+        int cls, boundary;
+
+        if (sc + 3 + need > size) {
+            /* keep a possibly split start code and its header for the next call */
+            s->pos = sc < size ? sc : (size > 2 ? size - 2 : 0);
+            if (eof && size) {
+                s->pos = 0;
+                s->seen_vcl = 0;
+                return size;
+            }
+            return 0;
+        }
+
+        if (s->codec == cudaVideoCodec_HEVC)
+            cls = ffnv_annexb_nal_class(s->codec, (nal[0] >> 1) & 0x3f);
+        else
+            cls = ffnv_annexb_nal_class(s->codec, nal[0] & 0x1f);
+
+        boundary = s->seen_vcl &&
+                   (cls == FFNV_ANNEXB_NAL_AU_PREFIX ||
+                    (cls == FFNV_ANNEXB_NAL_VCL && ffnv_annexb_first_slice(s->codec, nal)));
+
+        if (boundary) {
+            size_t start = sc;
+
+            /* a zero_byte before the start code belongs to the next AU */
+            if (start > 0 && !buf[start - 1])
+                start--;
+
+            s->seen_vcl = cls == FFNV_ANNEXB_NAL_VCL;
+            s->pos = sc + 3 - start;
+            return start;
+        }
+
+        if (cls == FFNV_ANNEXB_NAL_VCL)
+            s->seen_vcl = 1;
+        pos = sc + 3;
+    }
+}
+
+/** Describe one access unit as a parser packet. */
+static inline void ffnv_annexb_packet(CUVIDSOURCEDATAPACKET *pkt, const uint8_t *au, size_t size,
+                                      CUvideotimestamp timestamp)
+{
+    pkt->flags        = CUVID_PKT_ENDOFPICTURE | CUVID_PKT_TIMESTAMP;
+    pkt->payload_size = (tcu_ulong)size;
+    pkt->payload      = au;
+    pkt->timestamp    = timestamp;
+}
+
+#endif
@@ -0,0 +1,772 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Chunked decode of one H.264 or HEVC stream on several decoders at once.
+ *
+ * ffnv_chunk_plan() splits an FFNVGopIndexView at closed GOP boundaries
+ * into chunks of about equal size. Each FFNVChunkDecoder owns a parser, a
+ * decoder and a context lock, and is run on a thread of its own, taking
+ * chunks in order until none are left. The CUVIDPARSERDISPINFO of decoded
+ * pictures goes to a queue per chunk in the FFNVChunkReorder, and the
+ * consumer maps them chunk after chunk, which is display order.
+ *
+ * Pictures left in their decode surfaces are limited to depth per chunk.
+ * Without spilling, a decoder ahead of the output blocks once depth
+ * pictures of its chunk wait, so chunks longer than depth pictures decode
+ * mostly one after another. With spilling enabled, the pictures of a chunk
+ * that is not being output go on into device memory copies, up to
+ * max_spill pictures over all chunks, and every decoder runs a whole chunk
+ * ahead; a decoder only moves on to another chunk once the surfaces of its
+ * previous one were released.
+ */
+
+#ifndef FFNV_CUVID_CHUNKED_H
+#define FFNV_CUVID_CHUNKED_H
+
+#include "dynlink_loader.h"
+#include "cuvid_gop_index.h"
+#include "ffnv_thread.h"
+
+#define FFNV_CHUNK_MAX_DEPTH 32
+
+/* surfaces beyond the queue: the largest DPB, the current picture and the display delay */
+#define FFNV_CHUNK_DPB_SURFACES  20
+#define FFNV_CHUNK_DISPLAY_DELAY 2
+
+typedef struct FFNVChunk {
+    uint32_t first; /**< first index entry */
+    uint32_t end;   /**< one past the last index entry */
+} FFNVChunk;
+
+struct FFNVChunkDecoder;
+
+typedef struct FFNVChunkEntry {
+    CUVIDPARSERDISPINFO disp;
+    CUdeviceptr spill;     /* copy of the picture, 0 while it is in its decode surface */
+    unsigned int pitch;    /* of the copy */
+    size_t size;
+} FFNVChunkEntry;
+
+typedef struct FFNVChunkQueue {
+    struct FFNVChunkDecoder *dec;
+    FFNVChunkEntry *entries;   /* ring in display order */
+    int size;
+    int head;
+    int count;
+    int nb_surfaces;           /* entries still in decode surfaces */
+    int done;
+} FFNVChunkQueue;
+
+typedef struct FFNVChunkReorder {
+    FFNVMutex lock;
+    FFNVCond cond;
+
+    const FFNVGopIndexView *view;
+    const uint8_t *stream;
+    const FFNVChunk *chunks;
+    FFNVChunkQueue *queues;
+    int nb_chunks;
+    int depth;
+    CudaFunctions *cu;  /* NULL if pictures are never spilled */
+    int max_spill;
+    int nb_spilled;
+
+    int next_chunk; /* next chunk to hand to a decoder */
+    int out_chunk;  /* chunk pictures are output from */
+    int aborted;
+} FFNVChunkReorder;
+
+typedef struct FFNVChunkFrame {
+    struct FFNVChunkDecoder *dec; /**< decoder to map from, dec->format describes the picture */
+    CUVIDPARSERDISPINFO disp;
+    int chunk;
+    FFNVChunkEntry entry;
+} FFNVChunkFrame;
+
+typedef struct FFNVChunkDecoder {
+    FFNVChunkReorder *reorder;
+    CuvidFunctions *cvdl;
+    CUvideoctxlock ctx_lock;
+    CUvideodecoder decoder;
+    CUvideoparser parser;
+    int chunk;
+    int nb_surfaces;
+
+    CUVIDEOFORMAT format;
+    CUresult last_error;
+    unsigned int nb_frames;
+
+    /* spilled copies: output size and the unused buffers of the current size */
+    CudaFunctions *cu;
+    unsigned int target_width, target_height, bytes_per_pixel;
+    CUdeviceptr *spill_free;
+    int nb_spill_free, spill_free_size;
+    size_t spill_size;
+} FFNVChunkDecoder;
+
+/* A split before entry i loses nothing: a random access point without RASL pictures. */
+static inline int ffnv_chunk_closed_gop(const FFNVGopIndexView *view, uint32_t i)
+{
+    const FFNVGopIndexEntry *e = view->entries;
+    uint32_t j;
+
+    if (!(e[i].flags & FFNV_GOP_FLAG_KEY))
+        return 0;
+    if (!(e[i].flags & FFNV_GOP_FLAG_OPEN))
+        return 1;
+
+    for (j = i + 1; j < view->nb_entries && !(e[j].flags & FFNV_GOP_FLAG_KEY); j++) {
+        if (e[j].flags & FFNV_GOP_FLAG_RASL)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Split the indexed stream into at most max_chunks chunks of about equal
+ * byte size, each starting at a closed GOP. Returns the number of chunks
+ * written to chunks.
+ */
+static inline int ffnv_chunk_plan(const FFNVGopIndexView *view, int max_chunks, FFNVChunk *chunks)
+{
+    const FFNVGopIndexEntry *e = view->entries;
+    uint64_t total = 0, acc = 0;
+    uint32_t i, start = 0;
+    int n = 0;
+
+    if (max_chunks < 1 || !view->nb_entries)
+        return 0;
+
+    for (i = 0; i < view->nb_entries; i++)
+        total += e[i].size;
+
+    for (i = 0; i < view->nb_entries; i++) {
+        if (i > start && n + 1 < max_chunks &&
+            acc * (uint64_t)max_chunks >= total * (uint64_t)(n + 1) &&
+            ffnv_chunk_closed_gop(view, i)) {
+            chunks[n].first = start;
+            chunks[n].end   = i;
+            start = i;
+            n++;
+        }
+        acc += e[i].size;
+    }
+
+    chunks[n].first = start;
+    chunks[n].end   = view->nb_entries;
+    return n + 1;
+}
+
+/**
+ * Call before uninitializing the decoders, whose contexts the pictures
+ * still spilled are freed in.
+ */
+static inline void ffnv_chunk_reorder_uninit(FFNVChunkReorder *r)
+{
+    int i, j;
+
+    for (i = 0; r->queues && i < r->nb_chunks; i++) {
+        FFNVChunkQueue *q = &r->queues[i];
+
+        for (j = 0; j < q->count; j++) {
+            FFNVChunkEntry *e = &q->entries[(q->head + j) % q->size];
+
+            if (e->spill) {
+                q->dec->cvdl->cuvidCtxLock(q->dec->ctx_lock, 0);
+                r->cu->cuMemFree(e->spill);
+                q->dec->cvdl->cuvidCtxUnlock(q->dec->ctx_lock, 0);
+            }
+        }
+        free(q->entries);
+    }
+    if (r->queues) {
+        ffnv_cond_destroy(&r->cond);
+        ffnv_mutex_destroy(&r->lock);
+    }
+    free(r->queues);
+    memset(r, 0, sizeof(*r));
+}
+
+/**
+ * Set up the reorder stage for the given chunks of the stream the index
+ * was built on, with at most depth pictures per chunk in decode surfaces.
+ * With cu set, up to max_spill more pictures are copied to device memory
+ * to let decoders run ahead of the output. Returns 0 on success, -1 on
+ * error.
+ */
+static inline int ffnv_chunk_reorder_init(FFNVChunkReorder *r, const FFNVGopIndexView *view,
+                                          const uint8_t *stream, const FFNVChunk *chunks,
+                                          int nb_chunks, int depth, CudaFunctions *cu, int max_spill)
+{
+    memset(r, 0, sizeof(*r));
+
+    if (nb_chunks < 1 || depth < 1 || depth > FFNV_CHUNK_MAX_DEPTH)
+        return -1;
+
+    r->queues = (FFNVChunkQueue*)calloc(nb_chunks, sizeof(*r->queues));
+    if (!r->queues)
+        return -1;
+    if (ffnv_mutex_init(&r->lock) < 0) {
+        free(r->queues);
+        r->queues = NULL;
+        return -1;
+    }
+    if (ffnv_cond_init(&r->cond) < 0) {
+        ffnv_mutex_destroy(&r->lock);
+        free(r->queues);
+        r->queues = NULL;
+        return -1;
+    }
+
+    r->view      = view;
+    r->stream    = stream;
+    r->chunks    = chunks;
+    r->nb_chunks = nb_chunks;
+    r->depth     = depth;
+    r->cu        = max_spill > 0 ? cu : NULL;
+    r->max_spill = max_spill;
+    return 0;
+}
+
+/* Append to a queue, growing it. Called with the lock held. Returns 0 on success, -1 on error. */
+static inline int ffnv_chunk_queue_push(FFNVChunkQueue *q, const FFNVChunkEntry *e)
+{
+    if (q->count == q->size) {
+        int size = q->size ? 2 * q->size : 2 * FFNV_CHUNK_MAX_DEPTH, i;
+        FFNVChunkEntry *entries = (FFNVChunkEntry*)malloc(size * sizeof(*entries));
+
+        if (!entries)
+            return -1;
+        for (i = 0; i < q->count; i++)
+            entries[i] = q->entries[(q->head + i) % q->size];
+        free(q->entries);
+        q->entries = entries;
+        q->size    = size;
+        q->head    = 0;
+    }
+    q->entries[(q->head + q->count) % q->size] = *e;
+    q->count++;
+    q->nb_surfaces += !e->spill;
+    return 0;
+}
+
+/** Wake up and stop all decoders and the consumer, e.g. on error. */
+static inline void ffnv_chunk_reorder_abort(FFNVChunkReorder *r)
+{
+    ffnv_mutex_lock(&r->lock);
+    r->aborted = 1;
+    ffnv_cond_broadcast(&r->cond);
+    ffnv_mutex_unlock(&r->lock);
+}
+
+/* Skip finished chunks that were fully output. Called with the lock held. */
+static inline void ffnv_chunk_advance(FFNVChunkReorder *r)
+{
+    int moved = 0;
+
+    while (r->out_chunk < r->nb_chunks && r->queues[r->out_chunk].done &&
+           !r->queues[r->out_chunk].count) {
+        r->out_chunk++;
+        moved = 1;
+    }
+    if (moved)
+        ffnv_cond_broadcast(&r->cond);
+}
+
+static inline int ffnv_chunk_aborted(FFNVChunkReorder *r)
+{
+    int ret;
+
+    ffnv_mutex_lock(&r->lock);
+    ret = r->aborted;
+    ffnv_mutex_unlock(&r->lock);
+    return ret;
+}
+
+/* Wait until the decode surfaces of a chunk were released. Returns 0 if aborted. */
+static inline int ffnv_chunk_wait_empty(FFNVChunkReorder *r, int chunk)
+{
+    int ret;
+
+    ffnv_mutex_lock(&r->lock);
+    while (!r->aborted && r->queues[chunk].nb_surfaces)
+        ffnv_cond_wait(&r->cond, &r->lock);
+    ret = !r->aborted;
+    ffnv_mutex_unlock(&r->lock);
+    return ret;
+}
+
+/* Whether a decoder created for a can decode b as is. */
+static inline int ffnv_chunk_same_format(const CUVIDEOFORMAT *a, const CUVIDEOFORMAT *b)
+{
+    return a->codec == b->codec &&
+           a->coded_width == b->coded_width && a->coded_height == b->coded_height &&
+           a->chroma_format == b->chroma_format &&
+           a->bit_depth_luma_minus8 == b->bit_depth_luma_minus8 &&
+           a->bit_depth_chroma_minus8 == b->bit_depth_chroma_minus8 &&
+           a->progressive_sequence == b->progressive_sequence &&
+           !memcmp(&a->display_area, &b->display_area, sizeof(a->display_area));
+}
+
+static inline int CUDAAPI ffnv_chunk_sequence_cb(void *opaque, CUVIDEOFORMAT *fmt)
+{
+    FFNVChunkDecoder *d = (FFNVChunkDecoder*)opaque;
+    CUVIDDECODECREATEINFO ci;
+    CUresult err;
+
+    /* every chunk has its own parser, which announces the sequence again */
+    if (d->decoder && ffnv_chunk_same_format(&d->format, fmt))
+        return 1;
+
+    /* queued pictures live in the surfaces of the current decoder */
+    if (!ffnv_chunk_wait_empty(d->reorder, d->chunk))
+        return 0;
+
+    memset(&ci, 0, sizeof(ci));
+    ci.ulWidth             = fmt->coded_width;
+    ci.ulHeight            = fmt->coded_height;
+    ci.ulNumDecodeSurfaces = d->nb_surfaces;
+    ci.CodecType           = fmt->codec;
+    ci.ChromaFormat        = fmt->chroma_format;
+    ci.ulCreationFlags     = cudaVideoCreate_PreferCUVID;
+    ci.bitDepthMinus8      = fmt->bit_depth_luma_minus8;
+    ci.display_area.left   = (short)fmt->display_area.left;
+    ci.display_area.top    = (short)fmt->display_area.top;
+    ci.display_area.right  = (short)fmt->display_area.right;
+    ci.display_area.bottom = (short)fmt->display_area.bottom;
+    ci.OutputFormat        = fmt->bit_depth_luma_minus8 ? cudaVideoSurfaceFormat_P016
+                                                        : cudaVideoSurfaceFormat_NV12;
+    ci.DeinterlaceMode     = fmt->progressive_sequence ? cudaVideoDeinterlaceMode_Weave
+                                                       : cudaVideoDeinterlaceMode_Adaptive;
+    ci.ulTargetWidth       = ffnv_parse_even(fmt->display_area.right  - fmt->display_area.left);
+    ci.ulTargetHeight      = ffnv_parse_even(fmt->display_area.bottom - fmt->display_area.top);
+    ci.ulNumOutputSurfaces = 1;
+    ci.vidLock             = d->ctx_lock;
+
+    d->cvdl->cuvidCtxLock(d->ctx_lock, 0);
+    if (d->decoder) {
+        d->cvdl->cuvidDestroyDecoder(d->decoder);
+        d->decoder = NULL;
+    }
+    err = d->cvdl->cuvidCreateDecoder(&d->decoder, &ci);
+    d->cvdl->cuvidCtxUnlock(d->ctx_lock, 0);
+
+    if (err != CUDA_SUCCESS) {
+        d->last_error = err;
+        d->decoder    = NULL;
+        return 0;
+    }
+
+    d->format          = *fmt;
+    d->target_width    = ci.ulTargetWidth;
+    d->target_height   = ci.ulTargetHeight;
+    d->bytes_per_pixel = fmt->bit_depth_luma_minus8 ? 2 : 1;
+    return 1;
+}
+
+static inline int CUDAAPI ffnv_chunk_decode_cb(void *opaque, CUVIDPICPARAMS *pic)
+{
+    FFNVChunkDecoder *d = (FFNVChunkDecoder*)opaque;
+    CUresult err;
+
+    d->cvdl->cuvidCtxLock(d->ctx_lock, 0);
+    err = d->cvdl->cuvidDecodePicture(d->decoder, pic);
+    d->cvdl->cuvidCtxUnlock(d->ctx_lock, 0);
+
+    if (err != CUDA_SUCCESS) {
+        d->last_error = err;
+        return 0;
+    }
+    return 1;
+}
+
+/* Give back a spilled copy, with the context lock of d held. */
+static inline void ffnv_chunk_spill_free(FFNVChunkDecoder *d, const FFNVChunkEntry *e)
+{
+    FFNVChunkReorder *r = d->reorder;
+    int kept = 0;
+
+    ffnv_mutex_lock(&r->lock);
+    if (e->size == d->spill_size) {
+        if (d->nb_spill_free == d->spill_free_size) {
+            int size = d->spill_free_size ? 2 * d->spill_free_size : 16;
+            CUdeviceptr *list = (CUdeviceptr*)realloc(d->spill_free, size * sizeof(*list));
+
+            if (list) {
+                d->spill_free      = list;
+                d->spill_free_size = size;
+            }
+        }
+        if (d->nb_spill_free < d->spill_free_size) {
+            d->spill_free[d->nb_spill_free++] = e->spill;
+            kept = 1;
+        }
+    }
+    ffnv_mutex_unlock(&r->lock);
+
+    if (!kept)
+        d->cu->cuMemFree(e->spill);
+}
+
+/* Copy a decoded picture to device memory of its own and release its surface. */
+static inline CUresult ffnv_chunk_spill(FFNVChunkDecoder *d, const CUVIDPARSERDISPINFO *disp, FFNVChunkEntry *e)
+{
+    FFNVChunkReorder *r = d->reorder;
+    unsigned int width = d->target_width * d->bytes_per_pixel;
+    unsigned int rows = d->target_height + d->target_height / 2, src_pitch;
+    CUdeviceptr src, stale = 0;
+    CUVIDPROCPARAMS vpp;
+    CUDA_MEMCPY2D cp;
+    CUresult err;
+
+    memset(e, 0, sizeof(*e));
+    e->disp  = *disp;
+    e->pitch = (width + 255) & ~255u;
+    e->size  = (size_t)e->pitch * rows;
+
+    d->cvdl->cuvidCtxLock(d->ctx_lock, 0);
+
+    ffnv_mutex_lock(&r->lock);
+    if (d->nb_spill_free && d->spill_size == e->size) {
+        e->spill = d->spill_free[--d->nb_spill_free];
+    } else if (d->spill_size != e->size) {
+        /* the output size changed, the cached buffers are of no use */
+        d->spill_size = e->size;
+        while (d->nb_spill_free) {
+            stale = d->spill_free[--d->nb_spill_free];
+            ffnv_mutex_unlock(&r->lock);
+            d->cu->cuMemFree(stale);
+            ffnv_mutex_lock(&r->lock);
+        }
+    }
+    ffnv_mutex_unlock(&r->lock);
+
+    err = e->spill ? CUDA_SUCCESS : d->cu->cuMemAlloc(&e->spill, e->size);
+    if (err == CUDA_SUCCESS) {
+        memset(&vpp, 0, sizeof(vpp));
+        vpp.progressive_frame = disp->progressive_frame;
+        vpp.top_field_first   = disp->top_field_first;
+
+        err = d->cvdl->cuvidMapVideoFrame(d->decoder, disp->picture_index, &src, &src_pitch, &vpp);
+        if (err == CUDA_SUCCESS) {
+            /* the chroma rows follow the luma rows in both */
+            memset(&cp, 0, sizeof(cp));
+            cp.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+            cp.srcDevice     = src;
+            cp.srcPitch      = src_pitch;
+            cp.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+            cp.dstDevice     = e->spill;
+            cp.dstPitch      = e->pitch;
+            cp.WidthInBytes  = width;
+            cp.Height        = rows;
+            err = d->cu->cuMemcpy2D(&cp);
+            d->cvdl->cuvidUnmapVideoFrame(d->decoder, src);
+        }
+        if (err != CUDA_SUCCESS) {
+            ffnv_chunk_spill_free(d, e);
+            e->spill = 0;
+        }
+    }
+
+    d->cvdl->cuvidCtxUnlock(d->ctx_lock, 0);
+    return err;
+}
+
+static inline int CUDAAPI ffnv_chunk_display_cb(void *opaque, CUVIDPARSERDISPINFO *disp)
+{
+    FFNVChunkDecoder *d = (FFNVChunkDecoder*)opaque;
+    FFNVChunkReorder *r = d->reorder;
+    FFNVChunkQueue *q = &r->queues[d->chunk];
+    FFNVChunkEntry e;
+    int ret, spill = 0;
+
+    if (!disp)
+        return 1;
+
+    memset(&e, 0, sizeof(e));
+    e.disp = *disp;
+
+    ffnv_mutex_lock(&r->lock);
+    while (!r->aborted && q->nb_surfaces >= r->depth) {
+        /* the chunk being output drains by itself, the others spill */
+        if (r->cu && d->chunk != r->out_chunk && r->nb_spilled < r->max_spill) {
+            r->nb_spilled++;
+            spill = 1;
+            break;
+        }
+        ffnv_cond_wait(&r->cond, &r->lock);
+    }
+    ret = !r->aborted;
+    if (ret && !spill) {
+        ret = ffnv_chunk_queue_push(q, &e) == 0;
+        ffnv_cond_broadcast(&r->cond);
+    }
+    ffnv_mutex_unlock(&r->lock);
+
+    if (spill) {
+        CUresult err = ret ? ffnv_chunk_spill(d, disp, &e) : CUDA_ERROR_NOT_READY;
+
+        ffnv_mutex_lock(&r->lock);
+        if (err == CUDA_SUCCESS && ffnv_chunk_queue_push(q, &e) == 0) {
+            ffnv_cond_broadcast(&r->cond);
+        } else {
+            if (err == CUDA_SUCCESS) {
+                ffnv_mutex_unlock(&r->lock);
+                d->cvdl->cuvidCtxLock(d->ctx_lock, 0);
+                ffnv_chunk_spill_free(d, &e);
+                d->cvdl->cuvidCtxUnlock(d->ctx_lock, 0);
+                ffnv_mutex_lock(&r->lock);
+            } else if (ret) {
+                d->last_error = err;
+            }
+            r->nb_spilled--;
+            ret = 0;
+        }
+        ffnv_mutex_unlock(&r->lock);
+    }
+
+    d->nb_frames += ret;
+    return ret;
+}
+
+static inline void ffnv_chunk_decoder_uninit(FFNVChunkDecoder *d)
+{
+    if (d->parser)
+        d->cvdl->cuvidDestroyVideoParser(d->parser);
+    if (d->decoder || d->nb_spill_free) {
+        d->cvdl->cuvidCtxLock(d->ctx_lock, 0);
+        while (d->nb_spill_free)
+            d->cu->cuMemFree(d->spill_free[--d->nb_spill_free]);
+        if (d->decoder)
+            d->cvdl->cuvidDestroyDecoder(d->decoder);
+        d->cvdl->cuvidCtxUnlock(d->ctx_lock, 0);
+    }
+    free(d->spill_free);
+    if (d->ctx_lock)
+        d->cvdl->cuvidCtxLockDestroy(d->ctx_lock);
+    memset(d, 0, sizeof(*d));
+}
+
+/** Create the context lock of a decoder working for r on the context ctx. */
+static inline CUresult ffnv_chunk_decoder_init(FFNVChunkDecoder *d, FFNVChunkReorder *r,
+                                               CuvidFunctions *cvdl, CUcontext ctx)
+{
+    CUresult err;
+
+    memset(d, 0, sizeof(*d));
+    d->reorder     = r;
+    d->cvdl        = cvdl;
+    d->cu          = r->cu;
+    d->chunk       = -1;
+    d->nb_surfaces = r->depth + FFNV_CHUNK_DPB_SURFACES;
+
+    err = cvdl->cuvidCtxLockCreate(&d->ctx_lock, ctx);
+    if (err != CUDA_SUCCESS)
+        d->ctx_lock = NULL;
+    return err;
+}
+
+/* Parse and decode all access units of one chunk with a new parser. */
+static inline int ffnv_chunk_decode(FFNVChunkDecoder *d, int chunk)
+{
+    FFNVChunkReorder *r = d->reorder;
+    const FFNVChunk *c = &r->chunks[chunk];
+    CUVIDPARSERPARAMS params;
+    CUVIDSOURCEDATAPACKET pkt;
+    FFNVGopSeek s;
+    CUresult err;
+
+    memset(&params, 0, sizeof(params));
+    params.CodecType              = r->view->codec;
+    params.ulMaxNumDecodeSurfaces = d->nb_surfaces;
+    params.ulMaxDisplayDelay      = FFNV_CHUNK_DISPLAY_DELAY;
+    params.pUserData              = d;
+    params.pfnSequenceCallback    = ffnv_chunk_sequence_cb;
+    params.pfnDecodePicture       = ffnv_chunk_decode_cb;
+    params.pfnDisplayPicture      = ffnv_chunk_display_cb;
+
+    err = d->cvdl->cuvidCreateVideoParser(&d->parser, &params);
+    if (err != CUDA_SUCCESS) {
+        d->last_error = err;
+        d->parser     = NULL;
+        return -1;
+    }
+
+    ffnv_gop_seek_start(&s, r->view, c->first);
+
+    while (s.next < c->end && ffnv_gop_seek_packet(&s, r->stream, &pkt)) {
+        err = d->cvdl->cuvidParseVideoData(d->parser, &pkt);
+        if (err != CUDA_SUCCESS || ffnv_chunk_aborted(r))
+            break;
+    }
+
+    if (err == CUDA_SUCCESS && !ffnv_chunk_aborted(r)) {
+        memset(&pkt, 0, sizeof(pkt));
+        pkt.flags = CUVID_PKT_ENDOFSTREAM;
+        err = d->cvdl->cuvidParseVideoData(d->parser, &pkt);
+    }
+
+    d->cvdl->cuvidDestroyVideoParser(d->parser);
+    d->parser = NULL;
+
+    if (err != CUDA_SUCCESS)
+        d->last_error = err;
+    return err == CUDA_SUCCESS && !ffnv_chunk_aborted(r) ? 0 : -1;
+}
+
+/**
+ * Decode chunks until none are left. Meant to be the body of one thread
+ * per decoder. Returns 0 on success, -1 on error, in which case the
+ * reorder stage is aborted.
+ */
+static inline int ffnv_chunk_decoder_run(FFNVChunkDecoder *d)
+{
+    FFNVChunkReorder *r = d->reorder;
+    int chunk, ret = 0;
+
+    for (;;) {
+        /* the surfaces of the previous chunk are reused */
+        if (d->chunk >= 0 && !ffnv_chunk_wait_empty(r, d->chunk))
+            return -1;
+
+        ffnv_mutex_lock(&r->lock);
+        chunk = r->aborted || r->next_chunk >= r->nb_chunks ? -1 : r->next_chunk++;
+        if (chunk >= 0)
+            r->queues[chunk].dec = d;
+        ffnv_mutex_unlock(&r->lock);
+        if (chunk < 0)
+            return ffnv_chunk_aborted(r) ? -1 : 0;
+
+        d->chunk = chunk;
+        ret = ffnv_chunk_decode(d, chunk);
+
+        ffnv_mutex_lock(&r->lock);
+        r->queues[chunk].done = 1;
+        ffnv_chunk_advance(r);
+        ffnv_cond_broadcast(&r->cond);
+        ffnv_mutex_unlock(&r->lock);
+
+        if (ret < 0) {
+            ffnv_chunk_reorder_abort(r);
+            return -1;
+        }
+    }
+}
+
+/**
+ * Wait for the next picture in display order. Returns 1 if frame was
+ * filled, 0 once all chunks were output, -1 if aborted. The picture
+ * must be released with ffnv_chunk_unmap() before the next call.
+ */
+static inline int ffnv_chunk_reorder_get(FFNVChunkReorder *r, FFNVChunkFrame *frame)
+{
+    int ret;
+
+    ffnv_mutex_lock(&r->lock);
+    for (;;) {
+        FFNVChunkQueue *q;
+
+        ffnv_chunk_advance(r);
+        if (r->aborted) {
+            ret = -1;
+            break;
+        }
+        if (r->out_chunk >= r->nb_chunks) {
+            ret = 0;
+            break;
+        }
+
+        q = &r->queues[r->out_chunk];
+        if (q->count) {
+            frame->dec   = q->dec;
+            frame->entry = q->entries[q->head];
+            frame->disp  = frame->entry.disp;
+            frame->chunk = r->out_chunk;
+            ret = 1;
+            break;
+        }
+        ffnv_cond_wait(&r->cond, &r->lock);
+    }
+    ffnv_mutex_unlock(&r->lock);
+    return ret;
+}
+
+/**
+ * Map a picture returned by ffnv_chunk_reorder_get(). The context lock
+ * of its decoder is held, and the CUDA context current, until
+ * ffnv_chunk_unmap().
+ */
+static inline CUresult ffnv_chunk_map(FFNVChunkFrame *frame, CUdeviceptr *dptr, unsigned int *pitch)
+{
+    FFNVChunkDecoder *d = frame->dec;
+    CUVIDPROCPARAMS vpp;
+    CUresult err;
+
+    memset(&vpp, 0, sizeof(vpp));
+    vpp.progressive_frame = frame->disp.progressive_frame;
+    vpp.top_field_first   = frame->disp.top_field_first;
+
+    d->cvdl->cuvidCtxLock(d->ctx_lock, 0);
+    if (frame->entry.spill) {
+        *dptr  = frame->entry.spill;
+        *pitch = frame->entry.pitch;
+        return CUDA_SUCCESS;
+    }
+    err = d->cvdl->cuvidMapVideoFrame(d->decoder, frame->disp.picture_index, dptr, pitch, &vpp);
+    if (err != CUDA_SUCCESS)
+        d->cvdl->cuvidCtxUnlock(d->ctx_lock, 0);
+    return err;
+}
+
+/** Unmap a picture mapped with ffnv_chunk_map() and hand its surface or copy back. */
+static inline CUresult ffnv_chunk_unmap(FFNVChunkReorder *r, FFNVChunkFrame *frame, CUdeviceptr dptr)
+{
+    FFNVChunkDecoder *d = frame->dec;
+    FFNVChunkQueue *q = &r->queues[frame->chunk];
+    CUresult err = CUDA_SUCCESS;
+
+    if (frame->entry.spill)
+        ffnv_chunk_spill_free(d, &frame->entry);
+    else
+        err = d->cvdl->cuvidUnmapVideoFrame(d->decoder, dptr);
+    d->cvdl->cuvidCtxUnlock(d->ctx_lock, 0);
+
+    ffnv_mutex_lock(&r->lock);
+    q->head = (q->head + 1) % q->size;
+    q->count--;
+    if (frame->entry.spill)
+        r->nb_spilled--;
+    else
+        q->nb_surfaces--;
+    ffnv_chunk_advance(r);
+    ffnv_cond_broadcast(&r->cond);
+    ffnv_mutex_unlock(&r->lock);
+    return err;
+}
+
+#endif
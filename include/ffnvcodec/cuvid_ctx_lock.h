@@ -0,0 +1,316 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Context locking for processes running many decoders, as a replacement
+ * for the CUvideoctxlock of cuvidCtxLockCreate.
+ *
+ * FFNVCtxLock is a mutex that makes its context current while held and
+ * records how long it is waited for and held. It can be held over a batch
+ * of cuvidDecodePicture/cuvidMapVideoFrame calls, and
+ * ffnv_ctx_lock_yield() hands it to a waiter once the batch has held it
+ * long enough. Decoders using it are created with a NULL vidLock, as the
+ * caller makes the context current. The context is pushed and popped
+ * with ffnv_ctx_push()/ffnv_ctx_pop() of ffnv_ctx.h. Except with GCC and
+ * Clang on ELF and Mach-O targets, one source file of the program must
+ * then define FFNV_CTX_IMPLEMENTATION before including this header, or
+ * the link fails on ffnv_ctx_state.
+ *
+ * FFNVCtxShards spreads decoders over several contexts of one device,
+ * each with its own lock, so decoders of different shards never wait for
+ * each other. Every context costs device memory, and frames of one shard
+ * are only usable in the context of that shard.
+ */
+
+#ifndef FFNV_CUVID_CTX_LOCK_H
+#define FFNV_CUVID_CTX_LOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "dynlink_loader.h"
+#include "ffnv_atomic.h"
+#include "ffnv_ctx.h"
+#include "ffnv_thread.h"
+
+#define FFNV_CTX_MAX_SHARDS 16
+
+/* batches hold the lock at least this long before yielding to waiters */
+#define FFNV_CTX_LOCK_BATCH_NS 2000000
+
+typedef struct FFNVCtxLockStats {
+    uint64_t nb_acquires;
+    uint64_t nb_contended;     /**< acquisitions that had to wait */
+    uint64_t nb_yields;
+    uint64_t wait_ns, max_wait_ns;
+    uint64_t hold_ns, max_hold_ns;
+} FFNVCtxLockStats;
+
+typedef struct FFNVCtxLock {
+    FFNVMutex mutex;
+    CudaFunctions *cu;
+    CUcontext ctx;
+    volatile uint32_t waiters;
+    volatile uint32_t handoffs; /* bumped by every contended acquisition */
+    uint64_t acquired_at;
+    uint64_t batch_ns;         /**< minimum hold before ffnv_ctx_lock_yield() lets waiters in */
+    FFNVCtxLockStats stats;    /* protected by mutex */
+} FFNVCtxLock;
+
+/* Monotonic time in nanoseconds, 0 where no such clock is available (which disables the timings). */
+static inline uint64_t ffnv_ctx_lock_time(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/** Returns 0 on success, -1 on error. */
+static inline int ffnv_ctx_lock_init(FFNVCtxLock *l, CudaFunctions *cu, CUcontext ctx)
+{
+    memset(l, 0, sizeof(*l));
+    l->cu       = cu;
+    l->ctx      = ctx;
+    l->batch_ns = FFNV_CTX_LOCK_BATCH_NS;
+    return ffnv_mutex_init(&l->mutex);
+}
+
+static inline void ffnv_ctx_lock_uninit(FFNVCtxLock *l)
+{
+    ffnv_mutex_destroy(&l->mutex);
+    memset(l, 0, sizeof(*l));
+}
+
+static inline void ffnv_ctx_lock_take(FFNVCtxLock *l)
+{
+    uint64_t start = 0, now, wait = 0;
+    int contended = 0;
+
+    if (ffnv_mutex_trylock(&l->mutex) < 0) {
+        contended = 1;
+        start = ffnv_ctx_lock_time();
+        ffnv_atomic_add(&l->waiters, 1);
+        ffnv_mutex_lock(&l->mutex);
+        ffnv_atomic_add(&l->waiters, (uint32_t)-1);
+        ffnv_atomic_add(&l->handoffs, 1);
+        ffnv_futex_wake(&l->handoffs);
+    }
+
+    now = ffnv_ctx_lock_time();
+    if (contended) {
+        wait = now - start;
+        l->stats.nb_contended++;
+        l->stats.wait_ns += wait;
+        if (wait > l->stats.max_wait_ns)
+            l->stats.max_wait_ns = wait;
+    }
+    l->stats.nb_acquires++;
+    l->acquired_at = now;
+}
+
+static inline void ffnv_ctx_lock_give(FFNVCtxLock *l)
+{
+    uint64_t hold = ffnv_ctx_lock_time() - l->acquired_at;
+
+    l->stats.hold_ns += hold;
+    if (hold > l->stats.max_hold_ns)
+        l->stats.max_hold_ns = hold;
+    ffnv_mutex_unlock(&l->mutex);
+}
+
+/** Take the lock and push its context. */
+static inline CUresult ffnv_ctx_lock_acquire(FFNVCtxLock *l)
+{
+    CUresult err;
+
+    ffnv_ctx_lock_take(l);
+    err = ffnv_ctx_push(l->cu, l->ctx);
+    if (err != CUDA_SUCCESS)
+        ffnv_ctx_lock_give(l);
+    return err;
+}
+
+/** Pop the context and release the lock. */
+static inline CUresult ffnv_ctx_lock_release(FFNVCtxLock *l)
+{
+    CUresult err = ffnv_ctx_pop(l->cu, l->ctx);
+
+    ffnv_ctx_lock_give(l);
+    return err;
+}
+
+/**
+ * Between two calls of a batch: if another thread waits for the lock and
+ * the batch held it for batch_ns already, let a waiter take it and wait
+ * for the lock again. The context stays current on the calling thread
+ * meanwhile. Returns 1 if the lock was handed over, 0 if not.
+ */
+static inline int ffnv_ctx_lock_yield(FFNVCtxLock *l)
+{
+    uint32_t seen;
+
+    if (!ffnv_atomic_load(&l->waiters) ||
+        ffnv_ctx_lock_time() - l->acquired_at < l->batch_ns)
+        return 0;
+
+    l->stats.nb_yields++;
+    seen = ffnv_atomic_load(&l->handoffs);
+    ffnv_ctx_lock_give(l);
+
+    /* the mutex is not fair: do not race the waiter for it */
+    while (ffnv_atomic_load(&l->handoffs) == seen && ffnv_atomic_load(&l->waiters))
+        ffnv_futex_wait(&l->handoffs, seen, 1);
+
+    ffnv_ctx_lock_take(l);
+    return 1;
+}
+
+/** Copy of the statistics, reset them if reset is set. */
+static inline void ffnv_ctx_lock_stats(FFNVCtxLock *l, FFNVCtxLockStats *stats, int reset)
+{
+    ffnv_mutex_lock(&l->mutex);
+    *stats = l->stats;
+    if (reset)
+        memset(&l->stats, 0, sizeof(l->stats));
+    ffnv_mutex_unlock(&l->mutex);
+}
+
+typedef struct FFNVCtxShards {
+    FFNVMutex mutex;
+    CudaFunctions *cu;
+    FFNVCtxLock locks[FFNV_CTX_MAX_SHARDS];
+    int owned[FFNV_CTX_MAX_SHARDS];     /* contexts created here */
+    int nb_users[FFNV_CTX_MAX_SHARDS];
+    int nb_shards;
+} FFNVCtxShards;
+
+static inline void ffnv_ctx_shards_uninit(FFNVCtxShards *sh)
+{
+    int i;
+
+    for (i = 0; i < sh->nb_shards; i++) {
+        if (sh->owned[i])
+            sh->cu->cuCtxDestroy(sh->locks[i].ctx);
+        ffnv_ctx_lock_uninit(&sh->locks[i]);
+    }
+    if (sh->cu)
+        ffnv_mutex_destroy(&sh->mutex);
+    memset(sh, 0, sizeof(*sh));
+}
+
+/**
+ * Set up nb_shards contexts on device. If ctx is not NULL it is the
+ * first shard and the others are created; nb_shards 1 with a ctx keeps
+ * all decoders on that context, with the batching and metrics only.
+ */
+static inline CUresult ffnv_ctx_shards_init(FFNVCtxShards *sh, CudaFunctions *cu, CUdevice device,
+                                            CUcontext ctx, int nb_shards)
+{
+    CUcontext dummy;
+    CUresult err;
+    int i;
+
+    memset(sh, 0, sizeof(*sh));
+    if (nb_shards < 1)
+        nb_shards = 1;
+    if (nb_shards > FFNV_CTX_MAX_SHARDS)
+        nb_shards = FFNV_CTX_MAX_SHARDS;
+
+    if (ffnv_mutex_init(&sh->mutex) < 0)
+        return CUDA_ERROR_NOT_READY;
+    sh->cu = cu;
+
+    for (i = 0; i < nb_shards; i++) {
+        CUcontext c = ctx;
+
+        if (i || !ctx) {
+            err = cu->cuCtxCreate(&c, 0, device);
+            if (err == CUDA_SUCCESS) {
+                /* cuCtxCreate made it current */
+                err = cu->cuCtxPopCurrent(&dummy);
+                if (err != CUDA_SUCCESS)
+                    cu->cuCtxDestroy(c);
+            }
+            if (err != CUDA_SUCCESS) {
+                ffnv_ctx_shards_uninit(sh);
+                return err;
+            }
+        }
+
+        if (ffnv_ctx_lock_init(&sh->locks[i], cu, c) < 0) {
+            if (c != ctx)
+                cu->cuCtxDestroy(c);
+            ffnv_ctx_shards_uninit(sh);
+            return CUDA_ERROR_NOT_READY;
+        }
+        sh->owned[i] = c != ctx;
+        sh->nb_shards++;
+    }
+
+    return CUDA_SUCCESS;
+}
+
+/** Assign a new decoder to the shard with the fewest decoders, returns its index. */
+static inline int ffnv_ctx_shards_assign(FFNVCtxShards *sh)
+{
+    int i, best = 0;
+
+    ffnv_mutex_lock(&sh->mutex);
+    for (i = 1; i < sh->nb_shards; i++)
+        if (sh->nb_users[i] < sh->nb_users[best])
+            best = i;
+    sh->nb_users[best]++;
+    ffnv_mutex_unlock(&sh->mutex);
+    return best;
+}
+
+static inline void ffnv_ctx_shards_release(FFNVCtxShards *sh, int shard)
+{
+    ffnv_mutex_lock(&sh->mutex);
+    sh->nb_users[shard]--;
+    ffnv_mutex_unlock(&sh->mutex);
+}
+
+/** Lock of a shard, whose ctx the decoders of the shard are created in. */
+static inline FFNVCtxLock *ffnv_ctx_shards_lock(FFNVCtxShards *sh, int shard)
+{
+    return &sh->locks[shard];
+}
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Lock-free hand over of displayed pictures from parser threads to a
+ * frame mapping thread.
+ *
+ * FFNVDispRing is a bounded ring of CUVIDPARSERDISPINFO, written from
+ * the display callbacks of one parser (single producer) or several
+ * (multiple producers) and read by one mapping thread, which sleeps on a
+ * futex while it is empty.
+ *
+ * FFNVSurfaceMap tracks the surfaces of one decoder between their display
+ * and their unmapping. The display callback marks picture_index in use,
+ * the mapping thread clears it once the frame is unmapped, and the decode
+ * callback waits for CurrPicIdx to be free before decoding into it, so
+ * the parser only blocks once all ulNumDecodeSurfaces are in flight.
+ *
+ *     display:  ffnv_surface_map_acquire(map, disp->picture_index);
+ *               ffnv_disp_ring_push(ring, disp, map);
+ *     decode:   ffnv_surface_map_wait(map, pic->CurrPicIdx, -1);
+ *               cuvidDecodePicture(...);
+ *     mapping:  ffnv_disp_ring_pop(ring, &entry, timeout);
+ *               cuvidMapVideoFrame(...); copy; cuvidUnmapVideoFrame(...);
+ *               ffnv_surface_map_release(entry.opaque, entry.disp.picture_index);
+ */
+
+#ifndef FFNV_CUVID_DISP_RING_H
+#define FFNV_CUVID_DISP_RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dynlink_cuda.h"
+#include "dynlink_nvcuvid.h"
+#include "ffnv_atomic.h"
+
+#define FFNV_SURFACE_MAP_MAX 64
+
+typedef struct FFNVDispEntry {
+    CUVIDPARSERDISPINFO disp;
+    void *opaque;          /**< passed to ffnv_disp_ring_push(), e.g. the FFNVSurfaceMap of the decoder */
+} FFNVDispEntry;
+
+typedef struct FFNVDispSlot {
+    volatile uint32_t seq;
+    FFNVDispEntry entry;
+} FFNVDispSlot;
+
+typedef struct FFNVDispRing {
+    FFNVDispSlot *slots;
+    uint32_t mask;
+    int multi_producer;
+
+    uint8_t pad0[64];
+    volatile uint32_t tail;        /* next slot written */
+    uint8_t pad1[64];
+    uint32_t head;                 /* next slot read, consumer only */
+    volatile uint32_t pushed;      /* futex word of the consumer */
+    volatile uint32_t waiting;
+    volatile uint32_t closed;
+    uint8_t pad2[64];
+
+    volatile uint32_t nb_full;     /**< pushes refused as the ring was full */
+} FFNVDispRing;
+
+/**
+ * capacity is rounded up to a power of two and should be at least the
+ * summed ulNumDecodeSurfaces of the producers, so a push never finds the
+ * ring full. Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_disp_ring_init(FFNVDispRing *r, int capacity, int multi_producer)
+{
+    uint32_t size = 1, i;
+
+    memset(r, 0, sizeof(*r));
+    while ((int)size < capacity)
+        size <<= 1;
+
+    r->slots = (FFNVDispSlot*)calloc(size, sizeof(*r->slots));
+    if (!r->slots)
+        return -1;
+    for (i = 0; i < size; i++)
+        r->slots[i].seq = i;
+
+    r->mask           = size - 1;
+    r->multi_producer = multi_producer;
+    return 0;
+}
+
+static inline void ffnv_disp_ring_uninit(FFNVDispRing *r)
+{
+    free(r->slots);
+    memset(r, 0, sizeof(*r));
+}
+
+/** Returns 0 on success, -1 if the ring is full. */
+static inline int ffnv_disp_ring_push(FFNVDispRing *r, const CUVIDPARSERDISPINFO *disp, void *opaque)
+{
+    FFNVDispSlot *slot;
+    uint32_t pos = ffnv_atomic_load(&r->tail);
+
+    for (;;) {
+        int32_t dif;
+
+        slot = &r->slots[pos & r->mask];
+        dif  = (int32_t)(ffnv_atomic_load(&slot->seq) - pos);
+        if (dif < 0) {
+            ffnv_atomic_add(&r->nb_full, 1);
+            return -1;
+        }
+        if (dif == 0) {
+            if (!r->multi_producer) {
+                ffnv_atomic_store(&r->tail, pos + 1);
+                break;
+            }
+            if (ffnv_atomic_cas(&r->tail, pos, pos + 1))
+                break;
+        }
+        pos = ffnv_atomic_load(&r->tail);
+    }
+
+    slot->entry.disp   = *disp;
+    slot->entry.opaque = opaque;
+    ffnv_atomic_store(&slot->seq, pos + 1);
+
+    ffnv_atomic_add(&r->pushed, 1);
+    if (ffnv_atomic_load(&r->waiting))
+        ffnv_futex_wake(&r->pushed);
+    return 0;
+}
+
+static inline int ffnv_disp_ring_try_pop(FFNVDispRing *r, FFNVDispEntry *entry)
+{
+    FFNVDispSlot *slot = &r->slots[r->head & r->mask];
+
+    if (ffnv_atomic_load(&slot->seq) != r->head + 1)
+        return 0;
+
+    *entry = slot->entry;
+    ffnv_atomic_store(&slot->seq, r->head + r->mask + 1);
+    r->head++;
+    return 1;
+}
+
+/**
+ * Get the next picture, waiting at most timeout_ms milliseconds (forever
+ * if negative). Returns 1 if entry was set, 0 if the ring is still empty,
+ * possibly before the timeout, or -1 once it is closed and empty.
+ */
+static inline int ffnv_disp_ring_pop(FFNVDispRing *r, FFNVDispEntry *entry, int timeout_ms)
+{
+    uint32_t pushed;
+
+    for (;;) {
+        pushed = ffnv_atomic_load(&r->pushed);
+        if (ffnv_disp_ring_try_pop(r, entry))
+            return 1;
+        if (ffnv_atomic_load(&r->closed))
+            return ffnv_disp_ring_try_pop(r, entry) ? 1 : -1;
+        if (!timeout_ms)
+            return 0;
+
+        ffnv_atomic_add(&r->waiting, 1);
+        ffnv_futex_wait(&r->pushed, pushed, timeout_ms);
+        ffnv_atomic_add(&r->waiting, (uint32_t)-1);
+
+        if (ffnv_disp_ring_try_pop(r, entry))
+            return 1;
+        if (timeout_ms > 0)
+            return ffnv_atomic_load(&r->closed) ? -1 : 0;
+    }
+}
+
+/** End of stream: the consumer gets -1 once the ring is drained. */
+static inline void ffnv_disp_ring_close(FFNVDispRing *r)
+{
+    ffnv_atomic_store(&r->closed, 1);
+    ffnv_atomic_add(&r->pushed, 1);
+    ffnv_futex_wake(&r->pushed);
+}
+
+typedef struct FFNVSurfaceMap {
+    volatile uint32_t inuse[FFNV_SURFACE_MAP_MAX / 32];
+    volatile uint32_t released;    /* futex word of the parser */
+    volatile uint32_t waiting;
+    volatile uint32_t closed;
+    uint32_t nb_waits;             /**< decode callbacks that had to wait, parser thread only */
+} FFNVSurfaceMap;
+
+static inline void ffnv_surface_map_init(FFNVSurfaceMap *m)
+{
+    memset((void*)m, 0, sizeof(*m));
+}
+
+/** Mark surface idx in flight, from the display callback. */
+static inline void ffnv_surface_map_acquire(FFNVSurfaceMap *m, int idx)
+{
+    ffnv_atomic_or(&m->inuse[idx >> 5], 1u << (idx & 31));
+}
+
+/** Surface idx was unmapped. */
+static inline void ffnv_surface_map_release(FFNVSurfaceMap *m, int idx)
+{
+    ffnv_atomic_and(&m->inuse[idx >> 5], ~(1u << (idx & 31)));
+    ffnv_atomic_add(&m->released, 1);
+    if (ffnv_atomic_load(&m->waiting))
+        ffnv_futex_wake(&m->released);
+}
+
+static inline int ffnv_surface_map_busy(FFNVSurfaceMap *m, int idx)
+{
+    return !!(ffnv_atomic_load(&m->inuse[idx >> 5]) & (1u << (idx & 31)));
+}
+
+/**
+ * Wait for surface idx to be unmapped, from the decode callback. With
+ * timeout_ms not negative, gives up after one wait of at most that many
+ * milliseconds. Returns 0 once it is free, -1 if it is still in use or
+ * the map was closed.
+ */
+static inline int ffnv_surface_map_wait(FFNVSurfaceMap *m, int idx, int timeout_ms)
+{
+    uint32_t released;
+    int waited = 0;
+
+    for (;;) {
+        released = ffnv_atomic_load(&m->released);
+        if (!ffnv_surface_map_busy(m, idx))
+            return 0;
+        if (ffnv_atomic_load(&m->closed) || (waited && timeout_ms >= 0))
+            return -1;
+
+        if (!waited)
+            m->nb_waits++;
+        waited = 1;
+
+        ffnv_atomic_add(&m->waiting, 1);
+        ffnv_futex_wait(&m->released, released, timeout_ms);
+        ffnv_atomic_add(&m->waiting, (uint32_t)-1);
+    }
+}
+
+/** Wake up and fail the waits, when the mapping thread stops. */
+static inline void ffnv_surface_map_close(FFNVSurfaceMap *m)
+{
+    ffnv_atomic_store(&m->closed, 1);
+    ffnv_atomic_add(&m->released, 1);
+    ffnv_futex_wake(&m->released);
+}
+
+#endif
@@ -0,0 +1,568 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Access unit index of H.264 and HEVC elementary streams for seeking.
+ *
+ * FFNVGopIndexBuilder is fed one access unit at a time and records its
+ * byte offset, size, PTS, picture type, whether it is a reference and
+ * the random access point decoding has to start from to reach it. The
+ * index is written as a flat file of fixed-size entries in host byte
+ * order, which can be mapped into memory and used in place through
+ * FFNVGopIndexView.
+ *
+ * FFNVGopSeek turns a target PTS into the sequence of packets to pass to
+ * cuvidParseVideoData(): the parameter sets in effect (the latest of
+ * every VPS, SPS and PPS id, wherever they were sent), then every access
+ * unit from the random access point on. Pictures displayed before the
+ * target are to be dropped, so a seek is frame accurate and costs at most
+ * the decode of one GOP.
+ */
+
+#ifndef FFNV_CUVID_GOP_INDEX_H
+#define FFNV_CUVID_GOP_INDEX_H
+
+#include <stdio.h>
+
+#include "cuvid_annexb.h"
+#include "cuvid_parse.h"
+
+#define FFNV_GOP_INDEX_MAGIC      "FFNVGIDX"
+#define FFNV_GOP_INDEX_VERSION    2
+#define FFNV_GOP_INDEX_BYTE_ORDER 0x01020304
+
+/* FFNVGopIndexEntry.key when no random access point precedes the access unit */
+#define FFNV_GOP_NO_KEY 0xffffffffu
+
+/* parameter set ids, H.264: 32 SPS and 256 PPS, HEVC: 16 VPS, 16 SPS and 64 PPS */
+#define FFNV_GOP_MAX_PS 288
+
+#define FFNV_GOP_FRAME_UNKNOWN 0
+#define FFNV_GOP_FRAME_I       1
+#define FFNV_GOP_FRAME_P       2
+#define FFNV_GOP_FRAME_B       3
+
+#define FFNV_GOP_FLAG_KEY        0x01 /**< IDR (H.264) or IRAP (HEVC), decoding can start here */
+#define FFNV_GOP_FLAG_REFERENCE  0x02 /**< may be referenced by later pictures */
+#define FFNV_GOP_FLAG_PARAM_SETS 0x04 /**< carries a VPS, SPS or PPS */
+#define FFNV_GOP_FLAG_RASL       0x08 /**< leading picture depending on the GOP before its random access point */
+#define FFNV_GOP_FLAG_OPEN       0x10 /**< random access point whose RASL pictures can be decoded (HEVC CRA) */
+
+typedef struct FFNVGopIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  /**< FFNV_GOP_INDEX_BYTE_ORDER as written by the host */
+    uint32_t codec;       /**< cudaVideoCodec */
+    uint32_t entry_size;  /**< sizeof(FFNVGopIndexEntry) */
+    uint64_t nb_entries;
+} FFNVGopIndexHeader;
+
+typedef struct FFNVGopIndexEntry {
+    uint64_t offset;   /**< byte offset of the access unit in the stream */
+    int64_t pts;
+    uint32_t size;
+    uint32_t key;      /**< last random access point in decode order, or FFNV_GOP_NO_KEY */
+    uint32_t ps;       /**< last entry carrying parameter sets, this one included, or FFNV_GOP_NO_KEY */
+    uint8_t type;      /**< FFNV_GOP_FRAME_* */
+    uint8_t flags;     /**< FFNV_GOP_FLAG_* */
+    uint16_t nb_ps;    /**< distinct parameter set ids sent up to this entry */
+} FFNVGopIndexEntry;
+
+typedef struct FFNVGopIndexView {
+    cudaVideoCodec codec;
+    const FFNVGopIndexEntry *entries;
+    uint32_t nb_entries;
+} FFNVGopIndexView;
+
+typedef struct FFNVGopIndexBuilder {
+    cudaVideoCodec codec;
+    FFNVGopIndexEntry *entries;
+    int entries_size;
+    uint32_t nb_entries;
+
+    uint32_t key;
+    uint32_t ps;
+    uint16_t nb_ps;
+    uint8_t ps_seen[FFNV_GOP_MAX_PS];
+    uint8_t extra_slice_header_bits[64]; /* per HEVC PPS id */
+} FFNVGopIndexBuilder;
+
+static inline void ffnv_gop_index_uninit(FFNVGopIndexBuilder *b)
+{
+    free(b->entries);
+    memset(b, 0, sizeof(*b));
+}
+
+/** Returns 0 on success, -1 if codec is neither H.264 nor HEVC. */
+static inline int ffnv_gop_index_init(FFNVGopIndexBuilder *b, cudaVideoCodec codec)
+{
+    memset(b, 0, sizeof(*b));
+
+    if (codec != cudaVideoCodec_H264 && codec != cudaVideoCodec_HEVC)
+        return -1;
+
+    b->codec = codec;
+    b->key   = FFNV_GOP_NO_KEY;
+    b->ps    = FFNV_GOP_NO_KEY;
+    return 0;
+}
+
+/*
+ * Index in [0, FFNV_GOP_MAX_PS) of the kind and id of the parameter set in
+ * NAL unit nal of the given type, -1 if it is none.
+ */
+static inline int ffnv_gop_index_ps_slot(cudaVideoCodec codec, const uint8_t *nal, size_t size, int type)
+{
+    uint8_t rbsp[128];
+    FFNVBitReader br;
+    uint32_t id;
+    int i, sub, present[7];
+
+    if (codec == cudaVideoCodec_H264) {
+        if ((type != 7 && type != 8) || size < 2)
+            return -1;
+        ffnv_br_init(&br, rbsp, ffnv_unescape_rbsp(rbsp, sizeof(rbsp), nal + 1, size - 1));
+        if (type == 7)
+            ffnv_br_skip(&br, 24); /* profile_idc, constraint_set flags, level_idc */
+        id = ffnv_br_get_ue(&br);
+        if (ffnv_br_overread(&br))
+            return -1;
+        if (type == 7)
+            return id < 32 ? (int)id : -1;
+        return id < 256 ? 32 + (int)id : -1;
+    }
+
+    if (type < 32 || type > 34 || size < 3)
+        return -1;
+    ffnv_br_init(&br, rbsp, ffnv_unescape_rbsp(rbsp, sizeof(rbsp), nal + 2, size - 2));
+
+    if (type == 32)
+        return (int)ffnv_br_get_bits(&br, 4);
+
+    if (type == 33) {
+        /* sps_seq_parameter_set_id follows profile_tier_level() */
+        ffnv_br_skip(&br, 4); /* sps_video_parameter_set_id */
+        sub = (int)ffnv_br_get_bits(&br, 3);
+        ffnv_br_skip(&br, 1 + 88 + 8);
+        for (i = 0; i < sub; i++)
+            present[i] = (int)ffnv_br_get_bits(&br, 2);
+        if (sub)
+            ffnv_br_skip(&br, 2 * (8 - sub));
+        for (i = 0; i < sub; i++)
+            ffnv_br_skip(&br, (present[i] & 2 ? 88 : 0) + (present[i] & 1 ? 8 : 0));
+        id = ffnv_br_get_ue(&br);
+        return !ffnv_br_overread(&br) && id < 16 ? 16 + (int)id : -1;
+    }
+
+    id = ffnv_br_get_ue(&br);
+    return !ffnv_br_overread(&br) && id < 64 ? 32 + (int)id : -1;
+}
+
+/* num_extra_slice_header_bits of an HEVC PPS, needed to get to slice_type */
+static inline void ffnv_gop_index_hevc_pps(FFNVGopIndexBuilder *b, const uint8_t *nal, size_t size)
+{
+    uint8_t rbsp[16];
+    FFNVBitReader br;
+    uint32_t pps_id;
+
+    ffnv_br_init(&br, rbsp, ffnv_unescape_rbsp(rbsp, sizeof(rbsp), nal + 2, size - 2));
+    pps_id = ffnv_br_get_ue(&br);
+    ffnv_br_get_ue(&br);  /* pps_seq_parameter_set_id */
+    ffnv_br_skip(&br, 2); /* dependent_slice_segments_enabled_flag, output_flag_present_flag */
+    if (pps_id < 64 && !ffnv_br_overread(&br))
+        b->extra_slice_header_bits[pps_id] = (uint8_t)ffnv_br_get_bits(&br, 3);
+}
+
+/* slice_type of the first slice of a picture as FFNV_GOP_FRAME_* */
+static inline int ffnv_gop_index_slice_type(const FFNVGopIndexBuilder *b, const uint8_t *nal,
+                                            size_t size, int type)
+{
+    static const uint8_t h264_types[5] = {
+        FFNV_GOP_FRAME_P, FFNV_GOP_FRAME_B, FFNV_GOP_FRAME_I, FFNV_GOP_FRAME_P, FFNV_GOP_FRAME_I,
+    };
+    static const uint8_t hevc_types[3] = {
+        FFNV_GOP_FRAME_B, FFNV_GOP_FRAME_P, FFNV_GOP_FRAME_I,
+    };
+    uint8_t rbsp[32];
+    FFNVBitReader br;
+    uint32_t slice_type, pps_id;
+
+    if (b->codec == cudaVideoCodec_H264) {
+        ffnv_br_init(&br, rbsp, ffnv_unescape_rbsp(rbsp, sizeof(rbsp), nal + 1, size - 1));
+        ffnv_br_get_ue(&br); /* first_mb_in_slice */
+        slice_type = ffnv_br_get_ue(&br);
+        return !ffnv_br_overread(&br) && slice_type < 10 ? h264_types[slice_type % 5]
+                                                         : FFNV_GOP_FRAME_UNKNOWN;
+    }
+
+    ffnv_br_init(&br, rbsp, ffnv_unescape_rbsp(rbsp, sizeof(rbsp), nal + 2, size - 2));
+    ffnv_br_skip(&br, 1 + (type >= 16 && type <= 23)); /* first_slice_segment_in_pic_flag, no_output_of_prior_pics_flag */
+    pps_id = ffnv_br_get_ue(&br);
+    if (pps_id >= 64)
+        return FFNV_GOP_FRAME_UNKNOWN;
+    ffnv_br_skip(&br, b->extra_slice_header_bits[pps_id]);
+    slice_type = ffnv_br_get_ue(&br);
+    return !ffnv_br_overread(&br) && slice_type < 3 ? hevc_types[slice_type] : FFNV_GOP_FRAME_UNKNOWN;
+}
+
+/**
+ * Add the next access unit in decode order, found at byte offset in the
+ * stream. Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_gop_index_add(FFNVGopIndexBuilder *b, const uint8_t *au, size_t size,
+                                     uint64_t offset, int64_t pts)
+{
+    const int hevc = b->codec == cudaVideoCodec_HEVC;
+    FFNVGopIndexEntry *e;
+    FFNVAnnexBNAL nal, next;
+    size_t pos = 0;
+    int have_nal, have_next, have_slice = 0, slot;
+
+    if (size > UINT32_MAX || b->nb_entries >= (uint32_t)1 << 30 ||
+        ffnv_parse_grow((void**)&b->entries, &b->entries_size,
+                        (int)b->nb_entries + 1, sizeof(*b->entries)) < 0)
+        return -1;
+
+    e = &b->entries[b->nb_entries];
+    memset(e, 0, sizeof(*e));
+    e->offset = offset;
+    e->pts    = pts;
+    e->size   = (uint32_t)size;
+
+    have_nal = ffnv_annexb_next_nal(b->codec, au, size, &pos, &nal);
+    for (; have_nal; nal = next, have_nal = have_next) {
+        const uint8_t *data = au + nal.data_offset;
+        size_t len;
+
+        have_next = ffnv_annexb_next_nal(b->codec, au, size, &pos, &next);
+        len = (have_next ? next.offset : size) - nal.data_offset;
+
+        /* base layer only */
+        if (hevc && ((data[0] & 1) || data[1] >> 3))
+            continue;
+
+        slot = ffnv_gop_index_ps_slot(b->codec, data, len, nal.type);
+        if (slot >= 0) {
+            e->flags |= FFNV_GOP_FLAG_PARAM_SETS;
+            if (!b->ps_seen[slot]) {
+                b->ps_seen[slot] = 1;
+                b->nb_ps++;
+            }
+            if (hevc && nal.type == 34)
+                ffnv_gop_index_hevc_pps(b, data, len);
+        }
+
+        if (have_slice || ffnv_annexb_nal_class(b->codec, nal.type) != FFNV_ANNEXB_NAL_VCL ||
+            len < (size_t)(hevc ? 3 : 2) || !ffnv_annexb_first_slice(b->codec, data))
+            continue;
+        have_slice = 1;
+
+        e->type = (uint8_t)ffnv_gop_index_slice_type(b, data, len, nal.type);
+        if (hevc) {
+            if (nal.type >= 16 && nal.type <= 23) {
+                e->flags |= FFNV_GOP_FLAG_KEY | (nal.type == 21 ? FFNV_GOP_FLAG_OPEN : 0);
+                b->key    = b->nb_entries;
+            } else if (nal.type == 8 || nal.type == 9) {
+                e->flags |= FFNV_GOP_FLAG_RASL;
+            }
+            /* everything but sub-layer non-reference pictures */
+            if (nal.type > 14 || (nal.type & 1))
+                e->flags |= FFNV_GOP_FLAG_REFERENCE;
+        } else {
+            if (nal.type == 5) {
+                e->flags |= FFNV_GOP_FLAG_KEY;
+                b->key    = b->nb_entries;
+            }
+            if (data[0] & 0x60)
+                e->flags |= FFNV_GOP_FLAG_REFERENCE;
+        }
+    }
+
+    if (e->flags & FFNV_GOP_FLAG_PARAM_SETS)
+        b->ps = b->nb_entries;
+    e->key   = b->key;
+    e->ps    = b->ps;
+    e->nb_ps = b->nb_ps;
+    b->nb_entries++;
+    return 0;
+}
+
+static inline void ffnv_gop_index_view(const FFNVGopIndexBuilder *b, FFNVGopIndexView *view)
+{
+    view->codec      = b->codec;
+    view->entries    = b->entries;
+    view->nb_entries = b->nb_entries;
+}
+
+/** Write the index to f. Returns 0 on success, -1 on error. */
+static inline int ffnv_gop_index_write(const FFNVGopIndexBuilder *b, FILE *f)
+{
+    FFNVGopIndexHeader hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FFNV_GOP_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version    = FFNV_GOP_INDEX_VERSION;
+    hdr.byte_order = FFNV_GOP_INDEX_BYTE_ORDER;
+    hdr.codec      = (uint32_t)b->codec;
+    hdr.entry_size = sizeof(FFNVGopIndexEntry);
+    hdr.nb_entries = b->nb_entries;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        (b->nb_entries && fwrite(b->entries, sizeof(*b->entries), b->nb_entries, f) != b->nb_entries))
+        return -1;
+    return 0;
+}
+
+/**
+ * Use an index file held in memory, e.g. mapped with mmap(). data must be
+ * 8-byte aligned and stay valid while the view is used. Returns 0 on
+ * success, -1 if the data is no index written by a host of the same byte
+ * order.
+ */
+static inline int ffnv_gop_index_open(FFNVGopIndexView *view, const void *data, size_t size)
+{
+    const FFNVGopIndexHeader *hdr = (const FFNVGopIndexHeader*)data;
+
+    if (size < sizeof(*hdr) || ((uintptr_t)data & 7) ||
+        memcmp(hdr->magic, FFNV_GOP_INDEX_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != FFNV_GOP_INDEX_VERSION ||
+        hdr->byte_order != FFNV_GOP_INDEX_BYTE_ORDER ||
+        hdr->entry_size != sizeof(FFNVGopIndexEntry) ||
+        hdr->nb_entries >= FFNV_GOP_NO_KEY ||
+        hdr->nb_entries > (size - sizeof(*hdr)) / sizeof(FFNVGopIndexEntry))
+        return -1;
+
+    view->codec      = (cudaVideoCodec)hdr->codec;
+    view->entries    = (const FFNVGopIndexEntry*)(hdr + 1);
+    view->nb_entries = (uint32_t)hdr->nb_entries;
+    return 0;
+}
+
+/**
+ * Entry to start decoding from to reach entry i: its random access point,
+ * or the one before for RASL pictures. Returns FFNV_GOP_NO_KEY if entry i
+ * cannot be decoded.
+ */
+static inline uint32_t ffnv_gop_index_start(const FFNVGopIndexView *view, uint32_t i)
+{
+    const FFNVGopIndexEntry *e = view->entries;
+    uint32_t key = e[i].key;
+
+    if (key == FFNV_GOP_NO_KEY || !(e[i].flags & FFNV_GOP_FLAG_RASL))
+        return key;
+    if (!(e[key].flags & FFNV_GOP_FLAG_OPEN) || !key)
+        return FFNV_GOP_NO_KEY;
+    return e[key - 1].key;
+}
+
+/**
+ * Entry of the picture shown at pts: the one with the largest PTS not
+ * after it. Returns FFNV_GOP_NO_KEY if there is none that can be decoded.
+ */
+static inline uint32_t ffnv_gop_index_find(const FFNVGopIndexView *view, int64_t pts)
+{
+    const FFNVGopIndexEntry *e = view->entries;
+    uint32_t lo = 0, hi = view->nb_entries, i, key, best = FFNV_GOP_NO_KEY;
+    int keys = 0;
+
+    /* the PTS of random access points grows in decode order: find the last one not after pts */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (e[mid].key != FFNV_GOP_NO_KEY && e[e[mid].key].pts > pts)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (!lo)
+        return FFNV_GOP_NO_KEY;
+    key = e[lo - 1].key;
+    if (key == FFNV_GOP_NO_KEY)
+        return FFNV_GOP_NO_KEY;
+
+    /* leading pictures of the next random access point may still come first in display order */
+    for (i = key; i < view->nb_entries && keys < 3; i++) {
+        keys += !!(e[i].flags & FFNV_GOP_FLAG_KEY);
+        if (e[i].pts <= pts && (best == FFNV_GOP_NO_KEY || e[i].pts > e[best].pts) &&
+            ffnv_gop_index_start(view, i) != FFNV_GOP_NO_KEY)
+            best = i;
+    }
+    return best;
+}
+
+typedef struct FFNVGopSeek {
+    const FFNVGopIndexView *view;
+    int64_t target_pts;
+    uint32_t next;     /**< next entry to send */
+    uint32_t ps[FFNV_GOP_MAX_PS]; /* entries whose parameter sets are sent first, newest first */
+    int nb_ps;         /* of them left to send, -1 until they were looked up */
+    size_t ps_pos;
+    int discontinuity;
+    int reached;
+} FFNVGopSeek;
+
+/** Prepare sending the access units from entry start on, which must be a random access point. */
+static inline void ffnv_gop_seek_start(FFNVGopSeek *s, const FFNVGopIndexView *view, uint32_t start)
+{
+    memset(s, 0, sizeof(*s));
+    s->view          = view;
+    s->next          = start;
+    s->nb_ps         = -1;
+    s->discontinuity = 1;
+}
+
+/**
+ * Prepare a seek to the picture shown at pts. Returns 0 on success, -1 if
+ * no decodable picture is shown at or before pts.
+ */
+static inline int ffnv_gop_seek_init(FFNVGopSeek *s, const FFNVGopIndexView *view, int64_t pts)
+{
+    uint32_t target = ffnv_gop_index_find(view, pts);
+
+    memset(s, 0, sizeof(*s));
+    if (target == FFNV_GOP_NO_KEY)
+        return -1;
+
+    ffnv_gop_seek_start(s, view, ffnv_gop_index_start(view, target));
+    s->target_pts = view->entries[target].pts;
+    return 0;
+}
+
+/*
+ * Find the entries holding the latest parameter set of every id defined
+ * before the start entry, going back through the entries that carry
+ * parameter sets until all ids were seen. The start entry sends its own.
+ */
+static inline void ffnv_gop_seek_find_ps(FFNVGopSeek *s, const uint8_t *stream)
+{
+    const cudaVideoCodec codec = s->view->codec;
+    const FFNVGopIndexEntry *e = s->view->entries;
+    uint8_t seen[FFNV_GOP_MAX_PS];
+    uint32_t p = s->next < s->view->nb_entries ? e[s->next].ps : FFNV_GOP_NO_KEY;
+    unsigned int found = 0, total = p != FFNV_GOP_NO_KEY ? e[s->next].nb_ps : 0;
+
+    memset(seen, 0, sizeof(seen));
+    s->nb_ps = 0;
+
+    while (p != FFNV_GOP_NO_KEY && found < total) {
+        const uint8_t *au = stream + e[p].offset;
+        FFNVAnnexBNAL nal, next;
+        size_t pos = 0, end;
+        int have_nal, have_next, needed = 0, slot;
+
+        have_nal = ffnv_annexb_next_nal(codec, au, e[p].size, &pos, &nal);
+        for (; have_nal; nal = next, have_nal = have_next) {
+            have_next = ffnv_annexb_next_nal(codec, au, e[p].size, &pos, &next);
+            end = have_next ? next.offset : e[p].size;
+
+            if (codec == cudaVideoCodec_HEVC && ((au[nal.data_offset] & 1) || au[nal.data_offset + 1] >> 3))
+                continue;
+            slot = ffnv_gop_index_ps_slot(codec, au + nal.data_offset, end - nal.data_offset, nal.type);
+            if (slot >= 0 && !seen[slot]) {
+                seen[slot] = 1;
+                found++;
+                needed = 1;
+            }
+        }
+
+        if (needed && p != s->next)
+            s->ps[s->nb_ps++] = p;
+        p = p ? e[p - 1].ps : FFNV_GOP_NO_KEY;
+    }
+}
+
+/**
+ * Fill the next packet for cuvidParseVideoData() from the stream the index
+ * was built on. Returns 1 if pkt was filled, 0 at the end of the index.
+ * Sending may go on past the target for normal playback.
+ */
+static inline int ffnv_gop_seek_packet(FFNVGopSeek *s, const uint8_t *stream, CUVIDSOURCEDATAPACKET *pkt)
+{
+    const FFNVGopIndexEntry *e;
+
+    memset(pkt, 0, sizeof(*pkt));
+
+    if (s->nb_ps < 0)
+        ffnv_gop_seek_find_ps(s, stream);
+
+    /* the parameter set NAL units of those entries, oldest first, one at a time */
+    while (s->nb_ps > 0) {
+        const cudaVideoCodec codec = s->view->codec;
+        const uint8_t *au;
+        FFNVAnnexBNAL nal, next;
+        size_t size, end;
+        int ps;
+
+        e    = &s->view->entries[s->ps[s->nb_ps - 1]];
+        au   = stream + e->offset;
+        size = e->size;
+        if (!ffnv_annexb_next_nal(codec, au, size, &s->ps_pos, &nal)) {
+            s->nb_ps--;
+            s->ps_pos = 0;
+            continue;
+        }
+        end = s->ps_pos;
+        end = ffnv_annexb_next_nal(codec, au, size, &end, &next) ? next.offset : size;
+
+        ps = codec == cudaVideoCodec_HEVC ? nal.type >= 32 && nal.type <= 34
+                                          : nal.type == 7 || nal.type == 8;
+        if (!ps)
+            continue;
+
+        pkt->flags        = s->discontinuity ? CUVID_PKT_DISCONTINUITY : 0;
+        pkt->payload_size = (tcu_ulong)(end - nal.offset);
+        pkt->payload      = au + nal.offset;
+        s->discontinuity  = 0;
+        return 1;
+    }
+
+    if (s->next >= s->view->nb_entries)
+        return 0;
+
+    e = &s->view->entries[s->next++];
+    ffnv_annexb_packet(pkt, stream + e->offset, e->size, e->pts);
+    if (s->discontinuity)
+        pkt->flags |= CUVID_PKT_DISCONTINUITY;
+    s->discontinuity = 0;
+    return 1;
+}
+
+/**
+ * Whether a picture displayed with the given timestamp comes before the
+ * target and must be dropped. Call from the display callback.
+ */
+static inline int ffnv_gop_seek_drop(FFNVGopSeek *s, int64_t timestamp)
+{
+    if (s->reached)
+        return 0;
+    if (timestamp < s->target_pts)
+        return 1;
+    s->reached = 1;
+    return 0;
+}
+
+#endif
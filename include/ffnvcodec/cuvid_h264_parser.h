@@ -0,0 +1,1666 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Standalone H.264 parser filling CUVIDPICPARAMS for cuvidDecodePicture().
+ *
+ * It parses SPS, PPS and slice headers, derives picture order counts,
+ * performs reference picture marking (sliding window, MMCO and frame_num
+ * gaps) and keeps the display queue, so no cuvidCreateVideoParser() and
+ * no callbacks are involved. The parser state is only touched by the
+ * calling thread, which does not have to be the thread submitting the
+ * pictures to the decoder.
+ *
+ * Input is one access unit per call, e.g. as split by FFNVAnnexBSplitter.
+ * The filled CUVIDPICPARAMS may point into the access unit, which must
+ * stay valid until cuvidDecodePicture() returns. Pictures before the
+ * first IDR or recovery point SEI are skipped, as their references are
+ * missing.
+ */
+
+#ifndef FFNV_CUVID_H264_PARSER_H
+#define FFNV_CUVID_H264_PARSER_H
+
+#include "cuvid_annexb.h"
+#include "cuvid_parse.h"
+
+#define FFNV_H264_MAX_SPS   32
+#define FFNV_H264_MAX_PPS   256
+#define FFNV_H264_MAX_REFS  16
+#define FFNV_H264_MAX_MMCO  66
+
+/* slice headers are parsed from at most this many bytes of RBSP */
+#define FFNV_H264_SLICE_HEADER_SIZE 4096
+
+static const uint8_t ffnv_h264_zigzag4x4[16] = {
+    0,  1,  4,  8,  5,  2,  3,  6,  9, 12, 13, 10,  7, 11, 14, 15,
+};
+
+static const uint8_t ffnv_h264_zigzag8x8[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/* Table 7-3 and 7-4, in scan order */
+static const uint8_t ffnv_h264_default_scaling4[2][16] = {
+    {  6, 13, 13, 20, 20, 20, 28, 28, 28, 28, 32, 32, 32, 37, 37, 42 },
+    { 10, 14, 14, 20, 20, 20, 24, 24, 24, 24, 27, 27, 27, 30, 30, 34 },
+};
+
+static const uint8_t ffnv_h264_default_scaling8[2][64] = {
+    {  6, 10, 10, 13, 11, 13, 16, 16, 16, 16, 18, 18, 18, 18, 18, 23,
+      23, 23, 23, 23, 23, 25, 25, 25, 25, 25, 25, 25, 27, 27, 27, 27,
+      27, 27, 27, 27, 29, 29, 29, 29, 29, 29, 29, 31, 31, 31, 31, 31,
+      31, 33, 33, 33, 33, 33, 36, 36, 36, 36, 38, 38, 38, 40, 40, 42 },
+    {  9, 13, 13, 15, 13, 15, 17, 17, 17, 17, 19, 19, 19, 19, 19, 21,
+      21, 21, 21, 21, 21, 22, 22, 22, 22, 22, 22, 22, 24, 24, 24, 24,
+      24, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 27, 27, 27, 27, 27,
+      27, 28, 28, 28, 28, 28, 30, 30, 30, 30, 32, 32, 32, 33, 33, 35 },
+};
+
+static const uint8_t ffnv_h264_sar[17][2] = {
+    {  0,  1 }, {  1,  1 }, { 12, 11 }, { 10, 11 }, { 16, 11 }, { 40, 33 },
+    { 24, 11 }, { 20, 11 }, { 32, 11 }, { 80, 33 }, { 18, 11 }, { 15, 11 },
+    { 64, 33 }, {160, 99 }, {  4,  3 }, {  3,  2 }, {  2,  1 },
+};
+
+typedef struct FFNVH264SPS {
+    int profile_idc;
+    int constraint_flags;
+    int level_idc;
+    int chroma_format_idc;
+    int separate_colour_plane_flag;
+    int bit_depth_luma_minus8;
+    int bit_depth_chroma_minus8;
+    int qpprime_y_zero_transform_bypass_flag;
+    int seq_scaling_matrix_present_flag;
+    uint8_t scaling4x4[6][16]; /* scan order, fall-back rules applied */
+    uint8_t scaling8x8[6][64];
+    int log2_max_frame_num_minus4;
+    int pic_order_cnt_type;
+    int log2_max_pic_order_cnt_lsb_minus4;
+    int delta_pic_order_always_zero_flag;
+    int offset_for_non_ref_pic;
+    int offset_for_top_to_bottom_field;
+    int num_ref_frames_in_pic_order_cnt_cycle;
+    int offset_for_ref_frame[256];
+    int max_num_ref_frames;
+    int gaps_in_frame_num_value_allowed_flag;
+    int pic_width_in_mbs;
+    int pic_height_in_map_units;
+    int frame_mbs_only_flag;
+    int mb_adaptive_frame_field_flag;
+    int direct_8x8_inference_flag;
+    int crop_left, crop_right, crop_top, crop_bottom; /* in luma samples */
+
+    /* VUI */
+    int sar_width, sar_height;
+    int video_format;
+    int video_full_range_flag;
+    int colour_primaries;
+    int transfer_characteristics;
+    int matrix_coefficients;
+    uint32_t num_units_in_tick;
+    uint32_t time_scale;
+    int max_num_reorder_frames; /* -1 if not signalled */
+    int max_dec_frame_buffering;
+} FFNVH264SPS;
+
+typedef struct FFNVH264PPS {
+    int sps_id;
+    int entropy_coding_mode_flag;
+    int bottom_field_pic_order_in_frame_present_flag;
+    int num_slice_groups_minus1;
+    int slice_group_map_type;
+    int slice_group_change_rate_minus1;
+    int num_ref_idx_default_active_minus1[2];
+    int weighted_pred_flag;
+    int weighted_bipred_idc;
+    int pic_init_qp_minus26;
+    int pic_init_qs_minus26;
+    int chroma_qp_index_offset;
+    int deblocking_filter_control_present_flag;
+    int constrained_intra_pred_flag;
+    int redundant_pic_cnt_present_flag;
+    int transform_8x8_mode_flag;
+    int pic_scaling_matrix_present_flag;
+    int scaling_list_present[12]; /* 0 = not sent, 1 = sent, 2 = use default */
+    uint8_t scaling4x4[6][16];
+    uint8_t scaling8x8[6][64];
+    int second_chroma_qp_index_offset;
+} FFNVH264PPS;
+
+typedef struct FFNVH264MMCO {
+    int op;
+    int pic_num;  /* difference_of_pic_nums_minus1 or long_term_pic_num */
+    int lt_idx;   /* long_term_frame_idx or max_long_term_frame_idx_plus1 */
+} FFNVH264MMCO;
+
+typedef struct FFNVH264SliceHeader {
+    int nal_unit_type;
+    int nal_ref_idc;
+    int first_mb_in_slice;
+    int slice_type;
+    int pps_id;
+    int frame_num;
+    int field_pic_flag;
+    int bottom_field_flag;
+    int idr_pic_id;
+    int pic_order_cnt_lsb;
+    int delta_pic_order_cnt_bottom;
+    int delta_pic_order_cnt[2];
+    int redundant_pic_cnt;
+    int num_ref_idx_active_minus1[2];
+    int no_output_of_prior_pics_flag;
+    int long_term_reference_flag;
+    int adaptive_ref_pic_marking_mode_flag;
+    FFNVH264MMCO mmco[FFNV_H264_MAX_MMCO];
+    int nb_mmco;
+} FFNVH264SliceHeader;
+
+/* A frame or field pair in the DPB that is used for reference. */
+typedef struct FFNVH264Ref {
+    int pic_idx;       /* -1 for frames inferred from frame_num gaps */
+    int frame_num;
+    int long_term_frame_idx;
+    int short_ref;     /* 1 = top field, 2 = bottom field, 3 = both */
+    int long_ref;
+    int not_existing;
+    int poc[2];
+} FFNVH264Ref;
+
+typedef struct FFNVH264SliceRange {
+    size_t start, end;
+} FFNVH264SliceRange;
+
+typedef struct FFNVH264Parser {
+    /** Number of pictures to hold back for reordering, -1 to derive it from the SPS. */
+    int display_delay;
+
+    FFNVH264SPS *sps[FFNV_H264_MAX_SPS];
+    FFNVH264PPS *pps[FFNV_H264_MAX_PPS];
+    FFNVH264SPS active_sps;
+    int has_active_sps;
+    int reorder;
+    int draining;
+    int random_access;     /* an IDR or recovery point was decoded */
+    int recovery_point;    /* a recovery point SEI comes before the next picture */
+
+    /** Bytes of the buffer used by the last ffnv_h264_parse_au(), see there. */
+    size_t consumed;
+
+    FFNVFramePool pool;
+    FFNVH264Ref refs[FFNV_H264_MAX_REFS];
+    int nb_refs;
+    int max_long_term_frame_idx;
+
+    int prev_poc_msb, prev_poc_lsb;
+    int prev_frame_num, prev_frame_num_offset;
+    int prev_ref_frame_num;
+    int64_t epoch;
+
+    /* unpaired first field, field_idx is -1 if there is none */
+    int field_idx;
+    int field_bottom;
+    int field_frame_num;
+    int field_poc;
+    int64_t field_order;
+    int64_t field_timestamp;
+
+    /* current picture */
+    FFNVH264SliceHeader sh;
+    FFNVH264SliceHeader tmp;
+    const FFNVH264SPS *cur_sps;
+    const FFNVH264PPS *cur_pps;
+    int cur_idx;
+    int second_field;
+    int frame_num_offset;
+    int poc_msb;
+    int poc[2];
+    int64_t timestamp;
+    uint8_t scaling4x4[6][16];
+    uint8_t scaling8x8[6][64];
+
+    uint8_t *rbsp;
+    int rbsp_size;
+    FFNVH264SliceRange *slices;
+    int slices_size;
+    int nb_slices;
+    unsigned int *slice_offsets;
+    int slice_offsets_size;
+    uint8_t *bitstream;
+    int bitstream_size;
+} FFNVH264Parser;
+
+static inline void ffnv_h264_parser_free(FFNVH264Parser **pp)
+{
+    FFNVH264Parser *p = *pp;
+    int i;
+
+    if (!p)
+        return;
+
+    for (i = 0; i < FFNV_H264_MAX_SPS; i++)
+        free(p->sps[i]);
+    for (i = 0; i < FFNV_H264_MAX_PPS; i++)
+        free(p->pps[i]);
+    free(p->rbsp);
+    free(p->slices);
+    free(p->slice_offsets);
+    free(p->bitstream);
+    free(p);
+    *pp = NULL;
+}
+
+/**
+ * Allocate a parser handing out picture indices below nb_surfaces, which
+ * must match CUVIDDECODECREATEINFO::ulNumDecodeSurfaces.
+ * Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_h264_parser_init(FFNVH264Parser **pp, int nb_surfaces)
+{
+    FFNVH264Parser *p = (FFNVH264Parser*)calloc(1, sizeof(*p));
+
+    *pp = p;
+    if (!p)
+        return -1;
+
+    p->display_delay           = -1;
+    p->max_long_term_frame_idx = -1;
+    p->field_idx               = -1;
+    ffnv_pool_init(&p->pool, nb_surfaces);
+    return 0;
+}
+
+/* Copy the RBSP of a NAL unit, without its header byte, into p->rbsp. */
+static inline int ffnv_h264_load_rbsp(FFNVH264Parser *p, FFNVBitReader *br,
+                                      const uint8_t *nal, size_t size, size_t max_size)
+{
+    size_t n;
+
+    if (size < 2)
+        return -1;
+    if (size > max_size)
+        size = max_size;
+    if (ffnv_parse_grow((void**)&p->rbsp, &p->rbsp_size, (int)size, 1) < 0)
+        return -1;
+
+    n = ffnv_unescape_rbsp(p->rbsp, size, nal + 1, size - 1);
+    ffnv_br_init(br, p->rbsp, n);
+    return 0;
+}
+
+/* Returns 1 if the list was sent, 2 if the default list is to be used. */
+static inline int ffnv_h264_scaling_list(FFNVBitReader *br, uint8_t *list, int size)
+{
+    int last = 8, next = 8, j;
+
+    for (j = 0; j < size; j++) {
+        if (next) {
+            next = (last + ffnv_br_get_se(br) + 256) & 0xff;
+            if (!j && !next)
+                return 2;
+        }
+        list[j] = (uint8_t)(next ? next : last);
+        last = list[j];
+    }
+    return 1;
+}
+
+/*
+ * Apply the fall-back rules of Table 7-2 to the lists that were not sent.
+ * fb holds the fall-backs for the intra/inter 4x4 and intra/inter 8x8 luma lists.
+ */
+static inline void ffnv_h264_scaling_fallback(uint8_t s4[6][16], uint8_t s8[6][64],
+                                              const int present[12], const uint8_t *const fb[4])
+{
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        if (present[i] == 2)
+            memcpy(s4[i], ffnv_h264_default_scaling4[i >= 3], 16);
+        else if (!present[i])
+            memcpy(s4[i], i == 0 || i == 3 ? fb[i / 3] : s4[i - 1], 16);
+    }
+    for (i = 0; i < 6; i++) {
+        if (present[6 + i] == 2)
+            memcpy(s8[i], ffnv_h264_default_scaling8[i & 1], 64);
+        else if (!present[6 + i])
+            memcpy(s8[i], i < 2 ? fb[2 + i] : s8[i - 2], 64);
+    }
+}
+
+static inline void ffnv_h264_hrd(FFNVBitReader *br)
+{
+    uint32_t cpb_cnt = ffnv_br_get_ue(br) + 1, i;
+
+    if (cpb_cnt > 32)
+        cpb_cnt = 32;
+
+    ffnv_br_skip(br, 8);
+    for (i = 0; i < cpb_cnt; i++) {
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        ffnv_br_skip(br, 1);
+    }
+    ffnv_br_skip(br, 20);
+}
+
+static inline void ffnv_h264_vui(FFNVBitReader *br, FFNVH264SPS *sps)
+{
+    int nal_hrd, vcl_hrd;
+
+    if (ffnv_br_get_bit(br)) {
+        int idc = (int)ffnv_br_get_bits(br, 8);
+
+        if (idc == 255) {
+            sps->sar_width  = (int)ffnv_br_get_bits(br, 16);
+            sps->sar_height = (int)ffnv_br_get_bits(br, 16);
+        } else if (idc < 17) {
+            sps->sar_width  = ffnv_h264_sar[idc][0];
+            sps->sar_height = ffnv_h264_sar[idc][1];
+        }
+    }
+
+    if (ffnv_br_get_bit(br))
+        ffnv_br_skip(br, 1);
+
+    if (ffnv_br_get_bit(br)) {
+        sps->video_format          = (int)ffnv_br_get_bits(br, 3);
+        sps->video_full_range_flag = ffnv_br_get_bit(br);
+        if (ffnv_br_get_bit(br)) {
+            sps->colour_primaries         = (int)ffnv_br_get_bits(br, 8);
+            sps->transfer_characteristics = (int)ffnv_br_get_bits(br, 8);
+            sps->matrix_coefficients      = (int)ffnv_br_get_bits(br, 8);
+        }
+    }
+
+    if (ffnv_br_get_bit(br)) {
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+    }
+
+    if (ffnv_br_get_bit(br)) {
+        sps->num_units_in_tick = ffnv_br_get_bits(br, 32);
+        sps->time_scale        = ffnv_br_get_bits(br, 32);
+        ffnv_br_skip(br, 1);
+    }
+
+    nal_hrd = ffnv_br_get_bit(br);
+    if (nal_hrd)
+        ffnv_h264_hrd(br);
+    vcl_hrd = ffnv_br_get_bit(br);
+    if (vcl_hrd)
+        ffnv_h264_hrd(br);
+    if (nal_hrd || vcl_hrd)
+        ffnv_br_skip(br, 1);
+    ffnv_br_skip(br, 1);
+
+    if (ffnv_br_get_bit(br)) {
+        ffnv_br_skip(br, 1);
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        sps->max_num_reorder_frames  = (int)ffnv_br_get_ue(br);
+        sps->max_dec_frame_buffering = (int)ffnv_br_get_ue(br);
+
+        /* ignore restrictions cut off or out of range */
+        if (ffnv_br_overread(br) || sps->max_num_reorder_frames > FFNV_H264_MAX_REFS)
+            sps->max_num_reorder_frames = -1;
+    }
+}
+
+/* MaxDpbFrames of A.3.1 */
+static inline int ffnv_h264_max_dpb_frames(const FFNVH264SPS *sps)
+{
+    static const struct { int level, mbs; } max_dpb_mbs[] = {
+        {  9,    396 }, { 10,    396 }, { 11,    900 }, { 12,   2376 }, { 13,   2376 },
+        { 20,   2376 }, { 21,   4752 }, { 22,   8100 }, { 30,   8100 }, { 31,  18000 },
+        { 32,  20480 }, { 40,  32768 }, { 41,  32768 }, { 42,  34816 }, { 50, 110400 },
+        { 51, 184320 }, { 52, 184320 }, { 60, 696320 }, { 61, 696320 }, { 62, 696320 },
+    };
+    int frame_mbs = sps->pic_width_in_mbs * sps->pic_height_in_map_units * (2 - sps->frame_mbs_only_flag);
+    int level = sps->level_idc == 11 && sps->constraint_flags & 0x10 ? 9 : sps->level_idc;
+    int i, n = FFNV_H264_MAX_REFS;
+
+    for (i = 0; i < (int)(sizeof(max_dpb_mbs) / sizeof(max_dpb_mbs[0])); i++) {
+        if (max_dpb_mbs[i].level == level) {
+            n = max_dpb_mbs[i].mbs / frame_mbs;
+            break;
+        }
+    }
+
+    if (n < sps->max_num_ref_frames)
+        n = sps->max_num_ref_frames;
+    return n > FFNV_H264_MAX_REFS ? FFNV_H264_MAX_REFS : n;
+}
+
+static inline int ffnv_h264_parse_sps(FFNVH264Parser *p, const uint8_t *nal, size_t size)
+{
+    static const uint8_t flat16[64] = {
+        16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+        16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+        16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+        16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    };
+    FFNVBitReader br;
+    FFNVH264SPS sps;
+    uint32_t id, v;
+    int i;
+
+    if (ffnv_h264_load_rbsp(p, &br, nal, size, size) < 0)
+        return -1;
+
+    memset(&sps, 0, sizeof(sps));
+    sps.profile_idc       = (int)ffnv_br_get_bits(&br, 8);
+    sps.constraint_flags  = (int)ffnv_br_get_bits(&br, 8);
+    sps.level_idc         = (int)ffnv_br_get_bits(&br, 8);
+    sps.chroma_format_idc = 1;
+    id = ffnv_br_get_ue(&br);
+    if (id >= FFNV_H264_MAX_SPS)
+        return -1;
+
+    switch (sps.profile_idc) {
+    case 100: case 110: case 122: case 244: case  44: case  83: case  86:
+    case 118: case 128: case 138: case 139: case 134: case 135:
+        sps.chroma_format_idc = (int)ffnv_br_get_ue(&br);
+        if (sps.chroma_format_idc > 3)
+            return -1;
+        if (sps.chroma_format_idc == 3)
+            sps.separate_colour_plane_flag = ffnv_br_get_bit(&br);
+        sps.bit_depth_luma_minus8   = (int)ffnv_br_get_ue(&br);
+        sps.bit_depth_chroma_minus8 = (int)ffnv_br_get_ue(&br);
+        if (sps.bit_depth_luma_minus8 > 6 || sps.bit_depth_chroma_minus8 > 6)
+            return -1;
+        sps.qpprime_y_zero_transform_bypass_flag = ffnv_br_get_bit(&br);
+        sps.seq_scaling_matrix_present_flag      = ffnv_br_get_bit(&br);
+        break;
+    }
+
+    if (sps.seq_scaling_matrix_present_flag) {
+        const uint8_t *fb[4] = {
+            ffnv_h264_default_scaling4[0], ffnv_h264_default_scaling4[1],
+            ffnv_h264_default_scaling8[0], ffnv_h264_default_scaling8[1],
+        };
+        int present[12] = { 0 };
+
+        for (i = 0; i < (sps.chroma_format_idc != 3 ? 8 : 12); i++) {
+            if (ffnv_br_get_bit(&br))
+                present[i] = i < 6 ? ffnv_h264_scaling_list(&br, sps.scaling4x4[i], 16)
+                                   : ffnv_h264_scaling_list(&br, sps.scaling8x8[i - 6], 64);
+        }
+        ffnv_h264_scaling_fallback(sps.scaling4x4, sps.scaling8x8, present, fb);
+    } else {
+        for (i = 0; i < 6; i++) {
+            memcpy(sps.scaling4x4[i], flat16, 16);
+            memcpy(sps.scaling8x8[i], flat16, 64);
+        }
+    }
+
+    sps.log2_max_frame_num_minus4 = (int)ffnv_br_get_ue(&br);
+    sps.pic_order_cnt_type        = (int)ffnv_br_get_ue(&br);
+    if (sps.log2_max_frame_num_minus4 > 12 || sps.pic_order_cnt_type > 2)
+        return -1;
+
+    if (sps.pic_order_cnt_type == 0) {
+        sps.log2_max_pic_order_cnt_lsb_minus4 = (int)ffnv_br_get_ue(&br);
+        if (sps.log2_max_pic_order_cnt_lsb_minus4 > 12)
+            return -1;
+    } else if (sps.pic_order_cnt_type == 1) {
+        sps.delta_pic_order_always_zero_flag = ffnv_br_get_bit(&br);
+        sps.offset_for_non_ref_pic           = ffnv_br_get_se(&br);
+        sps.offset_for_top_to_bottom_field   = ffnv_br_get_se(&br);
+        v = ffnv_br_get_ue(&br);
+        if (v > 255)
+            return -1;
+        sps.num_ref_frames_in_pic_order_cnt_cycle = (int)v;
+        for (i = 0; i < sps.num_ref_frames_in_pic_order_cnt_cycle; i++)
+            sps.offset_for_ref_frame[i] = ffnv_br_get_se(&br);
+    }
+
+    sps.max_num_ref_frames                   = (int)ffnv_br_get_ue(&br);
+    sps.gaps_in_frame_num_value_allowed_flag = ffnv_br_get_bit(&br);
+    sps.pic_width_in_mbs                     = (int)ffnv_br_get_ue(&br) + 1;
+    sps.pic_height_in_map_units              = (int)ffnv_br_get_ue(&br) + 1;
+    if (sps.max_num_ref_frames > FFNV_H264_MAX_REFS ||
+        sps.pic_width_in_mbs <= 0 || sps.pic_width_in_mbs > 1024 ||
+        sps.pic_height_in_map_units <= 0 || sps.pic_height_in_map_units > 1024)
+        return -1;
+
+    sps.frame_mbs_only_flag = ffnv_br_get_bit(&br);
+    if (!sps.frame_mbs_only_flag)
+        sps.mb_adaptive_frame_field_flag = ffnv_br_get_bit(&br);
+    sps.direct_8x8_inference_flag = ffnv_br_get_bit(&br);
+
+    if (ffnv_br_get_bit(&br)) {
+        int chroma_array_type = sps.separate_colour_plane_flag ? 0 : sps.chroma_format_idc;
+        int crop_x = chroma_array_type == 1 || chroma_array_type == 2 ? 2 : 1;
+        int crop_y = (chroma_array_type == 1 ? 2 : 1) * (2 - sps.frame_mbs_only_flag);
+
+        sps.crop_left   = (int)ffnv_br_get_ue(&br) * crop_x;
+        sps.crop_right  = (int)ffnv_br_get_ue(&br) * crop_x;
+        sps.crop_top    = (int)ffnv_br_get_ue(&br) * crop_y;
+        sps.crop_bottom = (int)ffnv_br_get_ue(&br) * crop_y;
+        if (sps.crop_left < 0 || sps.crop_right < 0 || sps.crop_top < 0 || sps.crop_bottom < 0 ||
+            sps.crop_left + sps.crop_right >= sps.pic_width_in_mbs * 16 ||
+            sps.crop_top + sps.crop_bottom >= sps.pic_height_in_map_units * (2 - sps.frame_mbs_only_flag) * 16)
+            sps.crop_left = sps.crop_right = sps.crop_top = sps.crop_bottom = 0;
+    }
+
+    if (ffnv_br_overread(&br))
+        return -1;
+
+    sps.video_format             = 5;
+    sps.colour_primaries         = 2;
+    sps.transfer_characteristics = 2;
+    sps.matrix_coefficients      = 2;
+    sps.max_num_reorder_frames   = -1;
+    if (ffnv_br_get_bit(&br))
+        ffnv_h264_vui(&br, &sps);
+
+    if (sps.max_num_reorder_frames < 0) {
+        /* intra-only profiles never reorder */
+        if ((sps.profile_idc == 44 || sps.profile_idc == 86 || sps.profile_idc == 100 ||
+             sps.profile_idc == 110 || sps.profile_idc == 122 || sps.profile_idc == 244) &&
+            sps.constraint_flags & 0x10)
+            sps.max_num_reorder_frames = 0;
+        else
+            sps.max_num_reorder_frames = ffnv_h264_max_dpb_frames(&sps);
+    }
+
+    if (!p->sps[id]) {
+        p->sps[id] = (FFNVH264SPS*)malloc(sizeof(sps));
+        if (!p->sps[id])
+            return -1;
+    }
+    *p->sps[id] = sps;
+    return 0;
+}
+
+static inline int ffnv_h264_parse_pps(FFNVH264Parser *p, const uint8_t *nal, size_t size)
+{
+    FFNVBitReader br;
+    FFNVH264PPS pps;
+    const FFNVH264SPS *sps;
+    uint32_t id;
+    int i;
+
+    if (ffnv_h264_load_rbsp(p, &br, nal, size, size) < 0)
+        return -1;
+
+    memset(&pps, 0, sizeof(pps));
+    id         = ffnv_br_get_ue(&br);
+    pps.sps_id = (int)ffnv_br_get_ue(&br);
+    if (id >= FFNV_H264_MAX_PPS || pps.sps_id < 0 || pps.sps_id >= FFNV_H264_MAX_SPS ||
+        !p->sps[pps.sps_id])
+        return -1;
+    sps = p->sps[pps.sps_id];
+
+    pps.entropy_coding_mode_flag                     = ffnv_br_get_bit(&br);
+    pps.bottom_field_pic_order_in_frame_present_flag = ffnv_br_get_bit(&br);
+    pps.num_slice_groups_minus1                      = (int)ffnv_br_get_ue(&br);
+    if (pps.num_slice_groups_minus1 < 0 || pps.num_slice_groups_minus1 > 7)
+        return -1;
+
+    if (pps.num_slice_groups_minus1 > 0) {
+        pps.slice_group_map_type = (int)ffnv_br_get_ue(&br);
+        switch (pps.slice_group_map_type) {
+        case 0:
+            for (i = 0; i <= pps.num_slice_groups_minus1; i++)
+                ffnv_br_get_ue(&br);
+            break;
+        case 2:
+            for (i = 0; i < pps.num_slice_groups_minus1; i++) {
+                ffnv_br_get_ue(&br);
+                ffnv_br_get_ue(&br);
+            }
+            break;
+        case 3: case 4: case 5:
+            ffnv_br_skip(&br, 1);
+            pps.slice_group_change_rate_minus1 = (int)ffnv_br_get_ue(&br);
+            break;
+        case 6: {
+            uint32_t n = ffnv_br_get_ue(&br) + 1;
+            int bits = 0;
+
+            while ((1 << bits) < pps.num_slice_groups_minus1 + 1)
+                bits++;
+            if (!n || n > 1024 * 1024)
+                return -1;
+            ffnv_br_skip(&br, (size_t)n * bits);
+            break;
+        }
+        }
+    }
+
+    pps.num_ref_idx_default_active_minus1[0] = (int)ffnv_br_get_ue(&br);
+    pps.num_ref_idx_default_active_minus1[1] = (int)ffnv_br_get_ue(&br);
+    if (pps.num_ref_idx_default_active_minus1[0] < 0 || pps.num_ref_idx_default_active_minus1[0] > 31 ||
+        pps.num_ref_idx_default_active_minus1[1] < 0 || pps.num_ref_idx_default_active_minus1[1] > 31)
+        return -1;
+
+    pps.weighted_pred_flag                     = ffnv_br_get_bit(&br);
+    pps.weighted_bipred_idc                    = (int)ffnv_br_get_bits(&br, 2);
+    pps.pic_init_qp_minus26                    = ffnv_br_get_se(&br);
+    pps.pic_init_qs_minus26                    = ffnv_br_get_se(&br);
+    pps.chroma_qp_index_offset                 = ffnv_br_get_se(&br);
+    pps.deblocking_filter_control_present_flag = ffnv_br_get_bit(&br);
+    pps.constrained_intra_pred_flag            = ffnv_br_get_bit(&br);
+    pps.redundant_pic_cnt_present_flag         = ffnv_br_get_bit(&br);
+    pps.second_chroma_qp_index_offset          = pps.chroma_qp_index_offset;
+
+    if (ffnv_br_more_rbsp_data(&br)) {
+        pps.transform_8x8_mode_flag         = ffnv_br_get_bit(&br);
+        pps.pic_scaling_matrix_present_flag = ffnv_br_get_bit(&br);
+        if (pps.pic_scaling_matrix_present_flag) {
+            int n = 6 + (sps->chroma_format_idc != 3 ? 2 : 6) * pps.transform_8x8_mode_flag;
+
+            for (i = 0; i < n; i++) {
+                if (ffnv_br_get_bit(&br))
+                    pps.scaling_list_present[i] =
+                        i < 6 ? ffnv_h264_scaling_list(&br, pps.scaling4x4[i], 16)
+                              : ffnv_h264_scaling_list(&br, pps.scaling8x8[i - 6], 64);
+            }
+        }
+        pps.second_chroma_qp_index_offset = ffnv_br_get_se(&br);
+    }
+
+    if (ffnv_br_overread(&br))
+        return -1;
+
+    if (!p->pps[id]) {
+        p->pps[id] = (FFNVH264PPS*)malloc(sizeof(pps));
+        if (!p->pps[id])
+            return -1;
+    }
+    *p->pps[id] = pps;
+    return 0;
+}
+
+static inline int ffnv_h264_skip_ref_list_modification(FFNVBitReader *br)
+{
+    int i;
+
+    if (!ffnv_br_get_bit(br))
+        return 0;
+
+    for (i = 0; i <= 32; i++) {
+        uint32_t idc = ffnv_br_get_ue(br);
+
+        if (idc == 3)
+            return 0;
+        if (idc > 5)
+            return -1;
+        ffnv_br_get_ue(br);
+    }
+    return -1;
+}
+
+static inline void ffnv_h264_skip_pred_weight_table(FFNVBitReader *br, const FFNVH264SPS *sps,
+                                                    const FFNVH264SliceHeader *sh)
+{
+    int chroma = !sps->separate_colour_plane_flag && sps->chroma_format_idc;
+    int list, i;
+
+    ffnv_br_get_ue(br);
+    if (chroma)
+        ffnv_br_get_ue(br);
+
+    for (list = 0; list < (sh->slice_type == 1 ? 2 : 1); list++) {
+        for (i = 0; i <= sh->num_ref_idx_active_minus1[list]; i++) {
+            if (ffnv_br_get_bit(br)) {
+                ffnv_br_get_se(br);
+                ffnv_br_get_se(br);
+            }
+            if (chroma && ffnv_br_get_bit(br)) {
+                ffnv_br_get_se(br);
+                ffnv_br_get_se(br);
+                ffnv_br_get_se(br);
+                ffnv_br_get_se(br);
+            }
+        }
+    }
+}
+
+/* Parse a slice header up to and including dec_ref_pic_marking(). */
+static inline int ffnv_h264_parse_slice_header(FFNVH264Parser *p, const uint8_t *nal, size_t size,
+                                               FFNVH264SliceHeader *sh)
+{
+    const FFNVH264SPS *sps;
+    const FFNVH264PPS *pps;
+    FFNVBitReader br;
+    uint32_t v;
+
+    if (ffnv_h264_load_rbsp(p, &br, nal, size, FFNV_H264_SLICE_HEADER_SIZE) < 0)
+        return -1;
+
+    sh->nal_unit_type     = nal[0] & 0x1f;
+    sh->nal_ref_idc       = nal[0] >> 5 & 3;
+    sh->first_mb_in_slice = (int)ffnv_br_get_ue(&br);
+
+    v = ffnv_br_get_ue(&br);
+    if (v > 9)
+        return -1;
+    sh->slice_type = (int)(v % 5);
+
+    v = ffnv_br_get_ue(&br);
+    if (v >= FFNV_H264_MAX_PPS || !p->pps[v])
+        return -1;
+    sh->pps_id = (int)v;
+
+    pps = p->pps[sh->pps_id];
+    sps = p->sps[pps->sps_id];
+    if (!sps)
+        return -1;
+    if (sh->nal_unit_type == 5 && sh->slice_type != 2 && sh->slice_type != 4)
+        return -1;
+
+    if (sps->separate_colour_plane_flag)
+        ffnv_br_skip(&br, 2);
+    sh->frame_num = (int)ffnv_br_get_bits(&br, sps->log2_max_frame_num_minus4 + 4);
+
+    sh->field_pic_flag    = 0;
+    sh->bottom_field_flag = 0;
+    if (!sps->frame_mbs_only_flag) {
+        sh->field_pic_flag = ffnv_br_get_bit(&br);
+        if (sh->field_pic_flag)
+            sh->bottom_field_flag = ffnv_br_get_bit(&br);
+    }
+
+    sh->idr_pic_id = sh->nal_unit_type == 5 ? (int)ffnv_br_get_ue(&br) : 0;
+
+    sh->pic_order_cnt_lsb          = 0;
+    sh->delta_pic_order_cnt_bottom = 0;
+    sh->delta_pic_order_cnt[0]     = 0;
+    sh->delta_pic_order_cnt[1]     = 0;
+    if (sps->pic_order_cnt_type == 0) {
+        sh->pic_order_cnt_lsb = (int)ffnv_br_get_bits(&br, sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+        if (pps->bottom_field_pic_order_in_frame_present_flag && !sh->field_pic_flag)
+            sh->delta_pic_order_cnt_bottom = ffnv_br_get_se(&br);
+    } else if (sps->pic_order_cnt_type == 1 && !sps->delta_pic_order_always_zero_flag) {
+        sh->delta_pic_order_cnt[0] = ffnv_br_get_se(&br);
+        if (pps->bottom_field_pic_order_in_frame_present_flag && !sh->field_pic_flag)
+            sh->delta_pic_order_cnt[1] = ffnv_br_get_se(&br);
+    }
+
+    sh->redundant_pic_cnt = pps->redundant_pic_cnt_present_flag ? (int)ffnv_br_get_ue(&br) : 0;
+
+    if (sh->slice_type == 1)
+        ffnv_br_skip(&br, 1);
+
+    sh->num_ref_idx_active_minus1[0] = pps->num_ref_idx_default_active_minus1[0];
+    sh->num_ref_idx_active_minus1[1] = pps->num_ref_idx_default_active_minus1[1];
+    if (sh->slice_type == 0 || sh->slice_type == 1 || sh->slice_type == 3) {
+        if (ffnv_br_get_bit(&br)) {
+            sh->num_ref_idx_active_minus1[0] = (int)ffnv_br_get_ue(&br);
+            if (sh->slice_type == 1)
+                sh->num_ref_idx_active_minus1[1] = (int)ffnv_br_get_ue(&br);
+        }
+        if (sh->num_ref_idx_active_minus1[0] < 0 || sh->num_ref_idx_active_minus1[0] > 31 ||
+            sh->num_ref_idx_active_minus1[1] < 0 || sh->num_ref_idx_active_minus1[1] > 31)
+            return -1;
+    }
+
+    if (sh->slice_type != 2 && sh->slice_type != 4) {
+        if (ffnv_h264_skip_ref_list_modification(&br) < 0)
+            return -1;
+        if (sh->slice_type == 1 && ffnv_h264_skip_ref_list_modification(&br) < 0)
+            return -1;
+    }
+
+    if ((pps->weighted_pred_flag && (sh->slice_type == 0 || sh->slice_type == 3)) ||
+        (pps->weighted_bipred_idc == 1 && sh->slice_type == 1))
+        ffnv_h264_skip_pred_weight_table(&br, sps, sh);
+
+    sh->no_output_of_prior_pics_flag       = 0;
+    sh->long_term_reference_flag           = 0;
+    sh->adaptive_ref_pic_marking_mode_flag = 0;
+    sh->nb_mmco                            = 0;
+    if (sh->nal_ref_idc) {
+        if (sh->nal_unit_type == 5) {
+            sh->no_output_of_prior_pics_flag = ffnv_br_get_bit(&br);
+            sh->long_term_reference_flag     = ffnv_br_get_bit(&br);
+        } else {
+            sh->adaptive_ref_pic_marking_mode_flag = ffnv_br_get_bit(&br);
+            while (sh->adaptive_ref_pic_marking_mode_flag) {
+                FFNVH264MMCO *m = &sh->mmco[sh->nb_mmco];
+
+                m->op = (int)ffnv_br_get_ue(&br);
+                if (!m->op)
+                    break;
+                if (m->op > 6 || sh->nb_mmco == FFNV_H264_MAX_MMCO - 1)
+                    return -1;
+
+                m->pic_num = m->lt_idx = 0;
+                if (m->op == 1 || m->op == 2 || m->op == 3)
+                    m->pic_num = (int)ffnv_br_get_ue(&br);
+                if (m->op == 3 || m->op == 4 || m->op == 6)
+                    m->lt_idx = (int)ffnv_br_get_ue(&br);
+                if (ffnv_br_overread(&br))
+                    return -1;
+                sh->nb_mmco++;
+            }
+        }
+    }
+
+    return ffnv_br_overread(&br) ? -1 : 0;
+}
+
+
+static inline int ffnv_h264_max_frame_num(const FFNVH264SPS *sps)
+{
+    return 1 << (sps->log2_max_frame_num_minus4 + 4);
+}
+
+static inline int ffnv_h264_frame_num_wrap(const FFNVH264Parser *p, const FFNVH264Ref *r, int frame_num)
+{
+    return r->frame_num > frame_num ? r->frame_num - ffnv_h264_max_frame_num(p->cur_sps) : r->frame_num;
+}
+
+static inline void ffnv_h264_remove_unused_refs(FFNVH264Parser *p)
+{
+    int i, n = 0;
+
+    for (i = 0; i < p->nb_refs; i++) {
+        if (p->refs[i].short_ref || p->refs[i].long_ref)
+            p->refs[n++] = p->refs[i];
+    }
+    p->nb_refs = n;
+}
+
+/* Surfaces used for reference, plus an unpaired first field not queued for display yet. */
+static inline void ffnv_h264_update_busy(FFNVH264Parser *p)
+{
+    int i;
+
+    p->pool.busy_ref = 0;
+    for (i = 0; i < p->nb_refs; i++)
+        ffnv_pool_set_ref(&p->pool, p->refs[i].pic_idx, 1);
+    ffnv_pool_set_ref(&p->pool, p->field_idx, 1);
+}
+
+/*
+ * Sliding window marking (8.2.5.3) down to fewer than max_refs frames.
+ * Long-term frames are only dropped when the DPB is full, which does not
+ * happen with conforming streams.
+ */
+static inline void ffnv_h264_sliding_window(FFNVH264Parser *p, int max_refs, int frame_num)
+{
+    while (p->nb_refs >= max_refs) {
+        int i, oldest = -1;
+
+        for (i = 0; i < p->nb_refs; i++) {
+            if (p->refs[i].short_ref &&
+                (oldest < 0 || ffnv_h264_frame_num_wrap(p, &p->refs[i], frame_num) <
+                               ffnv_h264_frame_num_wrap(p, &p->refs[oldest], frame_num)))
+                oldest = i;
+        }
+        if (oldest < 0) {
+            if (p->nb_refs < FFNV_H264_MAX_REFS)
+                return;
+            oldest = 0;
+            p->refs[0].long_ref = 0;
+        }
+
+        p->refs[oldest].short_ref = 0;
+        ffnv_h264_remove_unused_refs(p);
+    }
+}
+
+/* Insert the frames skipped by a frame_num gap as non-existing references (8.2.5.2). */
+static inline void ffnv_h264_fill_gaps(FFNVH264Parser *p)
+{
+    const int max_frame_num = ffnv_h264_max_frame_num(p->cur_sps);
+    const int max_refs = p->cur_sps->max_num_ref_frames > 1 ? p->cur_sps->max_num_ref_frames : 1;
+    int unused = (p->prev_ref_frame_num + 1) % max_frame_num;
+
+    if (p->sh.frame_num == p->prev_ref_frame_num)
+        return;
+
+    for (; unused != p->sh.frame_num; unused = (unused + 1) % max_frame_num) {
+        FFNVH264Ref *r;
+
+        ffnv_h264_sliding_window(p, max_refs, unused);
+
+        r = &p->refs[p->nb_refs++];
+        memset(r, 0, sizeof(*r));
+        r->pic_idx      = -1;
+        r->frame_num    = unused;
+        r->short_ref    = 3;
+        r->not_existing = 1;
+
+        if (unused < p->prev_frame_num)
+            p->prev_frame_num_offset += max_frame_num;
+        p->prev_frame_num     = unused;
+        p->prev_ref_frame_num = unused;
+    }
+}
+
+/* Picture order count of the current picture (8.2.1). */
+static inline void ffnv_h264_compute_poc(FFNVH264Parser *p)
+{
+    const FFNVH264SPS *sps = p->cur_sps;
+    const FFNVH264SliceHeader *sh = &p->sh;
+    const int idr = sh->nal_unit_type == 5;
+    int offset = 0, top, bottom, i;
+
+    if (!idr) {
+        offset = p->prev_frame_num_offset;
+        if (p->prev_frame_num > sh->frame_num)
+            offset += ffnv_h264_max_frame_num(sps);
+    }
+    p->frame_num_offset = offset;
+
+    if (sps->pic_order_cnt_type == 0) {
+        const int max_lsb  = 1 << (sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+        const int prev_msb = idr ? 0 : p->prev_poc_msb;
+        const int prev_lsb = idr ? 0 : p->prev_poc_lsb;
+        const int lsb      = sh->pic_order_cnt_lsb;
+
+        if (lsb < prev_lsb && prev_lsb - lsb >= max_lsb / 2)
+            p->poc_msb = prev_msb + max_lsb;
+        else if (lsb > prev_lsb && lsb - prev_lsb > max_lsb / 2)
+            p->poc_msb = prev_msb - max_lsb;
+        else
+            p->poc_msb = prev_msb;
+
+        top    = p->poc_msb + lsb;
+        bottom = sh->field_pic_flag ? top : top + sh->delta_pic_order_cnt_bottom;
+    } else if (sps->pic_order_cnt_type == 1) {
+        const int n = sps->num_ref_frames_in_pic_order_cnt_cycle;
+        int abs_frame_num = n ? offset + sh->frame_num : 0;
+        int expected = 0;
+
+        if (!sh->nal_ref_idc && abs_frame_num > 0)
+            abs_frame_num--;
+        if (abs_frame_num > 0) {
+            int delta_per_cycle = 0;
+
+            for (i = 0; i < n; i++)
+                delta_per_cycle += sps->offset_for_ref_frame[i];
+            expected = (abs_frame_num - 1) / n * delta_per_cycle;
+            for (i = 0; i <= (abs_frame_num - 1) % n; i++)
+                expected += sps->offset_for_ref_frame[i];
+        }
+        if (!sh->nal_ref_idc)
+            expected += sps->offset_for_non_ref_pic;
+
+        top    = expected + sh->delta_pic_order_cnt[0];
+        bottom = sh->field_pic_flag ? top + sps->offset_for_top_to_bottom_field
+                                    : top + sps->offset_for_top_to_bottom_field + sh->delta_pic_order_cnt[1];
+    } else {
+        top    = idr ? 0 : 2 * (offset + sh->frame_num) - !sh->nal_ref_idc;
+        bottom = top;
+    }
+
+    if (!sh->field_pic_flag) {
+        p->poc[0] = top;
+        p->poc[1] = bottom;
+    } else {
+        /* the other parity is the first field of the pair, if any */
+        p->poc[sh->bottom_field_flag]  = sh->bottom_field_flag ? bottom : top;
+        p->poc[!sh->bottom_field_flag] = p->second_field ? p->field_poc : 0;
+    }
+}
+
+/* Reference matching picNumX, or LongTermPicNum if long_term is set; *fields gets the matching field mask. */
+static inline int ffnv_h264_find_pic(const FFNVH264Parser *p, int pic_num, int long_term, int *fields)
+{
+    const FFNVH264SliceHeader *sh = &p->sh;
+    const int parity = sh->bottom_field_flag ? 2 : 1;
+    int i, f;
+
+    for (i = 0; i < p->nb_refs; i++) {
+        const FFNVH264Ref *r = &p->refs[i];
+        int mask = long_term ? r->long_ref : r->short_ref;
+        int n    = long_term ? r->long_term_frame_idx : ffnv_h264_frame_num_wrap(p, r, sh->frame_num);
+
+        if (!sh->field_pic_flag) {
+            if (mask == 3 && n == pic_num) {
+                *fields = 3;
+                return i;
+            }
+            continue;
+        }
+
+        for (f = 1; f <= 2; f++) {
+            if (mask & f && 2 * n + (f == parity) == pic_num) {
+                *fields = f;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+static inline void ffnv_h264_unmark_long_term_idx(FFNVH264Parser *p, int idx, int keep)
+{
+    int i;
+
+    for (i = 0; i < p->nb_refs; i++) {
+        if (i != keep && p->refs[i].long_ref && p->refs[i].long_term_frame_idx == idx)
+            p->refs[i].long_ref = 0;
+    }
+}
+
+/*
+ * Decoded reference picture marking (8.2.5) for the current picture.
+ * Returns 1 if the picture had a memory_management_control_operation 5.
+ */
+static inline int ffnv_h264_mark(FFNVH264Parser *p)
+{
+    const FFNVH264SliceHeader *sh = &p->sh;
+    const int field = sh->field_pic_flag ? 1 << sh->bottom_field_flag : 3;
+    int cur = -1, long_term_idx = -1, mmco5 = 0, fields, i, j;
+    FFNVH264Ref *r;
+
+    if (!sh->nal_ref_idc)
+        return 0;
+
+    for (i = 0; p->second_field && i < p->nb_refs; i++) {
+        if (p->refs[i].pic_idx == p->cur_idx)
+            cur = i;
+    }
+
+    if (sh->nal_unit_type == 5) {
+        p->max_long_term_frame_idx = sh->long_term_reference_flag ? 0 : -1;
+        if (sh->long_term_reference_flag)
+            long_term_idx = 0;
+    } else if (sh->adaptive_ref_pic_marking_mode_flag) {
+        const int curr_pic_num = sh->field_pic_flag ? 2 * sh->frame_num + 1 : sh->frame_num;
+
+        for (j = 0; j < sh->nb_mmco; j++) {
+            const FFNVH264MMCO *m = &sh->mmco[j];
+
+            switch (m->op) {
+            case 1:
+                i = ffnv_h264_find_pic(p, curr_pic_num - (m->pic_num + 1), 0, &fields);
+                if (i >= 0)
+                    p->refs[i].short_ref &= ~fields;
+                break;
+            case 2:
+                i = ffnv_h264_find_pic(p, m->pic_num, 1, &fields);
+                if (i >= 0)
+                    p->refs[i].long_ref &= ~fields;
+                break;
+            case 3:
+                i = ffnv_h264_find_pic(p, curr_pic_num - (m->pic_num + 1), 0, &fields);
+                if (i < 0)
+                    break;
+                ffnv_h264_unmark_long_term_idx(p, m->lt_idx, i);
+                if (p->refs[i].long_term_frame_idx != m->lt_idx)
+                    p->refs[i].long_ref = 0;
+                p->refs[i].short_ref          &= ~fields;
+                p->refs[i].long_ref           |= fields;
+                p->refs[i].long_term_frame_idx = m->lt_idx;
+                break;
+            case 4:
+                for (i = 0; i < p->nb_refs; i++) {
+                    if (p->refs[i].long_ref && p->refs[i].long_term_frame_idx >= m->lt_idx)
+                        p->refs[i].long_ref = 0;
+                }
+                p->max_long_term_frame_idx = m->lt_idx - 1;
+                break;
+            case 5:
+                for (i = 0; i < p->nb_refs; i++)
+                    p->refs[i].short_ref = p->refs[i].long_ref = 0;
+                p->max_long_term_frame_idx = -1;
+                mmco5 = 1;
+                break;
+            case 6:
+                ffnv_h264_unmark_long_term_idx(p, m->lt_idx, cur);
+                long_term_idx = m->lt_idx;
+                break;
+            }
+        }
+    } else if (cur < 0) {
+        ffnv_h264_sliding_window(p, p->cur_sps->max_num_ref_frames > 1 ? p->cur_sps->max_num_ref_frames : 1,
+                                 sh->frame_num);
+    }
+
+    ffnv_h264_remove_unused_refs(p);
+
+    if (mmco5) {
+        /* the picture is inferred to have had frame_num 0 and its POC relative to itself */
+        int temp = !sh->field_pic_flag ? (p->poc[0] < p->poc[1] ? p->poc[0] : p->poc[1])
+                                       : p->poc[sh->bottom_field_flag];
+        p->poc[0] -= temp;
+        p->poc[1] -= temp;
+        p->epoch++;
+    }
+
+    /* the first field of the pair may have moved or been unmarked */
+    cur = -1;
+    for (i = 0; p->second_field && !mmco5 && i < p->nb_refs; i++) {
+        if (p->refs[i].pic_idx == p->cur_idx)
+            cur = i;
+    }
+
+    if (cur < 0) {
+        ffnv_h264_sliding_window(p, FFNV_H264_MAX_REFS, sh->frame_num);
+        cur = p->nb_refs++;
+        r = &p->refs[cur];
+        memset(r, 0, sizeof(*r));
+        r->pic_idx   = p->cur_idx;
+        r->frame_num = mmco5 ? 0 : sh->frame_num;
+    }
+
+    r = &p->refs[cur];
+    r->poc[0] = p->poc[0];
+    r->poc[1] = p->poc[1];
+    if (long_term_idx >= 0) {
+        r->long_ref           |= field;
+        r->long_term_frame_idx = long_term_idx;
+    } else {
+        r->short_ref |= field;
+    }
+
+    return mmco5;
+}
+
+static inline int ffnv_h264_sps_changed(const FFNVH264SPS *a, const FFNVH264SPS *b)
+{
+    return a->pic_width_in_mbs        != b->pic_width_in_mbs        ||
+           a->pic_height_in_map_units != b->pic_height_in_map_units ||
+           a->frame_mbs_only_flag     != b->frame_mbs_only_flag     ||
+           a->chroma_format_idc       != b->chroma_format_idc       ||
+           a->bit_depth_luma_minus8   != b->bit_depth_luma_minus8   ||
+           a->bit_depth_chroma_minus8 != b->bit_depth_chroma_minus8 ||
+           a->max_num_ref_frames      != b->max_num_ref_frames      ||
+           a->max_num_reorder_frames  != b->max_num_reorder_frames  ||
+           a->crop_left  != b->crop_left  || a->crop_right  != b->crop_right ||
+           a->crop_top   != b->crop_top   || a->crop_bottom != b->crop_bottom;
+}
+
+/* Queue an unpaired first field for display. */
+static inline void ffnv_h264_queue_field(FFNVH264Parser *p)
+{
+    CUVIDPARSERDISPINFO disp;
+
+    if (p->field_idx < 0)
+        return;
+
+    memset(&disp, 0, sizeof(disp));
+    disp.picture_index      = p->field_idx;
+    disp.top_field_first    = !p->field_bottom;
+    disp.repeat_first_field = -1;
+    disp.timestamp          = p->field_timestamp;
+    ffnv_pool_queue(&p->pool, p->field_order, &disp);
+
+    p->field_idx = -1;
+    ffnv_h264_update_busy(p);
+}
+
+static inline void ffnv_h264_resolve_scaling(FFNVH264Parser *p)
+{
+    const FFNVH264SPS *sps = p->cur_sps;
+    const FFNVH264PPS *pps = p->cur_pps;
+    const uint8_t *fb[4] = {
+        ffnv_h264_default_scaling4[0], ffnv_h264_default_scaling4[1],
+        ffnv_h264_default_scaling8[0], ffnv_h264_default_scaling8[1],
+    };
+
+    if (!pps->pic_scaling_matrix_present_flag) {
+        memcpy(p->scaling4x4, sps->scaling4x4, sizeof(p->scaling4x4));
+        memcpy(p->scaling8x8, sps->scaling8x8, sizeof(p->scaling8x8));
+        return;
+    }
+
+    if (sps->seq_scaling_matrix_present_flag) {
+        fb[0] = sps->scaling4x4[0];
+        fb[1] = sps->scaling4x4[3];
+        fb[2] = sps->scaling8x8[0];
+        fb[3] = sps->scaling8x8[1];
+    }
+
+    memcpy(p->scaling4x4, pps->scaling4x4, sizeof(p->scaling4x4));
+    memcpy(p->scaling8x8, pps->scaling8x8, sizeof(p->scaling8x8));
+    ffnv_h264_scaling_fallback(p->scaling4x4, p->scaling8x8, pps->scaling_list_present, fb);
+}
+
+/* Whether an SEI NAL unit holds a recovery point message. */
+static inline int ffnv_h264_sei_recovery(FFNVH264Parser *p, const uint8_t *nal, size_t size)
+{
+    FFNVBitReader br;
+    uint32_t type, len, b;
+
+    if (ffnv_h264_load_rbsp(p, &br, nal, size, FFNV_H264_SLICE_HEADER_SIZE) < 0)
+        return 0;
+
+    while (ffnv_br_more_rbsp_data(&br)) {
+        type = len = 0;
+        do {
+            b = ffnv_br_get_bits(&br, 8);
+            type += b;
+        } while (b == 0xff && !ffnv_br_overread(&br));
+        do {
+            b = ffnv_br_get_bits(&br, 8);
+            len += b;
+        } while (b == 0xff && !ffnv_br_overread(&br));
+
+        if (ffnv_br_overread(&br))
+            return 0;
+        if (type == 6)
+            return 1;
+        ffnv_br_skip(&br, (size_t)len * 8);
+    }
+    return 0;
+}
+
+/* Set up the picture of the first slice in p->sh. */
+static inline int ffnv_h264_start_picture(FFNVH264Parser *p, int64_t timestamp)
+{
+    const FFNVH264SliceHeader *sh = &p->sh;
+    const FFNVH264PPS *pps = p->pps[sh->pps_id];
+    const FFNVH264SPS *sps = p->sps[pps->sps_id];
+    int second_field, idx = -1;
+
+    if (!p->has_active_sps || ffnv_h264_sps_changed(&p->active_sps, sps)) {
+        ffnv_h264_queue_field(p);
+        p->active_sps     = *sps;
+        p->has_active_sps = 1;
+        p->reorder        = sps->max_num_reorder_frames;
+        p->draining       = 1;
+        return FFNV_PARSE_SEQUENCE;
+    }
+
+    second_field = p->field_idx >= 0 && sh->field_pic_flag && sh->nal_unit_type != 5 &&
+                   sh->bottom_field_flag != p->field_bottom &&
+                   sh->frame_num == p->field_frame_num;
+
+    if (!second_field) {
+        ffnv_h264_queue_field(p);
+        idx = ffnv_pool_get_free(&p->pool);
+        if (idx < 0)
+            return FFNV_PARSE_AGAIN;
+    }
+
+    p->draining     = 0;
+    p->cur_sps      = sps;
+    p->cur_pps      = pps;
+    p->second_field = second_field;
+    p->cur_idx      = second_field ? p->field_idx : idx;
+    p->timestamp    = timestamp;
+
+    if (sh->nal_unit_type == 5) {
+        p->nb_refs = 0;
+        p->epoch++;
+        p->active_sps = *sps;
+    } else if (!p->random_access) {
+        /* starting at a recovery point: no references, no frame_num gap */
+        p->nb_refs            = 0;
+        p->epoch++;
+        p->prev_frame_num     = sh->frame_num;
+        p->prev_ref_frame_num = sh->frame_num;
+    } else if (!second_field) {
+        ffnv_h264_fill_gaps(p);
+    }
+    p->random_access  = 1;
+    p->recovery_point = 0;
+
+    ffnv_h264_compute_poc(p);
+    ffnv_h264_resolve_scaling(p);
+    return 0;
+}
+
+/* Point pic at the slices, copying them only if they are not contiguous in the access unit. */
+static inline int ffnv_h264_slice_data(FFNVH264Parser *p, const uint8_t *au, CUVIDPICPARAMS *pic)
+{
+    const FFNVH264SliceRange *s = p->slices;
+    size_t total = 0, pos = 0;
+    int i, contiguous = 1;
+
+    if (ffnv_parse_grow((void**)&p->slice_offsets, &p->slice_offsets_size,
+                        p->nb_slices, sizeof(*p->slice_offsets)) < 0)
+        return FFNV_PARSE_ERROR;
+
+    for (i = 0; i < p->nb_slices; i++) {
+        total += s[i].end - s[i].start;
+        if (i && s[i].start != s[i - 1].end)
+            contiguous = 0;
+    }
+    if (total > 0x7fffffff)
+        return FFNV_PARSE_ERROR;
+
+    if (contiguous) {
+        for (i = 0; i < p->nb_slices; i++)
+            p->slice_offsets[i] = (unsigned int)(s[i].start - s[0].start);
+        pic->pBitstreamData = au + s[0].start;
+    } else {
+        if (ffnv_parse_grow((void**)&p->bitstream, &p->bitstream_size, (int)total, 1) < 0)
+            return FFNV_PARSE_ERROR;
+        for (i = 0; i < p->nb_slices; i++) {
+            p->slice_offsets[i] = (unsigned int)pos;
+            memcpy(p->bitstream + pos, au + s[i].start, s[i].end - s[i].start);
+            pos += s[i].end - s[i].start;
+        }
+        pic->pBitstreamData = p->bitstream;
+    }
+
+    pic->nBitstreamDataLen = (unsigned int)total;
+    pic->nNumSlices        = (unsigned int)p->nb_slices;
+    pic->pSliceDataOffsets = p->slice_offsets;
+    return 0;
+}
+
+static inline void ffnv_h264_fill_pic_params(const FFNVH264Parser *p, int intra, CUVIDPICPARAMS *pic)
+{
+    const FFNVH264SPS *sps = p->cur_sps;
+    const FFNVH264PPS *pps = p->cur_pps;
+    const FFNVH264SliceHeader *sh = &p->sh;
+    CUVIDH264PICPARAMS *h = &pic->CodecSpecific.h264;
+    int i, j, lt, n = 0;
+
+    pic->PicWidthInMbs     = sps->pic_width_in_mbs;
+    pic->FrameHeightInMbs  = (2 - sps->frame_mbs_only_flag) * sps->pic_height_in_map_units;
+    pic->CurrPicIdx        = p->cur_idx;
+    pic->field_pic_flag    = sh->field_pic_flag;
+    pic->bottom_field_flag = sh->bottom_field_flag;
+    pic->second_field      = p->second_field;
+    pic->ref_pic_flag      = sh->nal_ref_idc != 0;
+    pic->intra_pic_flag    = intra;
+
+    h->log2_max_frame_num_minus4            = sps->log2_max_frame_num_minus4;
+    h->pic_order_cnt_type                   = sps->pic_order_cnt_type;
+    h->log2_max_pic_order_cnt_lsb_minus4    = sps->log2_max_pic_order_cnt_lsb_minus4;
+    h->delta_pic_order_always_zero_flag     = sps->delta_pic_order_always_zero_flag;
+    h->frame_mbs_only_flag                  = sps->frame_mbs_only_flag;
+    h->direct_8x8_inference_flag            = sps->direct_8x8_inference_flag;
+    h->num_ref_frames                       = sps->max_num_ref_frames;
+    h->residual_colour_transform_flag       = (unsigned char)sps->separate_colour_plane_flag;
+    h->bit_depth_luma_minus8                = (unsigned char)sps->bit_depth_luma_minus8;
+    h->bit_depth_chroma_minus8              = (unsigned char)sps->bit_depth_chroma_minus8;
+    h->qpprime_y_zero_transform_bypass_flag = (unsigned char)sps->qpprime_y_zero_transform_bypass_flag;
+
+    h->entropy_coding_mode_flag               = pps->entropy_coding_mode_flag;
+    h->pic_order_present_flag                 = pps->bottom_field_pic_order_in_frame_present_flag;
+    h->num_ref_idx_l0_active_minus1           = pps->num_ref_idx_default_active_minus1[0];
+    h->num_ref_idx_l1_active_minus1           = pps->num_ref_idx_default_active_minus1[1];
+    h->weighted_pred_flag                     = pps->weighted_pred_flag;
+    h->weighted_bipred_idc                    = pps->weighted_bipred_idc;
+    h->pic_init_qp_minus26                    = pps->pic_init_qp_minus26;
+    h->deblocking_filter_control_present_flag = pps->deblocking_filter_control_present_flag;
+    h->redundant_pic_cnt_present_flag         = pps->redundant_pic_cnt_present_flag;
+    h->transform_8x8_mode_flag                = pps->transform_8x8_mode_flag;
+    h->MbaffFrameFlag                         = sps->mb_adaptive_frame_field_flag && !sh->field_pic_flag;
+    h->constrained_intra_pred_flag            = pps->constrained_intra_pred_flag;
+    h->chroma_qp_index_offset                 = pps->chroma_qp_index_offset;
+    h->second_chroma_qp_index_offset          = pps->second_chroma_qp_index_offset;
+    h->ref_pic_flag                           = sh->nal_ref_idc != 0;
+    h->frame_num                              = sh->frame_num;
+    h->CurrFieldOrderCnt[0]                   = p->poc[0];
+    h->CurrFieldOrderCnt[1]                   = p->poc[1];
+
+    /* short-term references first, then long-term ones */
+    for (lt = 0; lt < 2; lt++) {
+        for (i = 0; i < p->nb_refs; i++) {
+            const FFNVH264Ref *r = &p->refs[i];
+            CUVIDH264DPBENTRY *e;
+
+            if (!r->long_ref != !lt)
+                continue;
+
+            e = &h->dpb[n++];
+            e->PicIdx             = r->pic_idx;
+            e->FrameIdx           = lt ? r->long_term_frame_idx : r->frame_num;
+            e->is_long_term       = lt;
+            e->not_existing       = r->not_existing;
+            e->used_for_reference = r->short_ref | r->long_ref;
+            e->FieldOrderCnt[0]   = r->poc[0];
+            e->FieldOrderCnt[1]   = r->poc[1];
+        }
+    }
+    for (; n < 16; n++)
+        h->dpb[n].PicIdx = -1;
+
+    for (i = 0; i < 6; i++) {
+        for (j = 0; j < 16; j++)
+            h->WeightScale4x4[i][ffnv_h264_zigzag4x4[j]] = p->scaling4x4[i][j];
+    }
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 64; j++)
+            h->WeightScale8x8[i][ffnv_h264_zigzag8x8[j]] = p->scaling8x8[i][j];
+    }
+
+    h->fmo_aso_enable                 = pps->num_slice_groups_minus1 > 0;
+    h->num_slice_groups_minus1        = (unsigned char)pps->num_slice_groups_minus1;
+    h->slice_group_map_type           = (unsigned char)pps->slice_group_map_type;
+    h->pic_init_qs_minus26            = (signed char)pps->pic_init_qs_minus26;
+    h->slice_group_change_rate_minus1 = (unsigned int)pps->slice_group_change_rate_minus1;
+}
+
+static inline int ffnv_h264_end_picture(FFNVH264Parser *p, const uint8_t *au, int intra, CUVIDPICPARAMS *pic)
+{
+    const FFNVH264SliceHeader *sh = &p->sh;
+    CUVIDPARSERDISPINFO disp;
+    int64_t order;
+    int mmco5;
+
+    if (ffnv_h264_slice_data(p, au, pic) < 0)
+        return FFNV_PARSE_ERROR;
+
+    /* pic params use the DPB state before the current picture is marked */
+    ffnv_h264_fill_pic_params(p, intra, pic);
+    mmco5 = ffnv_h264_mark(p);
+
+    p->prev_frame_num        = mmco5 ? 0 : sh->frame_num;
+    p->prev_frame_num_offset = mmco5 ? 0 : p->frame_num_offset;
+    if (sh->nal_ref_idc) {
+        p->prev_ref_frame_num = p->prev_frame_num;
+        p->prev_poc_msb       = mmco5 ? 0 : p->poc_msb;
+        p->prev_poc_lsb       = !mmco5 ? sh->pic_order_cnt_lsb :
+                                sh->field_pic_flag && sh->bottom_field_flag ? 0 : p->poc[0];
+    }
+
+    order = (p->epoch << 32) + (sh->field_pic_flag ? p->poc[sh->bottom_field_flag] :
+                                p->poc[0] < p->poc[1] ? p->poc[0] : p->poc[1]);
+
+    if (sh->field_pic_flag && !p->second_field) {
+        p->field_idx       = p->cur_idx;
+        p->field_bottom    = sh->bottom_field_flag;
+        p->field_frame_num = mmco5 ? 0 : sh->frame_num;
+        p->field_poc       = p->poc[sh->bottom_field_flag];
+        p->field_order     = order;
+        p->field_timestamp = p->timestamp;
+    } else {
+        memset(&disp, 0, sizeof(disp));
+        disp.picture_index     = p->cur_idx;
+        disp.progressive_frame = !sh->field_pic_flag && p->cur_sps->frame_mbs_only_flag;
+        disp.timestamp         = p->timestamp;
+        if (p->second_field) {
+            disp.top_field_first = !p->field_bottom;
+            disp.timestamp       = p->field_timestamp;
+            if (p->field_order < order)
+                order = p->field_order;
+            p->field_idx = -1;
+        } else {
+            disp.top_field_first = p->poc[0] <= p->poc[1];
+        }
+        ffnv_pool_queue(&p->pool, order, &disp);
+    }
+
+    ffnv_h264_update_busy(p);
+    return FFNV_PARSE_PICTURE;
+}
+
+/**
+ * Parse one access unit and fill pic for cuvidDecodePicture().
+ *
+ * Returns FFNV_PARSE_PICTURE if pic was filled, 0 if the access unit
+ * holds no decodable picture, or a negative FFNV_PARSE_* error code.
+ * FFNV_PARSE_SEQUENCE is returned alone when a picture starts a new
+ * sequence: output all pending pictures, (re)create the decoder from
+ * ffnv_h264_get_format() and pass the same access unit again.
+ *
+ * Only the first picture of the buffer is parsed. If the buffer holds
+ * more than one access unit, p->consumed is less than size afterwards
+ * and the rest, from au + p->consumed on, must be passed again.
+ */
+static inline int ffnv_h264_parse_au(FFNVH264Parser *p, const uint8_t *au, size_t size,
+                                     int64_t timestamp, CUVIDPICPARAMS *pic)
+{
+    FFNVAnnexBNAL nal, next;
+    size_t pos = 0;
+    int have_nal, have_next, have_pic = 0, intra = 1, ret;
+
+    memset(pic, 0, sizeof(*pic));
+    p->nb_slices = 0;
+    p->consumed  = size;
+
+    have_nal = ffnv_annexb_next_nal(cudaVideoCodec_H264, au, size, &pos, &nal);
+    for (; have_nal; nal = next, have_nal = have_next) {
+        const uint8_t *data;
+        size_t end;
+
+        have_next = ffnv_annexb_next_nal(cudaVideoCodec_H264, au, size, &pos, &next);
+        end  = have_next ? next.offset : size;
+        data = au + nal.data_offset;
+
+        switch (nal.type) {
+        case 7:
+            ffnv_h264_parse_sps(p, data, end - nal.data_offset);
+            break;
+        case 8:
+            ffnv_h264_parse_pps(p, data, end - nal.data_offset);
+            break;
+        case 6:
+            if (!have_pic && ffnv_h264_sei_recovery(p, data, end - nal.data_offset))
+                p->recovery_point = 1;
+            break;
+        case 1:
+        case 5:
+            if (ffnv_h264_parse_slice_header(p, data, end - nal.data_offset, &p->tmp) < 0 ||
+                p->tmp.redundant_pic_cnt > 0)
+                break;
+
+            /* nothing can be decoded before the first IDR or recovery point */
+            if (!have_pic && !p->random_access && !p->recovery_point && p->tmp.nal_unit_type != 5)
+                break;
+
+            if (!have_pic) {
+                p->sh = p->tmp;
+                ret = ffnv_h264_start_picture(p, timestamp);
+                if (ret)
+                    return ret;
+                have_pic = 1;
+            } else if (!p->tmp.first_mb_in_slice) {
+                /* the next picture, the access unit was not split */
+                p->consumed = nal.offset;
+                have_next   = 0;
+                break;
+            }
+
+            if (ffnv_parse_grow((void**)&p->slices, &p->slices_size,
+                                p->nb_slices + 1, sizeof(*p->slices)) < 0)
+                return FFNV_PARSE_ERROR;
+            p->slices[p->nb_slices].start = nal.offset;
+            p->slices[p->nb_slices].end   = end;
+            p->nb_slices++;
+
+            intra &= p->tmp.slice_type == 2 || p->tmp.slice_type == 4;
+            break;
+        }
+    }
+
+    if (!have_pic)
+        return 0;
+    return ffnv_h264_end_picture(p, au, intra, pic);
+}
+
+/**
+ * Get the next picture to map in display order. Returns 1 if disp was
+ * filled, 0 if no picture is ready yet. The surface must be handed back
+ * with ffnv_h264_release() once it has been unmapped.
+ */
+static inline int ffnv_h264_get_display(FFNVH264Parser *p, CUVIDPARSERDISPINFO *disp)
+{
+    int delay = p->draining ? 0 : p->display_delay >= 0 ? p->display_delay : p->reorder;
+
+    return ffnv_pool_output(&p->pool, delay, disp);
+}
+
+static inline void ffnv_h264_release(FFNVH264Parser *p, int picture_index)
+{
+    ffnv_pool_release(&p->pool, picture_index);
+}
+
+/** Make all pending pictures available to ffnv_h264_get_display(), e.g. at the end of the stream. */
+static inline void ffnv_h264_flush(FFNVH264Parser *p)
+{
+    ffnv_h264_queue_field(p);
+    p->draining = 1;
+}
+
+/** Format of the active sequence. Returns 0 on success, -1 if no sequence was started yet. */
+static inline int ffnv_h264_get_format(const FFNVH264Parser *p, CUVIDEOFORMAT *fmt)
+{
+    const FFNVH264SPS *sps = &p->active_sps;
+    unsigned int g, dw, dh;
+
+    if (!p->has_active_sps)
+        return -1;
+
+    memset(fmt, 0, sizeof(*fmt));
+    fmt->codec = cudaVideoCodec_H264;
+    if (sps->num_units_in_tick && sps->time_scale) {
+        g = ffnv_parse_gcd(sps->time_scale, 2 * sps->num_units_in_tick);
+        fmt->frame_rate.numerator   = sps->time_scale / g;
+        fmt->frame_rate.denominator = 2 * sps->num_units_in_tick / g;
+    }
+    fmt->progressive_sequence    = (unsigned char)sps->frame_mbs_only_flag;
+    fmt->bit_depth_luma_minus8   = (unsigned char)sps->bit_depth_luma_minus8;
+    fmt->bit_depth_chroma_minus8 = (unsigned char)sps->bit_depth_chroma_minus8;
+    fmt->coded_width             = sps->pic_width_in_mbs * 16;
+    fmt->coded_height            = sps->pic_height_in_map_units * (2 - sps->frame_mbs_only_flag) * 16;
+    fmt->display_area.left       = sps->crop_left;
+    fmt->display_area.top        = sps->crop_top;
+    fmt->display_area.right      = (int)fmt->coded_width  - sps->crop_right;
+    fmt->display_area.bottom     = (int)fmt->coded_height - sps->crop_bottom;
+    fmt->chroma_format           = (cudaVideoChromaFormat)sps->chroma_format_idc;
+
+    dw = (unsigned int)(fmt->display_area.right  - fmt->display_area.left);
+    dh = (unsigned int)(fmt->display_area.bottom - fmt->display_area.top);
+    if (sps->sar_width && sps->sar_height) {
+        dw *= sps->sar_width;
+        dh *= sps->sar_height;
+    }
+    g = ffnv_parse_gcd(dw, dh);
+    fmt->display_aspect_ratio.x = (int)(dw / g);
+    fmt->display_aspect_ratio.y = (int)(dh / g);
+
+    fmt->video_signal_description.video_format             = sps->video_format & 7;
+    fmt->video_signal_description.video_full_range_flag    = sps->video_full_range_flag & 1;
+    fmt->video_signal_description.color_primaries          = (unsigned char)sps->colour_primaries;
+    fmt->video_signal_description.transfer_characteristics = (unsigned char)sps->transfer_characteristics;
+    fmt->video_signal_description.matrix_coefficients      = (unsigned char)sps->matrix_coefficients;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,1558 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Standalone HEVC parser filling CUVIDPICPARAMS for cuvidDecodePicture().
+ *
+ * SPS, PPS and the slice segment header up to the reference picture set
+ * are parsed; POC, RPS marking and the display queue are handled
+ * internally, so neither cuvidCreateVideoParser() nor callbacks are
+ * needed. Parameter sets, slice tables and the RBSP scratch buffer all
+ * live in the single parser allocation, so steady-state parsing does no
+ * heap allocation. The only exception is the copy made when slice
+ * segments of a picture are not contiguous in the access unit.
+ *
+ * The VPS carries nothing CUVIDHEVCPICPARAMS needs and is skipped, as
+ * are NAL units of layers other than the base layer.
+ *
+ * Input is one access unit per call, e.g. as split by FFNVAnnexBSplitter.
+ * The filled CUVIDPICPARAMS may point into the access unit, which must
+ * stay valid until cuvidDecodePicture() returns.
+ */
+
+#ifndef FFNV_CUVID_HEVC_PARSER_H
+#define FFNV_CUVID_HEVC_PARSER_H
+
+#include "cuvid_annexb.h"
+#include "cuvid_parse.h"
+
+#define FFNV_HEVC_MAX_SPS         16
+#define FFNV_HEVC_MAX_PPS         64
+#define FFNV_HEVC_MAX_ST_RPS      64
+#define FFNV_HEVC_MAX_LT_REFS     32
+#define FFNV_HEVC_MAX_REFS        16
+#define FFNV_HEVC_MAX_SLICES      600 /* MaxSliceSegmentsPerPicture of level 6.2 */
+#define FFNV_HEVC_MAX_TILE_COLS   20
+#define FFNV_HEVC_MAX_TILE_ROWS   21 /* CUVIDHEVCPICPARAMS limit, one below level 6 */
+
+/* parameter sets and slice headers are parsed from at most this many bytes of RBSP */
+#define FFNV_HEVC_RBSP_SIZE 8192
+
+enum {
+    FFNV_HEVC_NAL_RADL_N    = 6,
+    FFNV_HEVC_NAL_RASL_N    = 8,
+    FFNV_HEVC_NAL_RASL_R    = 9,
+    FFNV_HEVC_NAL_BLA_W_LP  = 16,
+    FFNV_HEVC_NAL_IDR_W_RADL = 19,
+    FFNV_HEVC_NAL_IDR_N_LP  = 20,
+    FFNV_HEVC_NAL_CRA       = 21,
+    FFNV_HEVC_NAL_SPS       = 33,
+    FFNV_HEVC_NAL_PPS       = 34,
+    FFNV_HEVC_NAL_EOS       = 36,
+    FFNV_HEVC_NAL_EOB       = 37,
+};
+
+/* Table 7-6, in coded (up-right diagonal) order */
+static const uint8_t ffnv_hevc_default_scaling[2][64] = {
+    { 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 17, 16, 17, 16, 17, 18,
+      17, 18, 18, 17, 18, 21, 19, 20, 21, 20, 19, 21, 24, 22, 22, 24,
+      24, 22, 22, 24, 25, 25, 27, 30, 27, 25, 25, 29, 31, 35, 35, 31,
+      29, 36, 41, 44, 41, 36, 47, 54, 54, 47, 65, 70, 65, 88, 88, 115 },
+    { 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 18,
+      18, 18, 18, 18, 18, 20, 20, 20, 20, 20, 20, 20, 24, 24, 24, 24,
+      24, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 28, 28, 28, 28, 28,
+      28, 33, 33, 33, 33, 33, 41, 41, 41, 41, 54, 54, 54, 71, 71, 91 },
+};
+
+static const uint8_t ffnv_hevc_sar[17][2] = {
+    {  0,  1 }, {  1,  1 }, { 12, 11 }, { 10, 11 }, { 16, 11 }, { 40, 33 },
+    { 24, 11 }, { 20, 11 }, { 32, 11 }, { 80, 33 }, { 18, 11 }, { 15, 11 },
+    { 64, 33 }, {160, 99 }, {  4,  3 }, {  3,  2 }, {  2,  1 },
+};
+
+/* Scaling lists in coded order, as CUVIDHEVCPICPARAMS expects them. */
+typedef struct FFNVHEVCScalingList {
+    uint8_t sl[4][6][64]; /* [sizeId][matrixId], 16 entries for 4x4 */
+    uint8_t dc[2][6];     /* 16x16 and 32x32 DC coefficients */
+} FFNVHEVCScalingList;
+
+typedef struct FFNVHEVCShortTermRPS {
+    int num_negative_pics;
+    int num_positive_pics;
+    int32_t delta_poc[16]; /* negative pictures first, closest first */
+    uint8_t used[16];
+} FFNVHEVCShortTermRPS;
+
+typedef struct FFNVHEVCSPS {
+    int valid;
+    int general_profile_idc;
+    int general_level_idc;
+    int chroma_format_idc;
+    int separate_colour_plane_flag;
+    int width, height;
+    int conf_left, conf_right, conf_top, conf_bottom; /* in luma samples */
+    int bit_depth_luma_minus8;
+    int bit_depth_chroma_minus8;
+    int log2_max_pic_order_cnt_lsb_minus4;
+    int max_dec_pic_buffering;
+    int max_num_reorder_pics;
+    int log2_min_luma_coding_block_size_minus3;
+    int log2_diff_max_min_luma_coding_block_size;
+    int log2_min_transform_block_size_minus2;
+    int log2_diff_max_min_transform_block_size;
+    int max_transform_hierarchy_depth_inter;
+    int max_transform_hierarchy_depth_intra;
+    int scaling_list_enabled_flag;
+    FFNVHEVCScalingList scaling;
+    int amp_enabled_flag;
+    int sample_adaptive_offset_enabled_flag;
+    int pcm_enabled_flag;
+    int pcm_sample_bit_depth_luma_minus1;
+    int pcm_sample_bit_depth_chroma_minus1;
+    int log2_min_pcm_luma_coding_block_size_minus3;
+    int log2_diff_max_min_pcm_luma_coding_block_size;
+    int pcm_loop_filter_disabled_flag;
+    int num_short_term_ref_pic_sets;
+    FFNVHEVCShortTermRPS st_rps[FFNV_HEVC_MAX_ST_RPS];
+    int long_term_ref_pics_present_flag;
+    int num_long_term_ref_pics_sps;
+    int lt_ref_pic_poc_lsb_sps[FFNV_HEVC_MAX_LT_REFS];
+    uint8_t used_by_curr_pic_lt_sps_flag[FFNV_HEVC_MAX_LT_REFS];
+    int sps_temporal_mvp_enabled_flag;
+    int strong_intra_smoothing_enabled_flag;
+    int high_precision_offsets_enabled_flag;
+
+    /* VUI */
+    int sar_width, sar_height;
+    int video_format;
+    int video_full_range_flag;
+    int colour_primaries;
+    int transfer_characteristics;
+    int matrix_coefficients;
+    int field_seq_flag;
+    uint32_t num_units_in_tick;
+    uint32_t time_scale;
+} FFNVHEVCSPS;
+
+typedef struct FFNVHEVCPPS {
+    int valid;
+    int sps_id;
+    int dependent_slice_segments_enabled_flag;
+    int output_flag_present_flag;
+    int num_extra_slice_header_bits;
+    int sign_data_hiding_enabled_flag;
+    int cabac_init_present_flag;
+    int num_ref_idx_l0_default_active_minus1;
+    int num_ref_idx_l1_default_active_minus1;
+    int init_qp_minus26;
+    int constrained_intra_pred_flag;
+    int transform_skip_enabled_flag;
+    int cu_qp_delta_enabled_flag;
+    int diff_cu_qp_delta_depth;
+    int pps_cb_qp_offset;
+    int pps_cr_qp_offset;
+    int pps_slice_chroma_qp_offsets_present_flag;
+    int weighted_pred_flag;
+    int weighted_bipred_flag;
+    int transquant_bypass_enabled_flag;
+    int tiles_enabled_flag;
+    int entropy_coding_sync_enabled_flag;
+    int num_tile_columns_minus1;
+    int num_tile_rows_minus1;
+    int uniform_spacing_flag;
+    int column_width_minus1[FFNV_HEVC_MAX_TILE_COLS];
+    int row_height_minus1[FFNV_HEVC_MAX_TILE_ROWS];
+    int loop_filter_across_tiles_enabled_flag;
+    int loop_filter_across_slices_enabled_flag;
+    int deblocking_filter_override_enabled_flag;
+    int pps_deblocking_filter_disabled_flag;
+    int pps_beta_offset_div2;
+    int pps_tc_offset_div2;
+    int scaling_list_data_present_flag;
+    FFNVHEVCScalingList scaling;
+    int lists_modification_present_flag;
+    int log2_parallel_merge_level_minus2;
+    int slice_segment_header_extension_present_flag;
+    int log2_max_transform_skip_block_size_minus2;
+    int log2_sao_offset_scale_luma;
+    int log2_sao_offset_scale_chroma;
+} FFNVHEVCPPS;
+
+typedef struct FFNVHEVCSliceHeader {
+    int nal_unit_type;
+    int temporal_id;
+    int pps_id;
+    int pic_output_flag;
+    int pic_order_cnt_lsb;
+    FFNVHEVCShortTermRPS st_rps; /* the one in use, copied from the SPS or parsed */
+    int st_rps_bits;             /* size of st_ref_pic_set() in the slice header */
+    int st_rps_ref_num_delta_pocs;
+    int num_long_term;
+    int lt_poc_lsb[FFNV_HEVC_MAX_LT_REFS];
+    int lt_msb_cycle[FFNV_HEVC_MAX_LT_REFS]; /* DeltaPocMsbCycleLt */
+    uint8_t lt_msb_present[FFNV_HEVC_MAX_LT_REFS];
+    uint8_t lt_used[FFNV_HEVC_MAX_LT_REFS];
+} FFNVHEVCSliceHeader;
+
+typedef struct FFNVHEVCRef {
+    int pic_idx;
+    int poc;
+    int long_term;
+} FFNVHEVCRef;
+
+typedef struct FFNVHEVCParser {
+    /** Number of pictures to hold back for reordering, -1 to derive it from the SPS. */
+    int display_delay;
+
+    FFNVHEVCSPS sps[FFNV_HEVC_MAX_SPS];
+    FFNVHEVCPPS pps[FFNV_HEVC_MAX_PPS];
+    FFNVHEVCSPS active_sps;
+    int has_active_sps;
+    int draining;
+
+    FFNVFramePool pool;
+    FFNVHEVCRef refs[FFNV_HEVC_MAX_REFS];
+    int nb_refs;
+
+    int prev_tid0_poc;
+    int first_picture; /* the next IRAP has NoRaslOutputFlag set */
+    int skip_rasl;     /* NoRaslOutputFlag of the associated IRAP */
+    int64_t epoch;
+
+    /* current picture */
+    FFNVHEVCSliceHeader sh;
+    const FFNVHEVCSPS *cur_sps;
+    const FFNVHEVCPPS *cur_pps;
+    int cur_idx;
+    int poc;
+    int64_t timestamp;
+    uint8_t st_curr_before[8], st_curr_after[8], lt_curr[8];
+    int nb_st_curr_before, nb_st_curr_after, nb_lt_curr;
+    uint16_t col_width[FFNV_HEVC_MAX_TILE_COLS];
+    uint16_t row_height[FFNV_HEVC_MAX_TILE_ROWS];
+
+    uint8_t rbsp[FFNV_HEVC_RBSP_SIZE];
+    size_t slice_start[FFNV_HEVC_MAX_SLICES];
+    size_t slice_end[FFNV_HEVC_MAX_SLICES];
+    unsigned int slice_offsets[FFNV_HEVC_MAX_SLICES];
+    int nb_slices;
+    uint8_t *bitstream;
+    int bitstream_size;
+} FFNVHEVCParser;
+
+static inline void ffnv_hevc_parser_free(FFNVHEVCParser **pp)
+{
+    if (!*pp)
+        return;
+
+    free((*pp)->bitstream);
+    free(*pp);
+    *pp = NULL;
+}
+
+/**
+ * Allocate a parser handing out picture indices below nb_surfaces, which
+ * must match CUVIDDECODECREATEINFO::ulNumDecodeSurfaces.
+ * Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_hevc_parser_init(FFNVHEVCParser **pp, int nb_surfaces)
+{
+    FFNVHEVCParser *p = (FFNVHEVCParser*)calloc(1, sizeof(*p));
+
+    *pp = p;
+    if (!p)
+        return -1;
+
+    p->display_delay = -1;
+    p->first_picture = 1;
+    ffnv_pool_init(&p->pool, nb_surfaces);
+    return 0;
+}
+
+/* Copy the RBSP of a NAL unit, without its two header bytes, into p->rbsp. */
+static inline int ffnv_hevc_load_rbsp(FFNVHEVCParser *p, FFNVBitReader *br, const uint8_t *nal, size_t size)
+{
+    size_t n;
+
+    if (size < 3)
+        return -1;
+
+    n = ffnv_unescape_rbsp(p->rbsp, sizeof(p->rbsp), nal + 2, size - 2);
+    ffnv_br_init(br, p->rbsp, n);
+    return 0;
+}
+
+static inline int ffnv_hevc_ceil_log2(int v)
+{
+    int n = 0;
+
+    while ((1 << n) < v)
+        n++;
+    return n;
+}
+
+static inline void ffnv_hevc_scaling_defaults(FFNVHEVCScalingList *sl)
+{
+    int size_id, matrix_id;
+
+    memset(sl->sl[0], 16, sizeof(sl->sl[0]));
+    for (size_id = 1; size_id < 4; size_id++) {
+        for (matrix_id = 0; matrix_id < 6; matrix_id++)
+            memcpy(sl->sl[size_id][matrix_id], ffnv_hevc_default_scaling[matrix_id >= 3], 64);
+    }
+    memset(sl->dc, 16, sizeof(sl->dc));
+}
+
+static inline int ffnv_hevc_scaling_list_data(FFNVBitReader *br, FFNVHEVCScalingList *sl)
+{
+    int size_id, matrix_id, i;
+
+    for (size_id = 0; size_id < 4; size_id++) {
+        const int coef_num = size_id ? 64 : 16;
+
+        for (matrix_id = 0; matrix_id < 6; matrix_id += size_id == 3 ? 3 : 1) {
+            if (!ffnv_br_get_bit(br)) {
+                uint32_t delta = ffnv_br_get_ue(br);
+
+                if (delta > (uint32_t)matrix_id / (size_id == 3 ? 3 : 1))
+                    return -1;
+
+                if (!delta) {
+                    if (size_id)
+                        memcpy(sl->sl[size_id][matrix_id], ffnv_hevc_default_scaling[matrix_id >= 3], 64);
+                    else
+                        memset(sl->sl[0][matrix_id], 16, 16);
+                    if (size_id > 1)
+                        sl->dc[size_id - 2][matrix_id] = 16;
+                } else {
+                    int ref = matrix_id - (int)delta * (size_id == 3 ? 3 : 1);
+
+                    memcpy(sl->sl[size_id][matrix_id], sl->sl[size_id][ref], coef_num);
+                    if (size_id > 1)
+                        sl->dc[size_id - 2][matrix_id] = sl->dc[size_id - 2][ref];
+                }
+            } else {
+                int next = 8;
+
+                if (size_id > 1) {
+                    next = ffnv_br_get_se(br) + 8;
+                    if (next < 1 || next > 255)
+                        return -1;
+                    sl->dc[size_id - 2][matrix_id] = (uint8_t)next;
+                }
+                for (i = 0; i < coef_num; i++) {
+                    next = (next + ffnv_br_get_se(br) + 256) & 0xff;
+                    sl->sl[size_id][matrix_id][i] = (uint8_t)next;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static inline void ffnv_hevc_profile_tier_level(FFNVBitReader *br, int *profile_idc, int *level_idc,
+                                                int max_sub_layers_minus1)
+{
+    int profile_present[8], level_present[8], i;
+
+    ffnv_br_skip(br, 3);
+    *profile_idc = (int)ffnv_br_get_bits(br, 5);
+    ffnv_br_skip(br, 32 + 4 + 43 + 1);
+    *level_idc = (int)ffnv_br_get_bits(br, 8);
+
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        profile_present[i] = ffnv_br_get_bit(br);
+        level_present[i]   = ffnv_br_get_bit(br);
+    }
+    if (max_sub_layers_minus1 > 0)
+        ffnv_br_skip(br, 2 * (8 - max_sub_layers_minus1));
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        if (profile_present[i])
+            ffnv_br_skip(br, 88);
+        if (level_present[i])
+            ffnv_br_skip(br, 8);
+    }
+}
+
+/* st_ref_pic_set(idx), idx is num_short_term_ref_pic_sets for the one in a slice header */
+static inline int ffnv_hevc_st_rps(FFNVBitReader *br, const FFNVHEVCSPS *sps, FFNVHEVCShortTermRPS *rps,
+                                   int idx, int *ref_num_delta_pocs)
+{
+    int i, j;
+
+    if (idx && ffnv_br_get_bit(br)) {
+        const FFNVHEVCShortTermRPS *ref;
+        uint8_t used[17], use_delta[17];
+        int delta_idx = 1, delta_rps, sign, nb_ref, dpoc, n;
+
+        if (idx == sps->num_short_term_ref_pic_sets) {
+            uint32_t v = ffnv_br_get_ue(br);
+
+            if (v >= (uint32_t)idx)
+                return -1;
+            delta_idx = (int)v + 1;
+        }
+        ref = &sps->st_rps[idx - delta_idx];
+        nb_ref = ref->num_negative_pics + ref->num_positive_pics;
+        if (ref_num_delta_pocs)
+            *ref_num_delta_pocs = nb_ref;
+
+        sign      = ffnv_br_get_bit(br);
+        delta_rps = (int)ffnv_br_get_ue(br) + 1;
+        if (delta_rps > 1 << 15)
+            return -1;
+        if (sign)
+            delta_rps = -delta_rps;
+
+        for (j = 0; j <= nb_ref; j++) {
+            used[j]      = (uint8_t)ffnv_br_get_bit(br);
+            use_delta[j] = used[j] ? 1 : (uint8_t)ffnv_br_get_bit(br);
+        }
+
+        /* (7-61) */
+        n = 0;
+        for (j = ref->num_positive_pics - 1; j >= 0; j--) {
+            dpoc = ref->delta_poc[ref->num_negative_pics + j] + delta_rps;
+            if (dpoc < 0 && use_delta[ref->num_negative_pics + j] && n < 16) {
+                rps->delta_poc[n] = dpoc;
+                rps->used[n++]    = used[ref->num_negative_pics + j];
+            }
+        }
+        if (delta_rps < 0 && use_delta[nb_ref] && n < 16) {
+            rps->delta_poc[n] = delta_rps;
+            rps->used[n++]    = used[nb_ref];
+        }
+        for (j = 0; j < ref->num_negative_pics; j++) {
+            dpoc = ref->delta_poc[j] + delta_rps;
+            if (dpoc < 0 && use_delta[j] && n < 16) {
+                rps->delta_poc[n] = dpoc;
+                rps->used[n++]    = used[j];
+            }
+        }
+        rps->num_negative_pics = n;
+
+        /* (7-62) */
+        for (j = ref->num_negative_pics - 1; j >= 0; j--) {
+            dpoc = ref->delta_poc[j] + delta_rps;
+            if (dpoc > 0 && use_delta[j] && n < 16) {
+                rps->delta_poc[n] = dpoc;
+                rps->used[n++]    = used[j];
+            }
+        }
+        if (delta_rps > 0 && use_delta[nb_ref] && n < 16) {
+            rps->delta_poc[n] = delta_rps;
+            rps->used[n++]    = used[nb_ref];
+        }
+        for (j = 0; j < ref->num_positive_pics; j++) {
+            dpoc = ref->delta_poc[ref->num_negative_pics + j] + delta_rps;
+            if (dpoc > 0 && use_delta[ref->num_negative_pics + j] && n < 16) {
+                rps->delta_poc[n] = dpoc;
+                rps->used[n++]    = used[ref->num_negative_pics + j];
+            }
+        }
+        rps->num_positive_pics = n - rps->num_negative_pics;
+    } else {
+        uint32_t neg = ffnv_br_get_ue(br), pos = ffnv_br_get_ue(br);
+        int poc = 0;
+
+        if (neg > 16 || pos > 16 || neg + pos > 16)
+            return -1;
+        if (ref_num_delta_pocs)
+            *ref_num_delta_pocs = 0;
+
+        rps->num_negative_pics = (int)neg;
+        rps->num_positive_pics = (int)pos;
+        for (i = 0; i < (int)neg; i++) {
+            poc -= (int)ffnv_br_get_ue(br) + 1;
+            rps->delta_poc[i] = poc;
+            rps->used[i]      = (uint8_t)ffnv_br_get_bit(br);
+        }
+        poc = 0;
+        for (; i < (int)(neg + pos); i++) {
+            poc += (int)ffnv_br_get_ue(br) + 1;
+            rps->delta_poc[i] = poc;
+            rps->used[i]      = (uint8_t)ffnv_br_get_bit(br);
+        }
+    }
+
+    return ffnv_br_overread(br) ? -1 : 0;
+}
+
+static inline void ffnv_hevc_sub_layer_hrd(FFNVBitReader *br, int cpb_cnt, int sub_pic)
+{
+    int i;
+
+    for (i = 0; i < cpb_cnt; i++) {
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        if (sub_pic) {
+            ffnv_br_get_ue(br);
+            ffnv_br_get_ue(br);
+        }
+        ffnv_br_skip(br, 1);
+    }
+}
+
+static inline void ffnv_hevc_hrd(FFNVBitReader *br, int max_sub_layers_minus1)
+{
+    int nal, vcl, sub_pic = 0, i;
+
+    nal = ffnv_br_get_bit(br);
+    vcl = ffnv_br_get_bit(br);
+    if (nal || vcl) {
+        sub_pic = ffnv_br_get_bit(br);
+        if (sub_pic)
+            ffnv_br_skip(br, 8 + 5 + 1 + 5);
+        ffnv_br_skip(br, 8);
+        if (sub_pic)
+            ffnv_br_skip(br, 4);
+        ffnv_br_skip(br, 15);
+    }
+
+    for (i = 0; i <= max_sub_layers_minus1; i++) {
+        int fixed = ffnv_br_get_bit(br), low_delay = 0;
+        uint32_t cpb_cnt = 1;
+
+        if (!fixed)
+            fixed = ffnv_br_get_bit(br);
+        if (fixed)
+            ffnv_br_get_ue(br);
+        else
+            low_delay = ffnv_br_get_bit(br);
+        if (!low_delay)
+            cpb_cnt = ffnv_br_get_ue(br) + 1;
+        if (cpb_cnt > 32)
+            return;
+
+        if (nal)
+            ffnv_hevc_sub_layer_hrd(br, (int)cpb_cnt, sub_pic);
+        if (vcl)
+            ffnv_hevc_sub_layer_hrd(br, (int)cpb_cnt, sub_pic);
+    }
+}
+
+static inline void ffnv_hevc_vui(FFNVBitReader *br, FFNVHEVCSPS *sps, int max_sub_layers_minus1)
+{
+    if (ffnv_br_get_bit(br)) {
+        int idc = (int)ffnv_br_get_bits(br, 8);
+
+        if (idc == 255) {
+            sps->sar_width  = (int)ffnv_br_get_bits(br, 16);
+            sps->sar_height = (int)ffnv_br_get_bits(br, 16);
+        } else if (idc < 17) {
+            sps->sar_width  = ffnv_hevc_sar[idc][0];
+            sps->sar_height = ffnv_hevc_sar[idc][1];
+        }
+    }
+
+    if (ffnv_br_get_bit(br))
+        ffnv_br_skip(br, 1);
+
+    if (ffnv_br_get_bit(br)) {
+        sps->video_format          = (int)ffnv_br_get_bits(br, 3);
+        sps->video_full_range_flag = ffnv_br_get_bit(br);
+        if (ffnv_br_get_bit(br)) {
+            sps->colour_primaries         = (int)ffnv_br_get_bits(br, 8);
+            sps->transfer_characteristics = (int)ffnv_br_get_bits(br, 8);
+            sps->matrix_coefficients      = (int)ffnv_br_get_bits(br, 8);
+        }
+    }
+
+    if (ffnv_br_get_bit(br)) {
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+    }
+
+    ffnv_br_skip(br, 1);
+    sps->field_seq_flag = ffnv_br_get_bit(br);
+    ffnv_br_skip(br, 1);
+
+    if (ffnv_br_get_bit(br)) {
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+    }
+
+    if (ffnv_br_get_bit(br)) {
+        sps->num_units_in_tick = ffnv_br_get_bits(br, 32);
+        sps->time_scale        = ffnv_br_get_bits(br, 32);
+        if (ffnv_br_get_bit(br))
+            ffnv_br_get_ue(br);
+        if (ffnv_br_get_bit(br))
+            ffnv_hevc_hrd(br, max_sub_layers_minus1);
+    }
+
+    if (ffnv_br_get_bit(br)) {
+        ffnv_br_skip(br, 3);
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+        ffnv_br_get_ue(br);
+    }
+}
+
+static inline int ffnv_hevc_parse_sps(FFNVHEVCParser *p, const uint8_t *nal, size_t size)
+{
+    FFNVBitReader br;
+    FFNVHEVCSPS *sps;
+    uint32_t id, v;
+    int max_sub_layers_minus1, profile_idc, level_idc, log2_ctb, sub_w, sub_h, i;
+
+    if (ffnv_hevc_load_rbsp(p, &br, nal, size) < 0)
+        return -1;
+
+    ffnv_br_skip(&br, 4);
+    max_sub_layers_minus1 = (int)ffnv_br_get_bits(&br, 3);
+    if (max_sub_layers_minus1 > 6)
+        return -1;
+    ffnv_br_skip(&br, 1);
+
+    ffnv_hevc_profile_tier_level(&br, &profile_idc, &level_idc, max_sub_layers_minus1);
+    id = ffnv_br_get_ue(&br);
+    if (id >= FFNV_HEVC_MAX_SPS)
+        return -1;
+
+    /* the slot stays invalid if anything below fails */
+    sps = &p->sps[id];
+    memset(sps, 0, sizeof(*sps));
+    sps->general_profile_idc = profile_idc;
+    sps->general_level_idc   = level_idc;
+
+    sps->chroma_format_idc = (int)ffnv_br_get_ue(&br);
+    if (sps->chroma_format_idc > 3)
+        return -1;
+    if (sps->chroma_format_idc == 3)
+        sps->separate_colour_plane_flag = ffnv_br_get_bit(&br);
+
+    sps->width  = (int)ffnv_br_get_ue(&br);
+    sps->height = (int)ffnv_br_get_ue(&br);
+    if (sps->width <= 0 || sps->width > 16888 || sps->height <= 0 || sps->height > 16888)
+        return -1;
+
+    if (ffnv_br_get_bit(&br)) {
+        sub_w = sps->chroma_format_idc == 1 || sps->chroma_format_idc == 2 ? 2 : 1;
+        sub_h = sps->chroma_format_idc == 1 ? 2 : 1;
+        sps->conf_left   = (int)ffnv_br_get_ue(&br) * sub_w;
+        sps->conf_right  = (int)ffnv_br_get_ue(&br) * sub_w;
+        sps->conf_top    = (int)ffnv_br_get_ue(&br) * sub_h;
+        sps->conf_bottom = (int)ffnv_br_get_ue(&br) * sub_h;
+        if (sps->conf_left < 0 || sps->conf_right < 0 || sps->conf_top < 0 || sps->conf_bottom < 0 ||
+            sps->conf_left + sps->conf_right >= sps->width ||
+            sps->conf_top + sps->conf_bottom >= sps->height)
+            sps->conf_left = sps->conf_right = sps->conf_top = sps->conf_bottom = 0;
+    }
+
+    sps->bit_depth_luma_minus8             = (int)ffnv_br_get_ue(&br);
+    sps->bit_depth_chroma_minus8           = (int)ffnv_br_get_ue(&br);
+    sps->log2_max_pic_order_cnt_lsb_minus4 = (int)ffnv_br_get_ue(&br);
+    if (sps->bit_depth_luma_minus8 > 8 || sps->bit_depth_chroma_minus8 > 8 ||
+        sps->log2_max_pic_order_cnt_lsb_minus4 > 12)
+        return -1;
+
+    /* keep the values of the highest sub-layer */
+    v = ffnv_br_get_bit(&br);
+    for (i = v ? 0 : max_sub_layers_minus1; i <= max_sub_layers_minus1; i++) {
+        sps->max_dec_pic_buffering = (int)ffnv_br_get_ue(&br) + 1;
+        sps->max_num_reorder_pics  = (int)ffnv_br_get_ue(&br);
+        ffnv_br_get_ue(&br);
+    }
+    if (sps->max_dec_pic_buffering <= 0 || sps->max_dec_pic_buffering > FFNV_HEVC_MAX_REFS ||
+        sps->max_num_reorder_pics < 0 || sps->max_num_reorder_pics >= sps->max_dec_pic_buffering)
+        return -1;
+
+    sps->log2_min_luma_coding_block_size_minus3   = (int)ffnv_br_get_ue(&br);
+    sps->log2_diff_max_min_luma_coding_block_size = (int)ffnv_br_get_ue(&br);
+    sps->log2_min_transform_block_size_minus2     = (int)ffnv_br_get_ue(&br);
+    sps->log2_diff_max_min_transform_block_size   = (int)ffnv_br_get_ue(&br);
+    sps->max_transform_hierarchy_depth_inter      = (int)ffnv_br_get_ue(&br);
+    sps->max_transform_hierarchy_depth_intra      = (int)ffnv_br_get_ue(&br);
+    log2_ctb = sps->log2_min_luma_coding_block_size_minus3 + 3 + sps->log2_diff_max_min_luma_coding_block_size;
+    if (log2_ctb < 4 || log2_ctb > 6 || sps->log2_min_transform_block_size_minus2 > 3 ||
+        sps->log2_diff_max_min_transform_block_size > 3)
+        return -1;
+
+    sps->scaling_list_enabled_flag = ffnv_br_get_bit(&br);
+    if (sps->scaling_list_enabled_flag) {
+        ffnv_hevc_scaling_defaults(&sps->scaling);
+        if (ffnv_br_get_bit(&br) && ffnv_hevc_scaling_list_data(&br, &sps->scaling) < 0)
+            return -1;
+    }
+
+    sps->amp_enabled_flag                    = ffnv_br_get_bit(&br);
+    sps->sample_adaptive_offset_enabled_flag = ffnv_br_get_bit(&br);
+    sps->pcm_enabled_flag                    = ffnv_br_get_bit(&br);
+    if (sps->pcm_enabled_flag) {
+        sps->pcm_sample_bit_depth_luma_minus1             = (int)ffnv_br_get_bits(&br, 4);
+        sps->pcm_sample_bit_depth_chroma_minus1           = (int)ffnv_br_get_bits(&br, 4);
+        sps->log2_min_pcm_luma_coding_block_size_minus3   = (int)ffnv_br_get_ue(&br);
+        sps->log2_diff_max_min_pcm_luma_coding_block_size = (int)ffnv_br_get_ue(&br);
+        sps->pcm_loop_filter_disabled_flag                = ffnv_br_get_bit(&br);
+    }
+
+    v = ffnv_br_get_ue(&br);
+    if (v > FFNV_HEVC_MAX_ST_RPS)
+        return -1;
+    sps->num_short_term_ref_pic_sets = (int)v;
+    for (i = 0; i < sps->num_short_term_ref_pic_sets; i++) {
+        if (ffnv_hevc_st_rps(&br, sps, &sps->st_rps[i], i, NULL) < 0)
+            return -1;
+    }
+
+    sps->long_term_ref_pics_present_flag = ffnv_br_get_bit(&br);
+    if (sps->long_term_ref_pics_present_flag) {
+        v = ffnv_br_get_ue(&br);
+        if (v > FFNV_HEVC_MAX_LT_REFS)
+            return -1;
+        sps->num_long_term_ref_pics_sps = (int)v;
+        for (i = 0; i < sps->num_long_term_ref_pics_sps; i++) {
+            sps->lt_ref_pic_poc_lsb_sps[i] =
+                (int)ffnv_br_get_bits(&br, sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+            sps->used_by_curr_pic_lt_sps_flag[i] = (uint8_t)ffnv_br_get_bit(&br);
+        }
+    }
+
+    sps->sps_temporal_mvp_enabled_flag       = ffnv_br_get_bit(&br);
+    sps->strong_intra_smoothing_enabled_flag = ffnv_br_get_bit(&br);
+
+    if (ffnv_br_overread(&br))
+        return -1;
+
+    sps->video_format             = 5;
+    sps->colour_primaries         = 2;
+    sps->transfer_characteristics = 2;
+    sps->matrix_coefficients      = 2;
+    if (ffnv_br_get_bit(&br))
+        ffnv_hevc_vui(&br, sps, max_sub_layers_minus1);
+
+    if (ffnv_br_get_bit(&br) && ffnv_br_get_bit(&br)) {
+        /* sps_range_extension() */
+        ffnv_br_skip(&br, 7 + 6);
+        sps->high_precision_offsets_enabled_flag = ffnv_br_get_bit(&br);
+    }
+
+    /* a cut-off VUI or extension is not fatal */
+    if (ffnv_br_overread(&br))
+        sps->high_precision_offsets_enabled_flag = 0;
+
+    sps->valid = 1;
+    return 0;
+}
+
+static inline int ffnv_hevc_parse_pps(FFNVHEVCParser *p, const uint8_t *nal, size_t size)
+{
+    FFNVBitReader br;
+    FFNVHEVCPPS *pps;
+    uint32_t id, v;
+    int i;
+
+    if (ffnv_hevc_load_rbsp(p, &br, nal, size) < 0)
+        return -1;
+
+    id = ffnv_br_get_ue(&br);
+    v  = ffnv_br_get_ue(&br);
+    if (id >= FFNV_HEVC_MAX_PPS || v >= FFNV_HEVC_MAX_SPS)
+        return -1;
+    pps = &p->pps[id];
+    memset(pps, 0, sizeof(*pps));
+    pps->sps_id = (int)v;
+
+    pps->dependent_slice_segments_enabled_flag = ffnv_br_get_bit(&br);
+    pps->output_flag_present_flag              = ffnv_br_get_bit(&br);
+    pps->num_extra_slice_header_bits           = (int)ffnv_br_get_bits(&br, 3);
+    pps->sign_data_hiding_enabled_flag         = ffnv_br_get_bit(&br);
+    pps->cabac_init_present_flag               = ffnv_br_get_bit(&br);
+    pps->num_ref_idx_l0_default_active_minus1  = (int)ffnv_br_get_ue(&br);
+    pps->num_ref_idx_l1_default_active_minus1  = (int)ffnv_br_get_ue(&br);
+    pps->init_qp_minus26                       = ffnv_br_get_se(&br);
+    pps->constrained_intra_pred_flag           = ffnv_br_get_bit(&br);
+    pps->transform_skip_enabled_flag           = ffnv_br_get_bit(&br);
+    pps->cu_qp_delta_enabled_flag              = ffnv_br_get_bit(&br);
+    if (pps->cu_qp_delta_enabled_flag)
+        pps->diff_cu_qp_delta_depth = (int)ffnv_br_get_ue(&br);
+    pps->pps_cb_qp_offset                         = ffnv_br_get_se(&br);
+    pps->pps_cr_qp_offset                         = ffnv_br_get_se(&br);
+    pps->pps_slice_chroma_qp_offsets_present_flag = ffnv_br_get_bit(&br);
+    pps->weighted_pred_flag                       = ffnv_br_get_bit(&br);
+    pps->weighted_bipred_flag                     = ffnv_br_get_bit(&br);
+    pps->transquant_bypass_enabled_flag           = ffnv_br_get_bit(&br);
+    pps->tiles_enabled_flag                       = ffnv_br_get_bit(&br);
+    pps->entropy_coding_sync_enabled_flag         = ffnv_br_get_bit(&br);
+    if (pps->num_ref_idx_l0_default_active_minus1 < 0 || pps->num_ref_idx_l0_default_active_minus1 > 14 ||
+        pps->num_ref_idx_l1_default_active_minus1 < 0 || pps->num_ref_idx_l1_default_active_minus1 > 14 ||
+        pps->diff_cu_qp_delta_depth < 0 || pps->diff_cu_qp_delta_depth > 3)
+        return -1;
+
+    if (pps->tiles_enabled_flag) {
+        pps->num_tile_columns_minus1 = (int)ffnv_br_get_ue(&br);
+        pps->num_tile_rows_minus1    = (int)ffnv_br_get_ue(&br);
+        if (pps->num_tile_columns_minus1 < 0 || pps->num_tile_columns_minus1 >= FFNV_HEVC_MAX_TILE_COLS ||
+            pps->num_tile_rows_minus1 < 0 || pps->num_tile_rows_minus1 >= FFNV_HEVC_MAX_TILE_ROWS)
+            return -1;
+        pps->uniform_spacing_flag = ffnv_br_get_bit(&br);
+        if (!pps->uniform_spacing_flag) {
+            for (i = 0; i < pps->num_tile_columns_minus1; i++)
+                pps->column_width_minus1[i] = (int)ffnv_br_get_ue(&br);
+            for (i = 0; i < pps->num_tile_rows_minus1; i++)
+                pps->row_height_minus1[i] = (int)ffnv_br_get_ue(&br);
+        }
+        pps->loop_filter_across_tiles_enabled_flag = ffnv_br_get_bit(&br);
+    }
+
+    pps->loop_filter_across_slices_enabled_flag = ffnv_br_get_bit(&br);
+    if (ffnv_br_get_bit(&br)) {
+        pps->deblocking_filter_override_enabled_flag = ffnv_br_get_bit(&br);
+        pps->pps_deblocking_filter_disabled_flag     = ffnv_br_get_bit(&br);
+        if (!pps->pps_deblocking_filter_disabled_flag) {
+            pps->pps_beta_offset_div2 = ffnv_br_get_se(&br);
+            pps->pps_tc_offset_div2   = ffnv_br_get_se(&br);
+        }
+    }
+
+    pps->scaling_list_data_present_flag = ffnv_br_get_bit(&br);
+    if (pps->scaling_list_data_present_flag) {
+        ffnv_hevc_scaling_defaults(&pps->scaling);
+        if (ffnv_hevc_scaling_list_data(&br, &pps->scaling) < 0)
+            return -1;
+    }
+
+    pps->lists_modification_present_flag             = ffnv_br_get_bit(&br);
+    pps->log2_parallel_merge_level_minus2            = (int)ffnv_br_get_ue(&br);
+    pps->slice_segment_header_extension_present_flag = ffnv_br_get_bit(&br);
+
+    if (ffnv_br_overread(&br))
+        return -1;
+
+    if (ffnv_br_get_bit(&br) && ffnv_br_get_bit(&br)) {
+        /* pps_range_extension() */
+        ffnv_br_skip(&br, 7);
+        if (pps->transform_skip_enabled_flag)
+            pps->log2_max_transform_skip_block_size_minus2 = (int)ffnv_br_get_ue(&br);
+        ffnv_br_skip(&br, 1);
+        if (ffnv_br_get_bit(&br)) {
+            ffnv_br_get_ue(&br);
+            v = ffnv_br_get_ue(&br);
+            for (i = 0; i <= (int)v && i < 6; i++) {
+                ffnv_br_get_se(&br);
+                ffnv_br_get_se(&br);
+            }
+        }
+        pps->log2_sao_offset_scale_luma   = (int)ffnv_br_get_ue(&br);
+        pps->log2_sao_offset_scale_chroma = (int)ffnv_br_get_ue(&br);
+        if (ffnv_br_overread(&br))
+            return -1;
+    }
+
+    pps->valid = 1;
+    return 0;
+}
+
+/* Parse the header of a first slice segment up to the reference picture set. */
+static inline int ffnv_hevc_parse_slice_header(FFNVHEVCParser *p, const uint8_t *nal, size_t size,
+                                               FFNVHEVCSliceHeader *sh)
+{
+    const FFNVHEVCSPS *sps;
+    const FFNVHEVCPPS *pps;
+    FFNVBitReader br;
+    uint32_t v;
+    int lsb_bits, i;
+
+    if (ffnv_hevc_load_rbsp(p, &br, nal, size) < 0)
+        return -1;
+
+    memset(sh, 0, sizeof(*sh));
+    sh->nal_unit_type   = (nal[0] >> 1) & 0x3f;
+    sh->temporal_id     = (nal[1] & 7) - 1;
+    sh->pic_output_flag = 1;
+
+    if (!ffnv_br_get_bit(&br))
+        return -1;
+    if (sh->nal_unit_type >= FFNV_HEVC_NAL_BLA_W_LP && sh->nal_unit_type <= 23)
+        ffnv_br_skip(&br, 1);
+
+    v = ffnv_br_get_ue(&br);
+    if (v >= FFNV_HEVC_MAX_PPS || !p->pps[v].valid || !p->sps[p->pps[v].sps_id].valid)
+        return -1;
+    sh->pps_id = (int)v;
+    pps = &p->pps[v];
+    sps = &p->sps[pps->sps_id];
+
+    ffnv_br_skip(&br, pps->num_extra_slice_header_bits);
+    if (ffnv_br_get_ue(&br) > 2)
+        return -1;
+    if (pps->output_flag_present_flag)
+        sh->pic_output_flag = ffnv_br_get_bit(&br);
+    if (sps->separate_colour_plane_flag)
+        ffnv_br_skip(&br, 2);
+
+    if (sh->nal_unit_type == FFNV_HEVC_NAL_IDR_W_RADL || sh->nal_unit_type == FFNV_HEVC_NAL_IDR_N_LP)
+        return ffnv_br_overread(&br) ? -1 : 0;
+
+    lsb_bits = sps->log2_max_pic_order_cnt_lsb_minus4 + 4;
+    sh->pic_order_cnt_lsb = (int)ffnv_br_get_bits(&br, lsb_bits);
+
+    if (!ffnv_br_get_bit(&br)) {
+        size_t start = br.index;
+
+        if (ffnv_hevc_st_rps(&br, sps, &sh->st_rps, sps->num_short_term_ref_pic_sets,
+                             &sh->st_rps_ref_num_delta_pocs) < 0)
+            return -1;
+        sh->st_rps_bits = (int)(br.index - start);
+    } else {
+        v = ffnv_br_get_bits(&br, ffnv_hevc_ceil_log2(sps->num_short_term_ref_pic_sets));
+        if (v >= (uint32_t)sps->num_short_term_ref_pic_sets)
+            return -1;
+        sh->st_rps = sps->st_rps[v];
+    }
+
+    if (sps->long_term_ref_pics_present_flag) {
+        uint32_t nb_sps = 0, nb_pics;
+
+        if (sps->num_long_term_ref_pics_sps > 0)
+            nb_sps = ffnv_br_get_ue(&br);
+        nb_pics = ffnv_br_get_ue(&br);
+        if (nb_sps > (uint32_t)sps->num_long_term_ref_pics_sps || nb_pics > FFNV_HEVC_MAX_LT_REFS ||
+            nb_sps + nb_pics > FFNV_HEVC_MAX_LT_REFS)
+            return -1;
+        sh->num_long_term = (int)(nb_sps + nb_pics);
+
+        for (i = 0; i < sh->num_long_term; i++) {
+            int cycle = 0;
+
+            if (i < (int)nb_sps) {
+                v = ffnv_br_get_bits(&br, ffnv_hevc_ceil_log2(sps->num_long_term_ref_pics_sps));
+                if (v >= (uint32_t)sps->num_long_term_ref_pics_sps)
+                    return -1;
+                sh->lt_poc_lsb[i] = sps->lt_ref_pic_poc_lsb_sps[v];
+                sh->lt_used[i]    = sps->used_by_curr_pic_lt_sps_flag[v];
+            } else {
+                sh->lt_poc_lsb[i] = (int)ffnv_br_get_bits(&br, lsb_bits);
+                sh->lt_used[i]    = (uint8_t)ffnv_br_get_bit(&br);
+            }
+
+            sh->lt_msb_present[i] = (uint8_t)ffnv_br_get_bit(&br);
+            if (sh->lt_msb_present[i])
+                cycle = (int)ffnv_br_get_ue(&br);
+
+            /* (7-52) */
+            if (i && i != (int)nb_sps)
+                cycle += sh->lt_msb_cycle[i - 1];
+            sh->lt_msb_cycle[i] = cycle;
+        }
+    }
+
+    return ffnv_br_overread(&br) ? -1 : 0;
+}
+
+static inline int ffnv_hevc_is_irap(int nal_unit_type)
+{
+    return nal_unit_type >= FFNV_HEVC_NAL_BLA_W_LP && nal_unit_type <= 23;
+}
+
+/* Derive column widths and row heights in CTBs for the current picture. */
+static inline int ffnv_hevc_tiles(FFNVHEVCParser *p)
+{
+    const FFNVHEVCSPS *sps = p->cur_sps;
+    const FFNVHEVCPPS *pps = p->cur_pps;
+    const int log2_ctb = sps->log2_min_luma_coding_block_size_minus3 + 3 +
+                         sps->log2_diff_max_min_luma_coding_block_size;
+    const int w = (sps->width  + (1 << log2_ctb) - 1) >> log2_ctb;
+    const int h = (sps->height + (1 << log2_ctb) - 1) >> log2_ctb;
+    const int cols = pps->num_tile_columns_minus1 + 1;
+    const int rows = pps->num_tile_rows_minus1 + 1;
+    int i, sum;
+
+    if (!pps->tiles_enabled_flag)
+        return 0;
+    if (cols > w || rows > h)
+        return -1;
+
+    if (pps->uniform_spacing_flag) {
+        for (i = 0; i < cols; i++)
+            p->col_width[i] = (uint16_t)((i + 1) * w / cols - i * w / cols);
+        for (i = 0; i < rows; i++)
+            p->row_height[i] = (uint16_t)((i + 1) * h / rows - i * h / rows);
+        return 0;
+    }
+
+    for (i = sum = 0; i < cols - 1; i++) {
+        p->col_width[i] = (uint16_t)(pps->column_width_minus1[i] + 1);
+        sum += p->col_width[i];
+    }
+    if (sum >= w)
+        return -1;
+    p->col_width[cols - 1] = (uint16_t)(w - sum);
+
+    for (i = sum = 0; i < rows - 1; i++) {
+        p->row_height[i] = (uint16_t)(pps->row_height_minus1[i] + 1);
+        sum += p->row_height[i];
+    }
+    if (sum >= h)
+        return -1;
+    p->row_height[rows - 1] = (uint16_t)(h - sum);
+    return 0;
+}
+
+/* PicOrderCntVal (8.3.1) */
+static inline int ffnv_hevc_compute_poc(const FFNVHEVCParser *p, int no_rasl)
+{
+    const int max_lsb  = 1 << (p->cur_sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+    const int lsb      = p->sh.pic_order_cnt_lsb;
+    const int prev_lsb = p->prev_tid0_poc & (max_lsb - 1);
+    const int prev_msb = p->prev_tid0_poc - prev_lsb;
+
+    if (no_rasl)
+        return lsb;
+    if (lsb < prev_lsb && prev_lsb - lsb >= max_lsb / 2)
+        return prev_msb + max_lsb + lsb;
+    if (lsb > prev_lsb && lsb - prev_lsb > max_lsb / 2)
+        return prev_msb - max_lsb + lsb;
+    return prev_msb + lsb;
+}
+
+static inline void ffnv_hevc_update_busy(FFNVHEVCParser *p)
+{
+    int i;
+
+    p->pool.busy_ref = 0;
+    for (i = 0; i < p->nb_refs; i++)
+        ffnv_pool_set_ref(&p->pool, p->refs[i].pic_idx, 1);
+}
+
+static inline int ffnv_hevc_remap_refs(uint8_t *list, int n, const uint8_t *remap, int missing)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        list[i] = remap[list[i]];
+        if (list[i] == 0xff) {
+            if (missing < 0)
+                return -1;
+            list[i] = (uint8_t)missing;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reference picture set (8.3.2): mark the pictures of the current RPS and
+ * drop all others. Missing references used by the current picture are
+ * replaced by the one closest in output order. Returns -1 if the picture
+ * needs references but none are left.
+ */
+static inline int ffnv_hevc_apply_rps(FFNVHEVCParser *p)
+{
+    const FFNVHEVCSliceHeader *sh = &p->sh;
+    const FFNVHEVCShortTermRPS *rps = &sh->st_rps;
+    const int max_lsb = 1 << (p->cur_sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+    uint8_t keep[FFNV_HEVC_MAX_REFS], remap[FFNV_HEVC_MAX_REFS + 1];
+    int i, j, n, best;
+
+    memset(keep, 0, sizeof(keep));
+    p->nb_st_curr_before = p->nb_st_curr_after = p->nb_lt_curr = 0;
+
+    /* long-term entries first, they may match pictures so far marked short-term */
+    for (i = 0; i < sh->num_long_term; i++) {
+        int poc = sh->lt_poc_lsb[i], mask = max_lsb - 1;
+
+        if (sh->lt_msb_present[i]) {
+            poc += p->poc - sh->lt_msb_cycle[i] * max_lsb - (p->poc & (max_lsb - 1));
+            mask = -1;
+        }
+        for (j = 0; j < p->nb_refs; j++) {
+            if ((p->refs[j].poc & mask) == poc)
+                break;
+        }
+        if (j < p->nb_refs) {
+            keep[j] = 1;
+            p->refs[j].long_term = 1;
+        }
+        if (sh->lt_used[i] && p->nb_lt_curr < 8)
+            p->lt_curr[p->nb_lt_curr++] = (uint8_t)j;
+    }
+
+    for (i = 0; i < rps->num_negative_pics + rps->num_positive_pics; i++) {
+        const int poc = p->poc + rps->delta_poc[i];
+
+        for (j = 0; j < p->nb_refs; j++) {
+            if (!p->refs[j].long_term && p->refs[j].poc == poc)
+                break;
+        }
+        if (j < p->nb_refs)
+            keep[j] = 1;
+        if (!rps->used[i])
+            continue;
+        if (i < rps->num_negative_pics && p->nb_st_curr_before < 8)
+            p->st_curr_before[p->nb_st_curr_before++] = (uint8_t)j;
+        else if (i >= rps->num_negative_pics && p->nb_st_curr_after < 8)
+            p->st_curr_after[p->nb_st_curr_after++] = (uint8_t)j;
+    }
+
+    /* drop the pictures not in the RPS, missing ones map to nb_refs */
+    for (i = n = 0; i < p->nb_refs; i++) {
+        remap[i] = (uint8_t)n;
+        if (keep[i])
+            p->refs[n++] = p->refs[i];
+    }
+    remap[p->nb_refs] = 0xff;
+    p->nb_refs = n;
+
+    for (i = 0, best = -1; i < n; i++) {
+        if (best < 0 || abs(p->refs[i].poc - p->poc) < abs(p->refs[best].poc - p->poc))
+            best = i;
+    }
+
+    if (ffnv_hevc_remap_refs(p->st_curr_before, p->nb_st_curr_before, remap, best) < 0 ||
+        ffnv_hevc_remap_refs(p->st_curr_after,  p->nb_st_curr_after,  remap, best) < 0 ||
+        ffnv_hevc_remap_refs(p->lt_curr,        p->nb_lt_curr,        remap, best) < 0)
+        return -1;
+
+    return 0;
+}
+static inline int ffnv_hevc_sps_changed(const FFNVHEVCSPS *a, const FFNVHEVCSPS *b)
+{
+    return a->width                   != b->width                   ||
+           a->height                  != b->height                  ||
+           a->chroma_format_idc       != b->chroma_format_idc       ||
+           a->bit_depth_luma_minus8   != b->bit_depth_luma_minus8   ||
+           a->bit_depth_chroma_minus8 != b->bit_depth_chroma_minus8 ||
+           a->max_dec_pic_buffering   != b->max_dec_pic_buffering   ||
+           a->max_num_reorder_pics    != b->max_num_reorder_pics    ||
+           a->conf_left != b->conf_left || a->conf_right  != b->conf_right ||
+           a->conf_top  != b->conf_top  || a->conf_bottom != b->conf_bottom;
+}
+
+/*
+ * Set up the picture of the first slice segment in p->sh. p->cur_idx is
+ * left at -1 if the picture is skipped: leading pictures of a random
+ * access point, pictures before the first one, or pictures without any
+ * of their references.
+ */
+static inline int ffnv_hevc_start_picture(FFNVHEVCParser *p, int64_t timestamp)
+{
+    const FFNVHEVCSliceHeader *sh = &p->sh;
+    const FFNVHEVCPPS *pps = &p->pps[sh->pps_id];
+    const FFNVHEVCSPS *sps = &p->sps[pps->sps_id];
+    const int type = sh->nal_unit_type;
+    const int irap = ffnv_hevc_is_irap(type);
+    int no_rasl, missing, idx = -1;
+
+    p->cur_idx = -1;
+
+    if (!irap && p->first_picture)
+        return 0;
+    if ((type == FFNV_HEVC_NAL_RASL_N || type == FFNV_HEVC_NAL_RASL_R) && p->skip_rasl)
+        return 0;
+
+    if (!p->has_active_sps || ffnv_hevc_sps_changed(&p->active_sps, sps)) {
+        p->active_sps     = *sps;
+        p->has_active_sps = 1;
+        p->draining       = 1;
+        return FFNV_PARSE_SEQUENCE;
+    }
+
+    p->cur_sps = sps;
+    p->cur_pps = pps;
+    if (ffnv_hevc_tiles(p) < 0)
+        return FFNV_PARSE_ERROR;
+
+    /* everything up to the surface allocation can be redone on FFNV_PARSE_AGAIN */
+    no_rasl = irap && (type <= FFNV_HEVC_NAL_IDR_N_LP || p->first_picture);
+    p->poc  = ffnv_hevc_compute_poc(p, no_rasl);
+    if (no_rasl)
+        p->nb_refs = 0;
+    missing = ffnv_hevc_apply_rps(p) < 0;
+    ffnv_hevc_update_busy(p);
+
+    if (!missing) {
+        idx = ffnv_pool_get_free(&p->pool);
+        if (idx < 0)
+            return FFNV_PARSE_AGAIN;
+    }
+
+    if (no_rasl)
+        p->epoch++;
+    if (irap) {
+        p->skip_rasl     = no_rasl;
+        p->first_picture = 0;
+    }
+    /* prevTid0Pic: not a RADL, RASL or sub-layer non-reference picture */
+    if (!sh->temporal_id && (type > 14 || (type & 1)) &&
+        (type < FFNV_HEVC_NAL_RADL_N || type > FFNV_HEVC_NAL_RASL_R))
+        p->prev_tid0_poc = p->poc;
+
+    p->draining  = 0;
+    p->cur_idx   = idx;
+    p->timestamp = timestamp;
+    return 0;
+}
+
+/* Point pic at the slices, copying them only if they are not contiguous in the access unit. */
+static inline int ffnv_hevc_slice_data(FFNVHEVCParser *p, const uint8_t *au, CUVIDPICPARAMS *pic)
+{
+    size_t total = 0, pos = 0;
+    int i, contiguous = 1;
+
+    for (i = 0; i < p->nb_slices; i++) {
+        total += p->slice_end[i] - p->slice_start[i];
+        if (i && p->slice_start[i] != p->slice_end[i - 1])
+            contiguous = 0;
+    }
+    if (total > 0x7fffffff)
+        return FFNV_PARSE_ERROR;
+
+    if (contiguous) {
+        for (i = 0; i < p->nb_slices; i++)
+            p->slice_offsets[i] = (unsigned int)(p->slice_start[i] - p->slice_start[0]);
+        pic->pBitstreamData = au + p->slice_start[0];
+    } else {
+        if (ffnv_parse_grow((void**)&p->bitstream, &p->bitstream_size, (int)total, 1) < 0)
+            return FFNV_PARSE_ERROR;
+        for (i = 0; i < p->nb_slices; i++) {
+            p->slice_offsets[i] = (unsigned int)pos;
+            memcpy(p->bitstream + pos, au + p->slice_start[i], p->slice_end[i] - p->slice_start[i]);
+            pos += p->slice_end[i] - p->slice_start[i];
+        }
+        pic->pBitstreamData = p->bitstream;
+    }
+
+    pic->nBitstreamDataLen = (unsigned int)total;
+    pic->nNumSlices        = (unsigned int)p->nb_slices;
+    pic->pSliceDataOffsets = p->slice_offsets;
+    return 0;
+}
+
+static inline void ffnv_hevc_fill_pic_params(const FFNVHEVCParser *p, CUVIDPICPARAMS *pic)
+{
+    const FFNVHEVCSPS *sps = p->cur_sps;
+    const FFNVHEVCPPS *pps = p->cur_pps;
+    const FFNVHEVCSliceHeader *sh = &p->sh;
+    const int irap = ffnv_hevc_is_irap(sh->nal_unit_type);
+    CUVIDHEVCPICPARAMS *h = &pic->CodecSpecific.hevc;
+    int i;
+
+    pic->PicWidthInMbs    = sps->width  / 16;
+    pic->FrameHeightInMbs = sps->height / 16;
+    pic->CurrPicIdx       = p->cur_idx;
+    pic->ref_pic_flag     = 1;
+    pic->intra_pic_flag   = irap;
+
+    h->pic_width_in_luma_samples                    = sps->width;
+    h->pic_height_in_luma_samples                   = sps->height;
+    h->log2_min_luma_coding_block_size_minus3       = (unsigned char)sps->log2_min_luma_coding_block_size_minus3;
+    h->log2_diff_max_min_luma_coding_block_size     = (unsigned char)sps->log2_diff_max_min_luma_coding_block_size;
+    h->log2_min_transform_block_size_minus2         = (unsigned char)sps->log2_min_transform_block_size_minus2;
+    h->log2_diff_max_min_transform_block_size       = (unsigned char)sps->log2_diff_max_min_transform_block_size;
+    h->pcm_enabled_flag                             = (unsigned char)sps->pcm_enabled_flag;
+    h->log2_min_pcm_luma_coding_block_size_minus3   = (unsigned char)sps->log2_min_pcm_luma_coding_block_size_minus3;
+    h->log2_diff_max_min_pcm_luma_coding_block_size = (unsigned char)sps->log2_diff_max_min_pcm_luma_coding_block_size;
+    h->pcm_sample_bit_depth_luma_minus1             = (unsigned char)sps->pcm_sample_bit_depth_luma_minus1;
+    h->pcm_sample_bit_depth_chroma_minus1           = (unsigned char)sps->pcm_sample_bit_depth_chroma_minus1;
+    h->pcm_loop_filter_disabled_flag                = (unsigned char)sps->pcm_loop_filter_disabled_flag;
+    h->strong_intra_smoothing_enabled_flag          = (unsigned char)sps->strong_intra_smoothing_enabled_flag;
+    h->max_transform_hierarchy_depth_intra          = (unsigned char)sps->max_transform_hierarchy_depth_intra;
+    h->max_transform_hierarchy_depth_inter          = (unsigned char)sps->max_transform_hierarchy_depth_inter;
+    h->amp_enabled_flag                             = (unsigned char)sps->amp_enabled_flag;
+    h->separate_colour_plane_flag                   = (unsigned char)sps->separate_colour_plane_flag;
+    h->log2_max_pic_order_cnt_lsb_minus4            = (unsigned char)sps->log2_max_pic_order_cnt_lsb_minus4;
+    h->num_short_term_ref_pic_sets                  = (unsigned char)sps->num_short_term_ref_pic_sets;
+    h->long_term_ref_pics_present_flag              = (unsigned char)sps->long_term_ref_pics_present_flag;
+    h->num_long_term_ref_pics_sps                   = (unsigned char)sps->num_long_term_ref_pics_sps;
+    h->sps_temporal_mvp_enabled_flag                = (unsigned char)sps->sps_temporal_mvp_enabled_flag;
+    h->sample_adaptive_offset_enabled_flag          = (unsigned char)sps->sample_adaptive_offset_enabled_flag;
+    h->scaling_list_enable_flag                     = (unsigned char)sps->scaling_list_enabled_flag;
+    h->IrapPicFlag                                  = (unsigned char)irap;
+    h->IdrPicFlag                                   = sh->nal_unit_type == FFNV_HEVC_NAL_IDR_W_RADL ||
+                                                      sh->nal_unit_type == FFNV_HEVC_NAL_IDR_N_LP;
+    h->bit_depth_luma_minus8                        = (unsigned char)sps->bit_depth_luma_minus8;
+    h->bit_depth_chroma_minus8                      = (unsigned char)sps->bit_depth_chroma_minus8;
+    h->log2_max_transform_skip_block_size_minus2    = (unsigned char)pps->log2_max_transform_skip_block_size_minus2;
+    h->log2_sao_offset_scale_luma                   = (unsigned char)pps->log2_sao_offset_scale_luma;
+    h->log2_sao_offset_scale_chroma                 = (unsigned char)pps->log2_sao_offset_scale_chroma;
+    h->high_precision_offsets_enabled_flag          = (unsigned char)sps->high_precision_offsets_enabled_flag;
+
+    h->dependent_slice_segments_enabled_flag       = (unsigned char)pps->dependent_slice_segments_enabled_flag;
+    h->slice_segment_header_extension_present_flag = (unsigned char)pps->slice_segment_header_extension_present_flag;
+    h->sign_data_hiding_enabled_flag               = (unsigned char)pps->sign_data_hiding_enabled_flag;
+    h->cu_qp_delta_enabled_flag                    = (unsigned char)pps->cu_qp_delta_enabled_flag;
+    h->diff_cu_qp_delta_depth                      = (unsigned char)pps->diff_cu_qp_delta_depth;
+    h->init_qp_minus26                             = (signed char)pps->init_qp_minus26;
+    h->pps_cb_qp_offset                            = (signed char)pps->pps_cb_qp_offset;
+    h->pps_cr_qp_offset                            = (signed char)pps->pps_cr_qp_offset;
+    h->constrained_intra_pred_flag                 = (unsigned char)pps->constrained_intra_pred_flag;
+    h->weighted_pred_flag                          = (unsigned char)pps->weighted_pred_flag;
+    h->weighted_bipred_flag                        = (unsigned char)pps->weighted_bipred_flag;
+    h->transform_skip_enabled_flag                 = (unsigned char)pps->transform_skip_enabled_flag;
+    h->transquant_bypass_enabled_flag              = (unsigned char)pps->transquant_bypass_enabled_flag;
+    h->entropy_coding_sync_enabled_flag            = (unsigned char)pps->entropy_coding_sync_enabled_flag;
+    h->log2_parallel_merge_level_minus2            = (unsigned char)pps->log2_parallel_merge_level_minus2;
+    h->num_extra_slice_header_bits                 = (unsigned char)pps->num_extra_slice_header_bits;
+    h->loop_filter_across_tiles_enabled_flag       = (unsigned char)pps->loop_filter_across_tiles_enabled_flag;
+    h->loop_filter_across_slices_enabled_flag      = (unsigned char)pps->loop_filter_across_slices_enabled_flag;
+    h->output_flag_present_flag                    = (unsigned char)pps->output_flag_present_flag;
+    h->num_ref_idx_l0_default_active_minus1        = (unsigned char)pps->num_ref_idx_l0_default_active_minus1;
+    h->num_ref_idx_l1_default_active_minus1        = (unsigned char)pps->num_ref_idx_l1_default_active_minus1;
+    h->lists_modification_present_flag             = (unsigned char)pps->lists_modification_present_flag;
+    h->cabac_init_present_flag                     = (unsigned char)pps->cabac_init_present_flag;
+    h->pps_slice_chroma_qp_offsets_present_flag    = (unsigned char)pps->pps_slice_chroma_qp_offsets_present_flag;
+    h->deblocking_filter_override_enabled_flag     = (unsigned char)pps->deblocking_filter_override_enabled_flag;
+    h->pps_deblocking_filter_disabled_flag         = (unsigned char)pps->pps_deblocking_filter_disabled_flag;
+    h->pps_beta_offset_div2                        = (signed char)pps->pps_beta_offset_div2;
+    h->pps_tc_offset_div2                          = (signed char)pps->pps_tc_offset_div2;
+    h->tiles_enabled_flag                          = (unsigned char)pps->tiles_enabled_flag;
+    h->uniform_spacing_flag                        = (unsigned char)pps->uniform_spacing_flag;
+    h->num_tile_columns_minus1                     = (unsigned char)pps->num_tile_columns_minus1;
+    h->num_tile_rows_minus1                        = (unsigned char)pps->num_tile_rows_minus1;
+
+    if (pps->tiles_enabled_flag) {
+        for (i = 0; i <= pps->num_tile_columns_minus1; i++)
+            h->column_width_minus1[i] = (unsigned short)(p->col_width[i] - 1);
+        for (i = 0; i <= pps->num_tile_rows_minus1; i++)
+            h->row_height_minus1[i] = (unsigned short)(p->row_height[i] - 1);
+    }
+
+    h->NumBitsForShortTermRPSInSlice = sh->st_rps_bits;
+    h->NumDeltaPocsOfRefRpsIdx       = sh->st_rps_ref_num_delta_pocs;
+    h->NumPocTotalCurr               = p->nb_st_curr_before + p->nb_st_curr_after + p->nb_lt_curr;
+    h->NumPocStCurrBefore            = p->nb_st_curr_before;
+    h->NumPocStCurrAfter             = p->nb_st_curr_after;
+    h->NumPocLtCurr                  = p->nb_lt_curr;
+    h->CurrPicOrderCntVal            = p->poc;
+
+    for (i = 0; i < 16; i++) {
+        if (i < p->nb_refs) {
+            h->RefPicIdx[i]      = p->refs[i].pic_idx;
+            h->PicOrderCntVal[i] = p->refs[i].poc;
+            h->IsLongTerm[i]     = (unsigned char)p->refs[i].long_term;
+        } else {
+            h->RefPicIdx[i] = -1;
+        }
+    }
+    memcpy(h->RefPicSetStCurrBefore, p->st_curr_before, p->nb_st_curr_before);
+    memcpy(h->RefPicSetStCurrAfter,  p->st_curr_after,  p->nb_st_curr_after);
+    memcpy(h->RefPicSetLtCurr,       p->lt_curr,        p->nb_lt_curr);
+
+    if (sps->scaling_list_enabled_flag) {
+        const FFNVHEVCScalingList *sl = pps->scaling_list_data_present_flag ? &pps->scaling : &sps->scaling;
+
+        for (i = 0; i < 6; i++) {
+            memcpy(h->ScalingList4x4[i],   sl->sl[0][i], 16);
+            memcpy(h->ScalingList8x8[i],   sl->sl[1][i], 64);
+            memcpy(h->ScalingList16x16[i], sl->sl[2][i], 64);
+            h->ScalingListDCCoeff16x16[i] = sl->dc[0][i];
+        }
+        for (i = 0; i < 2; i++) {
+            memcpy(h->ScalingList32x32[i], sl->sl[3][i * 3], 64);
+            h->ScalingListDCCoeff32x32[i] = sl->dc[1][i * 3];
+        }
+    }
+}
+
+static inline int ffnv_hevc_end_picture(FFNVHEVCParser *p, const uint8_t *au, CUVIDPICPARAMS *pic)
+{
+    CUVIDPARSERDISPINFO disp;
+
+    if (ffnv_hevc_slice_data(p, au, pic) < 0)
+        return FFNV_PARSE_ERROR;
+
+    /* pic params use the DPB state before the current picture is added */
+    ffnv_hevc_fill_pic_params(p, pic);
+
+    if (p->nb_refs == FFNV_HEVC_MAX_REFS)
+        memmove(p->refs, p->refs + 1, --p->nb_refs * sizeof(*p->refs));
+    p->refs[p->nb_refs].pic_idx   = p->cur_idx;
+    p->refs[p->nb_refs].poc       = p->poc;
+    p->refs[p->nb_refs].long_term = 0;
+    p->nb_refs++;
+
+    if (p->sh.pic_output_flag) {
+        memset(&disp, 0, sizeof(disp));
+        disp.picture_index     = p->cur_idx;
+        disp.progressive_frame = !p->cur_sps->field_seq_flag;
+        disp.top_field_first   = 1;
+        disp.timestamp         = p->timestamp;
+        ffnv_pool_queue(&p->pool, (p->epoch << 32) + p->poc, &disp);
+    }
+
+    ffnv_hevc_update_busy(p);
+    return FFNV_PARSE_PICTURE;
+}
+
+/**
+ * Parse one access unit and fill pic for cuvidDecodePicture().
+ *
+ * Returns FFNV_PARSE_PICTURE if pic was filled, 0 if the access unit
+ * holds no decodable picture, or a negative FFNV_PARSE_* error code.
+ * FFNV_PARSE_SEQUENCE is returned alone when a picture starts a new
+ * sequence: output all pending pictures, (re)create the decoder from
+ * ffnv_hevc_get_format() and pass the same access unit again.
+ */
+static inline int ffnv_hevc_parse_au(FFNVHEVCParser *p, const uint8_t *au, size_t size,
+                                     int64_t timestamp, CUVIDPICPARAMS *pic)
+{
+    FFNVAnnexBNAL nal, next;
+    size_t pos = 0;
+    int have_nal, have_next, have_pic = 0, ret;
+
+    memset(pic, 0, sizeof(*pic));
+    p->nb_slices = 0;
+
+    have_nal = ffnv_annexb_next_nal(cudaVideoCodec_HEVC, au, size, &pos, &nal);
+    for (; have_nal; nal = next, have_nal = have_next) {
+        const uint8_t *data;
+        size_t end, len;
+
+        have_next = ffnv_annexb_next_nal(cudaVideoCodec_HEVC, au, size, &pos, &next);
+        end  = have_next ? next.offset : size;
+        data = au + nal.data_offset;
+        len  = end - nal.data_offset;
+
+        /* base layer only */
+        if (len < 2 || (data[0] & 1) || data[1] >> 3)
+            continue;
+
+        switch (nal.type) {
+        case FFNV_HEVC_NAL_SPS:
+            ffnv_hevc_parse_sps(p, data, len);
+            break;
+        case FFNV_HEVC_NAL_PPS:
+            ffnv_hevc_parse_pps(p, data, len);
+            break;
+        case FFNV_HEVC_NAL_EOS:
+        case FFNV_HEVC_NAL_EOB:
+            p->first_picture = 1;
+            break;
+        default:
+            if (nal.type > FFNV_HEVC_NAL_CRA || len < 3 ||
+                (nal.type > FFNV_HEVC_NAL_RASL_R && nal.type < FFNV_HEVC_NAL_BLA_W_LP))
+                break;
+
+            /* first_slice_segment_in_pic_flag */
+            if (data[2] & 0x80) {
+                if (have_pic) {
+                    /* the next picture, the access unit was not split */
+                    have_next = 0;
+                    break;
+                }
+                if (ffnv_hevc_parse_slice_header(p, data, len, &p->sh) < 0)
+                    break;
+
+                ret = ffnv_hevc_start_picture(p, timestamp);
+                if (ret)
+                    return ret;
+                if (p->cur_idx < 0)
+                    return 0;
+                have_pic = 1;
+            } else if (!have_pic) {
+                break;
+            }
+
+            if (p->nb_slices >= FFNV_HEVC_MAX_SLICES)
+                return FFNV_PARSE_ERROR;
+            p->slice_start[p->nb_slices] = nal.offset;
+            p->slice_end[p->nb_slices]   = end;
+            p->nb_slices++;
+            break;
+        }
+    }
+
+    if (!have_pic)
+        return 0;
+    return ffnv_hevc_end_picture(p, au, pic);
+}
+
+/**
+ * Get the next picture to map in display order. Returns 1 if disp was
+ * filled, 0 if no picture is ready yet. The surface must be handed back
+ * with ffnv_hevc_release() once it has been unmapped.
+ */
+static inline int ffnv_hevc_get_display(FFNVHEVCParser *p, CUVIDPARSERDISPINFO *disp)
+{
+    int delay = p->draining ? 0 : p->display_delay >= 0 ? p->display_delay : p->active_sps.max_num_reorder_pics;
+
+    return ffnv_pool_output(&p->pool, delay, disp);
+}
+
+static inline void ffnv_hevc_release(FFNVHEVCParser *p, int picture_index)
+{
+    ffnv_pool_release(&p->pool, picture_index);
+}
+
+/** Make all pending pictures available to ffnv_hevc_get_display(), e.g. at the end of the stream. */
+static inline void ffnv_hevc_flush(FFNVHEVCParser *p)
+{
+    p->draining = 1;
+}
+
+/** Format of the active sequence. Returns 0 on success, -1 if no sequence was started yet. */
+static inline int ffnv_hevc_get_format(const FFNVHEVCParser *p, CUVIDEOFORMAT *fmt)
+{
+    const FFNVHEVCSPS *sps = &p->active_sps;
+    unsigned int g, dw, dh;
+
+    if (!p->has_active_sps)
+        return -1;
+
+    memset(fmt, 0, sizeof(*fmt));
+    fmt->codec = cudaVideoCodec_HEVC;
+    if (sps->num_units_in_tick && sps->time_scale) {
+        g = ffnv_parse_gcd(sps->time_scale, sps->num_units_in_tick);
+        fmt->frame_rate.numerator   = sps->time_scale / g;
+        fmt->frame_rate.denominator = sps->num_units_in_tick / g;
+    }
+    fmt->progressive_sequence    = !sps->field_seq_flag;
+    fmt->bit_depth_luma_minus8   = (unsigned char)sps->bit_depth_luma_minus8;
+    fmt->bit_depth_chroma_minus8 = (unsigned char)sps->bit_depth_chroma_minus8;
+    fmt->coded_width             = (unsigned int)sps->width;
+    fmt->coded_height            = (unsigned int)sps->height;
+    fmt->display_area.left       = sps->conf_left;
+    fmt->display_area.top        = sps->conf_top;
+    fmt->display_area.right      = sps->width  - sps->conf_right;
+    fmt->display_area.bottom     = sps->height - sps->conf_bottom;
+    fmt->chroma_format           = (cudaVideoChromaFormat)sps->chroma_format_idc;
+
+    dw = (unsigned int)(fmt->display_area.right  - fmt->display_area.left);
+    dh = (unsigned int)(fmt->display_area.bottom - fmt->display_area.top);
+    if (sps->sar_width && sps->sar_height) {
+        dw *= sps->sar_width;
+        dh *= sps->sar_height;
+    }
+    g = ffnv_parse_gcd(dw, dh);
+    fmt->display_aspect_ratio.x = (int)(dw / g);
+    fmt->display_aspect_ratio.y = (int)(dh / g);
+
+    fmt->video_signal_description.video_format             = sps->video_format & 7;
+    fmt->video_signal_description.video_full_range_flag    = sps->video_full_range_flag & 1;
+    fmt->video_signal_description.color_primaries          = (unsigned char)sps->colour_primaries;
+    fmt->video_signal_description.transfer_characteristics = (unsigned char)sps->transfer_characteristics;
+    fmt->video_signal_description.matrix_coefficients      = (unsigned char)sps->matrix_coefficients;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,699 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Bitstream ingest of many files at once from one thread, for feeding
+ * cuvidParseVideoData without a blocking reader thread per stream.
+ *
+ * FFNVIngest owns a pool of equally sized buffers and reads the streams
+ * into them in rounds, one buffer per stream and round, with up to depth
+ * reads in flight per stream. On Linux the reads of a round go to an
+ * io_uring with a single io_uring_enter; the pool is registered with the
+ * ring so they are READ_FIXED reads, or READV where registering fails
+ * (RLIMIT_MEMLOCK). Where no io_uring can be set up, ffnv_ingest_reap()
+ * reads the queued buffers with pread.
+ *
+ * Completed buffers are delivered to a callback in file order per
+ * stream, and go back to the pool when the callback returns. The parser
+ * consumes packets synchronously, so ffnv_ingest_parse() passes the
+ * buffer as the packet payload without a copy. The streams are regular
+ * files whose size is taken when they are added.
+ */
+
+#ifndef FFNV_CUVID_INGEST_H
+#define FFNV_CUVID_INGEST_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dynlink_loader.h"
+
+#if defined(_WIN32)
+# include <io.h>
+# include <windows.h>
+#else
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  define FFNV_INGEST_URING 1
+# endif
+#endif
+
+#ifdef FFNV_INGEST_URING
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# include "ffnv_atomic.h"
+
+/* the same on all architectures but alpha, older libcs lack them */
+# ifndef __NR_io_uring_setup
+#  define __NR_io_uring_setup    425
+#  define __NR_io_uring_enter    426
+#  define __NR_io_uring_register 427
+# endif
+#endif
+
+#define FFNV_INGEST_MAX_DEPTH 16
+
+typedef struct FFNVIngestBuffer {
+    uint8_t *data;
+    uint32_t size;     /**< bytes read */
+    int eos;           /**< last buffer of the stream */
+    int error;         /**< negative errno of a failed or short read, with eos set and size 0 */
+    int stream;
+    uint64_t offset;   /**< file offset of data */
+    void *opaque;      /**< of the stream */
+
+    uint32_t seq;      /* position in the stream */
+    uint32_t len;      /* bytes requested */
+    int complete;
+#ifdef FFNV_INGEST_URING
+    struct iovec iov;  /* for READV, valid until the read completes */
+#endif
+} FFNVIngestBuffer;
+
+/**
+ * Called with each buffer in file order. The data is only valid until it
+ * returns; returning a negative value drops the rest of the stream.
+ * It must not call the ingest functions.
+ */
+typedef int (*FFNVIngestDeliver)(void *opaque, const FFNVIngestBuffer *buf);
+
+typedef struct FFNVIngestStream {
+    int fd;
+    int active;        /* added and not finished, or reads of it still in flight */
+    int done;          /* eos delivered or dropped */
+    int in_flight;
+    uint64_t size;
+    uint64_t offset;   /* of the next read */
+    uint32_t seq_submit, seq_deliver;
+    int slots[FFNV_INGEST_MAX_DEPTH];  /* buffer of each seq % depth not delivered, -1 if none */
+    void *opaque;
+} FFNVIngestStream;
+
+typedef struct FFNVIngestStats {
+    uint64_t nb_reads;
+    uint64_t nb_bytes;
+    uint64_t nb_syscalls;  /**< io_uring_enter or pread calls */
+    uint64_t nb_errors;
+} FFNVIngestStats;
+
+typedef struct FFNVIngest {
+    FFNVIngestDeliver deliver;
+
+    uint8_t *pool;
+    FFNVIngestBuffer *buffers;
+    int *free_list;
+    int nb_free;
+    int nb_buffers;
+    uint32_t buf_size;
+
+    FFNVIngestStream *streams;
+    int nb_streams, max_streams;
+    int nb_active;
+    int next_stream;   /* first to get a buffer in the next round */
+    int depth;
+    int in_flight;
+
+    /* pread fallback: reads queued by submit, done by reap */
+    int *queue;
+    int queue_head, nb_queued;
+
+    int ring_fd;       /* -1 without io_uring */
+    int fixed;         /* buffers registered */
+#ifdef FFNV_INGEST_URING
+    void *ring;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    volatile uint32_t *sq_head, *sq_tail, *sq_array;
+    volatile uint32_t *cq_head, *cq_tail;
+    struct io_uring_cqe *cqes;
+    uint32_t sq_mask, sq_entries, cq_mask;
+    uint32_t to_submit;    /* in the SQ, not taken by the kernel yet */
+#endif
+
+    FFNVIngestStats stats;
+} FFNVIngest;
+
+#ifdef FFNV_INGEST_URING
+static inline int ffnv_ingest_uring_enter(FFNVIngest *in, uint32_t to_submit, uint32_t min_complete)
+{
+    long ret;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, in->ring_fd, to_submit, min_complete,
+                      min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    in->stats.nb_syscalls++;
+    return ret < 0 ? -errno : (int)ret;
+}
+
+static inline void ffnv_ingest_uring_close(FFNVIngest *in)
+{
+    if (in->sqes)
+        munmap(in->sqes, in->sqes_size);
+    if (in->ring)
+        munmap(in->ring, in->ring_size);
+    if (in->ring_fd >= 0)
+        close(in->ring_fd);
+    in->sqes    = NULL;
+    in->ring    = NULL;
+    in->ring_fd = -1;
+    in->fixed   = 0;
+}
+
+/* Returns 0 on success, -1 if io_uring is not available (old kernel, seccomp). */
+static inline int ffnv_ingest_uring_open(FFNVIngest *in)
+{
+    struct io_uring_params p;
+    struct iovec *iov;
+    size_t sq_size, cq_size;
+    uint8_t *ring;
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    in->ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)in->nb_buffers, &p);
+    if (in->ring_fd < 0)
+        return -1;
+
+    /* a CQ of its own needs a second mapping, only pre 5.4 kernels do that */
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+        goto fail;
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    in->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring = (uint8_t*)mmap(NULL, in->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          in->ring_fd, IORING_OFF_SQ_RING);
+    if (ring == (uint8_t*)MAP_FAILED)
+        goto fail;
+    in->ring = ring;
+
+    in->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    in->sqes = (struct io_uring_sqe*)mmap(NULL, in->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                          in->ring_fd, IORING_OFF_SQES);
+    if (in->sqes == (struct io_uring_sqe*)MAP_FAILED) {
+        in->sqes = NULL;
+        goto fail;
+    }
+
+    in->sq_head    = (volatile uint32_t*)(ring + p.sq_off.head);
+    in->sq_tail    = (volatile uint32_t*)(ring + p.sq_off.tail);
+    in->sq_array   = (volatile uint32_t*)(ring + p.sq_off.array);
+    in->sq_mask    = *(uint32_t*)(ring + p.sq_off.ring_mask);
+    in->sq_entries = p.sq_entries;
+    in->cq_head    = (volatile uint32_t*)(ring + p.cq_off.head);
+    in->cq_tail    = (volatile uint32_t*)(ring + p.cq_off.tail);
+    in->cq_mask    = *(uint32_t*)(ring + p.cq_off.ring_mask);
+    in->cqes       = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+
+    /* pinning the pool saves mapping the pages on every read */
+    iov = (struct iovec*)malloc(in->nb_buffers * sizeof(*iov));
+    if (iov) {
+        for (i = 0; i < in->nb_buffers; i++) {
+            iov[i].iov_base = in->buffers[i].data;
+            iov[i].iov_len  = in->buf_size;
+        }
+        in->fixed = syscall(__NR_io_uring_register, in->ring_fd, IORING_REGISTER_BUFFERS,
+                            iov, (unsigned)in->nb_buffers) == 0;
+        free(iov);
+    }
+    return 0;
+
+fail:
+    ffnv_ingest_uring_close(in);
+    return -1;
+}
+
+/* Returns 0 on success, -1 if the SQ is full. */
+static inline int ffnv_ingest_uring_queue(FFNVIngest *in, int idx, int fd)
+{
+    FFNVIngestBuffer *b = &in->buffers[idx];
+    uint32_t tail = *in->sq_tail;
+    struct io_uring_sqe *sqe;
+
+    if (tail - ffnv_atomic_load(in->sq_head) >= in->sq_entries)
+        return -1;
+
+    sqe = &in->sqes[tail & in->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd        = fd;
+    sqe->off       = b->offset;
+    sqe->user_data = (uint64_t)idx;
+    if (in->fixed) {
+        sqe->opcode    = IORING_OP_READ_FIXED;
+        sqe->addr      = (uint64_t)(uintptr_t)b->data;
+        sqe->len       = b->len;
+        sqe->buf_index = (uint16_t)idx;
+    } else {
+        b->iov.iov_base = b->data;
+        b->iov.iov_len  = b->len;
+        sqe->opcode     = IORING_OP_READV;
+        sqe->addr       = (uint64_t)(uintptr_t)&b->iov;
+        sqe->len        = 1;
+    }
+    in->sq_array[tail & in->sq_mask] = tail & in->sq_mask;
+    ffnv_atomic_store(in->sq_tail, tail + 1);
+    in->to_submit++;
+    return 0;
+}
+#endif
+
+/* Read size bytes at offset, returns the bytes read or a negative errno. */
+static inline int64_t ffnv_ingest_pread(int fd, void *data, uint32_t size, uint64_t offset)
+{
+#if defined(_WIN32)
+    OVERLAPPED ov;
+    DWORD n;
+
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset     = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    if (!ReadFile((HANDLE)_get_osfhandle(fd), data, size, &n, &ov))
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -EIO;
+    return n;
+#else
+    uint32_t done = 0;
+    ssize_t ret;
+
+    while (done < size) {
+# if !defined(__GLIBC__) || defined(__USE_UNIX98) || defined(__USE_XOPEN2K8)
+        ret = pread(fd, (uint8_t*)data + done, size - done, (off_t)(offset + done));
+# else
+        /* pread is not declared in strict ISO C builds, the fds are only read from here */
+        ret = -1;
+        if (lseek(fd, (off_t)(offset + done), SEEK_SET) >= 0)
+            ret = read(fd, (uint8_t*)data + done, size - done);
+# endif
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            return -errno;
+        if (!ret)
+            break;
+        done += (uint32_t)ret;
+    }
+    return done;
+#endif
+}
+
+static inline void ffnv_ingest_uninit(FFNVIngest *in)
+{
+#ifdef FFNV_INGEST_URING
+    ffnv_ingest_uring_close(in);
+#endif
+    free(in->pool);
+    free(in->buffers);
+    free(in->free_list);
+    free(in->queue);
+    free(in->streams);
+    memset(in, 0, sizeof(*in));
+    in->ring_fd = -1;
+}
+
+/**
+ * Set up nb_buffers buffers of buf_size bytes for up to max_streams
+ * streams with up to depth reads in flight each. With force_pread or
+ * where io_uring is not available the reads are done with pread.
+ * Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_ingest_init(FFNVIngest *in, int nb_buffers, uint32_t buf_size, int max_streams,
+                                   int depth, int force_pread, FFNVIngestDeliver deliver)
+{
+    int i;
+
+    memset(in, 0, sizeof(*in));
+    in->ring_fd = -1;
+    if (nb_buffers < 1 || !buf_size || max_streams < 1 || !deliver)
+        return -1;
+    if (depth < 1)
+        depth = 1;
+    if (depth > FFNV_INGEST_MAX_DEPTH)
+        depth = FFNV_INGEST_MAX_DEPTH;
+
+    in->deliver     = deliver;
+    in->nb_buffers  = nb_buffers;
+    in->buf_size    = buf_size;
+    in->max_streams = max_streams;
+    in->depth       = depth;
+
+    in->pool      = (uint8_t*)malloc((size_t)nb_buffers * buf_size);
+    in->buffers   = (FFNVIngestBuffer*)calloc(nb_buffers, sizeof(*in->buffers));
+    in->free_list = (int*)malloc(nb_buffers * sizeof(*in->free_list));
+    in->queue     = (int*)malloc(nb_buffers * sizeof(*in->queue));
+    in->streams   = (FFNVIngestStream*)calloc(max_streams, sizeof(*in->streams));
+    if (!in->pool || !in->buffers || !in->free_list || !in->queue || !in->streams) {
+        ffnv_ingest_uninit(in);
+        return -1;
+    }
+
+    for (i = 0; i < nb_buffers; i++) {
+        in->buffers[i].data = in->pool + (size_t)i * buf_size;
+        in->free_list[i] = nb_buffers - 1 - i;
+    }
+    in->nb_free = nb_buffers;
+
+#ifdef FFNV_INGEST_URING
+    if (!force_pread)
+        ffnv_ingest_uring_open(in);
+#else
+    (void)force_pread;
+#endif
+    return 0;
+}
+
+/** 1 if the reads go through io_uring, 0 if through pread. */
+static inline int ffnv_ingest_uses_uring(const FFNVIngest *in)
+{
+    return in->ring_fd >= 0;
+}
+
+/**
+ * Add an open file to read from its current size. The fd stays owned by
+ * the caller and must stay open until the stream is done. Returns the
+ * stream index, or -1 if all max_streams streams are still active.
+ */
+static inline int ffnv_ingest_add_stream(FFNVIngest *in, int fd, void *opaque)
+{
+    FFNVIngestStream *s = NULL;
+    int64_t size;
+    int i;
+
+#if defined(_WIN32)
+    size = _filelengthi64(fd);
+#else
+    struct stat st;
+
+    size = fstat(fd, &st) < 0 ? -1 : (int64_t)st.st_size;
+#endif
+    if (size < 0)
+        return -1;
+
+    for (i = 0; i < in->nb_streams; i++) {
+        if (!in->streams[i].active) {
+            s = &in->streams[i];
+            break;
+        }
+    }
+    if (!s) {
+        if (in->nb_streams == in->max_streams)
+            return -1;
+        i = in->nb_streams++;
+        s = &in->streams[i];
+    }
+
+    memset(s, 0, sizeof(*s));
+    memset(s->slots, -1, sizeof(s->slots));
+    s->fd     = fd;
+    s->active = 1;
+    s->size   = (uint64_t)size;
+    s->opaque = opaque;
+    in->nb_active++;
+    return i;
+}
+
+static inline void ffnv_ingest_release(FFNVIngest *in, int idx)
+{
+    in->buffers[idx].complete = 0;
+    in->free_list[in->nb_free++] = idx;
+}
+
+static inline void ffnv_ingest_finish(FFNVIngest *in, FFNVIngestStream *s)
+{
+    int i;
+
+    if (!s->done) {
+        s->done = 1;
+        /* drop the completed reads past the end, the ones in flight are dropped as they complete */
+        for (i = 0; i < in->depth; i++) {
+            if (s->slots[i] >= 0 && in->buffers[s->slots[i]].complete) {
+                ffnv_ingest_release(in, s->slots[i]);
+                s->slots[i] = -1;
+            }
+        }
+    }
+    if (!s->in_flight && s->active) {
+        s->active = 0;
+        in->nb_active--;
+    }
+}
+
+/* Deliver the completed buffers of a stream that are next in file order. */
+static inline int ffnv_ingest_deliver(FFNVIngest *in, FFNVIngestStream *s)
+{
+    int nb = 0;
+
+    while (!s->done) {
+        int slot = s->seq_deliver % in->depth, idx = s->slots[slot], ret;
+        FFNVIngestBuffer *b;
+
+        if (idx < 0 || !in->buffers[idx].complete)
+            break;
+
+        b = &in->buffers[idx];
+        s->slots[slot] = -1;
+        s->seq_deliver++;
+        if (b->error) {
+            b->eos  = 1;
+            b->size = 0;
+            in->stats.nb_errors++;
+        }
+        ret = in->deliver(s->opaque, b);
+        ffnv_ingest_release(in, idx);
+        nb++;
+        if (ret < 0 || b->eos)
+            ffnv_ingest_finish(in, s);
+    }
+    return nb;
+}
+
+/* A read is done: hand its buffer to its stream, or drop it if the stream is done. */
+static inline int ffnv_ingest_complete(FFNVIngest *in, int idx, int64_t res)
+{
+    FFNVIngestBuffer *b = &in->buffers[idx];
+    FFNVIngestStream *s = &in->streams[b->stream];
+
+    in->in_flight--;
+    s->in_flight--;
+    if (s->done) {
+        ffnv_ingest_release(in, idx);
+        ffnv_ingest_finish(in, s);
+        return 0;
+    }
+
+    b->complete = 1;
+    b->size     = res > 0 ? (uint32_t)res : 0;
+    /* the file shrank or the read failed */
+    b->error    = res < 0 ? (int)res : b->size != b->len ? -EIO : 0;
+    in->stats.nb_reads++;
+    in->stats.nb_bytes += b->size;
+    return ffnv_ingest_deliver(in, s);
+}
+
+/**
+ * Start a round of reads: each stream with data left and fewer than depth
+ * reads in flight gets a buffer, round after round while buffers are
+ * free. With io_uring they are submitted with one io_uring_enter.
+ * Returns the number of reads started, or -1 on error.
+ */
+static inline int ffnv_ingest_submit(FFNVIngest *in)
+{
+    int nb = 0, added, i;
+
+    do {
+        added = 0;
+        for (i = 0; i < in->nb_streams && in->nb_free; i++) {
+            int si = (in->next_stream + i) % in->nb_streams;
+            FFNVIngestStream *s = &in->streams[si];
+            FFNVIngestBuffer *b;
+            uint64_t left;
+            int idx;
+
+            if (!s->active || s->done || s->offset >= s->size ||
+                s->seq_submit - s->seq_deliver >= (uint32_t)in->depth)
+                continue;
+
+            idx  = in->free_list[in->nb_free - 1];
+            b    = &in->buffers[idx];
+            left = s->size - s->offset;
+
+            b->stream   = si;
+            b->opaque   = s->opaque;
+            b->offset   = s->offset;
+            b->len      = left < in->buf_size ? (uint32_t)left : in->buf_size;
+            b->seq      = s->seq_submit;
+            b->eos      = b->len == left;
+            b->error    = 0;
+            b->complete = 0;
+
+#ifdef FFNV_INGEST_URING
+            if (in->ring_fd >= 0) {
+                if (ffnv_ingest_uring_queue(in, idx, s->fd) < 0)
+                    break;
+            } else
+#endif
+            in->queue[(in->queue_head + in->nb_queued++) % in->nb_buffers] = idx;
+
+            in->nb_free--;
+            s->slots[s->seq_submit % in->depth] = idx;
+            s->seq_submit++;
+            s->offset += b->len;
+            s->in_flight++;
+            in->in_flight++;
+            added++;
+        }
+        nb += added;
+    } while (added && in->nb_free);
+
+    if (in->nb_streams)
+        in->next_stream = (in->next_stream + 1) % in->nb_streams;
+
+#ifdef FFNV_INGEST_URING
+    if (in->ring_fd >= 0 && in->to_submit) {
+        int ret = ffnv_ingest_uring_enter(in, in->to_submit, 0);
+
+        if (ret < 0 && ret != -EAGAIN && ret != -EBUSY)
+            return -1;
+        /* what the kernel did not take stays in the SQ for the next call */
+        if (ret > 0)
+            in->to_submit -= (uint32_t)ret;
+    }
+#endif
+    return nb;
+}
+
+/**
+ * Complete reads and deliver the buffers that are next in order. With
+ * wait, block until at least one read completed if any is in flight.
+ * Streams without data (empty files) deliver a single empty eos buffer.
+ * Returns the number of buffers delivered, or -1 on error.
+ */
+static inline int ffnv_ingest_reap(FFNVIngest *in, int wait)
+{
+    int nb = 0, i;
+
+    for (i = 0; i < in->nb_streams; i++) {
+        FFNVIngestStream *s = &in->streams[i];
+        FFNVIngestBuffer b;
+
+        if (!s->active || s->done || s->size)
+            continue;
+        memset(&b, 0, sizeof(b));
+        b.eos    = 1;
+        b.stream = i;
+        b.opaque = s->opaque;
+        in->deliver(s->opaque, &b);
+        ffnv_ingest_finish(in, s);
+        nb++;
+    }
+
+#ifdef FFNV_INGEST_URING
+    if (in->ring_fd >= 0) {
+        uint32_t head = *in->cq_head, tail = ffnv_atomic_load(in->cq_tail);
+
+        if (head == tail && wait && in->in_flight) {
+            int ret = ffnv_ingest_uring_enter(in, in->to_submit, 1);
+
+            if (ret < 0)
+                return -1;
+            in->to_submit -= (uint32_t)ret;
+            tail = ffnv_atomic_load(in->cq_tail);
+        }
+
+        while (head != tail) {
+            const struct io_uring_cqe *cqe = &in->cqes[head & in->cq_mask];
+            int idx = (int)cqe->user_data;
+            int64_t res = cqe->res;
+
+            /* free the CQ entry before the callback */
+            ffnv_atomic_store(in->cq_head, ++head);
+            nb += ffnv_ingest_complete(in, idx, res);
+            if (head == tail)
+                tail = ffnv_atomic_load(in->cq_tail);
+        }
+        return nb;
+    }
+#endif
+
+    (void)wait;
+    while (in->nb_queued) {
+        int idx = in->queue[in->queue_head];
+        FFNVIngestBuffer *b = &in->buffers[idx];
+        int64_t res = 0;
+
+        in->queue_head = (in->queue_head + 1) % in->nb_buffers;
+        in->nb_queued--;
+        /* reads of dropped streams are not done */
+        if (!in->streams[b->stream].done) {
+            res = ffnv_ingest_pread(in->streams[b->stream].fd, b->data, b->len, b->offset);
+            in->stats.nb_syscalls++;
+        }
+        nb += ffnv_ingest_complete(in, idx, res);
+    }
+    return nb;
+}
+
+/** Read all streams added so far to their end. Returns 0 on success, -1 on error. */
+static inline int ffnv_ingest_run(FFNVIngest *in)
+{
+    while (in->nb_active) {
+        if (ffnv_ingest_submit(in) < 0 || ffnv_ingest_reap(in, 1) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/** Pass a buffer to the parser as the payload of a packet, the end of stream with its last one. */
+static inline CUresult ffnv_ingest_parse(CuvidFunctions *cvdl, CUvideoparser parser,
+                                         const FFNVIngestBuffer *buf)
+{
+    CUVIDSOURCEDATAPACKET pkt;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.payload      = buf->data;
+    pkt.payload_size = buf->size;
+    if (buf->eos)
+        pkt.flags |= CUVID_PKT_ENDOFSTREAM;
+    return cvdl->cuvidParseVideoData(parser, &pkt);
+}
+
+/** Copy of the statistics, reset them if reset is set. */
+static inline void ffnv_ingest_stats(FFNVIngest *in, FFNVIngestStats *stats, int reset)
+{
+    *stats = in->stats;
+    if (reset)
+        memset(&in->stats, 0, sizeof(in->stats));
+}
+
+#endif
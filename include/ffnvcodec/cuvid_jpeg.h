@@ -0,0 +1,452 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Decode of JPEG images and MJPEG frames on cudaVideoCodec_JPEG decoders.
+ *
+ * ffnv_jpeg_parse() reads the frame header of a JFIF/EXIF image on the
+ * CPU, giving its size and chroma format, or rejecting the codings NVDEC
+ * does not handle (progressive, lossless, arithmetic, 12 bit, unusual
+ * subsampling), which are left to a software decoder.
+ *
+ * FFNVJpegEngine keeps one decoder per image shape (size and chroma
+ * format), replacing the least recently used one when all are taken.
+ * Every image is decoded whole, as a single slice, into the next surface
+ * of its decoder, and is mapped and handed to the output callback only
+ * once depth more images were submitted to that decoder or on flush, so
+ * the decoding of the following images overlaps the mapping.
+ * ffnv_jpeg_batch() submits a set of images grouped by shape.
+ *
+ * The calls must be made with the CUDA context current, or the engine
+ * created with the CUvideoctxlock of the context.
+ */
+
+#ifndef FFNV_CUVID_JPEG_H
+#define FFNV_CUVID_JPEG_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dynlink_loader.h"
+
+#define FFNV_JPEG_MAX_DECODERS 8
+#define FFNV_JPEG_NUM_SURFACES 8
+
+typedef struct FFNVJpegInfo {
+    int width, height;
+    cudaVideoChromaFormat chroma;
+} FFNVJpegInfo;
+
+/**
+ * Read the frame header of a JPEG image. Returns 0 on success, -1 if data
+ * is not a JPEG image or uses a coding NVDEC does not decode.
+ */
+static inline int ffnv_jpeg_parse(const uint8_t *data, size_t size, FFNVJpegInfo *info)
+{
+    size_t pos = 2;
+
+    if (size < 4 || data[0] != 0xff || data[1] != 0xd8)
+        return -1;
+
+    while (pos + 4 <= size) {
+        unsigned marker, len;
+
+        if (data[pos] != 0xff)
+            return -1;
+        while (pos < size && data[pos] == 0xff)
+            pos++;
+        if (pos + 3 > size)
+            return -1;
+        marker = data[pos++];
+
+        /* markers without a segment */
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+            continue;
+        /* end of image or start of scan before any frame header */
+        if (marker == 0xd9 || marker == 0xda)
+            return -1;
+
+        len = data[pos] << 8 | data[pos + 1];
+        if (len < 2 || pos + len > size)
+            return -1;
+
+        if (marker == 0xc0 || marker == 0xc1) {
+            const uint8_t *p = data + pos + 2;
+            unsigned nb_comps, h0, v0, hc, vc;
+
+            if (len < 8)
+                return -1;
+            nb_comps = p[5];
+            if (p[0] != 8 || len < 8 + 3 * nb_comps)
+                return -1;
+
+            info->height = p[1] << 8 | p[2];
+            info->width  = p[3] << 8 | p[4];
+            if (!info->width || !info->height)
+                return -1;
+
+            if (nb_comps == 1) {
+                info->chroma = cudaVideoChromaFormat_Monochrome;
+                return 0;
+            }
+            if (nb_comps != 3)
+                return -1;
+
+            h0 = p[7] >> 4;
+            v0 = p[7] & 15;
+            hc = p[10] >> 4;
+            vc = p[10] & 15;
+            /* both chroma components sampled alike, and at most half of luma */
+            if (p[13] != p[10] || !hc || !vc || h0 % hc || v0 % vc)
+                return -1;
+
+            if (h0 / hc == 2 && v0 / vc == 2)
+                info->chroma = cudaVideoChromaFormat_420;
+            else if (h0 / hc == 2 && v0 / vc == 1)
+                info->chroma = cudaVideoChromaFormat_422;
+            else if (h0 / hc == 1 && v0 / vc == 1)
+                info->chroma = cudaVideoChromaFormat_444;
+            else
+                return -1;
+            return 0;
+        }
+
+        /* progressive, lossless, hierarchical or arithmetic coded frames */
+        if ((marker >= 0xc2 && marker <= 0xcf) && marker != 0xc4 && marker != 0xc8 && marker != 0xcc)
+            return -1;
+
+        pos += len;
+    }
+
+    return -1;
+}
+
+/**
+ * Called with image index (as passed to ffnv_jpeg_submit()) decoded as
+ * NV12 at frame, valid until the callback returns. The surface has the
+ * size of the image rounded up to even values, so the chroma plane starts
+ * at frame + pitch * ((info->height + 1) & ~1). A negative return value
+ * is returned by the submitting call.
+ */
+typedef int (*FFNVJpegOutput)(void *opaque, int index, CUdeviceptr frame, unsigned int pitch,
+                              const FFNVJpegInfo *info);
+
+typedef struct FFNVJpegDecoder {
+    FFNVJpegInfo shape;
+    CUvideodecoder decoder;
+    int pending[FFNV_JPEG_NUM_SURFACES];  /* image indices, oldest at head */
+    int head, count;
+    uint64_t last_use;
+} FFNVJpegDecoder;
+
+typedef struct FFNVJpegEngine {
+    CuvidFunctions *cvdl;
+    CUvideoctxlock ctx_lock;
+    FFNVJpegDecoder decoders[FFNV_JPEG_MAX_DECODERS];
+    int nb_decoders;
+    int depth;
+    uint64_t clock;
+
+    CUVIDDECODECAPS caps[cudaVideoChromaFormat_444 + 1];
+    int caps_queried[cudaVideoChromaFormat_444 + 1];
+
+    FFNVJpegOutput output;
+    void *opaque;
+    CUresult last_error;        /**< result of the last failed driver call */
+
+    unsigned int nb_images;     /**< images output */
+    unsigned int nb_rejected;   /**< images refused, to decode in software */
+    unsigned int nb_created;    /**< decoders created */
+} FFNVJpegEngine;
+
+/**
+ * depth is the number of images of a shape in flight before the oldest
+ * one is output, from 1 for the lowest latency (live MJPEG) to
+ * FFNV_JPEG_NUM_SURFACES for the highest throughput (batches).
+ */
+static inline void ffnv_jpeg_init(FFNVJpegEngine *e, CuvidFunctions *cvdl, CUvideoctxlock ctx_lock,
+                                  int depth, FFNVJpegOutput output, void *opaque)
+{
+    memset(e, 0, sizeof(*e));
+    e->cvdl     = cvdl;
+    e->ctx_lock = ctx_lock;
+    e->depth    = depth < 1 ? 1 : depth > FFNV_JPEG_NUM_SURFACES ? FFNV_JPEG_NUM_SURFACES : depth;
+    e->output   = output;
+    e->opaque   = opaque;
+}
+
+/* Map, output and unmap the oldest image in flight on d. */
+static inline int ffnv_jpeg_output_one(FFNVJpegEngine *e, FFNVJpegDecoder *d)
+{
+    CUVIDPROCPARAMS vpp;
+    CUdeviceptr frame;
+    unsigned int pitch;
+    CUresult err;
+    int surface = d->head, ret;
+
+    memset(&vpp, 0, sizeof(vpp));
+    vpp.progressive_frame = 1;
+
+    d->head = (d->head + 1) % FFNV_JPEG_NUM_SURFACES;
+    d->count--;
+
+    err = e->cvdl->cuvidMapVideoFrame(d->decoder, surface, &frame, &pitch, &vpp);
+    if (err != CUDA_SUCCESS) {
+        e->last_error = err;
+        return -1;
+    }
+
+    ret = e->output(e->opaque, d->pending[surface], frame, pitch, &d->shape);
+    e->nb_images++;
+
+    err = e->cvdl->cuvidUnmapVideoFrame(d->decoder, frame);
+    if (err != CUDA_SUCCESS) {
+        e->last_error = err;
+        return -1;
+    }
+    return ret < 0 ? ret : 0;
+}
+
+static inline int ffnv_jpeg_drain(FFNVJpegEngine *e, FFNVJpegDecoder *d)
+{
+    int ret = 0;
+
+    while (d->count)
+        if (ffnv_jpeg_output_one(e, d) < 0)
+            ret = -1;
+    return ret;
+}
+
+/** Output all images in flight. Returns 0, or -1 if any failed. */
+static inline int ffnv_jpeg_flush(FFNVJpegEngine *e)
+{
+    int i, ret = 0;
+
+    for (i = 0; i < e->nb_decoders; i++)
+        if (ffnv_jpeg_drain(e, &e->decoders[i]) < 0)
+            ret = -1;
+    return ret;
+}
+
+/** Flushes, then destroys the decoders. */
+static inline void ffnv_jpeg_uninit(FFNVJpegEngine *e)
+{
+    int i;
+
+    ffnv_jpeg_flush(e);
+    for (i = 0; i < e->nb_decoders; i++)
+        e->cvdl->cuvidDestroyDecoder(e->decoders[i].decoder);
+    memset(e, 0, sizeof(*e));
+}
+
+/* Whether the hardware decodes images of this shape. */
+static inline int ffnv_jpeg_supported(FFNVJpegEngine *e, const FFNVJpegInfo *info)
+{
+    CUVIDDECODECAPS *caps = &e->caps[info->chroma];
+
+    if (!e->caps_queried[info->chroma]) {
+        memset(caps, 0, sizeof(*caps));
+        caps->eCodecType    = cudaVideoCodec_JPEG;
+        caps->eChromaFormat = info->chroma;
+        if (e->cvdl->cuvidGetDecoderCaps(caps) != CUDA_SUCCESS)
+            caps->bIsSupported = 0;
+        e->caps_queried[info->chroma] = 1;
+    }
+
+    return caps->bIsSupported &&
+           (unsigned)info->width  <= caps->nMaxWidth && (unsigned)info->height <= caps->nMaxHeight &&
+           info->width >= caps->nMinWidth && info->height >= caps->nMinHeight &&
+           ((info->width + 15) / 16) * ((info->height + 15) / 16) <= (int)caps->nMaxMBCount;
+}
+
+/* Decoder for images of shape info, created if needed. */
+static inline FFNVJpegDecoder *ffnv_jpeg_get_decoder(FFNVJpegEngine *e, const FFNVJpegInfo *info)
+{
+    CUVIDDECODECREATEINFO ci;
+    FFNVJpegDecoder *d = NULL;
+    CUresult err;
+    int i;
+
+    for (i = 0; i < e->nb_decoders; i++) {
+        d = &e->decoders[i];
+        if (d->shape.width == info->width && d->shape.height == info->height &&
+            d->shape.chroma == info->chroma) {
+            d->last_use = ++e->clock;
+            return d;
+        }
+    }
+
+    if (e->nb_decoders < FFNV_JPEG_MAX_DECODERS) {
+        d = &e->decoders[e->nb_decoders];
+    } else {
+        d = &e->decoders[0];
+        for (i = 1; i < e->nb_decoders; i++)
+            if (e->decoders[i].last_use < d->last_use)
+                d = &e->decoders[i];
+        ffnv_jpeg_drain(e, d);
+        e->cvdl->cuvidDestroyDecoder(d->decoder);
+        /* keep the table dense in case the creation below fails */
+        *d = e->decoders[--e->nb_decoders];
+        d = &e->decoders[e->nb_decoders];
+    }
+
+    memset(&ci, 0, sizeof(ci));
+    ci.ulWidth             = info->width;
+    ci.ulHeight            = info->height;
+    ci.ulNumDecodeSurfaces = FFNV_JPEG_NUM_SURFACES;
+    ci.CodecType           = cudaVideoCodec_JPEG;
+    ci.ChromaFormat        = info->chroma;
+    ci.ulCreationFlags     = cudaVideoCreate_PreferCUVID;
+    ci.ulIntraDecodeOnly   = 1;
+    ci.display_area.right  = (short)info->width;
+    ci.display_area.bottom = (short)info->height;
+    ci.OutputFormat        = cudaVideoSurfaceFormat_NV12;
+    ci.DeinterlaceMode     = cudaVideoDeinterlaceMode_Weave;
+    ci.ulTargetWidth       = (info->width  + 1) & ~1;
+    ci.ulTargetHeight      = (info->height + 1) & ~1;
+    ci.ulNumOutputSurfaces = 1;
+    ci.vidLock             = e->ctx_lock;
+
+    memset(d, 0, sizeof(*d));
+    err = e->cvdl->cuvidCreateDecoder(&d->decoder, &ci);
+    if (err != CUDA_SUCCESS) {
+        e->last_error = err;
+        return NULL;
+    }
+
+    d->shape    = *info;
+    d->last_use = ++e->clock;
+    e->nb_decoders++;
+    e->nb_created++;
+    return d;
+}
+
+/**
+ * Decode one image, identified by index in the output callback. data is
+ * not needed anymore once the call returns. Returns 0 on success, 1 if
+ * the image is not decodable by the hardware and was skipped, -1 on error.
+ */
+static inline int ffnv_jpeg_submit(FFNVJpegEngine *e, const uint8_t *data, size_t size, int index)
+{
+    static const unsigned int slice_offset = 0;
+    FFNVJpegInfo info;
+    FFNVJpegDecoder *d;
+    CUVIDPICPARAMS pic;
+    CUresult err;
+    int ret = 0;
+
+    if (ffnv_jpeg_parse(data, size, &info) < 0 || !ffnv_jpeg_supported(e, &info)) {
+        e->nb_rejected++;
+        return 1;
+    }
+
+    d = ffnv_jpeg_get_decoder(e, &info);
+    if (!d)
+        return -1;
+
+    if (d->count >= e->depth)
+        ret = ffnv_jpeg_output_one(e, d);
+
+    memset(&pic, 0, sizeof(pic));
+    pic.PicWidthInMbs     = (info.width  + 15) / 16;
+    pic.FrameHeightInMbs  = (info.height + 15) / 16;
+    pic.CurrPicIdx        = (d->head + d->count) % FFNV_JPEG_NUM_SURFACES;
+    pic.intra_pic_flag    = 1;
+    pic.nBitstreamDataLen = (unsigned int)size;
+    pic.pBitstreamData    = data;
+    pic.nNumSlices        = 1;
+    pic.pSliceDataOffsets = &slice_offset;
+
+    err = e->cvdl->cuvidDecodePicture(d->decoder, &pic);
+    if (err != CUDA_SUCCESS) {
+        e->last_error = err;
+        return -1;
+    }
+
+    d->pending[pic.CurrPicIdx] = index;
+    d->count++;
+    return ret;
+}
+
+/* qsort context is not portable, images are sorted through a shape key */
+typedef struct FFNVJpegOrder {
+    uint64_t key;
+    int index;
+} FFNVJpegOrder;
+
+static inline int ffnv_jpeg_order_cmp(const void *a, const void *b)
+{
+    const FFNVJpegOrder *x = (const FFNVJpegOrder*)a, *y = (const FFNVJpegOrder*)b;
+
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->index - y->index;
+}
+
+/**
+ * Decode nb_images images grouped by shape and flush. Images the
+ * hardware cannot decode are flagged in skipped (if not NULL). Returns
+ * the number of images decoded, or -1 on error.
+ */
+static inline int ffnv_jpeg_batch(FFNVJpegEngine *e, const uint8_t * const *data, const size_t *sizes,
+                                  int nb_images, uint8_t *skipped)
+{
+    FFNVJpegOrder *order;
+    FFNVJpegInfo info;
+    int i, ret, nb_decoded = 0;
+
+    order = (FFNVJpegOrder*)malloc(nb_images * sizeof(*order) + 1);
+    if (!order)
+        return -1;
+
+    for (i = 0; i < nb_images; i++) {
+        order[i].index = i;
+        order[i].key   = UINT64_MAX;
+        if (!ffnv_jpeg_parse(data[i], sizes[i], &info))
+            order[i].key = (uint64_t)info.chroma << 48 | (uint64_t)info.width << 24 | info.height;
+    }
+    qsort(order, nb_images, sizeof(*order), ffnv_jpeg_order_cmp);
+
+    for (i = 0; i < nb_images; i++) {
+        int idx = order[i].index;
+
+        ret = ffnv_jpeg_submit(e, data[idx], sizes[idx], idx);
+        if (ret < 0) {
+            free(order);
+            return -1;
+        }
+        if (skipped)
+            skipped[idx] = ret == 1;
+        nb_decoded += !ret;
+    }
+    free(order);
+
+    return ffnv_jpeg_flush(e) < 0 ? -1 : nb_decoded;
+}
+
+#endif
@@ -0,0 +1,402 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Keyframe sampler for thumbnails of H.264 and HEVC elementary streams.
+ *
+ * Access units are only scanned for their NAL unit types until a random
+ * access point (IDR for H.264, IRAP for HEVC) is due; everything else is
+ * dropped before it reaches the decoder, apart from parameter sets. The
+ * sampled pictures are decoded by a decoder created with
+ * ulIntraDecodeOnly set and a minimal number of surfaces, and scaled on
+ * the decode engine to the thumbnail size through ulTargetWidth and
+ * ulTargetHeight.
+ *
+ * All calls into the decoder are made from the calling thread, which must
+ * have the CUDA context current.
+ */
+
+#ifndef FFNV_CUVID_KEYFRAME_H
+#define FFNV_CUVID_KEYFRAME_H
+
+#include "dynlink_loader.h"
+#include "cuvid_h264_parser.h"
+#include "cuvid_hevc_parser.h"
+
+/* intra pictures never reference another surface, a spare one is enough */
+#define FFNV_KEYFRAME_NUM_SURFACES 2
+
+typedef struct FFNVKeyframeSampler {
+    CuvidFunctions *cvdl;
+    CUvideoctxlock ctx_lock;
+    cudaVideoCodec codec;
+    CUvideodecoder decoder;
+    FFNVH264Parser *h264;
+    FFNVHEVCParser *hevc;
+
+    int req_width, req_height;
+    int64_t interval;
+    int64_t next_timestamp;
+    int sampled_any;
+
+    CUVIDEOFORMAT format;
+    int width, height;          /**< size of the mapped thumbnails */
+
+    CUVIDPARSERDISPINFO disp;
+    int ready;                  /**< a decoded thumbnail waits to be mapped */
+    int mapped;
+    CUresult last_error;        /**< result of the last failed driver call */
+
+    unsigned int nb_access_units;
+    unsigned int nb_keyframes;
+    unsigned int nb_sampled;
+} FFNVKeyframeSampler;
+
+/** Whether the access unit holds a slice of an IDR (H.264) or base layer IRAP (HEVC) picture. */
+static inline int ffnv_keyframe_is_random_access(cudaVideoCodec codec, const uint8_t *au, size_t size)
+{
+    FFNVAnnexBNAL nal;
+    size_t pos = 0;
+
+    while (ffnv_annexb_next_nal(codec, au, size, &pos, &nal)) {
+        if (codec == cudaVideoCodec_HEVC) {
+            if (ffnv_hevc_is_irap(nal.type) && !(au[nal.data_offset] & 1) &&
+                !(au[nal.data_offset + 1] >> 3))
+                return 1;
+        } else if (nal.type == 5) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Thumbnail size for fmt fitting into width x height with the display
+ * aspect ratio kept. Either dimension may be 0 to derive it from the
+ * other. The size never exceeds the display area before being rounded up
+ * to even values.
+ */
+static inline void ffnv_keyframe_target_size(const CUVIDEOFORMAT *fmt, int width, int height,
+                                             int *out_width, int *out_height)
+{
+    int64_t dw = fmt->display_area.right  - fmt->display_area.left;
+    int64_t dh = fmt->display_area.bottom - fmt->display_area.top;
+    int64_t ax = fmt->display_aspect_ratio.x > 0 ? fmt->display_aspect_ratio.x : dw;
+    int64_t ay = fmt->display_aspect_ratio.y > 0 ? fmt->display_aspect_ratio.y : dh;
+    int64_t w, h;
+
+    if (width <= 0 && height <= 0) {
+        w = dw;
+        h = dh;
+    } else if (height <= 0 || (width > 0 && width * ay <= height * ax)) {
+        w = width;
+        h = (w * ay + ax / 2) / ax;
+    } else {
+        h = height;
+        w = (h * ax + ay / 2) / ay;
+    }
+
+    if (w > dw) w = dw;
+    if (h > dh) h = dh;
+    *out_width  = ffnv_parse_even(w < 2 ? 2 : (int)w);
+    *out_height = ffnv_parse_even(h < 2 ? 2 : (int)h);
+}
+
+/** Fill the creation parameters of an intra-only decoder producing width x height output. */
+static inline void ffnv_keyframe_decoder_info(CUVIDDECODECREATEINFO *ci, const CUVIDEOFORMAT *fmt,
+                                              int width, int height, CUvideoctxlock ctx_lock)
+{
+    memset(ci, 0, sizeof(*ci));
+    ci->ulWidth             = fmt->coded_width;
+    ci->ulHeight            = fmt->coded_height;
+    ci->ulNumDecodeSurfaces = FFNV_KEYFRAME_NUM_SURFACES;
+    ci->CodecType           = fmt->codec;
+    ci->ChromaFormat        = fmt->chroma_format;
+    ci->ulCreationFlags     = cudaVideoCreate_PreferCUVID;
+    ci->bitDepthMinus8      = fmt->bit_depth_luma_minus8;
+    ci->ulIntraDecodeOnly   = 1;
+    ci->display_area.left   = (short)fmt->display_area.left;
+    ci->display_area.top    = (short)fmt->display_area.top;
+    ci->display_area.right  = (short)fmt->display_area.right;
+    ci->display_area.bottom = (short)fmt->display_area.bottom;
+    ci->OutputFormat        = fmt->bit_depth_luma_minus8 ? cudaVideoSurfaceFormat_P016
+                                                         : cudaVideoSurfaceFormat_NV12;
+    /* an IDR field is sampled without its second field */
+    ci->DeinterlaceMode     = fmt->progressive_sequence ? cudaVideoDeinterlaceMode_Weave
+                                                        : cudaVideoDeinterlaceMode_Bob;
+    ci->ulTargetWidth       = width;
+    ci->ulTargetHeight      = height;
+    ci->ulNumOutputSurfaces = 1;
+    ci->vidLock             = ctx_lock;
+}
+
+static inline void ffnv_keyframe_sampler_uninit(FFNVKeyframeSampler *s)
+{
+    if (s->decoder)
+        s->cvdl->cuvidDestroyDecoder(s->decoder);
+    ffnv_h264_parser_free(&s->h264);
+    ffnv_hevc_parser_free(&s->hevc);
+    memset(s, 0, sizeof(*s));
+}
+
+/**
+ * Set up a sampler producing thumbnails fitting into width x height (see
+ * ffnv_keyframe_target_size()), taking a random access point only once
+ * at least interval timestamp units have passed since the last sampled
+ * one. An interval of 0 samples every random access point.
+ * Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_keyframe_sampler_init(FFNVKeyframeSampler *s, CuvidFunctions *cvdl,
+                                             CUvideoctxlock ctx_lock, cudaVideoCodec codec,
+                                             int width, int height, int64_t interval)
+{
+    int ret;
+
+    memset(s, 0, sizeof(*s));
+
+    if (codec == cudaVideoCodec_H264)
+        ret = ffnv_h264_parser_init(&s->h264, FFNV_KEYFRAME_NUM_SURFACES);
+    else if (codec == cudaVideoCodec_HEVC)
+        ret = ffnv_hevc_parser_init(&s->hevc, FFNV_KEYFRAME_NUM_SURFACES);
+    else
+        return -1;
+    if (ret < 0) {
+        ffnv_keyframe_sampler_uninit(s);
+        return -1;
+    }
+
+    s->cvdl       = cvdl;
+    s->ctx_lock   = ctx_lock;
+    s->codec      = codec;
+    s->req_width  = width;
+    s->req_height = height;
+    s->interval   = interval < 0 ? 0 : interval;
+
+    /* a sampled picture is displayed as soon as it is decoded */
+    if (s->h264)
+        s->h264->display_delay = 0;
+    else
+        s->hevc->display_delay = 0;
+    return 0;
+}
+
+/* Parse the parameter sets of an access unit that is not sampled. */
+static inline void ffnv_keyframe_param_sets(FFNVKeyframeSampler *s, const uint8_t *au, size_t size)
+{
+    FFNVAnnexBNAL nal, next;
+    size_t pos = 0;
+    int have_nal, have_next;
+
+    have_nal = ffnv_annexb_next_nal(s->codec, au, size, &pos, &nal);
+    for (; have_nal; nal = next, have_nal = have_next) {
+        const uint8_t *data = au + nal.data_offset;
+        size_t len;
+
+        have_next = ffnv_annexb_next_nal(s->codec, au, size, &pos, &next);
+        len = (have_next ? next.offset : size) - nal.data_offset;
+
+        if (s->h264) {
+            if (nal.type == 7)
+                ffnv_h264_parse_sps(s->h264, data, len);
+            else if (nal.type == 8)
+                ffnv_h264_parse_pps(s->h264, data, len);
+        } else if (!(data[0] & 1) && !(data[1] >> 3)) {
+            if (nal.type == FFNV_HEVC_NAL_SPS)
+                ffnv_hevc_parse_sps(s->hevc, data, len);
+            else if (nal.type == FFNV_HEVC_NAL_PPS)
+                ffnv_hevc_parse_pps(s->hevc, data, len);
+        }
+    }
+}
+
+/* Recreate the decoder for the sequence the parser just started. */
+static inline int ffnv_keyframe_new_sequence(FFNVKeyframeSampler *s)
+{
+    CUVIDDECODECREATEINFO ci;
+    CUresult err;
+    int ret;
+
+    if (s->decoder) {
+        s->cvdl->cuvidDestroyDecoder(s->decoder);
+        s->decoder = NULL;
+    }
+
+    ret = s->h264 ? ffnv_h264_get_format(s->h264, &s->format)
+                  : ffnv_hevc_get_format(s->hevc, &s->format);
+    if (ret < 0)
+        return -1;
+
+    ffnv_keyframe_target_size(&s->format, s->req_width, s->req_height, &s->width, &s->height);
+    ffnv_keyframe_decoder_info(&ci, &s->format, s->width, s->height, s->ctx_lock);
+
+    err = s->cvdl->cuvidCreateDecoder(&s->decoder, &ci);
+    if (err != CUDA_SUCCESS) {
+        s->last_error = err;
+        s->decoder    = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Forget all references, so that only the surface being decoded is busy. */
+static inline void ffnv_keyframe_drop_refs(FFNVKeyframeSampler *s)
+{
+    if (s->h264) {
+        s->h264->nb_refs = 0;
+        ffnv_h264_update_busy(s->h264);
+    } else {
+        /* every sampled IRAP starts a coded video sequence of its own */
+        s->hevc->first_picture = 1;
+        s->hevc->nb_refs       = 0;
+        ffnv_hevc_update_busy(s->hevc);
+    }
+}
+
+static inline void ffnv_keyframe_release(FFNVKeyframeSampler *s)
+{
+    if (s->h264)
+        ffnv_h264_release(s->h264, s->disp.picture_index);
+    else
+        ffnv_hevc_release(s->hevc, s->disp.picture_index);
+    s->ready = 0;
+}
+
+/**
+ * Pass the next access unit, e.g. as split by FFNVAnnexBSplitter. Returns
+ * 1 if a thumbnail was decoded and can be mapped with
+ * ffnv_keyframe_sampler_map(), 0 if the access unit was dropped, -1 on
+ * error. A thumbnail that was not mapped is discarded by the next call,
+ * and a mapped one must be unmapped before it.
+ */
+static inline int ffnv_keyframe_sampler_push(FFNVKeyframeSampler *s, const uint8_t *au, size_t size,
+                                             int64_t timestamp)
+{
+    CUVIDPICPARAMS pic;
+    CUresult err;
+    int ret;
+
+    if (s->mapped)
+        return -1;
+
+    s->nb_access_units++;
+    if (!ffnv_keyframe_is_random_access(s->codec, au, size)) {
+        ffnv_keyframe_param_sets(s, au, size);
+        return 0;
+    }
+
+    s->nb_keyframes++;
+    if (s->sampled_any && timestamp < s->next_timestamp) {
+        ffnv_keyframe_param_sets(s, au, size);
+        return 0;
+    }
+
+    if (s->ready)
+        ffnv_keyframe_release(s);
+    ffnv_keyframe_drop_refs(s);
+
+    for (;;) {
+        ret = s->h264 ? ffnv_h264_parse_au(s->h264, au, size, timestamp, &pic)
+                      : ffnv_hevc_parse_au(s->hevc, au, size, timestamp, &pic);
+        if (ret != FFNV_PARSE_SEQUENCE)
+            break;
+        if (ffnv_keyframe_new_sequence(s) < 0)
+            return -1;
+    }
+    if (ret < 0)
+        return -1;
+    if (ret != FFNV_PARSE_PICTURE)
+        return 0;
+
+    err = s->cvdl->cuvidDecodePicture(s->decoder, &pic);
+
+    if (s->h264) {
+        ffnv_h264_flush(s->h264);
+        s->ready = ffnv_h264_get_display(s->h264, &s->disp);
+    } else {
+        ffnv_hevc_flush(s->hevc);
+        s->ready = ffnv_hevc_get_display(s->hevc, &s->disp);
+    }
+
+    if (err != CUDA_SUCCESS) {
+        s->last_error = err;
+        if (s->ready)
+            ffnv_keyframe_release(s);
+        return -1;
+    }
+    if (!s->ready)
+        return 0;
+
+    s->sampled_any    = 1;
+    s->next_timestamp = timestamp + s->interval;
+    s->nb_sampled++;
+    return 1;
+}
+
+/**
+ * Map the thumbnail decoded by the last ffnv_keyframe_sampler_push(),
+ * s->width x s->height NV12 (P016 for high bit depth) at *dptr.
+ */
+static inline CUresult ffnv_keyframe_sampler_map(FFNVKeyframeSampler *s, CUdeviceptr *dptr,
+                                                 unsigned int *pitch, int64_t *timestamp)
+{
+    CUVIDPROCPARAMS vpp;
+    CUresult err;
+
+    if (!s->ready || s->mapped)
+        return CUDA_ERROR_NOT_READY;
+
+    memset(&vpp, 0, sizeof(vpp));
+    vpp.progressive_frame = s->disp.progressive_frame;
+    vpp.top_field_first   = s->disp.top_field_first;
+    vpp.unpaired_field    = s->disp.repeat_first_field < 0;
+
+    err = s->cvdl->cuvidMapVideoFrame(s->decoder, s->disp.picture_index, dptr, pitch, &vpp);
+    if (err != CUDA_SUCCESS) {
+        s->last_error = err;
+        return err;
+    }
+
+    if (timestamp)
+        *timestamp = s->disp.timestamp;
+    s->mapped = 1;
+    return CUDA_SUCCESS;
+}
+
+static inline CUresult ffnv_keyframe_sampler_unmap(FFNVKeyframeSampler *s, CUdeviceptr dptr)
+{
+    CUresult err;
+
+    if (!s->mapped)
+        return CUDA_ERROR_NOT_READY;
+
+    err = s->cvdl->cuvidUnmapVideoFrame(s->decoder, dptr);
+    s->mapped = 0;
+    ffnv_keyframe_release(s);
+    return err;
+}
+
+#endif
@@ -0,0 +1,723 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Memory mapped MP4/MOV demuxer for H.264 and HEVC, in place of
+ * cuvidCreateVideoSource and its demux thread.
+ *
+ * ffnv_mp4_open() maps the file and turns the sample tables of the first
+ * video track (stsz/stz2, stco/co64, stsc, stts, ctts, stss and the edit
+ * list) into an index of offset, size, PTS and key flag per sample.
+ * ffnv_mp4_next_packet() then returns the samples in decode order as
+ * parser packets, one picture each, with their PTS in the track
+ * timescale, which is to be the ulClockRate of the parser.
+ *
+ * The mapping is private and writable, so samples with 3 or 4 byte NAL
+ * lengths are turned into Annex B by overwriting each length prefix with
+ * a start code, in a single pass that touches the prefixes only. The
+ * pages written to stop being shared with the page cache and are kept
+ * until ffnv_mp4_close(). Samples with 1 or 2 byte lengths are copied.
+ * Fragmented files (moof) and compressed movie headers are not supported.
+ */
+
+#ifndef FFNV_CUVID_MP4_H
+#define FFNV_CUVID_MP4_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuvid_annexb.h"
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#define FFNV_MP4_TAG(a, b, c, d) ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (uint32_t)(d))
+
+#define FFNV_MP4_SAMPLE_KEY    0x1
+#define FFNV_MP4_SAMPLE_ANNEXB 0x2  /* converted in place */
+#define FFNV_MP4_SAMPLE_BROKEN 0x4  /* NAL lengths do not add up, skipped */
+
+typedef struct FFNVMp4Sample {
+    uint64_t offset;
+    int64_t pts;       /**< in timescale units */
+    uint32_t size;
+    uint32_t flags;    /**< FFNV_MP4_SAMPLE_* */
+} FFNVMp4Sample;
+
+typedef struct FFNVMp4Box {
+    uint32_t type;
+    const uint8_t *data;   /* payload */
+    uint64_t size;
+} FFNVMp4Box;
+
+typedef struct FFNVMp4Demuxer {
+    uint8_t *map;
+    size_t size;
+#if defined(_WIN32)
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+
+    cudaVideoCodec codec;
+    int width, height;
+    int chroma_format;                 /**< chroma_format_idc */
+    int bit_depth_luma, bit_depth_chroma;
+    uint32_t timescale;                /**< timestamp units per second */
+    unsigned int fps_num, fps_den;     /**< 0 for a variable frame rate */
+    int nal_length_size;
+
+    uint8_t seqhdr[1024];              /* parameter sets in Annex B */
+    unsigned int seqhdr_size;
+
+    FFNVMp4Sample *samples;            /**< in decode order */
+    uint32_t nb_samples;
+    uint32_t nb_broken;
+
+    uint32_t next;                     /* sample of the next packet */
+    int discontinuity;
+    int eos_sent;
+
+    uint8_t *scratch;                  /* samples with short NAL lengths */
+    size_t scratch_size;
+} FFNVMp4Demuxer;
+
+static inline uint32_t ffnv_mp4_rb16(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 8 | p[1];
+}
+
+static inline uint32_t ffnv_mp4_rb32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint64_t ffnv_mp4_rb64(const uint8_t *p)
+{
+    return (uint64_t)ffnv_mp4_rb32(p) << 32 | ffnv_mp4_rb32(p + 4);
+}
+
+/* Read the box at *p and move past it. Returns 0 at the end of [*p, end) or on a box overrunning it. */
+static inline int ffnv_mp4_next_box(const uint8_t **p, const uint8_t *end, FFNVMp4Box *box)
+{
+    uint64_t left = end - *p, size, hdr = 8;
+
+    if (left < 8)
+        return 0;
+    size = ffnv_mp4_rb32(*p);
+    box->type = ffnv_mp4_rb32(*p + 4);
+    if (size == 1) {
+        if (left < 16)
+            return 0;
+        size = ffnv_mp4_rb64(*p + 8);
+        hdr  = 16;
+    } else if (!size) {
+        size = left;
+    }
+    if (size < hdr || size > left)
+        return 0;
+
+    box->data = *p + hdr;
+    box->size = size - hdr;
+    *p += size;
+    return 1;
+}
+
+/* Find the first child of type in a payload. Returns 1 if found. */
+static inline int ffnv_mp4_find_box(const uint8_t *data, uint64_t size, uint32_t type, FFNVMp4Box *box)
+{
+    const uint8_t *p = data, *end = data + size;
+
+    while (ffnv_mp4_next_box(&p, end, box)) {
+        if (box->type == type)
+            return 1;
+    }
+    return 0;
+}
+
+/* Full box with entry_count entries of entry_size bytes after the count (and skip bytes). Returns the count or -1. */
+static inline int64_t ffnv_mp4_table(const FFNVMp4Box *box, unsigned int skip, unsigned int entry_size)
+{
+    uint64_t n;
+
+    if (box->size < 8 + skip)
+        return -1;
+    n = ffnv_mp4_rb32(box->data + 4 + skip);
+    if (n * entry_size > box->size - 8 - skip)
+        return -1;
+    return (int64_t)n;
+}
+
+/* Append a NAL unit with a start code to the sequence header, if it fits. */
+static inline void ffnv_mp4_seqhdr_add(FFNVMp4Demuxer *d, const uint8_t *nal, unsigned int size)
+{
+    if (d->seqhdr_size + 4 + size > sizeof(d->seqhdr))
+        return;
+    memcpy(d->seqhdr + d->seqhdr_size, "\0\0\0\1", 4);
+    memcpy(d->seqhdr + d->seqhdr_size + 4, nal, size);
+    d->seqhdr_size += 4 + size;
+}
+
+/* Parse an avcC box. Returns 0 on success, -1 on error. */
+static inline int ffnv_mp4_parse_avcc(FFNVMp4Demuxer *d, const uint8_t *p, uint64_t size)
+{
+    const uint8_t *end = p + size;
+    int i, n, profile;
+
+    if (size < 7)
+        return -1;
+    profile = p[1];
+    d->nal_length_size = (p[4] & 3) + 1;
+    p += 5;
+
+    /* SPS then PPS */
+    for (i = 0; i < 2; i++) {
+        if (p >= end)
+            return -1;
+        n = i ? *p : *p & 0x1f;
+        p++;
+        while (n--) {
+            unsigned int len;
+
+            if (end - p < 2 || (len = ffnv_mp4_rb16(p)) > (uint64_t)(end - p - 2))
+                return -1;
+            ffnv_mp4_seqhdr_add(d, p + 2, len);
+            p += 2 + len;
+        }
+    }
+
+    d->chroma_format = 1;
+    d->bit_depth_luma = d->bit_depth_chroma = 8;
+    if ((profile == 100 || profile == 110 || profile == 122 || profile == 144) && end - p >= 3) {
+        d->chroma_format    = p[0] & 3;
+        d->bit_depth_luma   = (p[1] & 7) + 8;
+        d->bit_depth_chroma = (p[2] & 7) + 8;
+    }
+    return 0;
+}
+
+/* Parse an hvcC box. Returns 0 on success, -1 on error. */
+static inline int ffnv_mp4_parse_hvcc(FFNVMp4Demuxer *d, const uint8_t *p, uint64_t size)
+{
+    const uint8_t *end = p + size;
+    int arrays;
+
+    if (size < 23)
+        return -1;
+    d->chroma_format    = p[16] & 3;
+    d->bit_depth_luma   = (p[17] & 7) + 8;
+    d->bit_depth_chroma = (p[18] & 7) + 8;
+    d->nal_length_size  = (p[21] & 3) + 1;
+    arrays = p[22];
+    p += 23;
+
+    while (arrays--) {
+        unsigned int n;
+
+        if (end - p < 3)
+            return -1;
+        n = ffnv_mp4_rb16(p + 1);
+        p += 3;
+        while (n--) {
+            unsigned int len;
+
+            if (end - p < 2 || (len = ffnv_mp4_rb16(p)) > (uint64_t)(end - p - 2))
+                return -1;
+            ffnv_mp4_seqhdr_add(d, p + 2, len);
+            p += 2 + len;
+        }
+    }
+    return 0;
+}
+
+/* Parse the stsd of a track. Returns 0 for an H.264 or HEVC track, -1 otherwise. */
+static inline int ffnv_mp4_parse_stsd(FFNVMp4Demuxer *d, const FFNVMp4Box *stsd)
+{
+    const uint8_t *p;
+    FFNVMp4Box entry, cfg;
+
+    if (stsd->size < 8)
+        return -1;
+    p = stsd->data + 8;
+    /* the first entry describes the samples, files switching codecs are not handled */
+    if (!ffnv_mp4_next_box(&p, stsd->data + stsd->size, &entry) || entry.size < 78)
+        return -1;
+
+    d->width  = (int)ffnv_mp4_rb16(entry.data + 24);
+    d->height = (int)ffnv_mp4_rb16(entry.data + 26);
+    d->seqhdr_size = 0;
+
+    switch (entry.type) {
+    case FFNV_MP4_TAG('a', 'v', 'c', '1'):
+    case FFNV_MP4_TAG('a', 'v', 'c', '3'):
+        d->codec = cudaVideoCodec_H264;
+        if (!ffnv_mp4_find_box(entry.data + 78, entry.size - 78, FFNV_MP4_TAG('a', 'v', 'c', 'C'), &cfg))
+            return -1;
+        return ffnv_mp4_parse_avcc(d, cfg.data, cfg.size);
+    case FFNV_MP4_TAG('h', 'v', 'c', '1'):
+    case FFNV_MP4_TAG('h', 'e', 'v', '1'):
+        d->codec = cudaVideoCodec_HEVC;
+        if (!ffnv_mp4_find_box(entry.data + 78, entry.size - 78, FFNV_MP4_TAG('h', 'v', 'c', 'C'), &cfg))
+            return -1;
+        return ffnv_mp4_parse_hvcc(d, cfg.data, cfg.size);
+    }
+    return -1;
+}
+
+/* Fill the sample index from the sample tables. Returns 0 on success, -1 on error. */
+static inline int ffnv_mp4_parse_stbl(FFNVMp4Demuxer *d, const FFNVMp4Box *stbl, int64_t shift)
+{
+    FFNVMp4Box stsz, stco, stsc, stts, ctts, stss;
+    int64_t nb_chunks, nb_stsc, n;
+    uint32_t nb, i, j, s, fixed_size = 0, field = 32, delta = 0;
+    int co64 = 0;
+    int64_t dts = 0;
+
+    if (ffnv_mp4_find_box(stbl->data, stbl->size, FFNV_MP4_TAG('s', 't', 's', 'z'), &stsz)) {
+        if (stsz.size < 12)
+            return -1;
+        fixed_size = ffnv_mp4_rb32(stsz.data + 4);
+        nb = ffnv_mp4_rb32(stsz.data + 8);
+        if (!fixed_size && (uint64_t)nb * 4 > stsz.size - 12)
+            return -1;
+    } else if (ffnv_mp4_find_box(stbl->data, stbl->size, FFNV_MP4_TAG('s', 't', 'z', '2'), &stsz)) {
+        if (stsz.size < 12)
+            return -1;
+        field = stsz.data[7];
+        nb = ffnv_mp4_rb32(stsz.data + 8);
+        if ((field != 4 && field != 8 && field != 16) || ((uint64_t)nb * field + 7) / 8 > stsz.size - 12)
+            return -1;
+    } else {
+        return -1;
+    }
+
+    if (!ffnv_mp4_find_box(stbl->data, stbl->size, FFNV_MP4_TAG('s', 't', 'c', 'o'), &stco)) {
+        if (!ffnv_mp4_find_box(stbl->data, stbl->size, FFNV_MP4_TAG('c', 'o', '6', '4'), &stco))
+            return -1;
+        co64 = 1;
+    }
+    if (!ffnv_mp4_find_box(stbl->data, stbl->size, FFNV_MP4_TAG('s', 't', 's', 'c'), &stsc) ||
+        !ffnv_mp4_find_box(stbl->data, stbl->size, FFNV_MP4_TAG('s', 't', 't', 's'), &stts))
+        return -1;
+    nb_chunks = ffnv_mp4_table(&stco, 0, co64 ? 8 : 4);
+    nb_stsc   = ffnv_mp4_table(&stsc, 0, 12);
+    if (!nb || nb_chunks < 0 || nb_stsc < 0 || ffnv_mp4_table(&stts, 0, 8) < 0)
+        return -1;
+
+    d->samples = (FFNVMp4Sample*)calloc(nb, sizeof(*d->samples));
+    if (!d->samples)
+        return -1;
+
+    /* sizes */
+    for (i = 0; i < nb; i++) {
+        const uint8_t *t = stsz.data + 12;
+
+        if (fixed_size)
+            d->samples[i].size = fixed_size;
+        else if (field == 32)
+            d->samples[i].size = ffnv_mp4_rb32(t + 4 * i);
+        else if (field == 16)
+            d->samples[i].size = ffnv_mp4_rb16(t + 2 * i);
+        else if (field == 8)
+            d->samples[i].size = t[i];
+        else
+            d->samples[i].size = i & 1 ? t[i / 2] & 0xf : t[i / 2] >> 4;
+    }
+
+    /* offsets: runs of chunks with the same number of samples */
+    s = 0;
+    for (i = 0; i < (uint32_t)nb_stsc && s < nb; i++) {
+        const uint8_t *e = stsc.data + 8 + 12 * i;
+        uint32_t first = ffnv_mp4_rb32(e) - 1, per_chunk = ffnv_mp4_rb32(e + 4);
+        uint32_t last = i + 1 < (uint32_t)nb_stsc ? ffnv_mp4_rb32(e + 12) - 1 : (uint32_t)nb_chunks;
+        uint32_t c;
+
+        if (last > (uint32_t)nb_chunks)
+            last = (uint32_t)nb_chunks;
+        for (c = first; c < last && s < nb; c++) {
+            uint64_t off = co64 ? ffnv_mp4_rb64(stco.data + 8 + 8 * c) : ffnv_mp4_rb32(stco.data + 8 + 4 * c);
+
+            for (j = 0; j < per_chunk && s < nb; j++, s++) {
+                d->samples[s].offset = off;
+                off += d->samples[s].size;
+            }
+        }
+    }
+    /* samples past the chunks or the end of the file are lost */
+    for (nb = 0; nb < s; nb++) {
+        if (d->samples[nb].offset > d->size || d->samples[nb].size > d->size - d->samples[nb].offset)
+            break;
+    }
+    if (!nb)
+        return -1;
+    d->nb_samples = nb;
+
+    /* decode times, presentation times and the frame rate */
+    n = ffnv_mp4_table(&stts, 0, 8);
+    for (i = 0, s = 0; i < (uint32_t)n && s < nb; i++) {
+        uint32_t count = ffnv_mp4_rb32(stts.data + 8 + 8 * i);
+
+        delta = ffnv_mp4_rb32(stts.data + 12 + 8 * i);
+        for (j = 0; j < count && s < nb; j++, s++) {
+            d->samples[s].pts = dts;
+            dts += delta;
+        }
+    }
+    for (; s < nb; s++)
+        d->samples[s].pts = dts;
+    if (n == 1 && delta) {
+        uint32_t a = d->timescale, b = delta, t;
+
+        while (b) {
+            t = a % b;
+            a = b;
+            b = t;
+        }
+        d->fps_num = d->timescale / a;
+        d->fps_den = delta / a;
+    }
+
+    if (ffnv_mp4_find_box(stbl->data, stbl->size, FFNV_MP4_TAG('c', 't', 't', 's'), &ctts) &&
+        (n = ffnv_mp4_table(&ctts, 0, 8)) > 0) {
+        for (i = 0, s = 0; i < (uint32_t)n && s < nb; i++) {
+            uint32_t count = ffnv_mp4_rb32(ctts.data + 8 + 8 * i);
+            /* signed in version 1, and in practice in version 0 as well */
+            int32_t offset = (int32_t)ffnv_mp4_rb32(ctts.data + 12 + 8 * i);
+
+            for (j = 0; j < count && s < nb; j++, s++)
+                d->samples[s].pts += offset;
+        }
+    }
+    for (s = 0; s < nb; s++)
+        d->samples[s].pts -= shift;
+
+    /* without stss all samples are key frames */
+    if (ffnv_mp4_find_box(stbl->data, stbl->size, FFNV_MP4_TAG('s', 't', 's', 's'), &stss)) {
+        n = ffnv_mp4_table(&stss, 0, 4);
+        for (i = 0; i < (uint32_t)(n > 0 ? n : 0); i++) {
+            uint32_t k = ffnv_mp4_rb32(stss.data + 8 + 4 * i);
+
+            if (k >= 1 && k <= nb)
+                d->samples[k - 1].flags |= FFNV_MP4_SAMPLE_KEY;
+        }
+    } else {
+        for (s = 0; s < nb; s++)
+            d->samples[s].flags |= FFNV_MP4_SAMPLE_KEY;
+    }
+    return 0;
+}
+
+/* Media time the presentation starts at, from the first edit that is not empty. */
+static inline int64_t ffnv_mp4_edit_shift(const FFNVMp4Box *trak)
+{
+    FFNVMp4Box edts, elst;
+    int64_t n, i;
+    int v;
+
+    if (!ffnv_mp4_find_box(trak->data, trak->size, FFNV_MP4_TAG('e', 'd', 't', 's'), &edts) ||
+        !ffnv_mp4_find_box(edts.data, edts.size, FFNV_MP4_TAG('e', 'l', 's', 't'), &elst) ||
+        elst.size < 8)
+        return 0;
+    v = elst.data[0];
+    n = ffnv_mp4_table(&elst, 0, v == 1 ? 20 : 12);
+    for (i = 0; i < n; i++) {
+        const uint8_t *e = elst.data + 8 + i * (v == 1 ? 20 : 12);
+        int64_t media_time = v == 1 ? (int64_t)ffnv_mp4_rb64(e + 8) : (int32_t)ffnv_mp4_rb32(e + 4);
+
+        if (media_time >= 0)
+            return media_time;
+    }
+    return 0;
+}
+
+/* Index the track if it is an H.264 or HEVC video track. Returns 0 on success, -1 otherwise. */
+static inline int ffnv_mp4_parse_trak(FFNVMp4Demuxer *d, const FFNVMp4Box *trak)
+{
+    FFNVMp4Box mdia, hdlr, mdhd, minf, stbl, stsd;
+
+    if (!ffnv_mp4_find_box(trak->data, trak->size, FFNV_MP4_TAG('m', 'd', 'i', 'a'), &mdia) ||
+        !ffnv_mp4_find_box(mdia.data, mdia.size, FFNV_MP4_TAG('h', 'd', 'l', 'r'), &hdlr) ||
+        hdlr.size < 12 || ffnv_mp4_rb32(hdlr.data + 8) != FFNV_MP4_TAG('v', 'i', 'd', 'e'))
+        return -1;
+
+    if (!ffnv_mp4_find_box(mdia.data, mdia.size, FFNV_MP4_TAG('m', 'd', 'h', 'd'), &mdhd) ||
+        mdhd.size < 24 || (mdhd.data[0] == 1 && mdhd.size < 32))
+        return -1;
+    d->timescale = ffnv_mp4_rb32(mdhd.data + (mdhd.data[0] == 1 ? 20 : 12));
+    if (!d->timescale)
+        return -1;
+
+    if (!ffnv_mp4_find_box(mdia.data, mdia.size, FFNV_MP4_TAG('m', 'i', 'n', 'f'), &minf) ||
+        !ffnv_mp4_find_box(minf.data, minf.size, FFNV_MP4_TAG('s', 't', 'b', 'l'), &stbl) ||
+        !ffnv_mp4_find_box(stbl.data, stbl.size, FFNV_MP4_TAG('s', 't', 's', 'd'), &stsd) ||
+        ffnv_mp4_parse_stsd(d, &stsd) < 0)
+        return -1;
+
+    return ffnv_mp4_parse_stbl(d, &stbl, ffnv_mp4_edit_shift(trak));
+}
+
+static inline void ffnv_mp4_close(FFNVMp4Demuxer *d)
+{
+#if defined(_WIN32)
+    if (d->map)
+        UnmapViewOfFile(d->map);
+    if (d->mapping)
+        CloseHandle(d->mapping);
+    if (d->file && d->file != INVALID_HANDLE_VALUE)
+        CloseHandle(d->file);
+#else
+    if (d->map)
+        munmap(d->map, d->size);
+    if (d->fd >= 0)
+        close(d->fd);
+#endif
+    free(d->samples);
+    free(d->scratch);
+    memset(d, 0, sizeof(*d));
+#if !defined(_WIN32)
+    d->fd = -1;
+#endif
+}
+
+/**
+ * Open path and index its first H.264 or HEVC track. Returns 0 on
+ * success, -1 on error or if there is no such track.
+ */
+static inline int ffnv_mp4_open(FFNVMp4Demuxer *d, const char *path)
+{
+    FFNVMp4Box moov, trak;
+    const uint8_t *p;
+
+    memset(d, 0, sizeof(*d));
+#if !defined(_WIN32)
+    d->fd = -1;
+#endif
+
+#if defined(_WIN32)
+    {
+        LARGE_INTEGER size;
+
+        d->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+        if (d->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(d->file, &size) || !size.QuadPart)
+            goto fail;
+        d->size    = (size_t)size.QuadPart;
+        d->mapping = CreateFileMappingA(d->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (!d->mapping)
+            goto fail;
+        d->map = (uint8_t*)MapViewOfFile(d->mapping, FILE_MAP_COPY, 0, 0, 0);
+        if (!d->map)
+            goto fail;
+    }
+#else
+    {
+        struct stat st;
+        void *map;
+
+        d->fd = open(path, O_RDONLY);
+        if (d->fd < 0 || fstat(d->fd, &st) < 0 || st.st_size <= 0)
+            goto fail;
+        d->size = (size_t)st.st_size;
+        /* copy on write, for the conversion in place */
+        map = mmap(NULL, d->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, d->fd, 0);
+        if (map == MAP_FAILED)
+            goto fail;
+        d->map = (uint8_t*)map;
+    }
+#endif
+
+    if (!ffnv_mp4_find_box(d->map, d->size, FFNV_MP4_TAG('m', 'o', 'o', 'v'), &moov))
+        goto fail;
+
+    p = moov.data;
+    while (ffnv_mp4_next_box(&p, moov.data + moov.size, &trak)) {
+        if (trak.type != FFNV_MP4_TAG('t', 'r', 'a', 'k'))
+            continue;
+        if (!ffnv_mp4_parse_trak(d, &trak))
+            return 0;
+        free(d->samples);
+        d->samples = NULL;
+    }
+
+fail:
+    ffnv_mp4_close(d);
+    return -1;
+}
+
+/**
+ * Format of the track for the pExtVideoInfo of the parser, with the
+ * parameter sets of the sample description as sequence header.
+ */
+static inline void ffnv_mp4_format(const FFNVMp4Demuxer *d, CUVIDEOFORMATEX *ext)
+{
+    CUVIDEOFORMAT *f = &ext->format;
+
+    memset(ext, 0, sizeof(*ext));
+    f->codec                   = d->codec;
+    f->frame_rate.numerator    = d->fps_num;
+    f->frame_rate.denominator  = d->fps_den;
+    f->progressive_sequence    = 1;
+    f->bit_depth_luma_minus8   = (unsigned char)(d->bit_depth_luma - 8);
+    f->bit_depth_chroma_minus8 = (unsigned char)(d->bit_depth_chroma - 8);
+    f->coded_width             = d->width;
+    f->coded_height            = d->height;
+    f->display_area.right      = d->width;
+    f->display_area.bottom     = d->height;
+    f->chroma_format           = (cudaVideoChromaFormat)d->chroma_format;
+    f->display_aspect_ratio.x  = d->width;
+    f->display_aspect_ratio.y  = d->height;
+    f->seqhdr_data_length      = d->seqhdr_size;
+    memcpy(ext->raw_seqhdr_data, d->seqhdr, d->seqhdr_size);
+}
+
+/*
+ * Turn sample s into Annex B: in place for 3 and 4 byte lengths, into
+ * the scratch buffer otherwise. Returns 0 on success, -1 if its NAL
+ * lengths overrun it.
+ */
+static inline int ffnv_mp4_annexb(FFNVMp4Demuxer *d, FFNVMp4Sample *s, const uint8_t **data, size_t *size)
+{
+    uint8_t *p = d->map + s->offset, *end = p + s->size;
+    int l = d->nal_length_size;
+
+    if (s->flags & FFNV_MP4_SAMPLE_BROKEN)
+        return -1;
+    *data = p;
+    *size = s->size;
+    if (s->flags & FFNV_MP4_SAMPLE_ANNEXB)
+        return 0;
+
+    if (l >= 3) {
+        while (end - p >= l) {
+            uint32_t len = l == 4 ? ffnv_mp4_rb32(p) : (uint32_t)p[0] << 16 | ffnv_mp4_rb16(p + 1);
+
+            if (len > (uint64_t)(end - p - l))
+                goto broken;
+            if (l == 4)
+                p[0] = 0;
+            p[l - 3] = 0;
+            p[l - 2] = 0;
+            p[l - 1] = 1;
+            p += l + len;
+        }
+        if (p != end)
+            goto broken;
+        s->flags |= FFNV_MP4_SAMPLE_ANNEXB;
+        return 0;
+    } else {
+        /* each NAL of at least l + 1 bytes grows by 4 - l */
+        size_t max = (size_t)s->size / (l + 1) * (4 - l) + s->size;
+        uint8_t *out;
+
+        if (max > d->scratch_size) {
+            uint8_t *b = (uint8_t*)realloc(d->scratch, max);
+            if (!b)
+                return -1;
+            d->scratch      = b;
+            d->scratch_size = max;
+        }
+        out = d->scratch;
+        while (end - p >= l) {
+            uint32_t len = l == 2 ? ffnv_mp4_rb16(p) : p[0];
+
+            if (!len || len > (uint64_t)(end - p - l))
+                goto broken;
+            memcpy(out, "\0\0\0\1", 4);
+            memcpy(out + 4, p + l, len);
+            out += 4 + len;
+            p   += l + len;
+        }
+        if (p != end)
+            goto broken;
+        *data = d->scratch;
+        *size = out - d->scratch;
+        return 0;
+    }
+
+broken:
+    /* what was converted cannot be parsed as lengths again */
+    s->flags |= FFNV_MP4_SAMPLE_BROKEN;
+    d->nb_broken++;
+    return -1;
+}
+
+/**
+ * Next packet in decode order, one sample with CUVID_PKT_ENDOFPICTURE
+ * and its PTS, then a CUVID_PKT_ENDOFSTREAM one. The payload points into
+ * the mapping or the scratch buffer and is valid until the next call.
+ * Returns 1 if pkt was filled, 0 at the end.
+ */
+static inline int ffnv_mp4_next_packet(FFNVMp4Demuxer *d, CUVIDSOURCEDATAPACKET *pkt)
+{
+    while (d->next < d->nb_samples) {
+        FFNVMp4Sample *s = &d->samples[d->next++];
+        const uint8_t *data;
+        size_t size;
+
+        if (ffnv_mp4_annexb(d, s, &data, &size) < 0)
+            continue;
+        ffnv_annexb_packet(pkt, data, size, s->pts);
+        if (d->discontinuity)
+            pkt->flags |= CUVID_PKT_DISCONTINUITY;
+        d->discontinuity = 0;
+        return 1;
+    }
+
+    if (d->eos_sent)
+        return 0;
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->flags  = CUVID_PKT_ENDOFSTREAM;
+    d->eos_sent = 1;
+    return 1;
+}
+
+/**
+ * Continue from the last key frame presented at or before pts (timescale
+ * units). Pictures displayed before pts are to be dropped by the caller.
+ * Returns the sample decoding restarts at.
+ */
+static inline uint32_t ffnv_mp4_seek(FFNVMp4Demuxer *d, int64_t pts)
+{
+    uint32_t i, key = 0;
+
+    for (i = 0; i < d->nb_samples; i++) {
+        if ((d->samples[i].flags & FFNV_MP4_SAMPLE_KEY) && d->samples[i].pts <= pts)
+            key = i;
+    }
+    d->next          = key;
+    d->discontinuity = 1;
+    d->eos_sent      = 0;
+    return key;
+}
+
+#endif
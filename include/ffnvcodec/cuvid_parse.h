@@ -0,0 +1,329 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Building blocks shared by the standalone bitstream parsers that fill
+ * CUVIDPICPARAMS for cuvidDecodePicture() without cuvidCreateVideoParser():
+ * an MSB-first bit reader with Exp-Golomb support, emulation prevention
+ * removal, and a decode surface pool with a display reorder queue.
+ */
+
+#ifndef FFNV_CUVID_PARSE_H
+#define FFNV_CUVID_PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dynlink_cuda.h"
+#include "dynlink_nvcuvid.h"
+
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
+/* parser return flags */
+#define FFNV_PARSE_PICTURE  1 /**< CUVIDPICPARAMS were filled, the picture can be decoded */
+#define FFNV_PARSE_SEQUENCE 2 /**< a new sequence starts, the decoder may have to be (re)created first */
+
+/* parser error codes */
+#define FFNV_PARSE_ERROR -1 /**< invalid data or allocation failure */
+#define FFNV_PARSE_AGAIN -2 /**< no free surface: output and release pictures, then pass the same data again */
+
+#define FFNV_PARSE_MAX_SURFACES 64
+
+typedef struct FFNVBitReader {
+    const uint8_t *buf;
+    size_t size;  /* in bytes */
+    size_t index; /* in bits */
+} FFNVBitReader;
+
+static inline void ffnv_br_init(FFNVBitReader *br, const uint8_t *buf, size_t size)
+{
+    br->buf   = buf;
+    br->size  = size;
+    br->index = 0;
+}
+
+static inline int ffnv_br_clz64(uint64_t v)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    return _BitScanReverse64(&i, v) ? 63 - (int)i : 64;
+#else
+    return v ? __builtin_clzll(v) : 64;
+#endif
+}
+
+/* Next 64 bits at the read position, zero-padded past the end. */
+static inline uint64_t ffnv_br_peek64(const FFNVBitReader *br)
+{
+    size_t byte = br->index >> 3;
+    uint64_t v = 0;
+    int i;
+
+    if (byte + 8 <= br->size) {
+        const uint8_t *p = br->buf + byte;
+        v = (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 | (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+            (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 | (uint64_t)p[6] <<  8 | (uint64_t)p[7];
+    } else {
+        for (i = 0; i < 8; i++)
+            v = v << 8 | (byte + i < br->size ? br->buf[byte + i] : 0);
+    }
+
+    return v << (br->index & 7);
+}
+
+/** Read n bits, 0 <= n <= 32. */
+static inline uint32_t ffnv_br_get_bits(FFNVBitReader *br, int n)
+{
+    uint32_t v;
+
+    if (!n)
+        return 0;
+    v = (uint32_t)(ffnv_br_peek64(br) >> (64 - n));
+    br->index += n;
+    return v;
+}
+
+static inline int ffnv_br_get_bit(FFNVBitReader *br)
+{
+    return (int)ffnv_br_get_bits(br, 1);
+}
+
+static inline void ffnv_br_skip(FFNVBitReader *br, size_t n)
+{
+    br->index += n;
+}
+
+/** Unsigned Exp-Golomb code, up to 32 bits. Returns 0xffffffff on invalid codes. */
+static inline uint32_t ffnv_br_get_ue(FFNVBitReader *br)
+{
+    int zeros = ffnv_br_clz64(ffnv_br_peek64(br));
+
+    if (zeros > 31) {
+        br->index = br->size * 8 + 1;
+        return 0xffffffffu;
+    }
+
+    br->index += zeros;
+    return (uint32_t)((uint64_t)ffnv_br_get_bits(br, zeros + 1) - 1);
+}
+
+static inline int32_t ffnv_br_get_se(FFNVBitReader *br)
+{
+    uint32_t v = ffnv_br_get_ue(br);
+
+    return v & 1 ? (int32_t)((v >> 1) + 1) : -(int32_t)(v >> 1);
+}
+
+static inline size_t ffnv_br_bits_left(const FFNVBitReader *br)
+{
+    return br->index < br->size * 8 ? br->size * 8 - br->index : 0;
+}
+
+/** Whether more bits were read than available. */
+static inline int ffnv_br_overread(const FFNVBitReader *br)
+{
+    return br->index > br->size * 8;
+}
+
+static inline void ffnv_br_align(FFNVBitReader *br)
+{
+    br->index = (br->index + 7) & ~(size_t)7;
+}
+
+/** more_rbsp_data(): anything but the stop bit and zero padding left. */
+static inline int ffnv_br_more_rbsp_data(const FFNVBitReader *br)
+{
+    size_t end = br->size;
+    int last;
+
+    while (end > 0 && !br->buf[end - 1])
+        end--;
+    if (!end)
+        return 0;
+
+    /* position of the rbsp_stop_one_bit */
+    end *= 8;
+    for (last = br->buf[end / 8 - 1]; !(last & 1); last >>= 1)
+        end--;
+    return br->index < end - 1;
+}
+
+/**
+ * Copy at most dst_size bytes of RBSP from the NAL payload src, removing
+ * emulation prevention bytes. Returns the number of bytes written.
+ */
+static inline size_t ffnv_unescape_rbsp(uint8_t *dst, size_t dst_size, const uint8_t *src, size_t size)
+{
+    size_t i = 0, o = 0;
+    int zeros = 0;
+
+    while (i < size && o < dst_size) {
+        uint8_t c = src[i++];
+
+        if (zeros >= 2 && c == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = c ? 0 : zeros + 1;
+        dst[o++] = c;
+    }
+
+    return o;
+}
+
+/*
+ * Decode surface pool and display queue. A surface is busy while it is
+ * used as a reference, waiting for display, or handed out for display and
+ * not yet released by the caller. A surface can be displayed more than
+ * once (VP9 show_existing_frame), so the display uses are counted.
+ */
+typedef struct FFNVFrameQueueEntry {
+    int64_t order; /* display order key */
+    CUVIDPARSERDISPINFO disp;
+} FFNVFrameQueueEntry;
+
+typedef struct FFNVFramePool {
+    int nb_surfaces;
+    uint64_t busy_ref;
+    uint8_t nb_display[FFNV_PARSE_MAX_SURFACES]; /* queued or handed out, not released */
+
+    FFNVFrameQueueEntry queue[FFNV_PARSE_MAX_SURFACES];
+    int nb_queued;
+} FFNVFramePool;
+
+static inline void ffnv_pool_init(FFNVFramePool *pool, int nb_surfaces)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->nb_surfaces = nb_surfaces < 1 ? 1 :
+                        nb_surfaces > FFNV_PARSE_MAX_SURFACES ? FFNV_PARSE_MAX_SURFACES : nb_surfaces;
+}
+
+/** Lowest free surface index, or -1 if all are busy. */
+static inline int ffnv_pool_get_free(const FFNVFramePool *pool)
+{
+    int i;
+
+    for (i = 0; i < pool->nb_surfaces; i++) {
+        if (!(pool->busy_ref >> i & 1) && !pool->nb_display[i])
+            return i;
+    }
+    return -1;
+}
+
+static inline void ffnv_pool_set_ref(FFNVFramePool *pool, int idx, int ref)
+{
+    if (idx < 0)
+        return;
+    if (ref)
+        pool->busy_ref |=  (uint64_t)1 << idx;
+    else
+        pool->busy_ref &= ~((uint64_t)1 << idx);
+}
+
+/** Queue a decoded picture for display. */
+static inline void ffnv_pool_queue(FFNVFramePool *pool, int64_t order, const CUVIDPARSERDISPINFO *disp)
+{
+    if (pool->nb_queued >= FFNV_PARSE_MAX_SURFACES || disp->picture_index < 0 ||
+        disp->picture_index >= FFNV_PARSE_MAX_SURFACES)
+        return;
+
+    pool->queue[pool->nb_queued].order = order;
+    pool->queue[pool->nb_queued].disp  = *disp;
+    pool->nb_queued++;
+    pool->nb_display[disp->picture_index]++;
+}
+
+/**
+ * Pop the next picture in display order if more than max_delay pictures
+ * are queued. The surface stays busy until ffnv_pool_release().
+ * Returns 1 if disp was filled, 0 otherwise.
+ */
+static inline int ffnv_pool_output(FFNVFramePool *pool, int max_delay, CUVIDPARSERDISPINFO *disp)
+{
+    int i, best = 0;
+
+    if (pool->nb_queued <= max_delay || !pool->nb_queued)
+        return 0;
+
+    for (i = 1; i < pool->nb_queued; i++) {
+        if (pool->queue[i].order < pool->queue[best].order)
+            best = i;
+    }
+
+    *disp = pool->queue[best].disp;
+    pool->queue[best] = pool->queue[--pool->nb_queued];
+    return 1;
+}
+
+/** Give back a surface returned by ffnv_pool_output() once it has been mapped and unmapped, once per output. */
+static inline void ffnv_pool_release(FFNVFramePool *pool, int idx)
+{
+    if (idx >= 0 && idx < FFNV_PARSE_MAX_SURFACES && pool->nb_display[idx])
+        pool->nb_display[idx]--;
+}
+
+/** Size rounded up to an even value, as decoder output sizes must be. */
+static inline int ffnv_parse_even(int size)
+{
+    return (size + 1) & ~1;
+}
+
+static inline unsigned int ffnv_parse_gcd(unsigned int a, unsigned int b)
+{
+    while (b) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Growable array owned by a parser; only reallocates when it has to grow. */
+static inline int ffnv_parse_grow(void **ptr, int *capacity, int needed, size_t elem_size)
+{
+    void *tmp;
+    int cap = *capacity ? *capacity : 16;
+
+    if (needed <= *capacity)
+        return 0;
+    while (cap < needed)
+        cap *= 2;
+
+    tmp = realloc(*ptr, (size_t)cap * elem_size);
+    if (!tmp)
+        return -1;
+
+    *ptr = tmp;
+    *capacity = cap;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,686 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Standalone VP9 parser filling CUVIDPICPARAMS for cuvidDecodePicture().
+ *
+ * Packets, e.g. WebM blocks, are split at their superframe index with
+ * ffnv_vp9_split_superframe() and each frame is passed to
+ * ffnv_vp9_parse_frame(). Only the uncompressed header is parsed, the
+ * compressed header and the probability contexts are handled by the
+ * decoder. VP9 has no reordering: shown frames are available from
+ * ffnv_vp9_get_display() as soon as they are parsed.
+ */
+
+#ifndef FFNV_CUVID_VP9_PARSER_H
+#define FFNV_CUVID_VP9_PARSER_H
+
+#include "cuvid_parse.h"
+
+#define FFNV_VP9_MAX_FRAMES 8 /* frames in a superframe */
+#define FFNV_VP9_NUM_REFS   8
+
+enum {
+    FFNV_VP9_CS_UNKNOWN   = 0,
+    FFNV_VP9_CS_BT_601    = 1,
+    FFNV_VP9_CS_BT_709    = 2,
+    FFNV_VP9_CS_SMPTE_170 = 3,
+    FFNV_VP9_CS_SMPTE_240 = 4,
+    FFNV_VP9_CS_BT_2020   = 5,
+    FFNV_VP9_CS_RESERVED  = 6,
+    FFNV_VP9_CS_RGB       = 7,
+};
+
+/* uncompressed_header() of one frame */
+typedef struct FFNVVP9FrameHeader {
+    int profile;
+    int show_existing_frame;
+    int frame_to_show_map_idx;
+    int key_frame;
+    int show_frame;
+    int error_resilient_mode;
+    int intra_only;
+    int reset_frame_context;
+    int refresh_frame_flags;
+    int ref_frame_idx[3];
+    int ref_frame_sign_bias[3];
+    int width, height;
+    int render_width, render_height;
+    int allow_high_precision_mv;
+    int interp_filter; /* 0 regular, 1 smooth, 2 sharp, 3 bilinear, 4 switchable */
+    int refresh_frame_context;
+    int frame_parallel_decoding_mode;
+    int frame_context_idx;
+    int loop_filter_level;
+    int loop_filter_sharpness;
+    int loop_filter_delta_enabled;
+    int base_q_idx;
+    int delta_q_y_dc;
+    int delta_q_uv_dc;
+    int delta_q_uv_ac;
+    int segmentation_enabled;
+    int segmentation_update_map;
+    int segmentation_temporal_update;
+    int tile_cols_log2;
+    int tile_rows_log2;
+    int uncompressed_header_size; /* in bytes */
+    int compressed_header_size;
+} FFNVVP9FrameHeader;
+
+typedef struct FFNVVP9RefSlot {
+    int pic_idx; /* -1 if empty */
+    int width, height;
+} FFNVVP9RefSlot;
+
+typedef struct FFNVVP9Parser {
+    FFNVVP9FrameHeader hdr;
+    FFNVVP9RefSlot ref[FFNV_VP9_NUM_REFS];
+    int have_key_frame;
+
+    /* colour config of the last key or intra-only frame */
+    int bit_depth;
+    int color_space;
+    int color_range;
+    int subsampling_x, subsampling_y;
+
+    /* state carried across frames until setup_past_independence() */
+    int loop_filter_ref_deltas[4];
+    int loop_filter_mode_deltas[2];
+    int segmentation_abs_or_delta_update;
+    int feature_enabled[8][4];
+    int feature_data[8][4];
+    int tree_probs[7];
+    int pred_probs[3];
+
+    /* active sequence */
+    int has_active;
+    int active_width, active_height;
+    int active_bit_depth;
+    int active_subsampling_x, active_subsampling_y;
+
+    FFNVFramePool pool;
+    int64_t order;
+} FFNVVP9Parser;
+
+static inline void ffnv_vp9_parser_free(FFNVVP9Parser **pp)
+{
+    free(*pp);
+    *pp = NULL;
+}
+
+/**
+ * Allocate a parser handing out picture indices below nb_surfaces, which
+ * must match CUVIDDECODECREATEINFO::ulNumDecodeSurfaces.
+ * Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_vp9_parser_init(FFNVVP9Parser **pp, int nb_surfaces)
+{
+    FFNVVP9Parser *p = (FFNVVP9Parser*)calloc(1, sizeof(*p));
+    int i;
+
+    *pp = p;
+    if (!p)
+        return -1;
+
+    for (i = 0; i < FFNV_VP9_NUM_REFS; i++)
+        p->ref[i].pic_idx = -1;
+    ffnv_pool_init(&p->pool, nb_surfaces);
+    return 0;
+}
+
+/**
+ * Split a packet at its superframe index, if any. Fills offsets and sizes
+ * of up to FFNV_VP9_MAX_FRAMES frames and returns the number of frames,
+ * or -1 if the index does not match the packet.
+ */
+static inline int ffnv_vp9_split_superframe(const uint8_t *buf, size_t size, size_t *offsets, size_t *sizes)
+{
+    const uint8_t marker = size ? buf[size - 1] : 0;
+    size_t index_size, pos = 0, frame_size;
+    int nb_frames, mag, i, j;
+
+    if (!size)
+        return 0;
+
+    if ((marker & 0xe0) == 0xc0) {
+        nb_frames  = (marker & 7) + 1;
+        mag        = (marker >> 3 & 3) + 1;
+        index_size = 2 + (size_t)mag * nb_frames;
+
+        if (size >= index_size && buf[size - index_size] == marker) {
+            const uint8_t *idx = buf + size - index_size + 1;
+
+            for (i = 0; i < nb_frames; i++) {
+                frame_size = 0;
+                for (j = 0; j < mag; j++)
+                    frame_size |= (size_t)*idx++ << (8 * j);
+                if (frame_size > size - index_size - pos)
+                    return -1;
+                offsets[i] = pos;
+                sizes[i]   = frame_size;
+                pos       += frame_size;
+            }
+            return nb_frames;
+        }
+    }
+
+    offsets[0] = 0;
+    sizes[0]   = size;
+    return 1;
+}
+
+static inline int ffnv_vp9_su(FFNVBitReader *br, int n)
+{
+    int v = (int)ffnv_br_get_bits(br, n);
+
+    return ffnv_br_get_bit(br) ? -v : v;
+}
+
+static inline int ffnv_vp9_delta_q(FFNVBitReader *br)
+{
+    return ffnv_br_get_bit(br) ? ffnv_vp9_su(br, 4) : 0;
+}
+
+static inline int ffnv_vp9_sync_code(FFNVBitReader *br)
+{
+    return ffnv_br_get_bits(br, 24) == 0x498342 ? 0 : -1;
+}
+
+static inline int ffnv_vp9_color_config(FFNVVP9Parser *p, FFNVBitReader *br, int profile)
+{
+    p->bit_depth   = profile >= 2 ? (ffnv_br_get_bit(br) ? 12 : 10) : 8;
+    p->color_space = (int)ffnv_br_get_bits(br, 3);
+
+    if (p->color_space != FFNV_VP9_CS_RGB) {
+        p->color_range = ffnv_br_get_bit(br);
+        if (profile == 1 || profile == 3) {
+            p->subsampling_x = ffnv_br_get_bit(br);
+            p->subsampling_y = ffnv_br_get_bit(br);
+            if (ffnv_br_get_bit(br))
+                return -1;
+        } else {
+            p->subsampling_x = p->subsampling_y = 1;
+        }
+    } else {
+        p->color_range = 1;
+        if (profile != 1 && profile != 3)
+            return -1;
+        p->subsampling_x = p->subsampling_y = 0;
+        if (ffnv_br_get_bit(br))
+            return -1;
+    }
+    return 0;
+}
+
+static inline void ffnv_vp9_frame_size(FFNVBitReader *br, FFNVVP9FrameHeader *h)
+{
+    h->width  = (int)ffnv_br_get_bits(br, 16) + 1;
+    h->height = (int)ffnv_br_get_bits(br, 16) + 1;
+}
+
+static inline void ffnv_vp9_render_size(FFNVBitReader *br, FFNVVP9FrameHeader *h)
+{
+    if (ffnv_br_get_bit(br)) {
+        h->render_width  = (int)ffnv_br_get_bits(br, 16) + 1;
+        h->render_height = (int)ffnv_br_get_bits(br, 16) + 1;
+    } else {
+        h->render_width  = h->width;
+        h->render_height = h->height;
+    }
+}
+
+static inline void ffnv_vp9_setup_past_independence(FFNVVP9Parser *p)
+{
+    memset(p->feature_enabled, 0, sizeof(p->feature_enabled));
+    memset(p->feature_data,    0, sizeof(p->feature_data));
+    p->segmentation_abs_or_delta_update = 0;
+
+    p->loop_filter_ref_deltas[0]  =  1;
+    p->loop_filter_ref_deltas[1]  =  0;
+    p->loop_filter_ref_deltas[2]  = -1;
+    p->loop_filter_ref_deltas[3]  = -1;
+    p->loop_filter_mode_deltas[0] =  0;
+    p->loop_filter_mode_deltas[1] =  0;
+}
+
+static inline void ffnv_vp9_loop_filter_params(FFNVVP9Parser *p, FFNVBitReader *br)
+{
+    FFNVVP9FrameHeader *h = &p->hdr;
+    int i;
+
+    h->loop_filter_level         = (int)ffnv_br_get_bits(br, 6);
+    h->loop_filter_sharpness     = (int)ffnv_br_get_bits(br, 3);
+    h->loop_filter_delta_enabled = ffnv_br_get_bit(br);
+
+    if (h->loop_filter_delta_enabled && ffnv_br_get_bit(br)) {
+        for (i = 0; i < 4; i++) {
+            if (ffnv_br_get_bit(br))
+                p->loop_filter_ref_deltas[i] = ffnv_vp9_su(br, 6);
+        }
+        for (i = 0; i < 2; i++) {
+            if (ffnv_br_get_bit(br))
+                p->loop_filter_mode_deltas[i] = ffnv_vp9_su(br, 6);
+        }
+    }
+}
+
+static inline int ffnv_vp9_read_prob(FFNVBitReader *br)
+{
+    return ffnv_br_get_bit(br) ? (int)ffnv_br_get_bits(br, 8) : 255;
+}
+
+static inline void ffnv_vp9_segmentation_params(FFNVVP9Parser *p, FFNVBitReader *br)
+{
+    static const int feature_bits[4]   = { 8, 6, 2, 0 };
+    static const int feature_signed[4] = { 1, 1, 0, 0 };
+    FFNVVP9FrameHeader *h = &p->hdr;
+    int i, j;
+
+    h->segmentation_enabled = ffnv_br_get_bit(br);
+    if (!h->segmentation_enabled)
+        return;
+
+    h->segmentation_update_map = ffnv_br_get_bit(br);
+    if (h->segmentation_update_map) {
+        for (i = 0; i < 7; i++)
+            p->tree_probs[i] = ffnv_vp9_read_prob(br);
+        h->segmentation_temporal_update = ffnv_br_get_bit(br);
+        for (i = 0; i < 3; i++)
+            p->pred_probs[i] = h->segmentation_temporal_update ? ffnv_vp9_read_prob(br) : 255;
+    }
+
+    if (ffnv_br_get_bit(br)) {
+        p->segmentation_abs_or_delta_update = ffnv_br_get_bit(br);
+        for (i = 0; i < 8; i++) {
+            for (j = 0; j < 4; j++) {
+                int v = 0;
+
+                p->feature_enabled[i][j] = ffnv_br_get_bit(br);
+                if (p->feature_enabled[i][j]) {
+                    v = (int)ffnv_br_get_bits(br, feature_bits[j]);
+                    if (feature_signed[j] && ffnv_br_get_bit(br))
+                        v = -v;
+                }
+                p->feature_data[i][j] = v;
+            }
+        }
+    }
+}
+
+static inline void ffnv_vp9_tile_info(FFNVBitReader *br, FFNVVP9FrameHeader *h)
+{
+    const int sb64_cols = (((h->width + 7) >> 3) + 7) >> 3;
+    int min_log2 = 0, max_log2 = 1;
+
+    while ((64 << min_log2) < sb64_cols)
+        min_log2++;
+    while ((sb64_cols >> max_log2) >= 4)
+        max_log2++;
+    max_log2--;
+
+    h->tile_cols_log2 = min_log2;
+    while (h->tile_cols_log2 < max_log2 && ffnv_br_get_bit(br))
+        h->tile_cols_log2++;
+
+    h->tile_rows_log2 = ffnv_br_get_bit(br);
+    if (h->tile_rows_log2)
+        h->tile_rows_log2 += ffnv_br_get_bit(br);
+}
+
+/* Parse the uncompressed header into p->hdr and the state carried across frames. */
+static inline int ffnv_vp9_parse_header(FFNVVP9Parser *p, const uint8_t *buf, size_t size)
+{
+    static const int literal_to_type[4] = { 1, 0, 2, 3 };
+    FFNVVP9FrameHeader *h = &p->hdr;
+    FFNVBitReader br;
+    int i;
+
+    ffnv_br_init(&br, buf, size);
+    memset(h, 0, sizeof(*h));
+
+    if (ffnv_br_get_bits(&br, 2) != 2)
+        return -1;
+    h->profile  = ffnv_br_get_bit(&br);
+    h->profile |= ffnv_br_get_bit(&br) << 1;
+    if (h->profile == 3 && ffnv_br_get_bit(&br))
+        return -1;
+
+    h->show_existing_frame = ffnv_br_get_bit(&br);
+    if (h->show_existing_frame) {
+        h->frame_to_show_map_idx = (int)ffnv_br_get_bits(&br, 3);
+        return ffnv_br_overread(&br) ? -1 : 0;
+    }
+
+    h->key_frame            = !ffnv_br_get_bit(&br);
+    h->show_frame           = ffnv_br_get_bit(&br);
+    h->error_resilient_mode = ffnv_br_get_bit(&br);
+
+    if (h->key_frame) {
+        if (ffnv_vp9_sync_code(&br) < 0 || ffnv_vp9_color_config(p, &br, h->profile) < 0)
+            return -1;
+        ffnv_vp9_frame_size(&br, h);
+        ffnv_vp9_render_size(&br, h);
+        h->refresh_frame_flags = 0xff;
+    } else {
+        h->intra_only = h->show_frame ? 0 : ffnv_br_get_bit(&br);
+        h->reset_frame_context = h->error_resilient_mode ? 0 : (int)ffnv_br_get_bits(&br, 2);
+
+        if (h->intra_only) {
+            if (ffnv_vp9_sync_code(&br) < 0)
+                return -1;
+            if (h->profile > 0) {
+                if (ffnv_vp9_color_config(p, &br, h->profile) < 0)
+                    return -1;
+            } else {
+                p->bit_depth     = 8;
+                p->color_space   = FFNV_VP9_CS_BT_601;
+                p->color_range   = 0;
+                p->subsampling_x = p->subsampling_y = 1;
+            }
+            h->refresh_frame_flags = (int)ffnv_br_get_bits(&br, 8);
+            ffnv_vp9_frame_size(&br, h);
+            ffnv_vp9_render_size(&br, h);
+        } else {
+            h->refresh_frame_flags = (int)ffnv_br_get_bits(&br, 8);
+            for (i = 0; i < 3; i++) {
+                h->ref_frame_idx[i]       = (int)ffnv_br_get_bits(&br, 3);
+                h->ref_frame_sign_bias[i] = ffnv_br_get_bit(&br);
+            }
+
+            /* frame_size_with_refs() */
+            for (i = 0; i < 3; i++) {
+                if (ffnv_br_get_bit(&br)) {
+                    const FFNVVP9RefSlot *r = &p->ref[h->ref_frame_idx[i]];
+
+                    if (r->pic_idx < 0)
+                        return -1;
+                    h->width  = r->width;
+                    h->height = r->height;
+                    break;
+                }
+            }
+            if (i == 3)
+                ffnv_vp9_frame_size(&br, h);
+            ffnv_vp9_render_size(&br, h);
+
+            h->allow_high_precision_mv = ffnv_br_get_bit(&br);
+            h->interp_filter = ffnv_br_get_bit(&br) ? 4 : literal_to_type[ffnv_br_get_bits(&br, 2)];
+        }
+    }
+
+    if (!h->error_resilient_mode) {
+        h->refresh_frame_context        = ffnv_br_get_bit(&br);
+        h->frame_parallel_decoding_mode = ffnv_br_get_bit(&br);
+    } else {
+        h->frame_parallel_decoding_mode = 1;
+    }
+
+    /* for intra and error resilient frames the index only selects the context to reset */
+    h->frame_context_idx = (int)ffnv_br_get_bits(&br, 2);
+    if (h->key_frame || h->intra_only || h->error_resilient_mode) {
+        ffnv_vp9_setup_past_independence(p);
+        h->frame_context_idx = 0;
+    }
+
+    ffnv_vp9_loop_filter_params(p, &br);
+
+    h->base_q_idx    = (int)ffnv_br_get_bits(&br, 8);
+    h->delta_q_y_dc  = ffnv_vp9_delta_q(&br);
+    h->delta_q_uv_dc = ffnv_vp9_delta_q(&br);
+    h->delta_q_uv_ac = ffnv_vp9_delta_q(&br);
+
+    ffnv_vp9_segmentation_params(p, &br);
+    ffnv_vp9_tile_info(&br, h);
+
+    h->compressed_header_size = (int)ffnv_br_get_bits(&br, 16);
+    ffnv_br_align(&br);
+    h->uncompressed_header_size = (int)(br.index >> 3);
+
+    if (ffnv_br_overread(&br) || !h->compressed_header_size ||
+        (size_t)h->uncompressed_header_size + h->compressed_header_size > size)
+        return -1;
+    return 0;
+}
+
+static inline void ffnv_vp9_update_busy(FFNVVP9Parser *p)
+{
+    int i;
+
+    p->pool.busy_ref = 0;
+    for (i = 0; i < FFNV_VP9_NUM_REFS; i++)
+        ffnv_pool_set_ref(&p->pool, p->ref[i].pic_idx, 1);
+}
+
+static inline void ffnv_vp9_queue(FFNVVP9Parser *p, int pic_idx, int64_t timestamp)
+{
+    CUVIDPARSERDISPINFO disp;
+
+    memset(&disp, 0, sizeof(disp));
+    disp.picture_index     = pic_idx;
+    disp.progressive_frame = 1;
+    disp.top_field_first   = 1;
+    disp.timestamp         = timestamp;
+    ffnv_pool_queue(&p->pool, p->order++, &disp);
+}
+
+static inline void ffnv_vp9_fill_pic_params(const FFNVVP9Parser *p, int idx, CUVIDPICPARAMS *pic)
+{
+    const FFNVVP9FrameHeader *h = &p->hdr;
+    CUVIDVP9PICPARAMS *v = &pic->CodecSpecific.vp9;
+    int i, j;
+
+    pic->PicWidthInMbs    = (h->width  + 15) / 16;
+    pic->FrameHeightInMbs = (h->height + 15) / 16;
+    pic->CurrPicIdx       = idx;
+    pic->ref_pic_flag     = h->refresh_frame_flags != 0;
+    pic->intra_pic_flag   = h->key_frame || h->intra_only;
+
+    v->width        = (unsigned int)h->width;
+    v->height       = (unsigned int)h->height;
+    v->LastRefIdx   = (unsigned char)p->ref[h->ref_frame_idx[0]].pic_idx;
+    v->GoldenRefIdx = (unsigned char)p->ref[h->ref_frame_idx[1]].pic_idx;
+    v->AltRefIdx    = (unsigned char)p->ref[h->ref_frame_idx[2]].pic_idx;
+    v->colorSpace   = (unsigned char)p->color_space;
+
+    v->profile                 = (unsigned short)h->profile;
+    v->frameContextIdx         = (unsigned short)h->frame_context_idx;
+    v->frameType               = !h->key_frame;
+    v->showFrame               = (unsigned short)h->show_frame;
+    v->errorResilient          = (unsigned short)h->error_resilient_mode;
+    v->frameParallelDecoding   = (unsigned short)h->frame_parallel_decoding_mode;
+    v->subSamplingX            = (unsigned short)p->subsampling_x;
+    v->subSamplingY            = (unsigned short)p->subsampling_y;
+    v->intraOnly               = (unsigned short)h->intra_only;
+    v->allow_high_precision_mv = (unsigned short)h->allow_high_precision_mv;
+    v->refreshEntropyProbs     = (unsigned short)h->refresh_frame_context;
+
+    v->bitDepthMinus8Luma   = (unsigned char)(p->bit_depth - 8);
+    v->bitDepthMinus8Chroma = (unsigned char)(p->bit_depth - 8);
+    v->loopFilterLevel      = (unsigned char)h->loop_filter_level;
+    v->loopFilterSharpness  = (unsigned char)h->loop_filter_sharpness;
+    v->modeRefLfEnabled     = (unsigned char)h->loop_filter_delta_enabled;
+    v->log2_tile_columns    = (unsigned char)h->tile_cols_log2;
+    v->log2_tile_rows       = (unsigned char)h->tile_rows_log2;
+
+    v->segmentEnabled           = (unsigned char)h->segmentation_enabled;
+    v->segmentMapUpdate         = (unsigned char)h->segmentation_update_map;
+    v->segmentMapTemporalUpdate = (unsigned char)h->segmentation_temporal_update;
+    v->segmentFeatureMode       = (unsigned char)p->segmentation_abs_or_delta_update;
+    for (i = 0; i < 8; i++) {
+        for (j = 0; j < 4; j++) {
+            v->segmentFeatureEnable[i][j] = (unsigned char)p->feature_enabled[i][j];
+            v->segmentFeatureData[i][j]   = (short)p->feature_data[i][j];
+        }
+    }
+    for (i = 0; i < 7; i++)
+        v->mb_segment_tree_probs[i] = (unsigned char)p->tree_probs[i];
+    for (i = 0; i < 3; i++)
+        v->segment_pred_probs[i] = (unsigned char)p->pred_probs[i];
+
+    v->qpYAc  = h->base_q_idx;
+    v->qpYDc  = h->delta_q_y_dc;
+    v->qpChDc = h->delta_q_uv_dc;
+    v->qpChAc = h->delta_q_uv_ac;
+
+    for (i = 0; i < 3; i++) {
+        v->activeRefIdx[i]         = (unsigned int)h->ref_frame_idx[i];
+        v->refFrameSignBias[i + 1] = (unsigned char)h->ref_frame_sign_bias[i];
+    }
+    v->resetFrameContext = (unsigned int)h->reset_frame_context;
+    v->mcomp_filter_type = (unsigned int)h->interp_filter;
+    for (i = 0; i < 4; i++)
+        v->mbRefLfDelta[i] = (unsigned int)p->loop_filter_ref_deltas[i];
+    for (i = 0; i < 2; i++)
+        v->mbModeLfDelta[i] = (unsigned int)p->loop_filter_mode_deltas[i];
+    v->frameTagSize     = (unsigned int)h->uncompressed_header_size;
+    v->offsetToDctParts = (unsigned int)h->compressed_header_size;
+}
+
+/**
+ * Parse one frame, as split by ffnv_vp9_split_superframe(), and fill pic
+ * for cuvidDecodePicture(). pic points into buf, which must stay valid
+ * until cuvidDecodePicture() returns.
+ *
+ * Returns FFNV_PARSE_PICTURE if pic was filled, 0 if there is nothing to
+ * decode (show_existing_frame, or frames before the first key frame), or
+ * a negative FFNV_PARSE_* error code. FFNV_PARSE_SEQUENCE is returned
+ * alone when the frame size or format changes: output all pending
+ * pictures, (re)create the decoder from ffnv_vp9_get_format() and pass
+ * the same frame again.
+ */
+static inline int ffnv_vp9_parse_frame(FFNVVP9Parser *p, const uint8_t *buf, size_t size,
+                                       int64_t timestamp, CUVIDPICPARAMS *pic)
+{
+    const FFNVVP9FrameHeader *h = &p->hdr;
+    int idx, i;
+
+    memset(pic, 0, sizeof(*pic));
+
+    if (!size)
+        return 0;
+    if (ffnv_vp9_parse_header(p, buf, size) < 0)
+        return FFNV_PARSE_ERROR;
+
+    if (h->show_existing_frame) {
+        idx = p->ref[h->frame_to_show_map_idx].pic_idx;
+        if (idx >= 0)
+            ffnv_vp9_queue(p, idx, timestamp);
+        return 0;
+    }
+
+    if (!h->key_frame && !p->have_key_frame)
+        return 0;
+
+    if (!p->has_active || p->active_width != h->width || p->active_height != h->height ||
+        p->active_bit_depth != p->bit_depth ||
+        p->active_subsampling_x != p->subsampling_x || p->active_subsampling_y != p->subsampling_y) {
+        p->has_active           = 1;
+        p->active_width         = h->width;
+        p->active_height        = h->height;
+        p->active_bit_depth     = p->bit_depth;
+        p->active_subsampling_x = p->subsampling_x;
+        p->active_subsampling_y = p->subsampling_y;
+        return FFNV_PARSE_SEQUENCE;
+    }
+
+    idx = ffnv_pool_get_free(&p->pool);
+    if (idx < 0)
+        return FFNV_PARSE_AGAIN;
+
+    ffnv_vp9_fill_pic_params(p, idx, pic);
+    pic->nBitstreamDataLen = (unsigned int)size;
+    pic->pBitstreamData    = buf;
+    pic->nNumSlices        = 1;
+    pic->pSliceDataOffsets = NULL;
+
+    for (i = 0; i < FFNV_VP9_NUM_REFS; i++) {
+        if (h->refresh_frame_flags >> i & 1) {
+            p->ref[i].pic_idx = idx;
+            p->ref[i].width   = h->width;
+            p->ref[i].height  = h->height;
+        }
+    }
+    p->have_key_frame = 1;
+
+    if (h->show_frame)
+        ffnv_vp9_queue(p, idx, timestamp);
+    ffnv_vp9_update_busy(p);
+    return FFNV_PARSE_PICTURE;
+}
+
+/**
+ * Get the next shown frame. Returns 1 if disp was filled, 0 if there is
+ * none. The surface must be handed back with ffnv_vp9_release() once it
+ * has been unmapped, for every time it was returned: frames shown again
+ * with show_existing_frame come out once per showing.
+ */
+static inline int ffnv_vp9_get_display(FFNVVP9Parser *p, CUVIDPARSERDISPINFO *disp)
+{
+    return ffnv_pool_output(&p->pool, 0, disp);
+}
+
+static inline void ffnv_vp9_release(FFNVVP9Parser *p, int picture_index)
+{
+    ffnv_pool_release(&p->pool, picture_index);
+}
+
+/** Format of the active sequence. Returns 0 on success, -1 if no frame was parsed yet. */
+static inline int ffnv_vp9_get_format(const FFNVVP9Parser *p, CUVIDEOFORMAT *fmt)
+{
+    /* VP9 color_space to ISO/IEC 23001-8 MatrixCoefficients */
+    static const uint8_t matrix[8] = { 2, 6, 1, 6, 7, 9, 2, 0 };
+    unsigned int g;
+
+    if (!p->has_active)
+        return -1;
+
+    memset(fmt, 0, sizeof(*fmt));
+    fmt->codec                   = cudaVideoCodec_VP9;
+    fmt->progressive_sequence    = 1;
+    fmt->bit_depth_luma_minus8   = (unsigned char)(p->active_bit_depth - 8);
+    fmt->bit_depth_chroma_minus8 = (unsigned char)(p->active_bit_depth - 8);
+    fmt->coded_width             = (unsigned int)p->active_width;
+    fmt->coded_height            = (unsigned int)p->active_height;
+    fmt->display_area.right      = p->active_width;
+    fmt->display_area.bottom     = p->active_height;
+    fmt->chroma_format           = !p->active_subsampling_x ? cudaVideoChromaFormat_444 :
+                                   !p->active_subsampling_y ? cudaVideoChromaFormat_422 :
+                                                              cudaVideoChromaFormat_420;
+
+    g = ffnv_parse_gcd((unsigned int)p->active_width, (unsigned int)p->active_height);
+    fmt->display_aspect_ratio.x = (int)(p->active_width  / g);
+    fmt->display_aspect_ratio.y = (int)(p->active_height / g);
+
+    fmt->video_signal_description.video_format             = 5;
+    fmt->video_signal_description.video_full_range_flag    = p->color_range & 1;
+    fmt->video_signal_description.color_primaries          = 2;
+    fmt->video_signal_description.transfer_characteristics = 2;
+    fmt->video_signal_description.matrix_coefficients      = matrix[p->color_space & 7];
+    return 0;
+}
+
+#endif
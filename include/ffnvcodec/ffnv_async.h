@@ -0,0 +1,539 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Completion of decode and encode operations on an event loop thread.
+ *
+ * An FFNVAsyncOp completes either by being posted, from any thread, or by
+ * being polled from ffnv_async_run(), which the event loop calls when
+ * woken up and, while ops are polled, periodically. Completions are
+ * sourced from:
+ *  - cuStreamAddCallback, for the work queued on a CUDA stream, e.g. the
+ *    cuMemcpy2DAsync of a mapped frame;
+ *  - the NvEncRegisterAsyncEvent completion event of an output bitstream
+ *    with asynchronous encoding on Windows, or else NvEncLockBitstream
+ *    polled with doNotWait;
+ *  - the parser display callback, through FFNVAsyncFrameQueue, as
+ *    cuvidParseVideoData runs on the loop thread.
+ *
+ * From C++20 the ffnv namespace wraps these in awaitables, resuming the
+ * awaiting coroutine on the loop thread.
+ */
+
+#ifndef FFNV_ASYNC_H
+#define FFNV_ASYNC_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "dynlink_loader.h"
+#include "ffnv_thread.h"
+
+#define FFNV_ASYNC_MAX_FRAMES 32
+
+typedef struct FFNVAsyncLoop FFNVAsyncLoop;
+typedef struct FFNVAsyncOp FFNVAsyncOp;
+
+struct FFNVAsyncOp {
+    FFNVAsyncLoop *loop;
+    /** Called on the loop thread once the op completed. */
+    void (*complete)(FFNVAsyncOp *op);
+    /** Set for polled ops, returns 0 while the op is pending. */
+    int (*poll)(FFNVAsyncOp *op);
+    void *opaque;
+    int status;            /**< CUresult or NVENCSTATUS of the operation */
+    FFNVAsyncOp *next;
+};
+
+struct FFNVAsyncLoop {
+    FFNVMutex lock;
+    FFNVAsyncOp *posted, *posted_tail;  /* completed on other threads */
+    FFNVAsyncOp *polled;                /* loop thread only */
+    int nb_polled;
+    /** Called after an op was posted, to wake up the event loop (eventfd, PostMessage, ...). */
+    void (*wakeup)(void *opaque);
+    void *wakeup_opaque;
+};
+
+/** wakeup may be NULL if the loop calls ffnv_async_run() regularly anyway. Returns 0 or -1. */
+static inline int ffnv_async_init(FFNVAsyncLoop *loop, void (*wakeup)(void *opaque), void *opaque)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->wakeup        = wakeup;
+    loop->wakeup_opaque = opaque;
+    return ffnv_mutex_init(&loop->lock);
+}
+
+/** No op may be pending. */
+static inline void ffnv_async_uninit(FFNVAsyncLoop *loop)
+{
+    ffnv_mutex_destroy(&loop->lock);
+    memset(loop, 0, sizeof(*loop));
+}
+
+/** Complete op with status; may be called from any thread. */
+static inline void ffnv_async_post(FFNVAsyncOp *op, int status)
+{
+    FFNVAsyncLoop *loop = op->loop;
+
+    op->status = status;
+    op->next   = NULL;
+    ffnv_mutex_lock(&loop->lock);
+    if (loop->posted_tail)
+        loop->posted_tail->next = op;
+    else
+        loop->posted = op;
+    loop->posted_tail = op;
+    ffnv_mutex_unlock(&loop->lock);
+
+    if (loop->wakeup)
+        loop->wakeup(loop->wakeup_opaque);
+}
+
+/** Have op polled by ffnv_async_run(); loop thread only. */
+static inline void ffnv_async_add_polled(FFNVAsyncOp *op)
+{
+    op->next         = op->loop->polled;
+    op->loop->polled = op;
+    op->loop->nb_polled++;
+}
+
+/**
+ * Poll the polled ops and run the completions of the finished ones, in
+ * the order they were posted. Returns the number of ops completed; while
+ * loop->nb_polled is not 0 the loop should call again after a short
+ * timeout even if not woken up.
+ */
+static inline int ffnv_async_run(FFNVAsyncLoop *loop)
+{
+    FFNVAsyncOp *op, *next, *pending = NULL, **tail = &pending;
+    int n = 0;
+
+    /* completions may add polled ops, so walk a detached list */
+    op = loop->polled;
+    loop->polled = NULL;
+    for (; op; op = next) {
+        next = op->next;
+        if (op->poll(op)) {
+            loop->nb_polled--;
+            op->next = NULL;
+            op->complete(op);
+            n++;
+        } else {
+            *tail = op;
+            tail  = &op->next;
+        }
+    }
+    *tail = loop->polled;
+    loop->polled = pending;
+
+    ffnv_mutex_lock(&loop->lock);
+    op = loop->posted;
+    loop->posted = loop->posted_tail = NULL;
+    ffnv_mutex_unlock(&loop->lock);
+
+    for (; op; op = next) {
+        next = op->next;
+        op->next = NULL;
+        op->complete(op);
+        n++;
+    }
+    return n;
+}
+
+static inline void CUDAAPI ffnv_async_stream_callback(CUstream stream, CUresult status, void *userdata)
+{
+    (void)stream;
+    ffnv_async_post((FFNVAsyncOp*)userdata, status);
+}
+
+/** Complete op once the work queued so far on stream is done. */
+static inline CUresult ffnv_async_stream_op(FFNVAsyncOp *op, CudaFunctions *cu, CUstream stream)
+{
+    op->poll = NULL;
+    return cu->cuStreamAddCallback(stream, ffnv_async_stream_callback, op, 0);
+}
+
+/** Output bitstream being waited for, op.status is the NvEncLockBitstream result. */
+typedef struct FFNVAsyncBitstream {
+    FFNVAsyncOp op;
+    NV_ENCODE_API_FUNCTION_LIST *nvenc;
+    void *encoder;
+    NV_ENC_LOCK_BITSTREAM lock;  /**< locked on success, to be unlocked by the caller */
+    void *event;                 /**< completion event registered with ffnv_async_register_event(), or NULL */
+#if defined(_WIN32)
+    HANDLE wait;
+#endif
+    void (*done)(struct FFNVAsyncBitstream *bs);
+    void *opaque;                /**< for done */
+} FFNVAsyncBitstream;
+
+/** Register an event for NV_ENC_PIC_PARAMS.completionEvent, asynchronous sessions on Windows only. */
+static inline NVENCSTATUS ffnv_async_register_event(NV_ENCODE_API_FUNCTION_LIST *nvenc, void *encoder, void *event)
+{
+    NV_ENC_EVENT_PARAMS params;
+
+    memset(&params, 0, sizeof(params));
+    params.version         = NV_ENC_EVENT_PARAMS_VER;
+    params.completionEvent = event;
+    return nvenc->nvEncRegisterAsyncEvent(encoder, &params);
+}
+
+static inline int ffnv_async_bitstream_poll(FFNVAsyncOp *op)
+{
+    FFNVAsyncBitstream *bs = (FFNVAsyncBitstream*)op->opaque;
+    NVENCSTATUS err = bs->nvenc->nvEncLockBitstream(bs->encoder, &bs->lock);
+
+    if (err == NV_ENC_ERR_LOCK_BUSY)
+        return 0;
+    op->status = err;
+    return 1;
+}
+
+static inline void ffnv_async_bitstream_complete(FFNVAsyncOp *op)
+{
+    FFNVAsyncBitstream *bs = (FFNVAsyncBitstream*)op->opaque;
+
+#if defined(_WIN32)
+    if (bs->wait) {
+        UnregisterWait(bs->wait);
+        bs->wait = NULL;
+        /* the event fired, the lock does not wait */
+        bs->lock.doNotWait = 0;
+        op->status = bs->nvenc->nvEncLockBitstream(bs->encoder, &bs->lock);
+    }
+#endif
+    bs->done(bs);
+}
+
+#if defined(_WIN32)
+static inline VOID CALLBACK ffnv_async_event_callback(PVOID opaque, BOOLEAN timeout)
+{
+    (void)timeout;
+    ffnv_async_post((FFNVAsyncOp*)opaque, NV_ENC_SUCCESS);
+}
+#endif
+
+/**
+ * Wait for output to be encoded on the loop thread, then lock it and
+ * call done. Returns 1 if the bitstream was locked (or failed) right
+ * away, in which case done is not called, 0 if the wait started.
+ */
+static inline int ffnv_async_lock_bitstream(FFNVAsyncBitstream *bs, FFNVAsyncLoop *loop,
+                                            NV_ENCODE_API_FUNCTION_LIST *nvenc, void *encoder,
+                                            NV_ENC_OUTPUT_PTR output,
+                                            void (*done)(FFNVAsyncBitstream *bs))
+{
+    memset(&bs->op, 0, sizeof(bs->op));
+    bs->op.loop     = loop;
+    bs->op.opaque   = bs;
+    bs->op.complete = ffnv_async_bitstream_complete;
+    bs->nvenc       = nvenc;
+    bs->encoder     = encoder;
+    bs->done        = done;
+
+    memset(&bs->lock, 0, sizeof(bs->lock));
+    bs->lock.version         = NV_ENC_LOCK_BITSTREAM_VER;
+    bs->lock.outputBitstream = output;
+    bs->lock.doNotWait       = 1;
+
+#if defined(_WIN32)
+    bs->wait = NULL;
+    if (bs->event) {
+        if (RegisterWaitForSingleObject(&bs->wait, (HANDLE)bs->event, ffnv_async_event_callback,
+                                        &bs->op, INFINITE, WT_EXECUTEONLYONCE))
+            return 0;
+        bs->wait = NULL;
+    }
+#endif
+
+    if (ffnv_async_bitstream_poll(&bs->op))
+        return 1;
+
+    bs->op.poll = ffnv_async_bitstream_poll;
+    ffnv_async_add_polled(&bs->op);
+    return 0;
+}
+
+/**
+ * Frames output by a parser, filled from its display callback and read on
+ * the loop thread. A frame waiter is completed when a frame or the end of
+ * the stream arrives.
+ */
+typedef struct FFNVAsyncFrameQueue {
+    CUVIDPARSERDISPINFO disp[FFNV_ASYNC_MAX_FRAMES];
+    int head, count;
+    int eos;
+    FFNVAsyncOp *waiter;
+} FFNVAsyncFrameQueue;
+
+/**
+ * To be called from the PFNVIDDISPLAYCALLBACK, disp being NULL at the end
+ * of the stream. Returns 1, or 0 if the queue is full, in which case the
+ * frames must be read before parsing more data.
+ */
+static inline int ffnv_async_frame_push(FFNVAsyncFrameQueue *q, CUVIDPARSERDISPINFO *disp)
+{
+    FFNVAsyncOp *waiter = q->waiter;
+
+    if (!disp) {
+        q->eos = 1;
+    } else {
+        if (q->count == FFNV_ASYNC_MAX_FRAMES)
+            return 0;
+        q->disp[(q->head + q->count++) % FFNV_ASYNC_MAX_FRAMES] = *disp;
+    }
+
+    if (waiter) {
+        q->waiter = NULL;
+        ffnv_async_post(waiter, 0);
+    }
+    return 1;
+}
+
+/** Returns 1 and sets disp, 0 if no frame is queued, -1 at the end of the stream. */
+static inline int ffnv_async_frame_pop(FFNVAsyncFrameQueue *q, CUVIDPARSERDISPINFO *disp)
+{
+    if (!q->count)
+        return q->eos ? -1 : 0;
+
+    *disp   = q->disp[q->head];
+    q->head = (q->head + 1) % FFNV_ASYNC_MAX_FRAMES;
+    q->count--;
+    return 1;
+}
+
+#if defined(__cplusplus) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+
+namespace ffnv {
+
+/** co_await ffnv::stream_done(loop, cu, stream) resumes with the CUresult once the stream is idle. */
+class stream_done {
+public:
+    stream_done(FFNVAsyncLoop *loop, CudaFunctions *cu, CUstream stream)
+        : cu_(cu), stream_(stream), err_(CUDA_SUCCESS)
+    {
+        memset(&op_, 0, sizeof(op_));
+        op_.loop     = loop;
+        op_.complete = resume;
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        handle_    = handle;
+        op_.opaque = this;
+        err_ = ffnv_async_stream_op(&op_, cu_, stream_);
+        return err_ == CUDA_SUCCESS;
+    }
+
+    CUresult await_resume() const noexcept
+    {
+        return err_ != CUDA_SUCCESS ? err_ : (CUresult)op_.status;
+    }
+
+private:
+    static void resume(FFNVAsyncOp *op) { static_cast<stream_done*>(op->opaque)->handle_.resume(); }
+
+    FFNVAsyncOp op_;
+    CudaFunctions *cu_;
+    CUstream stream_;
+    CUresult err_;
+    std::coroutine_handle<> handle_;
+};
+
+/** Output of an encoded picture: status, and lock to pass to NvEncUnlockBitstream if it is NV_ENC_SUCCESS. */
+struct bitstream_result {
+    NVENCSTATUS status;
+    NV_ENC_LOCK_BITSTREAM lock;
+};
+
+/** co_await ffnv::bitstream(...) resumes with a bitstream_result once the output is locked. */
+class bitstream {
+public:
+    bitstream(FFNVAsyncLoop *loop, NV_ENCODE_API_FUNCTION_LIST *nvenc, void *encoder,
+              NV_ENC_OUTPUT_PTR output, void *event = NULL)
+        : loop_(loop), output_(output)
+    {
+        memset(&bs_, 0, sizeof(bs_));
+        bs_.nvenc   = nvenc;
+        bs_.encoder = encoder;
+        bs_.event   = event;
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        handle_     = handle;
+        bs_.opaque  = this;
+        return !ffnv_async_lock_bitstream(&bs_, loop_, bs_.nvenc, bs_.encoder, output_, resume);
+    }
+
+    bitstream_result await_resume() const noexcept
+    {
+        bitstream_result res = { (NVENCSTATUS)bs_.op.status, bs_.lock };
+        return res;
+    }
+
+private:
+    static void resume(FFNVAsyncBitstream *bs) { static_cast<bitstream*>(bs->opaque)->handle_.resume(); }
+
+    FFNVAsyncBitstream bs_;
+    FFNVAsyncLoop *loop_;
+    NV_ENC_OUTPUT_PTR output_;
+    std::coroutine_handle<> handle_;
+};
+
+/** Parser output of one decode session, see ffnv_async_frame_push(). */
+class frame_queue {
+public:
+    explicit frame_queue(FFNVAsyncLoop *loop)
+    {
+        memset(&q_, 0, sizeof(q_));
+        memset(&op_, 0, sizeof(op_));
+        op_.loop     = loop;
+        op_.opaque   = this;
+        op_.complete = resume;
+    }
+
+    frame_queue(const frame_queue&) = delete;
+    frame_queue &operator=(const frame_queue&) = delete;
+
+    /** For the display callback. */
+    int push(CUVIDPARSERDISPINFO *disp) { return ffnv_async_frame_push(&q_, disp); }
+
+    class next_frame_awaiter {
+    public:
+        next_frame_awaiter(frame_queue &fq, CUVIDPARSERDISPINFO &disp) : fq_(fq), disp_(disp), ret_(0) {}
+
+        bool await_ready() noexcept
+        {
+            ret_ = ffnv_async_frame_pop(&fq_.q_, &disp_);
+            return ret_ != 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            fq_.handle_   = handle;
+            fq_.q_.waiter = &fq_.op_;
+        }
+
+        /** true with the frame set, false at the end of the stream. */
+        bool await_resume() noexcept
+        {
+            if (!ret_)
+                ret_ = ffnv_async_frame_pop(&fq_.q_, &disp_);
+            return ret_ > 0;
+        }
+
+    private:
+        frame_queue &fq_;
+        CUVIDPARSERDISPINFO &disp_;
+        int ret_;
+    };
+
+    /** co_await next_frame(disp) waits for the next frame in display order. */
+    next_frame_awaiter next_frame(CUVIDPARSERDISPINFO &disp) { return next_frame_awaiter(*this, disp); }
+
+private:
+    static void resume(FFNVAsyncOp *op) { static_cast<frame_queue*>(op->opaque)->handle_.resume(); }
+
+    FFNVAsyncFrameQueue q_;
+    FFNVAsyncOp op_;
+    std::coroutine_handle<> handle_;
+};
+
+/** Encode session driven from the loop thread. */
+class encoder {
+public:
+    encoder(FFNVAsyncLoop *loop, NV_ENCODE_API_FUNCTION_LIST *nvenc, void *session)
+        : loop_(loop), nvenc_(nvenc), session_(session) {}
+
+    /** co_await bitstream(output) waits for an output submitted earlier. */
+    ffnv::bitstream bitstream(NV_ENC_OUTPUT_PTR output, void *event = NULL)
+    {
+        return ffnv::bitstream(loop_, nvenc_, session_, output, event);
+    }
+
+    class encode_awaiter {
+    public:
+        encode_awaiter(encoder &enc, NV_ENC_PIC_PARAMS &pic)
+            : enc_(enc), pic_(pic), err_(NV_ENC_SUCCESS),
+              bs_(enc.loop_, enc.nvenc_, enc.session_, pic.outputBitstream, pic.completionEvent) {}
+
+        /* the picture is submitted when awaited, not when the awaiter is created */
+        bool await_ready() noexcept
+        {
+            err_ = enc_.nvenc_->nvEncEncodePicture(enc_.session_, &pic_);
+            return err_ != NV_ENC_SUCCESS;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) { return bs_.await_suspend(handle); }
+
+        /**
+         * status is the NvEncEncodePicture error, NV_ENC_ERR_NEED_MORE_INPUT
+         * if the output is delayed by reordering, or the lock result.
+         */
+        bitstream_result await_resume() const noexcept
+        {
+            bitstream_result res;
+
+            if (err_ == NV_ENC_SUCCESS)
+                return bs_.await_resume();
+            memset(&res, 0, sizeof(res));
+            res.status = err_;
+            return res;
+        }
+
+    private:
+        encoder &enc_;
+        NV_ENC_PIC_PARAMS &pic_;
+        NVENCSTATUS err_;
+        ffnv::bitstream bs_;
+    };
+
+    /**
+     * co_await encode(pic) submits a picture and waits for its output
+     * bitstream, resuming with a bitstream_result whose lock the caller
+     * unlocks. Outputs delayed with NV_ENC_ERR_NEED_MORE_INPUT are then
+     * awaited with bitstream().
+     */
+    encode_awaiter encode(NV_ENC_PIC_PARAMS &pic) { return encode_awaiter(*this, pic); }
+
+private:
+    FFNVAsyncLoop *loop_;
+    NV_ENCODE_API_FUNCTION_LIST *nvenc_;
+    void *session_;
+};
+
+}
+#endif
+
+#endif
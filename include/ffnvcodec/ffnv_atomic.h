@@ -0,0 +1,180 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * 32 bit atomics and address based waiting (futex on Linux, WaitOnAddress
+ * on Windows) for the lock-free helpers. Loads acquire, stores release and
+ * read-modify-write operations are sequentially consistent.
+ */
+
+#ifndef FFNV_ATOMIC_H
+#define FFNV_ATOMIC_H
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+# include <windows.h>
+# pragma comment(lib, "synchronization.lib")
+
+static inline uint32_t ffnv_atomic_load(const volatile uint32_t *p)
+{
+    return (uint32_t)InterlockedCompareExchange((volatile LONG*)p, 0, 0);
+}
+
+static inline void ffnv_atomic_store(volatile uint32_t *p, uint32_t v)
+{
+    InterlockedExchange((volatile LONG*)p, (LONG)v);
+}
+
+static inline uint32_t ffnv_atomic_add(volatile uint32_t *p, uint32_t v)
+{
+    return (uint32_t)InterlockedExchangeAdd((volatile LONG*)p, (LONG)v) + v;
+}
+
+static inline uint32_t ffnv_atomic_or(volatile uint32_t *p, uint32_t v)
+{
+    return (uint32_t)InterlockedOr((volatile LONG*)p, (LONG)v);
+}
+
+static inline uint32_t ffnv_atomic_and(volatile uint32_t *p, uint32_t v)
+{
+    return (uint32_t)InterlockedAnd((volatile LONG*)p, (LONG)v);
+}
+
+static inline int ffnv_atomic_cas(volatile uint32_t *p, uint32_t expected, uint32_t desired)
+{
+    return (uint32_t)InterlockedCompareExchange((volatile LONG*)p, (LONG)desired, (LONG)expected) == expected;
+}
+
+static inline void ffnv_cpu_relax(void)
+{
+    YieldProcessor();
+}
+#else
+static inline uint32_t ffnv_atomic_load(const volatile uint32_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void ffnv_atomic_store(volatile uint32_t *p, uint32_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+/** Returns the new value. */
+static inline uint32_t ffnv_atomic_add(volatile uint32_t *p, uint32_t v)
+{
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+/** Returns the previous value. */
+static inline uint32_t ffnv_atomic_or(volatile uint32_t *p, uint32_t v)
+{
+    return __atomic_fetch_or(p, v, __ATOMIC_SEQ_CST);
+}
+
+/** Returns the previous value. */
+static inline uint32_t ffnv_atomic_and(volatile uint32_t *p, uint32_t v)
+{
+    return __atomic_fetch_and(p, v, __ATOMIC_SEQ_CST);
+}
+
+/** Returns 1 if *p was expected and is now desired. */
+static inline int ffnv_atomic_cas(volatile uint32_t *p, uint32_t expected, uint32_t desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void ffnv_cpu_relax(void)
+{
+# if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+# elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+# endif
+}
+#endif
+
+#if defined(_WIN32)
+# if !defined(_MSC_VER)
+#  include <windows.h>
+# endif
+
+/** Sleep while *p is val, at most timeout_ms milliseconds unless it is negative. Spurious wakeups happen. */
+static inline void ffnv_futex_wait(volatile uint32_t *p, uint32_t val, int timeout_ms)
+{
+    WaitOnAddress(p, &val, sizeof(val), timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+}
+
+static inline void ffnv_futex_wake(volatile uint32_t *p)
+{
+    WakeByAddressAll((PVOID)p);
+}
+#elif defined(__linux__)
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+
+# if !defined(__cplusplus) && !defined(__USE_MISC)
+/* not declared in strict standard modes */
+long syscall(long number, ...);
+# endif
+
+/** Sleep while *p is val, at most timeout_ms milliseconds unless it is negative. Spurious wakeups happen. */
+static inline void ffnv_futex_wait(volatile uint32_t *p, uint32_t val, int timeout_ms)
+{
+    /* the timespec of SYS_futex, with long fields whatever the libc time_t is */
+    struct { long tv_sec, tv_nsec; } ts;
+
+    ts.tv_sec  = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    syscall(SYS_futex, p, FUTEX_WAIT_PRIVATE, val, timeout_ms < 0 ? NULL : &ts, NULL, 0);
+}
+
+static inline void ffnv_futex_wake(volatile uint32_t *p)
+{
+    syscall(SYS_futex, p, FUTEX_WAKE_PRIVATE, 0x7fffffff, NULL, NULL, 0);
+}
+#else
+# include <sched.h>
+
+/* no address based waiting, the waiters poll */
+static inline void ffnv_futex_wait(volatile uint32_t *p, uint32_t val, int timeout_ms)
+{
+    (void)p;
+    (void)val;
+    (void)timeout_ms;
+    sched_yield();
+}
+
+static inline void ffnv_futex_wake(volatile uint32_t *p)
+{
+    (void)p;
+}
+#endif
+
+#endif
@@ -0,0 +1,819 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host side conversion of decoded frames downloaded with cuMemcpy2D
+ * (cudaVideoSurfaceFormat_NV12 or _P016 surfaces), for CPU filters.
+ *
+ *     NV12 <-> I420
+ *     P016  -> P010, yuv420p10le, yuv420p12le
+ *     NV12  -> RGB24, RGBA, BGRA (BT.601 or BT.709, limited range)
+ *
+ * Planes are given with their pitch in bytes, e.g. the dstPitch of the
+ * CUDA_MEMCPY2D. 8 bit planes need no alignment, 16 bit ones need their
+ * address and pitch to be even. The rows are processed with AVX2 or
+ * AVX-512 on x86 and NEON on ARM where available, falling back to C, and
+ * all versions give the same output. An FFNVConvert runs the rows in
+ * bands over its threads, the calling one included.
+ */
+
+#ifndef FFNV_CONVERT_H
+#define FFNV_CONVERT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ffnv_thread.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define FFNV_CONVERT_X86 1
+# define FFNV_TARGET_AVX2 __attribute__((target("avx2")))
+# define FFNV_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+# include <immintrin.h>
+# include <intrin.h>
+# define FFNV_CONVERT_X86 1
+# define FFNV_TARGET_AVX2
+# define FFNV_TARGET_AVX512
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+# include <arm_neon.h>
+# define FFNV_CONVERT_NEON 1
+#endif
+
+#define FFNV_CONVERT_MAX_THREADS 64
+
+#define FFNV_CPU_AVX2   1
+#define FFNV_CPU_AVX512 2  /* F and BW */
+#define FFNV_CPU_NEON   4
+
+/* bands get at least this many rows */
+#define FFNV_CONVERT_MIN_BAND 16
+
+#define FFNV_RGB_RGB24 0
+#define FFNV_RGB_RGBA  1
+#define FFNV_RGB_BGRA  2
+
+#define FFNV_MATRIX_BT601 0
+#define FFNV_MATRIX_BT709 1
+
+/** SIMD extensions usable by the converters. */
+static inline int ffnv_cpu_flags(void)
+{
+#if defined(FFNV_CONVERT_X86) && defined(_MSC_VER)
+    int info[4], flags = 0;
+    unsigned long long xcr0;
+
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)))  /* OSXSAVE */
+        return 0;
+    xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if ((xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)))
+        flags |= FFNV_CPU_AVX2;
+    if ((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) && (info[1] & (1 << 30)))
+        flags |= FFNV_CPU_AVX512;
+    return flags;
+#elif defined(FFNV_CONVERT_X86)
+    int flags = 0;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        flags |= FFNV_CPU_AVX2;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        flags |= FFNV_CPU_AVX512;
+    return flags;
+#elif defined(FFNV_CONVERT_NEON)
+    return FFNV_CPU_NEON;
+#else
+    return 0;
+#endif
+}
+
+typedef struct FFNVPlanes {
+    uint8_t *data[3];
+    int pitch[3];
+} FFNVPlanes;
+
+/** Planes of an NV12 or P016 frame downloaded as one buffer, chroma following height luma rows. */
+static inline void ffnv_planes_semi(FFNVPlanes *p, uint8_t *buf, int pitch, int height)
+{
+    memset(p, 0, sizeof(*p));
+    p->data[0]  = buf;
+    p->data[1]  = buf + (size_t)pitch * height;
+    p->pitch[0] = p->pitch[1] = pitch;
+}
+
+typedef struct FFNVRgbCoeffs {
+    int16_t cy, crv, cgu, cgv, cbu;  /* 10.6 fixed point */
+} FFNVRgbCoeffs;
+
+/*
+ * Row kernels. n counts output samples of one plane, pairs for the
+ * split/merge ones, pixels for the RGB one.
+ */
+
+static inline void ffnv_row_split8_c(const uint8_t *src, uint8_t *u, uint8_t *v, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        u[i] = src[2 * i];
+        v[i] = src[2 * i + 1];
+    }
+}
+
+static inline void ffnv_row_merge8_c(const uint8_t *u, const uint8_t *v, uint8_t *dst, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[2 * i]     = u[i];
+        dst[2 * i + 1] = v[i];
+    }
+}
+
+/* (x >> rshift) << lshift on 16 bit samples */
+static inline void ffnv_row_shift16_c(const uint16_t *src, uint16_t *dst, int n, int rshift, int lshift)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = (uint16_t)((src[i] >> rshift) << lshift);
+}
+
+static inline void ffnv_row_split16_c(const uint16_t *src, uint16_t *u, uint16_t *v, int n,
+                                      int rshift, int lshift)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        u[i] = (uint16_t)((src[2 * i]     >> rshift) << lshift);
+        v[i] = (uint16_t)((src[2 * i + 1] >> rshift) << lshift);
+    }
+}
+
+static inline uint8_t ffnv_clip_u8(int x)
+{
+    return x < 0 ? 0 : x > 255 ? 255 : (uint8_t)x;
+}
+
+static inline void ffnv_row_rgb_c(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int n,
+                                  const FFNVRgbCoeffs *c, int format)
+{
+    int ri = format == FFNV_RGB_BGRA ? 2 : 0, bi = 2 - ri;
+    int bpp = format == FFNV_RGB_RGB24 ? 3 : 4;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        int y1 = (y[i] - 16) * c->cy + 32;
+        int u  = uv[i & ~1] - 128;
+        int v  = uv[i | 1] - 128;
+
+        dst[ri] = ffnv_clip_u8((y1 + c->crv * v) >> 6);
+        dst[1]  = ffnv_clip_u8((y1 - c->cgu * u - c->cgv * v) >> 6);
+        dst[bi] = ffnv_clip_u8((y1 + c->cbu * u) >> 6);
+        if (bpp == 4)
+            dst[3] = 255;
+        dst += bpp;
+    }
+}
+
+#if defined(FFNV_CONVERT_X86)
+static inline FFNV_TARGET_AVX2 void ffnv_row_split8_avx2(const uint8_t *src, uint8_t *u, uint8_t *v, int n)
+{
+    const __m256i mask = _mm256_set1_epi16(0xff);
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + 2 * i + 32));
+        __m256i uu = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+        __m256i vv = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+
+        _mm256_storeu_si256((__m256i*)(u + i), _mm256_permute4x64_epi64(uu, 0xd8));
+        _mm256_storeu_si256((__m256i*)(v + i), _mm256_permute4x64_epi64(vv, 0xd8));
+    }
+    ffnv_row_split8_c(src + 2 * i, u + i, v + i, n - i);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_row_merge8_avx2(const uint8_t *u, const uint8_t *v, uint8_t *dst, int n)
+{
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i uu = _mm256_loadu_si256((const __m256i*)(u + i));
+        __m256i vv = _mm256_loadu_si256((const __m256i*)(v + i));
+        __m256i lo = _mm256_unpacklo_epi8(uu, vv);
+        __m256i hi = _mm256_unpackhi_epi8(uu, vv);
+
+        _mm256_storeu_si256((__m256i*)(dst + 2 * i),      _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    ffnv_row_merge8_c(u + i, v + i, dst + 2 * i, n - i);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_row_shift16_avx2(const uint16_t *src, uint16_t *dst, int n,
+                                                          int rshift, int lshift)
+{
+    const __m128i rs = _mm_cvtsi32_si128(rshift), ls = _mm_cvtsi32_si128(lshift);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+
+        x = _mm256_sll_epi16(_mm256_srl_epi16(x, rs), ls);
+        _mm256_storeu_si256((__m256i*)(dst + i), x);
+    }
+    ffnv_row_shift16_c(src + i, dst + i, n - i, rshift, lshift);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_row_split16_avx2(const uint16_t *src, uint16_t *u, uint16_t *v, int n,
+                                                          int rshift, int lshift)
+{
+    const __m128i rs = _mm_cvtsi32_si128(rshift), ls = _mm_cvtsi32_si128(lshift);
+    const __m256i mask = _mm256_set1_epi32(0xffff);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + 2 * i + 16));
+        __m256i uu = _mm256_packus_epi32(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+        __m256i vv = _mm256_packus_epi32(_mm256_srli_epi32(a, 16), _mm256_srli_epi32(b, 16));
+
+        uu = _mm256_sll_epi16(_mm256_srl_epi16(_mm256_permute4x64_epi64(uu, 0xd8), rs), ls);
+        vv = _mm256_sll_epi16(_mm256_srl_epi16(_mm256_permute4x64_epi64(vv, 0xd8), rs), ls);
+        _mm256_storeu_si256((__m256i*)(u + i), uu);
+        _mm256_storeu_si256((__m256i*)(v + i), vv);
+    }
+    ffnv_row_split16_c(src + 2 * i, u + i, v + i, n - i, rshift, lshift);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_row_rgb_avx2(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int n,
+                                                      const FFNVRgbCoeffs *c, int format)
+{
+    const __m256i cy = _mm256_set1_epi16(c->cy), crv = _mm256_set1_epi16(c->crv);
+    const __m256i cgu = _mm256_set1_epi16(c->cgu), cgv = _mm256_set1_epi16(c->cgv);
+    const __m256i cbu = _mm256_set1_epi16(c->cbu);
+    const __m256i y_off = _mm256_set1_epi16(16), uv_off = _mm256_set1_epi16(128);
+    const __m256i round = _mm256_set1_epi16(32), alpha = _mm256_set1_epi8(-1);
+    const __m128i pack24 = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int bpp = format == FFNV_RGB_RGB24 ? 3 : 4;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m256i yy = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + i)));
+        __m256i cc = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(uv + i))), uv_off);
+        /* chroma lanes u0 v0 u1 v1 ..., doubled to one per pixel */
+        __m256i uu = _mm256_blend_epi16(cc, _mm256_slli_epi32(cc, 16), 0xaa);
+        __m256i vv = _mm256_blend_epi16(_mm256_srli_epi32(cc, 16), cc, 0xaa);
+        __m256i y1 = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(yy, y_off), cy), round);
+        __m256i r = _mm256_srai_epi16(_mm256_adds_epi16(y1, _mm256_mullo_epi16(vv, crv)), 6);
+        __m256i g = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(y1, _mm256_mullo_epi16(uu, cgu)),
+                                                        _mm256_mullo_epi16(vv, cgv)), 6);
+        __m256i b = _mm256_srai_epi16(_mm256_adds_epi16(y1, _mm256_mullo_epi16(uu, cbu)), 6);
+        __m256i r8 = _mm256_packus_epi16(r, r), g8 = _mm256_packus_epi16(g, g), b8 = _mm256_packus_epi16(b, b);
+        __m256i rg, ba, t0, t1, lo, hi;
+
+        if (format == FFNV_RGB_BGRA) {
+            __m256i t = r8;
+            r8 = b8;
+            b8 = t;
+        }
+        /* lanes of the 16 bit interleave hold pixels 0-3 and 8-11, 4-7 and 12-15 */
+        rg = _mm256_unpacklo_epi8(r8, g8);
+        ba = _mm256_unpacklo_epi8(b8, alpha);
+        t0 = _mm256_unpacklo_epi16(rg, ba);
+        t1 = _mm256_unpackhi_epi16(rg, ba);
+        lo = _mm256_permute2x128_si256(t0, t1, 0x20);
+        hi = _mm256_permute2x128_si256(t0, t1, 0x31);
+
+        if (bpp == 4) {
+            _mm256_storeu_si256((__m256i*)(dst + 4 * i),      lo);
+            _mm256_storeu_si256((__m256i*)(dst + 4 * i + 32), hi);
+        } else {
+            __m128i x0 = _mm_shuffle_epi8(_mm256_castsi256_si128(lo), pack24);
+            __m128i x1 = _mm_shuffle_epi8(_mm256_extracti128_si256(lo, 1), pack24);
+            __m128i x2 = _mm_shuffle_epi8(_mm256_castsi256_si128(hi), pack24);
+            __m128i x3 = _mm_shuffle_epi8(_mm256_extracti128_si256(hi, 1), pack24);
+
+            _mm_storeu_si128((__m128i*)(dst + 3 * i),      _mm_or_si128(x0, _mm_slli_si128(x1, 12)));
+            _mm_storeu_si128((__m128i*)(dst + 3 * i + 16), _mm_or_si128(_mm_srli_si128(x1, 4), _mm_slli_si128(x2, 8)));
+            _mm_storeu_si128((__m128i*)(dst + 3 * i + 32), _mm_or_si128(_mm_srli_si128(x2, 8), _mm_slli_si128(x3, 4)));
+        }
+    }
+    ffnv_row_rgb_c(y + i, uv + i, dst + bpp * i, n - i, c, format);
+}
+
+static inline FFNV_TARGET_AVX512 void ffnv_row_split8_avx512(const uint8_t *src, uint8_t *u, uint8_t *v, int n)
+{
+    const __m512i mask = _mm512_set1_epi16(0xff);
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    int i;
+
+    for (i = 0; i + 64 <= n; i += 64) {
+        __m512i a = _mm512_loadu_si512((const void*)(src + 2 * i));
+        __m512i b = _mm512_loadu_si512((const void*)(src + 2 * i + 64));
+        __m512i uu = _mm512_packus_epi16(_mm512_and_si512(a, mask), _mm512_and_si512(b, mask));
+        __m512i vv = _mm512_packus_epi16(_mm512_srli_epi16(a, 8), _mm512_srli_epi16(b, 8));
+
+        _mm512_storeu_si512((void*)(u + i), _mm512_permutexvar_epi64(order, uu));
+        _mm512_storeu_si512((void*)(v + i), _mm512_permutexvar_epi64(order, vv));
+    }
+    ffnv_row_split8_avx2(src + 2 * i, u + i, v + i, n - i);
+}
+
+static inline FFNV_TARGET_AVX512 void ffnv_row_merge8_avx512(const uint8_t *u, const uint8_t *v, uint8_t *dst, int n)
+{
+    const __m512i order0 = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    const __m512i order1 = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    int i;
+
+    for (i = 0; i + 64 <= n; i += 64) {
+        __m512i uu = _mm512_loadu_si512((const void*)(u + i));
+        __m512i vv = _mm512_loadu_si512((const void*)(v + i));
+        __m512i lo = _mm512_unpacklo_epi8(uu, vv);
+        __m512i hi = _mm512_unpackhi_epi8(uu, vv);
+
+        _mm512_storeu_si512((void*)(dst + 2 * i),      _mm512_permutex2var_epi64(lo, order0, hi));
+        _mm512_storeu_si512((void*)(dst + 2 * i + 64), _mm512_permutex2var_epi64(lo, order1, hi));
+    }
+    ffnv_row_merge8_avx2(u + i, v + i, dst + 2 * i, n - i);
+}
+
+static inline FFNV_TARGET_AVX512 void ffnv_row_shift16_avx512(const uint16_t *src, uint16_t *dst, int n,
+                                                              int rshift, int lshift)
+{
+    const __m128i rs = _mm_cvtsi32_si128(rshift), ls = _mm_cvtsi32_si128(lshift);
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m512i x = _mm512_loadu_si512((const void*)(src + i));
+
+        _mm512_storeu_si512((void*)(dst + i), _mm512_sll_epi16(_mm512_srl_epi16(x, rs), ls));
+    }
+    ffnv_row_shift16_avx2(src + i, dst + i, n - i, rshift, lshift);
+}
+
+static inline FFNV_TARGET_AVX512 void ffnv_row_split16_avx512(const uint16_t *src, uint16_t *u, uint16_t *v, int n,
+                                                              int rshift, int lshift)
+{
+    const __m128i rs = _mm_cvtsi32_si128(rshift), ls = _mm_cvtsi32_si128(lshift);
+    const __m512i mask = _mm512_set1_epi32(0xffff);
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m512i a = _mm512_loadu_si512((const void*)(src + 2 * i));
+        __m512i b = _mm512_loadu_si512((const void*)(src + 2 * i + 32));
+        __m512i uu = _mm512_packus_epi32(_mm512_and_si512(a, mask), _mm512_and_si512(b, mask));
+        __m512i vv = _mm512_packus_epi32(_mm512_srli_epi32(a, 16), _mm512_srli_epi32(b, 16));
+
+        uu = _mm512_sll_epi16(_mm512_srl_epi16(_mm512_permutexvar_epi64(order, uu), rs), ls);
+        vv = _mm512_sll_epi16(_mm512_srl_epi16(_mm512_permutexvar_epi64(order, vv), rs), ls);
+        _mm512_storeu_si512((void*)(u + i), uu);
+        _mm512_storeu_si512((void*)(v + i), vv);
+    }
+    ffnv_row_split16_avx2(src + 2 * i, u + i, v + i, n - i, rshift, lshift);
+}
+#endif
+
+#if defined(FFNV_CONVERT_NEON)
+static inline void ffnv_row_split8_neon(const uint8_t *src, uint8_t *u, uint8_t *v, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x2_t x = vld2q_u8(src + 2 * i);
+
+        vst1q_u8(u + i, x.val[0]);
+        vst1q_u8(v + i, x.val[1]);
+    }
+    ffnv_row_split8_c(src + 2 * i, u + i, v + i, n - i);
+}
+
+static inline void ffnv_row_merge8_neon(const uint8_t *u, const uint8_t *v, uint8_t *dst, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x2_t x;
+
+        x.val[0] = vld1q_u8(u + i);
+        x.val[1] = vld1q_u8(v + i);
+        vst2q_u8(dst + 2 * i, x);
+    }
+    ffnv_row_merge8_c(u + i, v + i, dst + 2 * i, n - i);
+}
+
+static inline void ffnv_row_shift16_neon(const uint16_t *src, uint16_t *dst, int n, int rshift, int lshift)
+{
+    const int16x8_t rs = vdupq_n_s16((int16_t)-rshift), ls = vdupq_n_s16((int16_t)lshift);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        vst1q_u16(dst + i, vshlq_u16(vshlq_u16(vld1q_u16(src + i), rs), ls));
+    ffnv_row_shift16_c(src + i, dst + i, n - i, rshift, lshift);
+}
+
+static inline void ffnv_row_split16_neon(const uint16_t *src, uint16_t *u, uint16_t *v, int n,
+                                         int rshift, int lshift)
+{
+    const int16x8_t rs = vdupq_n_s16((int16_t)-rshift), ls = vdupq_n_s16((int16_t)lshift);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        uint16x8x2_t x = vld2q_u16(src + 2 * i);
+
+        vst1q_u16(u + i, vshlq_u16(vshlq_u16(x.val[0], rs), ls));
+        vst1q_u16(v + i, vshlq_u16(vshlq_u16(x.val[1], rs), ls));
+    }
+    ffnv_row_split16_c(src + 2 * i, u + i, v + i, n - i, rshift, lshift);
+}
+
+static inline uint8x8_t ffnv_rgb_pack_neon(int16x8_t x)
+{
+    return vqmovun_s16(vshrq_n_s16(x, 6));
+}
+
+static inline void ffnv_row_rgb_neon(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int n,
+                                     const FFNVRgbCoeffs *c, int format)
+{
+    int bpp = format == FFNV_RGB_RGB24 ? 3 : 4;
+    int ri = format == FFNV_RGB_BGRA ? 2 : 0, bi = 2 - ri;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16_t yy = vld1q_u8(y + i);
+        uint8x8x2_t cc = vld2_u8(uv + i);
+        uint8x8x2_t ud = vzip_u8(cc.val[0], cc.val[0]);
+        uint8x8x2_t vd = vzip_u8(cc.val[1], cc.val[1]);
+        uint8x8_t r[2], g[2], b[2];
+        uint8x16x4_t out;
+        int h;
+
+        for (h = 0; h < 2; h++) {
+            int16x8_t yh = vreinterpretq_s16_u16(vmovl_u8(h ? vget_high_u8(yy) : vget_low_u8(yy)));
+            int16x8_t u  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(ud.val[h])), vdupq_n_s16(128));
+            int16x8_t v  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vd.val[h])), vdupq_n_s16(128));
+            int16x8_t y1 = vaddq_s16(vmulq_n_s16(vsubq_s16(yh, vdupq_n_s16(16)), c->cy), vdupq_n_s16(32));
+
+            r[h] = ffnv_rgb_pack_neon(vqaddq_s16(y1, vmulq_n_s16(v, c->crv)));
+            g[h] = ffnv_rgb_pack_neon(vqsubq_s16(vqsubq_s16(y1, vmulq_n_s16(u, c->cgu)),
+                                                 vmulq_n_s16(v, c->cgv)));
+            b[h] = ffnv_rgb_pack_neon(vqaddq_s16(y1, vmulq_n_s16(u, c->cbu)));
+        }
+        out.val[ri] = vcombine_u8(r[0], r[1]);
+        out.val[1]  = vcombine_u8(g[0], g[1]);
+        out.val[bi] = vcombine_u8(b[0], b[1]);
+        out.val[3]  = vdupq_n_u8(255);
+
+        if (bpp == 4) {
+            vst4q_u8(dst + 4 * i, out);
+        } else {
+            uint8x16x3_t rgb;
+
+            rgb.val[0] = out.val[0];
+            rgb.val[1] = out.val[1];
+            rgb.val[2] = out.val[2];
+            vst3q_u8(dst + 3 * i, rgb);
+        }
+    }
+    ffnv_row_rgb_c(y + i, uv + i, dst + bpp * i, n - i, c, format);
+}
+#endif
+
+#define FFNV_CONVERT_SPLIT8  0
+#define FFNV_CONVERT_MERGE8  1
+#define FFNV_CONVERT_SPLIT16 2
+#define FFNV_CONVERT_RGB     3
+
+typedef struct FFNVConvertJob {
+    int op;
+    FFNVPlanes src, dst;
+    int width, height;
+    int rshift, lshift;
+    int format;
+    const FFNVRgbCoeffs *coeffs;
+
+    void (*split8)(const uint8_t *src, uint8_t *u, uint8_t *v, int n);
+    void (*merge8)(const uint8_t *u, const uint8_t *v, uint8_t *dst, int n);
+    void (*shift16)(const uint16_t *src, uint16_t *dst, int n, int rshift, int lshift);
+    void (*split16)(const uint16_t *src, uint16_t *u, uint16_t *v, int n, int rshift, int lshift);
+    void (*rgb)(const uint8_t *y, const uint8_t *uv, uint8_t *dst, int n, const FFNVRgbCoeffs *c, int format);
+} FFNVConvertJob;
+
+typedef struct FFNVConvert {
+    int cpu_flags;          /**< from ffnv_cpu_flags(), can be masked to test the C versions */
+    int nb_threads;         /**< including the calling thread */
+
+    FFNVThread threads[FFNV_CONVERT_MAX_THREADS];
+    int nb_workers;
+    FFNVMutex mutex;
+    FFNVCond work_cond, done_cond;
+    void (*band)(void *job, int start, int end);
+    void *job;
+    int rows, nb_bands, next_band, nb_done;
+    int quit;
+} FFNVConvert;
+
+/* Claim and run the bands of the current job, with c->mutex held. */
+static inline void ffnv_convert_run_bands(FFNVConvert *c)
+{
+    while (c->next_band < c->nb_bands) {
+        void (*band)(void *job, int start, int end) = c->band;
+        void *job = c->job;
+        int b = c->next_band++;
+        int start = (int)((int64_t)c->rows * b / c->nb_bands);
+        int end   = (int)((int64_t)c->rows * (b + 1) / c->nb_bands);
+
+        ffnv_mutex_unlock(&c->mutex);
+        band(job, start, end);
+        ffnv_mutex_lock(&c->mutex);
+
+        if (++c->nb_done == c->nb_bands)
+            ffnv_cond_broadcast(&c->done_cond);
+    }
+}
+
+static inline FFNVThreadRet FFNV_THREAD_API ffnv_convert_worker(void *arg)
+{
+    FFNVConvert *c = (FFNVConvert*)arg;
+
+    ffnv_mutex_lock(&c->mutex);
+    while (!c->quit) {
+        ffnv_convert_run_bands(c);
+        if (!c->quit)
+            ffnv_cond_wait(&c->work_cond, &c->mutex);
+    }
+    ffnv_mutex_unlock(&c->mutex);
+    return 0;
+}
+
+/**
+ * Run band(job, start, end) over rows [0, rows) split in bands of at
+ * least min_band rows, and wait for all of them.
+ */
+static inline void ffnv_convert_run(FFNVConvert *c, void (*band)(void *job, int start, int end), void *job,
+                                    int rows, int min_band)
+{
+    int nb_bands = c->nb_workers ? 2 * c->nb_threads : 1;
+
+    if (nb_bands > rows / min_band)
+        nb_bands = rows / min_band;
+    if (nb_bands <= 1) {
+        band(job, 0, rows);
+        return;
+    }
+
+    ffnv_mutex_lock(&c->mutex);
+    c->band      = band;
+    c->job       = job;
+    c->rows      = rows;
+    c->nb_bands  = nb_bands;
+    c->next_band = 0;
+    c->nb_done   = 0;
+    ffnv_cond_broadcast(&c->work_cond);
+
+    ffnv_convert_run_bands(c);
+    while (c->nb_done < c->nb_bands)
+        ffnv_cond_wait(&c->done_cond, &c->mutex);
+    ffnv_mutex_unlock(&c->mutex);
+}
+
+static inline void ffnv_convert_uninit(FFNVConvert *c)
+{
+    int i;
+
+    if (c->nb_workers) {
+        ffnv_mutex_lock(&c->mutex);
+        c->quit = 1;
+        ffnv_cond_broadcast(&c->work_cond);
+        ffnv_mutex_unlock(&c->mutex);
+
+        for (i = 0; i < c->nb_workers; i++)
+            ffnv_thread_join(c->threads[i]);
+    }
+    if (c->nb_threads) {
+        ffnv_cond_destroy(&c->done_cond);
+        ffnv_cond_destroy(&c->work_cond);
+        ffnv_mutex_destroy(&c->mutex);
+    }
+    memset(c, 0, sizeof(*c));
+}
+
+/**
+ * nb_threads is the number of threads converting a frame, the calling
+ * one included, 0 for the number of CPUs. Returns 0 on success, -1 on
+ * error.
+ */
+static inline int ffnv_convert_init(FFNVConvert *c, int nb_threads)
+{
+    memset(c, 0, sizeof(*c));
+    c->cpu_flags = ffnv_cpu_flags();
+
+    if (nb_threads <= 0)
+        nb_threads = ffnv_cpu_count();
+    if (nb_threads > FFNV_CONVERT_MAX_THREADS)
+        nb_threads = FFNV_CONVERT_MAX_THREADS;
+
+    if (ffnv_mutex_init(&c->mutex) < 0)
+        return -1;
+    if (ffnv_cond_init(&c->work_cond) < 0) {
+        ffnv_mutex_destroy(&c->mutex);
+        return -1;
+    }
+    if (ffnv_cond_init(&c->done_cond) < 0) {
+        ffnv_cond_destroy(&c->work_cond);
+        ffnv_mutex_destroy(&c->mutex);
+        return -1;
+    }
+    c->nb_threads = 1;
+
+    while (c->nb_workers < nb_threads - 1) {
+        if (ffnv_thread_create(&c->threads[c->nb_workers], ffnv_convert_worker, c) < 0) {
+            ffnv_convert_uninit(c);
+            return -1;
+        }
+        c->nb_workers++;
+        c->nb_threads++;
+    }
+    return 0;
+}
+
+static inline void ffnv_convert_setup(FFNVConvert *c, FFNVConvertJob *j)
+{
+    j->split8  = ffnv_row_split8_c;
+    j->merge8  = ffnv_row_merge8_c;
+    j->shift16 = ffnv_row_shift16_c;
+    j->split16 = ffnv_row_split16_c;
+    j->rgb     = ffnv_row_rgb_c;
+#if defined(FFNV_CONVERT_X86)
+    if (c->cpu_flags & FFNV_CPU_AVX2) {
+        j->split8  = ffnv_row_split8_avx2;
+        j->merge8  = ffnv_row_merge8_avx2;
+        j->shift16 = ffnv_row_shift16_avx2;
+        j->split16 = ffnv_row_split16_avx2;
+        j->rgb     = ffnv_row_rgb_avx2;
+    }
+    if ((c->cpu_flags & (FFNV_CPU_AVX2 | FFNV_CPU_AVX512)) == (FFNV_CPU_AVX2 | FFNV_CPU_AVX512)) {
+        j->split8  = ffnv_row_split8_avx512;
+        j->merge8  = ffnv_row_merge8_avx512;
+        j->shift16 = ffnv_row_shift16_avx512;
+        j->split16 = ffnv_row_split16_avx512;
+    }
+#elif defined(FFNV_CONVERT_NEON)
+    if (c->cpu_flags & FFNV_CPU_NEON) {
+        j->split8  = ffnv_row_split8_neon;
+        j->merge8  = ffnv_row_merge8_neon;
+        j->shift16 = ffnv_row_shift16_neon;
+        j->split16 = ffnv_row_split16_neon;
+        j->rgb     = ffnv_row_rgb_neon;
+    }
+#endif
+}
+
+/* Rows of a 4:2:0 job, start and end counting luma row pairs. */
+static inline void ffnv_convert_band(void *arg, int start, int end)
+{
+    FFNVConvertJob *j = (FFNVConvertJob*)arg;
+    const FFNVPlanes *s = &j->src, *d = &j->dst;
+    int cw = (j->width + 1) >> 1;
+    int y, row;
+
+    for (row = start; row < end; row++) {
+        for (y = 2 * row; y < 2 * row + 2 && y < j->height; y++) {
+            const uint8_t *sy = s->data[0] + (size_t)y * s->pitch[0];
+            uint8_t *dy = d->data[0] + (size_t)y * d->pitch[0];
+
+            if (j->op == FFNV_CONVERT_RGB)
+                j->rgb(sy, s->data[1] + (size_t)row * s->pitch[1], dy, j->width, j->coeffs, j->format);
+            else if (j->op == FFNV_CONVERT_SPLIT16)
+                j->shift16((const uint16_t*)sy, (uint16_t*)dy, j->width, j->rshift, j->lshift);
+            else if (sy != dy)
+                memcpy(dy, sy, j->width);
+        }
+
+        switch (j->op) {
+        case FFNV_CONVERT_SPLIT8:
+            j->split8(s->data[1] + (size_t)row * s->pitch[1],
+                      d->data[1] + (size_t)row * d->pitch[1], d->data[2] + (size_t)row * d->pitch[2], cw);
+            break;
+        case FFNV_CONVERT_MERGE8:
+            j->merge8(s->data[1] + (size_t)row * s->pitch[1], s->data[2] + (size_t)row * s->pitch[2],
+                      d->data[1] + (size_t)row * d->pitch[1], cw);
+            break;
+        case FFNV_CONVERT_SPLIT16:
+            if (d->data[2])
+                j->split16((const uint16_t*)(s->data[1] + (size_t)row * s->pitch[1]),
+                           (uint16_t*)(d->data[1] + (size_t)row * d->pitch[1]),
+                           (uint16_t*)(d->data[2] + (size_t)row * d->pitch[2]), cw, j->rshift, j->lshift);
+            else
+                j->shift16((const uint16_t*)(s->data[1] + (size_t)row * s->pitch[1]),
+                           (uint16_t*)(d->data[1] + (size_t)row * d->pitch[1]), 2 * cw, j->rshift, j->lshift);
+            break;
+        }
+    }
+}
+
+static inline void ffnv_convert_exec(FFNVConvert *c, FFNVConvertJob *j, const FFNVPlanes *src,
+                                     const FFNVPlanes *dst, int width, int height)
+{
+    j->src    = *src;
+    j->dst    = *dst;
+    j->width  = width;
+    j->height = height;
+    ffnv_convert_setup(c, j);
+    ffnv_convert_run(c, ffnv_convert_band, j, (height + 1) >> 1, FFNV_CONVERT_MIN_BAND / 2);
+}
+
+/** NV12 to I420. The luma plane is not copied if src and dst share it. */
+static inline void ffnv_convert_nv12_to_i420(FFNVConvert *c, const FFNVPlanes *src, const FFNVPlanes *dst,
+                                             int width, int height)
+{
+    FFNVConvertJob j;
+
+    memset(&j, 0, sizeof(j));
+    j.op = FFNV_CONVERT_SPLIT8;
+    ffnv_convert_exec(c, &j, src, dst, width, height);
+}
+
+/** I420 to NV12. The luma plane is not copied if src and dst share it. */
+static inline void ffnv_convert_i420_to_nv12(FFNVConvert *c, const FFNVPlanes *src, const FFNVPlanes *dst,
+                                             int width, int height)
+{
+    FFNVConvertJob j;
+
+    memset(&j, 0, sizeof(j));
+    j.op = FFNV_CONVERT_MERGE8;
+    ffnv_convert_exec(c, &j, src, dst, width, height);
+}
+
+/** P016 to P010, clearing the 6 low bits. Can run in place. */
+static inline void ffnv_convert_p016_to_p010(FFNVConvert *c, const FFNVPlanes *src, const FFNVPlanes *dst,
+                                             int width, int height)
+{
+    FFNVConvertJob j;
+    FFNVPlanes d = *dst;
+
+    memset(&j, 0, sizeof(j));
+    j.op     = FFNV_CONVERT_SPLIT16;
+    j.rshift = j.lshift = 6;
+    d.data[2] = NULL;
+    ffnv_convert_exec(c, &j, src, &d, width, height);
+}
+
+/** P016 to planar little-endian samples of depth 10 or 12 (yuv420p10le, yuv420p12le). */
+static inline void ffnv_convert_p016_to_yuv420p(FFNVConvert *c, const FFNVPlanes *src, const FFNVPlanes *dst,
+                                                int width, int height, int depth)
+{
+    FFNVConvertJob j;
+
+    memset(&j, 0, sizeof(j));
+    j.op     = FFNV_CONVERT_SPLIT16;
+    j.rshift = 16 - depth;
+    ffnv_convert_exec(c, &j, src, dst, width, height);
+}
+
+/** NV12 to packed RGB (FFNV_RGB_*) in dst->data[0], limited range FFNV_MATRIX_* input. */
+static inline void ffnv_convert_nv12_to_rgb(FFNVConvert *c, const FFNVPlanes *src, const FFNVPlanes *dst,
+                                            int width, int height, int format, int matrix)
+{
+    static const FFNVRgbCoeffs coeffs[2] = {
+        { 75, 102, 25, 52, 129 },  /* BT.601 */
+        { 75, 115, 14, 34, 135 },  /* BT.709 */
+    };
+    FFNVConvertJob j;
+
+    memset(&j, 0, sizeof(j));
+    j.op     = FFNV_CONVERT_RGB;
+    j.format = format;
+    j.coeffs = &coeffs[matrix == FFNV_MATRIX_BT709];
+    ffnv_convert_exec(c, &j, src, dst, width, height);
+}
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Thread-local tracking of the current CUDA context, eliding redundant
+ * context switches.
+ *
+ * ffnv_ctx_push()/ffnv_ctx_pop() replace cuCtxPushCurrent/cuCtxPopCurrent
+ * and ffnv_ctx_lock()/ffnv_ctx_unlock() replace cuvidCtxLock/cuvidCtxUnlock.
+ * A push of the context already current on the thread, or a lock of a
+ * cuvid lock the thread already holds, only bumps a depth, so a group of
+ * calls bracketed once at the outer level pays for one switch. With
+ * ffnv_ctx_set_sticky() the context also stays current once the depth
+ * drops to zero, until another context is pushed or ffnv_ctx_flush().
+ *
+ * All context switches on the thread must go through these functions for
+ * the tracking to be right. The state is shared by the whole program.
+ * With GCC and Clang on ELF and Mach-O targets every file including this
+ * header emits a weak definition of it, which the linker merges. With
+ * other compilers exactly one source file must define
+ * FFNV_CTX_IMPLEMENTATION before including this header, to provide it.
+ * Defining FFNV_CTX_DEBUG turns on assertions on misuse: unbalanced or
+ * mismatched pops and unlocks, and contexts popped by someone else.
+ */
+
+#ifndef FFNV_CTX_H
+#define FFNV_CTX_H
+
+#include <string.h>
+
+#include "dynlink_loader.h"
+#include "ffnv_thread.h"
+
+#ifdef FFNV_CTX_DEBUG
+# include <assert.h>
+# define FFNV_CTX_ASSERT(x) assert(x)
+#else
+# define FFNV_CTX_ASSERT(x) ((void)0)
+#endif
+
+#define FFNV_CTX_MAX_DEPTH 16
+
+typedef struct FFNVCtxEntry {
+    CUcontext ctx;
+    CUvideoctxlock lock;   /* set for ffnv_ctx_lock() entries */
+    int switched;          /* this entry pushed the context or took the lock */
+} FFNVCtxEntry;
+
+typedef struct FFNVCtxState {
+    FFNVCtxEntry stack[FFNV_CTX_MAX_DEPTH];
+    int depth;
+    CUcontext sticky;      /* context left current by a sticky pop */
+    int sticky_mode;
+    unsigned long long nb_switches;  /**< driver push/pop pairs and lock/unlock pairs done */
+    unsigned long long nb_elided;    /**< calls served without the driver */
+} FFNVCtxState;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern FFNV_THREAD_LOCAL FFNVCtxState ffnv_ctx_state;
+#if defined(FFNV_CTX_IMPLEMENTATION)
+FFNV_THREAD_LOCAL FFNVCtxState ffnv_ctx_state;
+#elif defined(__GNUC__) && (defined(__ELF__) || defined(__APPLE__))
+__attribute__((weak)) FFNV_THREAD_LOCAL FFNVCtxState ffnv_ctx_state;
+#endif
+#ifdef __cplusplus
+}
+#endif
+
+/** Statistics of the calling thread. */
+static inline const FFNVCtxState *ffnv_ctx_stats(void)
+{
+    return &ffnv_ctx_state;
+}
+
+/* Context current on the thread as far as the tracker knows, NULL if unknown. */
+static inline CUcontext ffnv_ctx_current(void)
+{
+    FFNVCtxState *s = &ffnv_ctx_state;
+
+    return s->depth ? s->stack[s->depth - 1].ctx : s->sticky;
+}
+
+/** Pop the context left current by sticky mode, if any. */
+static inline CUresult ffnv_ctx_flush(CudaFunctions *cu)
+{
+    FFNVCtxState *s = &ffnv_ctx_state;
+    CUcontext dummy;
+    CUresult err;
+
+    FFNV_CTX_ASSERT(!s->depth);
+    if (!s->sticky)
+        return CUDA_SUCCESS;
+
+    err = cu->cuCtxPopCurrent(&dummy);
+    FFNV_CTX_ASSERT(err != CUDA_SUCCESS || dummy == s->sticky);
+    s->sticky = NULL;
+    return err;
+}
+
+/**
+ * In sticky mode the context of the outermost pop stays current. The
+ * thread must call ffnv_ctx_flush() before leaving sticky mode and before
+ * it exits.
+ */
+static inline void ffnv_ctx_set_sticky(int sticky)
+{
+    FFNV_CTX_ASSERT(sticky || !ffnv_ctx_state.sticky);
+    ffnv_ctx_state.sticky_mode = sticky;
+}
+
+static inline CUresult ffnv_ctx_enter(CudaFunctions *cu, CUcontext ctx, CUvideoctxlock lock,
+                                      CuvidFunctions *cvdl)
+{
+    FFNVCtxState *s = &ffnv_ctx_state;
+    FFNVCtxEntry *e;
+    CUresult err = CUDA_SUCCESS;
+    int switched = 1, i;
+
+    FFNV_CTX_ASSERT(s->depth < FFNV_CTX_MAX_DEPTH);
+    if (s->depth >= FFNV_CTX_MAX_DEPTH)
+        return CUDA_ERROR_NOT_READY;
+
+    if (lock) {
+        /* a lock held further up the stack */
+        for (i = 0; i < s->depth && switched; i++)
+            if (s->stack[i].lock == lock)
+                switched = 0;
+    } else if (ctx == ffnv_ctx_current()) {
+        switched = 0;
+    }
+
+    if (switched) {
+        if (s->sticky && !s->depth) {
+            err = ffnv_ctx_flush(cu);
+            if (err != CUDA_SUCCESS)
+                return err;
+        }
+        err = lock ? cvdl->cuvidCtxLock(lock, 0) : cu->cuCtxPushCurrent(ctx);
+        if (err != CUDA_SUCCESS)
+            return err;
+        s->nb_switches++;
+    } else {
+        s->nb_elided++;
+    }
+
+    e = &s->stack[s->depth++];
+    e->ctx      = ctx;
+    e->lock     = lock;
+    e->switched = switched;
+    return CUDA_SUCCESS;
+}
+
+static inline CUresult ffnv_ctx_leave(CudaFunctions *cu, CUcontext ctx, CUvideoctxlock lock,
+                                      CuvidFunctions *cvdl)
+{
+    FFNVCtxState *s = &ffnv_ctx_state;
+    FFNVCtxEntry *e;
+    CUcontext popped;
+    CUresult err = CUDA_SUCCESS;
+
+    FFNV_CTX_ASSERT(s->depth > 0);
+    if (s->depth <= 0)
+        return CUDA_ERROR_NOT_READY;
+
+    e = &s->stack[s->depth - 1];
+    FFNV_CTX_ASSERT(e->lock == lock);
+    FFNV_CTX_ASSERT(lock || e->ctx == ctx);
+    (void)ctx;
+    (void)lock;
+
+    if (e->switched) {
+        if (e->lock) {
+            err = cvdl->cuvidCtxUnlock(e->lock, 0);
+        } else if (s->sticky_mode && s->depth == 1) {
+            s->sticky = e->ctx;
+        } else {
+            err = cu->cuCtxPopCurrent(&popped);
+            FFNV_CTX_ASSERT(err != CUDA_SUCCESS || popped == e->ctx);
+        }
+    }
+
+    s->depth--;
+    return err;
+}
+
+/** cuCtxPushCurrent(ctx), elided if ctx is already current on the thread. */
+static inline CUresult ffnv_ctx_push(CudaFunctions *cu, CUcontext ctx)
+{
+    return ffnv_ctx_enter(cu, ctx, NULL, NULL);
+}
+
+/** Undo the matching ffnv_ctx_push(ctx). */
+static inline CUresult ffnv_ctx_pop(CudaFunctions *cu, CUcontext ctx)
+{
+    return ffnv_ctx_leave(cu, ctx, NULL, NULL);
+}
+
+/**
+ * cuvidCtxLock(lock), elided if the thread already holds lock. ctx is
+ * the context of the lock, which becomes current for the nested pushes.
+ */
+static inline CUresult ffnv_ctx_lock(CuvidFunctions *cvdl, CudaFunctions *cu, CUvideoctxlock lock, CUcontext ctx)
+{
+    return ffnv_ctx_enter(cu, ctx, lock, cvdl);
+}
+
+/** Undo the matching ffnv_ctx_lock(). */
+static inline CUresult ffnv_ctx_unlock(CuvidFunctions *cvdl, CudaFunctions *cu, CUvideoctxlock lock)
+{
+    return ffnv_ctx_leave(cu, NULL, lock, cvdl);
+}
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Placement of decode and encode sessions across the CUDA devices.
+ *
+ * The scheduler enumerates the devices through CudaFunctions and keeps,
+ * per device, the number of active NVDEC and NVENC sessions, their summed
+ * cost and their estimated memory. The cost of a session is its pixel
+ * rate times a codec weight. A new session goes to the device with the
+ * lowest load on the engine it needs once the session is added, skipping
+ * devices that would exceed their session or memory limits; devices that
+ * would go past the saturation threshold are only used when all of them
+ * would.
+ */
+
+#ifndef FFNV_SCHED_H
+#define FFNV_SCHED_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "dynlink_loader.h"
+#include "ffnv_thread.h"
+
+#define FFNV_SCHED_MAX_DEVICES 16
+
+#define FFNV_SCHED_DECODE 0
+#define FFNV_SCHED_ENCODE 1
+
+/* default engine capacity in weighted pixels per second: 2160p at 120 fps */
+#define FFNV_SCHED_DEFAULT_CAPACITY (3840.0 * 2160.0 * 120.0)
+
+typedef struct FFNVSchedDevice {
+    CUdevice device;
+    char name[64];
+    int cc_major, cc_minor;
+
+    int nb_sessions[2];     /**< active sessions, indexed by FFNV_SCHED_DECODE/ENCODE */
+    double load[2];         /**< summed cost of the active sessions */
+    uint64_t mem_used;      /**< summed memory estimate of the active sessions */
+
+    double capacity[2];     /**< cost the engines sustain, FFNV_SCHED_DEFAULT_CAPACITY unless set */
+    uint64_t mem_total;     /**< memory available to sessions, 0 if unlimited */
+    int max_sessions[2];    /**< session limit, 0 if unlimited */
+} FFNVSchedDevice;
+
+typedef struct FFNVSchedRequest {
+    int kind;               /**< FFNV_SCHED_DECODE or FFNV_SCHED_ENCODE */
+    int width, height;
+    double fps;
+    double weight;          /**< codec weight, see ffnv_sched_decode_weight() and ffnv_sched_encode_weight() */
+    uint64_t mem;           /**< device memory the session needs, see ffnv_sched_mem_estimate() */
+} FFNVSchedRequest;
+
+typedef struct FFNVSchedSession {
+    int device;             /**< index into FFNVScheduler.devices */
+    int kind;
+    double cost;
+    uint64_t mem;
+} FFNVSchedSession;
+
+typedef struct FFNVScheduler {
+    FFNVMutex lock;
+    int initialized;        /**< set once lock is initialized, nb_devices may still be 0 */
+    FFNVSchedDevice devices[FFNV_SCHED_MAX_DEVICES];
+    int nb_devices;
+
+    /** Load fraction above which a device is only used if all devices are above it. */
+    double saturation;
+} FFNVScheduler;
+
+/** Relative cost of decoding a pixel with the given codec. */
+static inline double ffnv_sched_decode_weight(cudaVideoCodec codec)
+{
+    switch (codec) {
+    case cudaVideoCodec_MPEG1:
+    case cudaVideoCodec_MPEG2:
+    case cudaVideoCodec_JPEG:
+        return 0.5;
+    case cudaVideoCodec_MPEG4:
+    case cudaVideoCodec_VC1:
+        return 0.75;
+    case cudaVideoCodec_HEVC:
+        return 1.25;
+    case cudaVideoCodec_VP9:
+        return 1.25;
+    default:
+        return 1.0;
+    }
+}
+
+/** Relative cost of encoding a pixel with the given codec GUID. */
+static inline double ffnv_sched_encode_weight(GUID codec)
+{
+    return memcmp(&codec, &NV_ENC_CODEC_HEVC_GUID, sizeof(codec)) ? 1.0 : 1.5;
+}
+
+/** Memory of nb_surfaces 4:2:0 surfaces, 16 bits per sample above 8 bits depth. */
+static inline uint64_t ffnv_sched_mem_estimate(int width, int height, int bit_depth, int nb_surfaces)
+{
+    uint64_t frame = (uint64_t)((width + 63) & ~63) * ((height + 31) & ~31) * 3 / 2;
+
+    return frame * (bit_depth > 8 ? 2 : 1) * nb_surfaces;
+}
+
+static inline double ffnv_sched_cost(const FFNVSchedRequest *req)
+{
+    return (double)req->width * req->height * req->fps * (req->weight > 0 ? req->weight : 1.0);
+}
+
+static inline void ffnv_sched_uninit(FFNVScheduler *s)
+{
+    if (s->initialized)
+        ffnv_mutex_destroy(&s->lock);
+    memset(s, 0, sizeof(*s));
+}
+
+/** Enumerate the CUDA devices. cu must have been loaded with cuda_load_functions(). */
+static inline CUresult ffnv_sched_init(FFNVScheduler *s, CudaFunctions *cu)
+{
+    CUresult err;
+    int i, count;
+
+    memset(s, 0, sizeof(*s));
+
+    err = cu->cuInit(0);
+    if (err != CUDA_SUCCESS)
+        return err;
+    err = cu->cuDeviceGetCount(&count);
+    if (err != CUDA_SUCCESS)
+        return err;
+    if (count > FFNV_SCHED_MAX_DEVICES)
+        count = FFNV_SCHED_MAX_DEVICES;
+
+    for (i = 0; i < count; i++) {
+        FFNVSchedDevice *d = &s->devices[i];
+
+        err = cu->cuDeviceGet(&d->device, i);
+        if (err == CUDA_SUCCESS)
+            err = cu->cuDeviceGetName(d->name, sizeof(d->name) - 1, d->device);
+        if (err == CUDA_SUCCESS)
+            err = cu->cuDeviceComputeCapability(&d->cc_major, &d->cc_minor, d->device);
+        if (err != CUDA_SUCCESS) {
+            memset(s, 0, sizeof(*s));
+            return err;
+        }
+
+        d->capacity[FFNV_SCHED_DECODE] = FFNV_SCHED_DEFAULT_CAPACITY;
+        d->capacity[FFNV_SCHED_ENCODE] = FFNV_SCHED_DEFAULT_CAPACITY;
+    }
+
+    if (ffnv_mutex_init(&s->lock) < 0) {
+        memset(s, 0, sizeof(*s));
+        return CUDA_ERROR_NOT_READY;
+    }
+    s->initialized = 1;
+    s->nb_devices = count;
+    s->saturation = 0.9;
+    return CUDA_SUCCESS;
+}
+
+/**
+ * Set the limits of device dev: engine capacities (0 keeps the current
+ * value), the memory available to sessions and the number of concurrent
+ * encode sessions (0 for no limit).
+ */
+static inline void ffnv_sched_set_limits(FFNVScheduler *s, int dev, double decode_capacity,
+                                         double encode_capacity, uint64_t mem_total, int max_encode)
+{
+    FFNVSchedDevice *d = &s->devices[dev];
+
+    ffnv_mutex_lock(&s->lock);
+    if (decode_capacity > 0)
+        d->capacity[FFNV_SCHED_DECODE] = decode_capacity;
+    if (encode_capacity > 0)
+        d->capacity[FFNV_SCHED_ENCODE] = encode_capacity;
+    d->mem_total = mem_total;
+    d->max_sessions[FFNV_SCHED_ENCODE] = max_encode;
+    ffnv_mutex_unlock(&s->lock);
+}
+
+/* Load fraction of device d once a session of the given cost is added. */
+static inline double ffnv_sched_projected(const FFNVSchedDevice *d, int kind, double cost)
+{
+    return (d->load[kind] + cost) / d->capacity[kind];
+}
+
+/**
+ * Pick a device for a new session and account for it. Returns the device
+ * index, also stored in session, or -1 if no device can take the session
+ * within its session and memory limits.
+ */
+static inline int ffnv_sched_place(FFNVScheduler *s, const FFNVSchedRequest *req, FFNVSchedSession *session)
+{
+    const int kind = req->kind == FFNV_SCHED_ENCODE ? FFNV_SCHED_ENCODE : FFNV_SCHED_DECODE;
+    const double cost = ffnv_sched_cost(req);
+    int i, best = -1, best_saturated = 1;
+    double best_load = 0;
+
+    ffnv_mutex_lock(&s->lock);
+    for (i = 0; i < s->nb_devices; i++) {
+        const FFNVSchedDevice *d = &s->devices[i];
+        double load;
+        int saturated;
+
+        if ((d->max_sessions[kind] && d->nb_sessions[kind] >= d->max_sessions[kind]) ||
+            (d->mem_total && d->mem_used + req->mem > d->mem_total))
+            continue;
+
+        load      = ffnv_sched_projected(d, kind, cost);
+        saturated = load > s->saturation;
+
+        /* unsaturated devices first, then the lowest load, then the fewest sessions */
+        if (best < 0 || saturated < best_saturated ||
+            (saturated == best_saturated &&
+             (load < best_load ||
+              (load == best_load && d->nb_sessions[kind] < s->devices[best].nb_sessions[kind])))) {
+            best           = i;
+            best_load      = load;
+            best_saturated = saturated;
+        }
+    }
+
+    if (best >= 0) {
+        FFNVSchedDevice *d = &s->devices[best];
+
+        d->nb_sessions[kind]++;
+        d->load[kind] += cost;
+        d->mem_used   += req->mem;
+
+        session->device = best;
+        session->kind   = kind;
+        session->cost   = cost;
+        session->mem    = req->mem;
+    }
+    ffnv_mutex_unlock(&s->lock);
+    return best;
+}
+
+/** Remove a session placed with ffnv_sched_place(). */
+static inline void ffnv_sched_release(FFNVScheduler *s, const FFNVSchedSession *session)
+{
+    FFNVSchedDevice *d = &s->devices[session->device];
+
+    ffnv_mutex_lock(&s->lock);
+    d->nb_sessions[session->kind]--;
+    d->load[session->kind] -= session->cost;
+    if (d->load[session->kind] < 0 || !d->nb_sessions[session->kind])
+        d->load[session->kind] = 0;
+    d->mem_used -= session->mem;
+    ffnv_mutex_unlock(&s->lock);
+}
+
+/** Copy of the state of device dev, for monitoring. */
+static inline void ffnv_sched_get_device(FFNVScheduler *s, int dev, FFNVSchedDevice *out)
+{
+    ffnv_mutex_lock(&s->lock);
+    *out = s->devices[dev];
+    ffnv_mutex_unlock(&s->lock);
+}
+
+#endif
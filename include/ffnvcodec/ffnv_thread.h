@@ -0,0 +1,136 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Minimal thread, mutex and condition variable wrappers over POSIX
+ * threads or Win32 threads and slim reader/writer locks, for the helpers
+ * that are shared between threads.
+ */
+
+#ifndef FFNV_THREAD_H
+#define FFNV_THREAD_H
+
+#if defined(__cplusplus) && __cplusplus >= 201103L
+# define FFNV_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+# define FFNV_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+# define FFNV_THREAD_LOCAL _Thread_local
+#else
+# define FFNV_THREAD_LOCAL __thread
+#endif
+
+#if defined(_WIN32)
+# include <windows.h>
+
+typedef HANDLE FFNVThread;
+typedef SRWLOCK FFNVMutex;
+typedef CONDITION_VARIABLE FFNVCond;
+
+/* thread functions are declared as FFNVThreadRet FFNV_THREAD_API func(void *arg) */
+typedef DWORD FFNVThreadRet;
+# define FFNV_THREAD_API WINAPI
+
+static inline int ffnv_thread_create(FFNVThread *t, FFNVThreadRet (FFNV_THREAD_API *func)(void*), void *arg)
+{
+    *t = CreateThread(NULL, 0, func, arg, 0, NULL);
+    return *t ? 0 : -1;
+}
+
+static inline void ffnv_thread_join(FFNVThread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+static inline int ffnv_cpu_count(void)
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+static inline int ffnv_mutex_init(FFNVMutex *m)     { InitializeSRWLock(m); return 0; }
+static inline void ffnv_mutex_destroy(FFNVMutex *m) { (void)m; }
+static inline void ffnv_mutex_lock(FFNVMutex *m)    { AcquireSRWLockExclusive(m); }
+static inline void ffnv_mutex_unlock(FFNVMutex *m)  { ReleaseSRWLockExclusive(m); }
+static inline int ffnv_mutex_trylock(FFNVMutex *m)  { return TryAcquireSRWLockExclusive(m) ? 0 : -1; }
+
+static inline int ffnv_cond_init(FFNVCond *c)       { InitializeConditionVariable(c); return 0; }
+static inline void ffnv_cond_destroy(FFNVCond *c)   { (void)c; }
+static inline void ffnv_cond_signal(FFNVCond *c)    { WakeConditionVariable(c); }
+static inline void ffnv_cond_broadcast(FFNVCond *c) { WakeAllConditionVariable(c); }
+static inline void ffnv_cond_wait(FFNVCond *c, FFNVMutex *m)
+{
+    SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+#else
+# include <pthread.h>
+# include <unistd.h>
+
+typedef pthread_t FFNVThread;
+typedef pthread_mutex_t FFNVMutex;
+typedef pthread_cond_t FFNVCond;
+
+typedef void *FFNVThreadRet;
+# define FFNV_THREAD_API
+
+static inline int ffnv_thread_create(FFNVThread *t, FFNVThreadRet (FFNV_THREAD_API *func)(void*), void *arg)
+{
+    return pthread_create(t, NULL, func, arg) ? -1 : 0;
+}
+
+static inline void ffnv_thread_join(FFNVThread t)
+{
+    pthread_join(t, NULL);
+}
+
+static inline int ffnv_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+
+static inline int ffnv_mutex_init(FFNVMutex *m)     { return pthread_mutex_init(m, NULL) ? -1 : 0; }
+static inline void ffnv_mutex_destroy(FFNVMutex *m) { pthread_mutex_destroy(m); }
+static inline void ffnv_mutex_lock(FFNVMutex *m)    { pthread_mutex_lock(m); }
+static inline void ffnv_mutex_unlock(FFNVMutex *m)  { pthread_mutex_unlock(m); }
+static inline int ffnv_mutex_trylock(FFNVMutex *m)  { return pthread_mutex_trylock(m) ? -1 : 0; }
+
+static inline int ffnv_cond_init(FFNVCond *c)       { return pthread_cond_init(c, NULL) ? -1 : 0; }
+static inline void ffnv_cond_destroy(FFNVCond *c)   { pthread_cond_destroy(c); }
+static inline void ffnv_cond_signal(FFNVCond *c)    { pthread_cond_signal(c); }
+static inline void ffnv_cond_broadcast(FFNVCond *c) { pthread_cond_broadcast(c); }
+static inline void ffnv_cond_wait(FFNVCond *c, FFNVMutex *m)
+{
+    pthread_cond_wait(c, m);
+}
+#endif
+
+#endif
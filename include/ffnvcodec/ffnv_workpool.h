@@ -0,0 +1,425 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Fixed size worker pool running the stages of many decode/encode
+ * pipelines, instead of a set of threads per stream.
+ *
+ * Tasks are submitted to strands. The tasks of a strand run one at a time
+ * in submission order, so a stream (or one stage of a stream) given its
+ * own strand keeps its ordering without a thread of its own. A strand
+ * with pending tasks sits in the queue of one worker; workers serve their
+ * own queue first and steal strands from the others when it is empty.
+ * Strands have a priority, live ones being served before VOD ones by
+ * every worker.
+ *
+ * Tasks should not block: the calls that can wait (NvEncLockBitstream
+ * with doNotWait, cuvidMapVideoFrame on a frame still decoding, ...)
+ * return FFNV_WORKPOOL_RETRY from the task when the result is not ready, and
+ * the task runs again after the other strands queued on the worker. A
+ * worker with nothing else to run backs off before running a strand that
+ * asked for retries several times in a row, sleeping up to
+ * FFNV_WORKPOOL_MAX_BACKOFF_MS or until a task is submitted.
+ */
+
+#ifndef FFNV_WORKPOOL_H
+#define FFNV_WORKPOOL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ffnv_atomic.h"
+#include "ffnv_thread.h"
+
+#define FFNV_WORKPOOL_MAX_WORKERS 256
+
+#define FFNV_WORKPOOL_LIVE 0
+#define FFNV_WORKPOOL_VOD 1
+#define FFNV_WORKPOOL_NB_PRIORITIES 2
+
+/* tasks of a strand run before it goes back to the queue */
+#define FFNV_WORKPOOL_BATCH 4
+
+/** Task return value asking to be run again later. */
+#define FFNV_WORKPOOL_RETRY 1
+
+/* retries in a row run without waiting, and the longest wait between two */
+#define FFNV_WORKPOOL_SPIN_RETRIES   3
+#define FFNV_WORKPOOL_MAX_BACKOFF_MS 4
+
+typedef struct FFNVTask FFNVTask;
+typedef struct FFNVStrand FFNVStrand;
+typedef struct FFNVWorkPool FFNVWorkPool;
+
+struct FFNVTask {
+    /**
+     * Called on worker worker. Returns 0 once done, after which the task
+     * is not touched by the pool anymore, or FFNV_WORKPOOL_RETRY.
+     */
+    int (*run)(FFNVTask *task, int worker);
+    void *opaque;
+    FFNVTask *next;
+};
+
+struct FFNVStrand {
+    FFNVMutex lock;
+    FFNVTask *head, *tail;
+    int priority;          /**< FFNV_WORKPOOL_LIVE or FFNV_WORKPOOL_VOD */
+    int scheduled;         /**< queued on a worker or running */
+    FFNVStrand *next;      /**< worker queue link */
+    uint64_t nb_tasks;     /**< tasks completed */
+    unsigned retries;      /* FFNV_WORKPOOL_RETRY in a row, owned by the worker running the strand */
+};
+
+typedef struct FFNVWorkPoolWorker {
+    FFNVWorkPool *pool;
+    int index;
+    FFNVThread thread;
+    FFNVMutex lock;
+    FFNVStrand *head[FFNV_WORKPOOL_NB_PRIORITIES], *tail[FFNV_WORKPOOL_NB_PRIORITIES];
+    uint64_t nb_tasks;
+    uint64_t nb_steals;
+} FFNVWorkPoolWorker;
+
+struct FFNVWorkPool {
+    FFNVMutex lock;
+    FFNVCond cond;
+    FFNVWorkPoolWorker *workers;
+    int nb_workers;
+    int nb_queued;         /* strands in the worker queues */
+    int nb_idle;
+    int stop;
+    unsigned next;         /* worker receiving the next submission from outside the pool */
+    volatile uint32_t nb_scheduled;  /* wakes up the workers backing off */
+    volatile uint32_t nb_backoff;
+};
+
+/** Returns 0 on success, -1 on error. */
+static inline int ffnv_strand_init(FFNVStrand *st, int priority)
+{
+    memset(st, 0, sizeof(*st));
+    st->priority = priority == FFNV_WORKPOOL_VOD ? FFNV_WORKPOOL_VOD : FFNV_WORKPOOL_LIVE;
+    return ffnv_mutex_init(&st->lock);
+}
+
+/** The strand must have no pending tasks. */
+static inline void ffnv_strand_uninit(FFNVStrand *st)
+{
+    ffnv_mutex_destroy(&st->lock);
+    memset(st, 0, sizeof(*st));
+}
+
+static inline void ffnv_workpool_worker_push(FFNVWorkPoolWorker *w, FFNVStrand *st)
+{
+    const int p = st->priority;
+
+    st->next = NULL;
+    ffnv_mutex_lock(&w->lock);
+    if (w->tail[p])
+        w->tail[p]->next = st;
+    else
+        w->head[p] = st;
+    w->tail[p] = st;
+    ffnv_mutex_unlock(&w->lock);
+}
+
+static inline FFNVStrand *ffnv_workpool_worker_pop(FFNVWorkPoolWorker *w, int p)
+{
+    FFNVStrand *st;
+
+    ffnv_mutex_lock(&w->lock);
+    st = w->head[p];
+    if (st) {
+        w->head[p] = st->next;
+        if (!w->head[p])
+            w->tail[p] = NULL;
+    }
+    ffnv_mutex_unlock(&w->lock);
+    return st;
+}
+
+/* Queue a strand on worker index, or on the next worker in turn if index is negative. */
+static inline void ffnv_workpool_schedule(FFNVWorkPool *pool, FFNVStrand *st, int index)
+{
+    ffnv_mutex_lock(&pool->lock);
+    if (index < 0 || index >= pool->nb_workers)
+        index = pool->next++ % pool->nb_workers;
+    pool->nb_queued++;
+    if (pool->nb_idle)
+        ffnv_cond_signal(&pool->cond);
+    ffnv_mutex_unlock(&pool->lock);
+
+    ffnv_workpool_worker_push(&pool->workers[index], st);
+
+    ffnv_atomic_add(&pool->nb_scheduled, 1);
+    if (ffnv_atomic_load(&pool->nb_backoff))
+        ffnv_futex_wake(&pool->nb_scheduled);
+}
+
+/* Wait for a submission before running a strand that keeps asking for retries, longer after every retry. */
+static inline void ffnv_workpool_backoff(FFNVWorkPool *pool, const FFNVStrand *st)
+{
+    uint32_t seen = ffnv_atomic_load(&pool->nb_scheduled);
+    int ms;
+
+    ms = (int)(st->retries - FFNV_WORKPOOL_SPIN_RETRIES);
+    if (ms > FFNV_WORKPOOL_MAX_BACKOFF_MS)
+        ms = FFNV_WORKPOOL_MAX_BACKOFF_MS;
+
+    ffnv_atomic_add(&pool->nb_backoff, 1);
+    ffnv_futex_wait(&pool->nb_scheduled, seen, ms);
+    ffnv_atomic_add(&pool->nb_backoff, (uint32_t)-1);
+}
+
+/* Next strand for worker w: own live queue, stolen live strand, then the same for VOD. */
+static inline FFNVStrand *ffnv_workpool_find(FFNVWorkPoolWorker *w)
+{
+    FFNVWorkPool *pool = w->pool;
+    FFNVStrand *st;
+    int p, i;
+
+    for (p = 0; p < FFNV_WORKPOOL_NB_PRIORITIES; p++) {
+        st = ffnv_workpool_worker_pop(w, p);
+        for (i = 1; !st && i < pool->nb_workers; i++) {
+            st = ffnv_workpool_worker_pop(&pool->workers[(w->index + i) % pool->nb_workers], p);
+            if (st)
+                w->nb_steals++;
+        }
+        if (st) {
+            ffnv_mutex_lock(&pool->lock);
+            pool->nb_queued--;
+            ffnv_mutex_unlock(&pool->lock);
+            return st;
+        }
+    }
+    return NULL;
+}
+
+static inline void ffnv_workpool_run_strand(FFNVWorkPoolWorker *w, FFNVStrand *st)
+{
+    FFNVTask *task;
+    int n, requeue;
+
+    for (n = 0; n < FFNV_WORKPOOL_BATCH; n++) {
+        ffnv_mutex_lock(&st->lock);
+        task = st->head;
+        if (task) {
+            st->head = task->next;
+            if (!st->head)
+                st->tail = NULL;
+        }
+        ffnv_mutex_unlock(&st->lock);
+        if (!task)
+            break;
+
+        task->next = NULL;
+        if (task->run(task, w->index) == FFNV_WORKPOOL_RETRY) {
+            st->retries++;
+            ffnv_mutex_lock(&st->lock);
+            task->next = st->head;
+            st->head   = task;
+            if (!st->tail)
+                st->tail = task;
+            ffnv_mutex_unlock(&st->lock);
+            break;
+        }
+        st->retries = 0;
+        w->nb_tasks++;
+
+        ffnv_mutex_lock(&st->lock);
+        st->nb_tasks++;
+        ffnv_mutex_unlock(&st->lock);
+    }
+
+    ffnv_mutex_lock(&st->lock);
+    requeue = st->head != NULL;
+    if (!requeue)
+        st->scheduled = 0;
+    ffnv_mutex_unlock(&st->lock);
+
+    if (requeue)
+        ffnv_workpool_schedule(w->pool, st, w->index);
+}
+
+static inline FFNVThreadRet FFNV_THREAD_API ffnv_workpool_worker_main(void *arg)
+{
+    FFNVWorkPoolWorker *w = (FFNVWorkPoolWorker*)arg;
+    FFNVWorkPool *pool = w->pool;
+    FFNVStrand *st;
+
+    for (;;) {
+        st = ffnv_workpool_find(w);
+        if (st && st->retries > FFNV_WORKPOOL_SPIN_RETRIES) {
+            /* run any other strand first, only wait if there is none */
+            FFNVStrand *other = ffnv_workpool_find(w);
+
+            if (other && other->retries <= FFNV_WORKPOOL_SPIN_RETRIES) {
+                ffnv_workpool_schedule(pool, st, w->index);
+                st = other;
+            } else {
+                if (other)
+                    ffnv_workpool_schedule(pool, other, w->index);
+                ffnv_workpool_backoff(pool, st);
+            }
+        }
+        if (st) {
+            ffnv_workpool_run_strand(w, st);
+            continue;
+        }
+
+        ffnv_mutex_lock(&pool->lock);
+        while (!pool->nb_queued && !pool->stop) {
+            pool->nb_idle++;
+            ffnv_cond_wait(&pool->cond, &pool->lock);
+            pool->nb_idle--;
+        }
+        if (!pool->nb_queued && pool->stop) {
+            ffnv_mutex_unlock(&pool->lock);
+            break;
+        }
+        ffnv_mutex_unlock(&pool->lock);
+    }
+
+    return 0;
+}
+
+/**
+ * Submit task to strand. worker is the index passed to the running task
+ * when submitting from a task, so the strand stays on that worker, or -1.
+ */
+static inline void ffnv_workpool_submit(FFNVWorkPool *pool, FFNVStrand *st, FFNVTask *task, int worker)
+{
+    int schedule = 0;
+
+    task->next = NULL;
+    ffnv_mutex_lock(&st->lock);
+    if (st->tail)
+        st->tail->next = task;
+    else
+        st->head = task;
+    st->tail = task;
+    if (!st->scheduled) {
+        st->scheduled = 1;
+        schedule = 1;
+    }
+    ffnv_mutex_unlock(&st->lock);
+
+    if (schedule)
+        ffnv_workpool_schedule(pool, st, worker);
+}
+
+/** Stop the workers once all submitted tasks completed. */
+static inline void ffnv_workpool_uninit(FFNVWorkPool *pool)
+{
+    int i;
+
+    if (!pool->workers)
+        return;
+
+    ffnv_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    ffnv_cond_broadcast(&pool->cond);
+    ffnv_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nb_workers; i++) {
+        ffnv_thread_join(pool->workers[i].thread);
+        ffnv_mutex_destroy(&pool->workers[i].lock);
+    }
+
+    ffnv_cond_destroy(&pool->cond);
+    ffnv_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    memset(pool, 0, sizeof(*pool));
+}
+
+/**
+ * Start nb_workers workers, one per CPU if nb_workers is 0. Returns 0 on
+ * success, -1 on error.
+ */
+static inline int ffnv_workpool_init(FFNVWorkPool *pool, int nb_workers)
+{
+    int i;
+
+    memset(pool, 0, sizeof(*pool));
+
+    if (nb_workers <= 0)
+        nb_workers = ffnv_cpu_count();
+    if (nb_workers > FFNV_WORKPOOL_MAX_WORKERS)
+        nb_workers = FFNV_WORKPOOL_MAX_WORKERS;
+
+    pool->workers = (FFNVWorkPoolWorker*)calloc(nb_workers, sizeof(*pool->workers));
+    if (!pool->workers)
+        return -1;
+    if (ffnv_mutex_init(&pool->lock) < 0) {
+        free(pool->workers);
+        pool->workers = NULL;
+        return -1;
+    }
+    if (ffnv_cond_init(&pool->cond) < 0) {
+        ffnv_mutex_destroy(&pool->lock);
+        free(pool->workers);
+        pool->workers = NULL;
+        return -1;
+    }
+
+    /* all queues exist before the first worker may steal */
+    for (i = 0; i < nb_workers; i++) {
+        pool->workers[i].pool  = pool;
+        pool->workers[i].index = i;
+        if (ffnv_mutex_init(&pool->workers[i].lock) < 0)
+            break;
+    }
+    pool->nb_workers = i;
+
+    for (i = 0; i < pool->nb_workers; i++)
+        if (ffnv_thread_create(&pool->workers[i].thread, ffnv_workpool_worker_main, &pool->workers[i]) < 0)
+            break;
+
+    if (i < nb_workers) {
+        int nb_started = i;
+
+        ffnv_mutex_lock(&pool->lock);
+        pool->stop = 1;
+        ffnv_cond_broadcast(&pool->cond);
+        ffnv_mutex_unlock(&pool->lock);
+
+        for (i = 0; i < nb_started; i++)
+            ffnv_thread_join(pool->workers[i].thread);
+        for (i = 0; i < pool->nb_workers; i++)
+            ffnv_mutex_destroy(&pool->workers[i].lock);
+        ffnv_cond_destroy(&pool->cond);
+        ffnv_mutex_destroy(&pool->lock);
+        free(pool->workers);
+        memset(pool, 0, sizeof(*pool));
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif
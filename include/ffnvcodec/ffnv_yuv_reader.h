@@ -0,0 +1,386 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Memory mapped reader of raw frame files (.yuv, .y4m), for encoding
+ * without a read into an intermediate buffer.
+ *
+ * The file is mapped read-only and the planes of a frame point into the
+ * mapping, ready for ffnv_pack_frame() into a locked input buffer or as
+ * the srcHost of a CUDA_MEMCPY2D. Each frame request asks the kernel to
+ * read the following prefetch frames ahead (MADV_WILLNEED), so the page
+ * faults of the copy find the data in the page cache, and with
+ * drop_behind the frames already read are dropped from the page cache,
+ * so encoding files larger than memory does not evict everything else.
+ *
+ * Y4M files give their size and format in their header (C420jpeg,
+ * C420paldv, C420mpeg2, C420, C420p10 and C444 are supported); raw files
+ * are opened with the size and format of their frames. The frames of a
+ * Y4M file start wherever the headers leave them, so 10 bit samples may
+ * be unaligned; the packing kernels read them as bytes. The advice calls
+ * need the POSIX declarations, and are left out of strict ISO C builds.
+ */
+
+#ifndef FFNV_YUV_READER_H
+#define FFNV_YUV_READER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvenc_pack.h"
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+/* frames read ahead by default */
+#define FFNV_YUV_PREFETCH 4
+
+typedef struct FFNVYuvReader {
+    const uint8_t *map;
+    size_t size;
+#if defined(_WIN32)
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+
+    int width, height;
+    int format;            /**< FFNV_PACK_YUV420P, _YUV420P10, _YUV444P or _BGRA */
+    int fps_num, fps_den;  /**< from the Y4M header, 0 for raw files */
+    int nb_frames;
+
+    size_t frame_size;     /* payload of a frame */
+    size_t data_start;     /* offset of the first frame (header included) */
+    size_t stride;         /* frame header and payload, if all headers have the same length */
+    size_t hdr_size;
+    size_t *offsets;       /* payload offsets, once headers of different lengths were seen */
+
+    int prefetch;          /**< frames read ahead, 0 to disable */
+    int drop_behind;       /**< drop the frames before the one read from the page cache */
+    int advised;           /* frames [0, advised) were read ahead */
+    int dropped;           /* frames [0, dropped) were dropped */
+} FFNVYuvReader;
+
+static inline size_t ffnv_yuv_frame_size(int format, int width, int height)
+{
+    size_t luma = (size_t)width * height;
+    size_t chroma = (size_t)((width + 1) >> 1) * ((height + 1) >> 1);
+
+    switch (format) {
+    case FFNV_PACK_YUV420P:   return luma + 2 * chroma;
+    case FFNV_PACK_YUV420P10: return 2 * (luma + 2 * chroma);
+    case FFNV_PACK_YUV444P:   return 3 * luma;
+    case FFNV_PACK_BGRA:      return 4 * luma;
+    }
+    return 0;
+}
+
+static inline void ffnv_yuv_reader_close(FFNVYuvReader *r)
+{
+#if defined(_WIN32)
+    if (r->map)
+        UnmapViewOfFile(r->map);
+    if (r->mapping)
+        CloseHandle(r->mapping);
+    if (r->file && r->file != INVALID_HANDLE_VALUE)
+        CloseHandle(r->file);
+#else
+    if (r->map)
+        munmap((void*)r->map, r->size);
+    if (r->fd >= 0)
+        close(r->fd);
+#endif
+    free(r->offsets);
+    memset(r, 0, sizeof(*r));
+#if !defined(_WIN32)
+    r->fd = -1;
+#endif
+}
+
+/* Parse the Y4M stream header. Returns 0 on success, -1 on error. */
+static inline int ffnv_yuv_parse_y4m(FFNVYuvReader *r)
+{
+    const char *p = (const char*)r->map + 10, *end;
+    const char *nl = (const char*)memchr(r->map, '\n', r->size);
+
+    if (!nl)
+        return -1;
+    end = nl;
+    r->format = FFNV_PACK_YUV420P;
+
+    while (p < end) {
+        const char *tok = p;
+        size_t len;
+
+        while (p < end && *p != ' ')
+            p++;
+        len = p - tok;
+        if (p < end)
+            p++;
+        if (!len)
+            continue;
+
+        switch (tok[0]) {
+        case 'W':
+            r->width = atoi(tok + 1);
+            break;
+        case 'H':
+            r->height = atoi(tok + 1);
+            break;
+        case 'F': {
+            const char *colon = (const char*)memchr(tok, ':', len);
+
+            r->fps_num = atoi(tok + 1);
+            r->fps_den = colon ? atoi(colon + 1) : 1;
+            break;
+        }
+        case 'C':
+            if (len == 7 && !memcmp(tok, "C420p10", 7))
+                r->format = FFNV_PACK_YUV420P10;
+            else if (len == 4 && !memcmp(tok, "C444", 4))
+                r->format = FFNV_PACK_YUV444P;
+            else if (len < 4 || memcmp(tok, "C420", 4) || (len > 4 && tok[4] != 'j' && tok[4] != 'p' && tok[4] != 'm'))
+                return -1;
+            break;
+        }
+    }
+
+    r->data_start = nl + 1 - (const char*)r->map;
+    return r->width > 0 && r->height > 0 ? 0 : -1;
+}
+
+/* Length of the frame header at offset, 0 if there is none. */
+static inline size_t ffnv_yuv_frame_header(const FFNVYuvReader *r, size_t offset)
+{
+    const uint8_t *nl;
+
+    if (offset + 6 > r->size || memcmp(r->map + offset, "FRAME", 5))
+        return 0;
+    nl = (const uint8_t*)memchr(r->map + offset + 5, '\n', r->size - offset - 5);
+    return nl ? (size_t)(nl + 1 - (r->map + offset)) : 0;
+}
+
+/* Index all frames of a Y4M file whose frame headers differ in length. */
+static inline int ffnv_yuv_index(FFNVYuvReader *r)
+{
+    size_t pos = r->data_start, hdr, cap = 0;
+    int n = 0;
+
+    free(r->offsets);
+    r->offsets = NULL;
+    while ((hdr = ffnv_yuv_frame_header(r, pos)) && pos + hdr + r->frame_size <= r->size) {
+        if (n == (int)cap) {
+            size_t *o = (size_t*)realloc(r->offsets, (cap = cap ? 2 * cap : 256) * sizeof(*o));
+            if (!o)
+                return -1;
+            r->offsets = o;
+        }
+        r->offsets[n++] = pos + hdr;
+        pos += hdr + r->frame_size;
+    }
+    r->nb_frames = n;
+    return 0;
+}
+
+/**
+ * Open path. For raw files width, height and format (FFNV_PACK_*) give
+ * the frames, Y4M files are recognized by their signature and these are
+ * ignored. Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_yuv_reader_open(FFNVYuvReader *r, const char *path, int width, int height, int format)
+{
+    memset(r, 0, sizeof(*r));
+    r->prefetch = FFNV_YUV_PREFETCH;
+#if !defined(_WIN32)
+    r->fd = -1;
+#endif
+
+#if defined(_WIN32)
+    {
+        LARGE_INTEGER size;
+
+        r->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (r->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(r->file, &size) || !size.QuadPart)
+            goto fail;
+        r->size    = (size_t)size.QuadPart;
+        r->mapping = CreateFileMappingA(r->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!r->mapping)
+            goto fail;
+        r->map = (const uint8_t*)MapViewOfFile(r->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!r->map)
+            goto fail;
+    }
+#else
+    {
+        struct stat st;
+        void *map;
+
+        r->fd = open(path, O_RDONLY);
+        if (r->fd < 0 || fstat(r->fd, &st) < 0 || st.st_size <= 0)
+            goto fail;
+        r->size = (size_t)st.st_size;
+        map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+        if (map == MAP_FAILED)
+            goto fail;
+        r->map = (const uint8_t*)map;
+# ifdef POSIX_MADV_SEQUENTIAL
+        posix_madvise(map, r->size, POSIX_MADV_SEQUENTIAL);
+# endif
+    }
+#endif
+
+    if (r->size >= 10 && !memcmp(r->map, "YUV4MPEG2 ", 10)) {
+        if (ffnv_yuv_parse_y4m(r) < 0)
+            goto fail;
+        r->frame_size = ffnv_yuv_frame_size(r->format, r->width, r->height);
+        r->hdr_size   = ffnv_yuv_frame_header(r, r->data_start);
+        if (!r->hdr_size)
+            goto fail;
+        r->stride    = r->hdr_size + r->frame_size;
+        r->nb_frames = (int)((r->size - r->data_start) / r->stride);
+    } else {
+        r->width      = width;
+        r->height     = height;
+        r->format     = format;
+        r->frame_size = ffnv_yuv_frame_size(format, width, height);
+        if (width <= 0 || height <= 0 || !r->frame_size)
+            goto fail;
+        r->stride    = r->frame_size;
+        r->nb_frames = (int)(r->size / r->stride);
+    }
+    return 0;
+
+fail:
+    ffnv_yuv_reader_close(r);
+    return -1;
+}
+
+/* Hint the kernel about the bytes [start, end) of the mapping. */
+static inline void ffnv_yuv_advise(FFNVYuvReader *r, size_t start, size_t end, int willneed)
+{
+#if defined(_WIN32)
+# if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+    if (willneed) {
+        WIN32_MEMORY_RANGE_ENTRY range;
+
+        range.VirtualAddress = (PVOID)(r->map + start);
+        range.NumberOfBytes  = end - start;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+# endif
+    (void)r; (void)start; (void)end; (void)willneed;
+#else
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (end > r->size)
+        end = r->size;
+    if (willneed) {
+        start &= ~(page - 1);
+# ifdef POSIX_MADV_WILLNEED
+        if (end > start)
+            posix_madvise((void*)(r->map + start), end - start, POSIX_MADV_WILLNEED);
+# endif
+    } else {
+        /* only whole pages of the range, the frames around may share the others */
+        start = (start + page - 1) & ~(page - 1);
+        end  &= ~(page - 1);
+# if defined(POSIX_MADV_DONTNEED) && defined(POSIX_FADV_DONTNEED)
+        if (end > start) {
+            posix_madvise((void*)(r->map + start), end - start, POSIX_MADV_DONTNEED);
+            posix_fadvise(r->fd, (off_t)start, (off_t)(end - start), POSIX_FADV_DONTNEED);
+        }
+# endif
+    }
+#endif
+}
+
+static inline size_t ffnv_yuv_offset(const FFNVYuvReader *r, int n)
+{
+    return r->offsets ? r->offsets[n] : r->data_start + (size_t)n * r->stride + r->hdr_size;
+}
+
+/**
+ * Planes of frame n, pointing into the mapping and valid until the
+ * reader is closed. Returns 0 on success, -1 if there is no frame n.
+ */
+static inline int ffnv_yuv_reader_frame(FFNVYuvReader *r, int n, FFNVPlanes *planes)
+{
+    int bps = r->format == FFNV_PACK_YUV420P10 ? 2 : 1;
+    int cw = r->format == FFNV_PACK_YUV444P ? r->width : (r->width + 1) >> 1;
+    int ch = r->format == FFNV_PACK_YUV444P ? r->height : (r->height + 1) >> 1;
+    size_t offset;
+    uint8_t *data;
+
+    if (n < 0 || n >= r->nb_frames)
+        return -1;
+
+    /* a Y4M frame header of another length than the first: index them all */
+    if (r->hdr_size && !r->offsets &&
+        ffnv_yuv_frame_header(r, ffnv_yuv_offset(r, n) - r->hdr_size) != r->hdr_size) {
+        if (ffnv_yuv_index(r) < 0 || n >= r->nb_frames)
+            return -1;
+    }
+    offset = ffnv_yuv_offset(r, n);
+
+    if (r->prefetch > 0) {
+        int last = n + r->prefetch < r->nb_frames ? n + r->prefetch : r->nb_frames - 1;
+
+        /* the requested frame too, in case of a seek */
+        if (r->advised <= n || r->advised > last + 1 + r->prefetch)
+            r->advised = n;
+        if (r->advised <= last) {
+            ffnv_yuv_advise(r, ffnv_yuv_offset(r, r->advised), ffnv_yuv_offset(r, last) + r->frame_size, 1);
+            r->advised = last + 1;
+        }
+    }
+    if (r->drop_behind && n > r->dropped) {
+        ffnv_yuv_advise(r, ffnv_yuv_offset(r, r->dropped), offset, 0);
+        r->dropped = n;
+    }
+
+    data = (uint8_t*)r->map + offset;
+    memset(planes, 0, sizeof(*planes));
+    planes->data[0]  = data;
+    planes->pitch[0] = r->width * (r->format == FFNV_PACK_BGRA ? 4 : bps);
+    if (r->format != FFNV_PACK_BGRA) {
+        planes->data[1]  = data + (size_t)planes->pitch[0] * r->height;
+        planes->pitch[1] = cw * bps;
+        planes->data[2]  = planes->data[1] + (size_t)planes->pitch[1] * ch;
+        planes->pitch[2] = cw * bps;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Emphasis level map builder for NV_ENC_QP_MAP_EMPHASIS.
+ *
+ * Per-frame importance heatmaps (one byte per sample, any resolution fixed
+ * at init time) are averaged down to one value per 16x16 macroblock,
+ * smoothed over time and turned into NV_ENC_EMPHASIS_MAP_LEVEL values with
+ * hysteresis so levels do not flicker between frames. The share of
+ * emphasized macroblocks can be capped so rate control keeps enough bits
+ * for the rest of the picture. All buffers are allocated once at init.
+ */
+
+#ifndef FFNV_NVENC_EMPHASIS_H
+#define FFNV_NVENC_EMPHASIS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvEncodeAPI.h"
+
+#define FFNV_EMPHASIS_NB_LEVELS (NV_ENC_EMPHASIS_MAP_LEVEL_5 + 1)
+
+typedef struct FFNVEmphasisMap {
+    int width_in_mbs;
+    int height_in_mbs;
+    int size;
+
+    int heat_width;
+    int heat_height;
+
+    /**
+     * Weight of the new frame in the temporal average, 1..256 where 256
+     * disables smoothing. Defaults to 64.
+     */
+    int smoothing;
+
+    /** Margin around each threshold a level must cross to change, 0..255. Defaults to 12. */
+    int hysteresis;
+
+    /** Importance (0..255) at which level i + 1 is entered. */
+    int thresholds[FFNV_EMPHASIS_NB_LEVELS - 1];
+
+    /** Maximum share of emphasized macroblocks in 1/1000 units, 1000 disables the cap. */
+    int max_area_permille;
+
+    uint16_t *xmap;   /* heatmap column -> macroblock column */
+    uint16_t *ymap;   /* heatmap row -> macroblock row */
+    uint32_t *count;  /* heatmap samples per macroblock */
+    uint32_t *acc;    /* per-frame sum of samples per macroblock */
+    uint16_t *state;  /* smoothed importance, 8.8 fixed point */
+    uint8_t  *levels; /* level after hysteresis */
+    int8_t   *map;    /* level after the area cap, handed to the encoder */
+
+    int first_frame;
+} FFNVEmphasisMap;
+
+static inline void ffnv_emphasis_uninit(FFNVEmphasisMap *e)
+{
+    free(e->xmap);
+    free(e->ymap);
+    free(e->count);
+    free(e->acc);
+    free(e->state);
+    free(e->levels);
+    free(e->map);
+    memset(e, 0, sizeof(*e));
+}
+
+/**
+ * Set up a builder for a width x height picture fed with heat_width x
+ * heat_height heatmaps. Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_emphasis_init(FFNVEmphasisMap *e, int width, int height,
+                                     int heat_width, int heat_height)
+{
+    int i, x, y;
+
+    memset(e, 0, sizeof(*e));
+
+    if (width <= 0 || height <= 0 || heat_width <= 0 || heat_height <= 0 ||
+        heat_width > 65535 || heat_height > 65535)
+        return -1;
+
+    e->width_in_mbs  = (width  + 15) / 16;
+    e->height_in_mbs = (height + 15) / 16;
+    e->size          = e->width_in_mbs * e->height_in_mbs;
+    e->heat_width    = heat_width;
+    e->heat_height   = heat_height;
+
+    e->smoothing         = 64;
+    e->hysteresis        = 12;
+    e->max_area_permille = 250;
+    for (i = 0; i < FFNV_EMPHASIS_NB_LEVELS - 1; i++)
+        e->thresholds[i] = 32 + i * 48;
+
+    e->xmap   = (uint16_t*)malloc(heat_width  * sizeof(*e->xmap));
+    e->ymap   = (uint16_t*)malloc(heat_height * sizeof(*e->ymap));
+    e->count  = (uint32_t*)calloc(e->size, sizeof(*e->count));
+    e->acc    = (uint32_t*)calloc(e->size, sizeof(*e->acc));
+    e->state  = (uint16_t*)calloc(e->size, sizeof(*e->state));
+    e->levels = (uint8_t*)calloc(e->size, sizeof(*e->levels));
+    e->map    = (int8_t*)calloc(e->size, sizeof(*e->map));
+    if (!e->xmap || !e->ymap || !e->count || !e->acc ||
+        !e->state || !e->levels || !e->map) {
+        ffnv_emphasis_uninit(e);
+        return -1;
+    }
+
+    for (i = 0; i < heat_width; i++)
+        e->xmap[i] = (uint16_t)((int64_t)i * e->width_in_mbs / heat_width);
+    for (i = 0; i < heat_height; i++)
+        e->ymap[i] = (uint16_t)((int64_t)i * e->height_in_mbs / heat_height);
+
+    for (y = 0; y < heat_height; y++)
+        for (x = 0; x < heat_width; x++)
+            e->count[e->ymap[y] * e->width_in_mbs + e->xmap[x]]++;
+
+    /* heatmaps coarser than the MB grid leave some MBs without samples,
+     * those store the index of the nearest sample with the top bit set */
+    for (y = 0; y < e->height_in_mbs; y++) {
+        for (x = 0; x < e->width_in_mbs; x++) {
+            if (!e->count[y * e->width_in_mbs + x]) {
+                int hx = (int)((int64_t)x * heat_width  / e->width_in_mbs);
+                int hy = (int)((int64_t)y * heat_height / e->height_in_mbs);
+                e->count[y * e->width_in_mbs + x] = 0x80000000u | (uint32_t)(hy * heat_width + hx);
+            }
+        }
+    }
+
+    e->first_frame = 1;
+    return 0;
+}
+
+static inline int ffnv_emphasis_level_update(const FFNVEmphasisMap *e, int level, int value)
+{
+    const int h = e->hysteresis << 8;
+
+    while (level < FFNV_EMPHASIS_NB_LEVELS - 1 && value >= (e->thresholds[level] << 8) + h)
+        level++;
+    while (level > 0 && value < (e->thresholds[level - 1] << 8) - h)
+        level--;
+
+    return level;
+}
+
+/**
+ * Feed the next frame's heatmap and rebuild the emphasis map.
+ * Returns the number of emphasized macroblocks, or -1 on error.
+ */
+static inline int ffnv_emphasis_update(FFNVEmphasisMap *e, const uint8_t *heat, int stride)
+{
+    int hist[FFNV_EMPHASIS_NB_LEVELS] = { 0 };
+    int x, y, i, shift, emphasized;
+    int alpha = e->smoothing;
+
+    if (!e->map || !heat)
+        return -1;
+
+    if (alpha < 1)   alpha = 1;
+    if (alpha > 256) alpha = 256;
+    if (e->first_frame)
+        alpha = 256;
+
+    memset(e->acc, 0, e->size * sizeof(*e->acc));
+    for (y = 0; y < e->heat_height; y++) {
+        const uint8_t *src = heat + (size_t)y * stride;
+        uint32_t *acc = e->acc + e->ymap[y] * e->width_in_mbs;
+        for (x = 0; x < e->heat_width; x++)
+            acc[e->xmap[x]] += src[x];
+    }
+
+    for (i = 0; i < e->size; i++) {
+        uint32_t n = e->count[i];
+        int v, s;
+
+        if (n & 0x80000000u) {
+            n &= 0x7fffffffu;
+            v = heat[(n / e->heat_width) * (size_t)stride + n % e->heat_width] << 8;
+        } else {
+            v = (int)((((uint64_t)e->acc[i] << 8) + n / 2) / n);
+        }
+
+        s = e->state[i];
+        s += (v - s) * alpha / 256;
+        e->state[i] = (uint16_t)s;
+
+        e->levels[i] = (uint8_t)ffnv_emphasis_level_update(e, e->levels[i], s);
+        hist[e->levels[i]]++;
+    }
+    e->first_frame = 0;
+
+    /* demote all levels uniformly until the emphasized area fits the budget */
+    emphasized = e->size - hist[0];
+    shift = 0;
+    if (e->max_area_permille < 1000) {
+        int budget = (int)((int64_t)e->size * e->max_area_permille / 1000);
+        while (shift < FFNV_EMPHASIS_NB_LEVELS - 1 && emphasized > budget) {
+            shift++;
+            emphasized -= hist[shift];
+        }
+    }
+
+    for (i = 0; i < e->size; i++) {
+        int l = e->levels[i] - shift;
+        e->map[i] = (int8_t)(l > 0 ? l : NV_ENC_EMPHASIS_MAP_LEVEL_0);
+    }
+
+    return emphasized;
+}
+
+/**
+ * Point pic_params at the current map. The session must have been
+ * initialized with NV_ENC_RC_PARAMS::qpMapMode = NV_ENC_QP_MAP_EMPHASIS,
+ * which requires NV_ENC_CAPS_SUPPORT_EMPHASIS_LEVEL_MAP and H.264.
+ */
+static inline void ffnv_emphasis_apply(const FFNVEmphasisMap *e, NV_ENC_PIC_PARAMS *pic_params)
+{
+    pic_params->qpDeltaMap     = e->map;
+    pic_params->qpDeltaMapSize = e->size;
+}
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * External ME hint builder for NV_ENC_PIC_PARAMS::meExternalHints.
+ *
+ * Turns a global motion estimate (e.g. from a stabilizer) and a list of
+ * moved rectangles (e.g. screen capture scroll/damage regions) into L0
+ * 16x16 candidates for every macroblock. Macroblocks inside a rectangle
+ * get the rectangle's vector first, all others the global vector first;
+ * the zero vector is always offered as well. The candidate count per
+ * macroblock is capped at the session's NVENC_EXTERNAL_ME_HINT_COUNTS_PER_BLOCKTYPE
+ * limit and the hint buffer is filled with replicated per-MB patterns.
+ *
+ * All vectors are integer pels pointing from the current block to its
+ * match in the reference frame.
+ */
+
+#ifndef FFNV_NVENC_MEHINT_H
+#define FFNV_NVENC_MEHINT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvEncodeAPI.h"
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define FFNV_MEHINT_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#endif
+
+#define FFNV_MEHINT_MAX_CANDS 4
+
+typedef struct FFNVMEHintRect {
+    int x, y;          /**< top-left corner in pixels */
+    int width, height; /**< size in pixels */
+    int mvx, mvy;      /**< motion of the rectangle's content */
+} FFNVMEHintRect;
+
+typedef struct FFNVMEHintBuilder {
+    int width_in_mbs;
+    int height_in_mbs;
+    int nb_cands;
+    NVENC_EXTERNAL_ME_HINT *hints;
+    uint32_t *words; /* same memory as hints */
+    NVENC_EXTERNAL_ME_HINT_COUNTS_PER_BLOCKTYPE counts;
+} FFNVMEHintBuilder;
+
+/**
+ * Enable external hints with nb_cands 16x16 L0 candidates on a session
+ * about to be initialized.
+ */
+static inline void ffnv_mehint_init_params(NV_ENC_INITIALIZE_PARAMS *init_params, int nb_cands)
+{
+    if (nb_cands > FFNV_MEHINT_MAX_CANDS)
+        nb_cands = FFNV_MEHINT_MAX_CANDS;
+
+    init_params->enableExternalMEHints = 1;
+    memset(init_params->maxMEHintCountsPerBlock, 0, sizeof(init_params->maxMEHintCountsPerBlock));
+    init_params->maxMEHintCountsPerBlock[0].numCandsPerBlk16x16 = nb_cands;
+}
+
+static inline void ffnv_mehint_uninit(FFNVMEHintBuilder *b)
+{
+    free(b->hints);
+    memset(b, 0, sizeof(*b));
+}
+
+/**
+ * Allocate the hint buffer for a width x height picture. max_counts is the
+ * L0 limit the session was initialized with; only 16x16 candidates are
+ * produced. Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_mehint_init(FFNVMEHintBuilder *b, int width, int height,
+                                   const NVENC_EXTERNAL_ME_HINT_COUNTS_PER_BLOCKTYPE *max_counts)
+{
+    memset(b, 0, sizeof(*b));
+
+    if (sizeof(NVENC_EXTERNAL_ME_HINT) != sizeof(uint32_t) ||
+        width <= 0 || height <= 0 || !max_counts->numCandsPerBlk16x16)
+        return -1;
+
+    b->width_in_mbs  = (width  + 15) / 16;
+    b->height_in_mbs = (height + 15) / 16;
+    b->nb_cands      = max_counts->numCandsPerBlk16x16;
+    if (b->nb_cands > FFNV_MEHINT_MAX_CANDS)
+        b->nb_cands = FFNV_MEHINT_MAX_CANDS;
+    b->counts.numCandsPerBlk16x16 = b->nb_cands;
+
+    b->hints = (NVENC_EXTERNAL_ME_HINT*)calloc((size_t)b->width_in_mbs * b->height_in_mbs * b->nb_cands,
+                                               sizeof(*b->hints));
+    if (!b->hints)
+        return -1;
+    b->words = (uint32_t*)b->hints;
+
+    return 0;
+}
+
+/*
+ * The NVENC_EXTERNAL_ME_HINT word, built with masks: its one bit fields
+ * are signed and cannot hold 1. The fields are allocated from the least
+ * significant bit, as by the compilers of the supported ABIs.
+ */
+static inline uint32_t ffnv_mehint_word(int mvx, int mvy, int last)
+{
+    mvx = mvx < -2048 ? -2048 : mvx > 2047 ? 2047 : mvx;
+    mvy = mvy <  -512 ?  -512 : mvy >  511 ?  511 : mvy;
+
+    /* refidx 0, dir L0, partType 16x16, lastofPart set */
+    return ((uint32_t)mvx & 0xfff)        |
+           ((uint32_t)mvy & 0x3ff) << 12  |
+           1u << 30                       |
+           (uint32_t)(last != 0) << 31;
+}
+
+/* Candidate words for one MB: primary vector, then secondary, then zero, padded by repetition. */
+static inline void ffnv_mehint_pattern(const FFNVMEHintBuilder *b, uint32_t *pattern,
+                                       int mvx0, int mvy0, int mvx1, int mvy1)
+{
+    int mv[3][2], n = 0, i;
+
+    mv[n][0] = mvx0; mv[n][1] = mvy0; n++;
+    if (mvx1 != mvx0 || mvy1 != mvy0) {
+        mv[n][0] = mvx1; mv[n][1] = mvy1; n++;
+    }
+    if ((mvx0 || mvy0) && (mvx1 || mvy1)) {
+        mv[n][0] = 0; mv[n][1] = 0; n++;
+    }
+
+    for (i = 0; i < b->nb_cands; i++) {
+        const int *v = mv[i < n ? i : 0];
+        pattern[i] = ffnv_mehint_word(v[0], v[1], i == b->nb_cands - 1);
+    }
+}
+
+/* Store the nb_cands word pattern for nb_mbs consecutive macroblocks. */
+static inline void ffnv_mehint_fill(uint32_t *dst, const uint32_t *pattern, int nb_cands, int nb_mbs)
+{
+    int i = 0, n = nb_mbs * nb_cands;
+
+#if defined(__AVX2__) || defined(FFNV_MEHINT_SSE2) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+    if (nb_cands == 1 || nb_cands == 2 || nb_cands == 4) {
+        uint32_t rep[8];
+        int j;
+
+        for (j = 0; j < 8; j++)
+            rep[j] = pattern[j % nb_cands];
+#if defined(__AVX2__)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)rep);
+            for (; i + 8 <= n; i += 8)
+                _mm256_storeu_si256((__m256i*)(dst + i), v);
+        }
+#elif defined(FFNV_MEHINT_SSE2)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)rep);
+            for (; i + 4 <= n; i += 4)
+                _mm_storeu_si128((__m128i*)(dst + i), v);
+        }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        {
+            uint32x4_t v = vld1q_u32(rep);
+            for (; i + 4 <= n; i += 4)
+                vst1q_u32(dst + i, v);
+        }
+#endif
+    }
+#endif
+
+    for (; i < n; i++)
+        dst[i] = pattern[i % nb_cands];
+}
+
+/**
+ * Rebuild all hints. Later rectangles take precedence over earlier ones
+ * where they overlap; a macroblock belongs to a rectangle if its center
+ * lies inside it.
+ */
+static inline void ffnv_mehint_build(FFNVMEHintBuilder *b, int global_mvx, int global_mvy,
+                                     const FFNVMEHintRect *rects, int nb_rects)
+{
+    uint32_t background[FFNV_MEHINT_MAX_CANDS];
+    uint32_t pattern[FFNV_MEHINT_MAX_CANDS];
+    const int row_words = b->width_in_mbs * b->nb_cands;
+    int i, y;
+
+    ffnv_mehint_pattern(b, background, global_mvx, global_mvy, 0, 0);
+    ffnv_mehint_fill(b->words, background, b->nb_cands, b->width_in_mbs * b->height_in_mbs);
+
+    for (i = 0; i < nb_rects; i++) {
+        const FFNVMEHintRect *r = &rects[i];
+        /* macroblock i has its center at 16 * i + 8 */
+        int x0 = (r->x + 7) / 16, x1 = (r->x + r->width  + 7) / 16;
+        int y0 = (r->y + 7) / 16, y1 = (r->y + r->height + 7) / 16;
+
+        if (r->x + 7 < 0) x0 = 0;
+        if (r->y + 7 < 0) y0 = 0;
+        if (x1 > b->width_in_mbs)  x1 = b->width_in_mbs;
+        if (y1 > b->height_in_mbs) y1 = b->height_in_mbs;
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+
+        ffnv_mehint_pattern(b, pattern, r->mvx, r->mvy, global_mvx, global_mvy);
+        for (y = y0; y < y1; y++)
+            ffnv_mehint_fill(b->words + y * row_words + x0 * b->nb_cands,
+                             pattern, b->nb_cands, x1 - x0);
+    }
+}
+
+/** Attach the hints to an encode call. */
+static inline void ffnv_mehint_apply(const FFNVMEHintBuilder *b, NV_ENC_PIC_PARAMS *pic_params)
+{
+    memset(pic_params->meHintCountsPerBlock, 0, sizeof(pic_params->meHintCountsPerBlock));
+    pic_params->meHintCountsPerBlock[0] = b->counts;
+    pic_params->meExternalHints = b->hints;
+}
+
+/** Attach the hints to a motion estimation only call (H.264 only). */
+static inline void ffnv_mehint_apply_meonly(const FFNVMEHintBuilder *b, NV_ENC_MEONLY_PARAMS *me_params)
+{
+    memset(me_params->meHintCountsPerBlock, 0, sizeof(me_params->meHintCountsPerBlock));
+    me_params->meHintCountsPerBlock[0] = b->counts;
+    me_params->meExternalHints = b->hints;
+}
+
+#endif
@@ -0,0 +1,439 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Motion estimation only driver around NvEncRunMotionEstimationOnly.
+ *
+ * An FFNVMESession wraps one ME-only encode session together with a ring
+ * of MV buffers created with NvEncCreateMVBuffer. Frame pairs are submitted
+ * into the ring and retrieved in order; retrieval locks the MV buffer and
+ * converts NV_ENC_H264_MV_DATA or NV_ENC_HEVC_MV_DATA into a struct of
+ * arrays of int16_t vectors on a uniform 8x8 block grid.
+ *
+ * ffnv_me_run_batch() pipelines a list of frame pairs spanning any number
+ * of sessions, only waiting for a result when a session's ring is full.
+ */
+
+#ifndef FFNV_NVENC_MEONLY_H
+#define FFNV_NVENC_MEONLY_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "nvEncodeAPI.h"
+
+#define FFNV_ME_MAX_DEPTH 16
+
+typedef struct FFNVMEVectors {
+    int width_in_blocks;  /**< number of 8x8 blocks per row, also the stride of all arrays */
+    int height_in_blocks;
+    int16_t *mvx;         /**< horizontal component in quarter pels, one per 8x8 block */
+    int16_t *mvy;         /**< vertical component in quarter pels, one per 8x8 block */
+    uint8_t *intra;       /**< optional, set to 1 for blocks coded intra */
+} FFNVMEVectors;
+
+typedef struct FFNVMESession {
+    NV_ENCODE_API_FUNCTION_LIST *nvenc;
+    void *encoder;
+
+    int width;
+    int height;
+    int hevc;
+    int ctb_size;
+    NV_ENC_BUFFER_FORMAT format;
+
+    int depth;
+    NV_ENC_OUTPUT_PTR mv_buffers[FFNV_ME_MAX_DEPTH];
+    void *tags[FFNV_ME_MAX_DEPTH];
+    unsigned submitted;
+    unsigned retrieved;
+} FFNVMESession;
+
+/**
+ * Fill init_params and config for an ME-only session. The caller still has
+ * to open the session and call nvEncInitializeEncoder() with them.
+ */
+static inline void ffnv_me_init_params(NV_ENC_INITIALIZE_PARAMS *init_params, NV_ENC_CONFIG *config,
+                                       GUID codec, GUID preset, int width, int height)
+{
+    memset(init_params, 0, sizeof(*init_params));
+    memset(config, 0, sizeof(*config));
+
+    config->version        = NV_ENC_CONFIG_VER;
+    config->gopLength      = NVENC_INFINITE_GOPLENGTH;
+    config->frameIntervalP = 1;
+    config->mvPrecision    = NV_ENC_MV_PRECISION_QUARTER_PEL;
+
+    init_params->version          = NV_ENC_INITIALIZE_PARAMS_VER;
+    init_params->encodeGUID       = codec;
+    init_params->presetGUID       = preset;
+    init_params->encodeWidth      = width;
+    init_params->encodeHeight     = height;
+    init_params->darWidth         = width;
+    init_params->darHeight        = height;
+    init_params->frameRateNum     = 30;
+    init_params->frameRateDen     = 1;
+    init_params->enableMEOnlyMode = 1;
+    init_params->encodeConfig     = config;
+}
+
+static inline void ffnv_me_session_uninit(FFNVMESession *s)
+{
+    int i;
+
+    for (i = 0; i < s->depth; i++) {
+        if (s->mv_buffers[i])
+            s->nvenc->nvEncDestroyMVBuffer(s->encoder, s->mv_buffers[i]);
+    }
+    memset(s, 0, sizeof(*s));
+}
+
+/**
+ * Create depth MV buffers on an initialized ME-only session. ctb_size is
+ * the HEVC CTB size the session uses and is ignored for H.264.
+ */
+static inline NVENCSTATUS ffnv_me_session_init(FFNVMESession *s, NV_ENCODE_API_FUNCTION_LIST *nvenc,
+                                               void *encoder, int hevc, int ctb_size,
+                                               int width, int height,
+                                               NV_ENC_BUFFER_FORMAT format, int depth)
+{
+    NVENCSTATUS ret;
+    int i;
+
+    memset(s, 0, sizeof(*s));
+
+    if (depth < 1 || depth > FFNV_ME_MAX_DEPTH || width <= 0 || height <= 0 ||
+        (hevc && ctb_size != 16 && ctb_size != 32 && ctb_size != 64))
+        return NV_ENC_ERR_INVALID_PARAM;
+
+    s->nvenc    = nvenc;
+    s->encoder  = encoder;
+    s->hevc     = hevc;
+    s->ctb_size = hevc ? ctb_size : 16;
+    s->width    = width;
+    s->height   = height;
+    s->format   = format;
+
+    for (i = 0; i < depth; i++) {
+        NV_ENC_CREATE_MV_BUFFER params;
+
+        memset(&params, 0, sizeof(params));
+        params.version = NV_ENC_CREATE_MV_BUFFER_VER;
+        ret = nvenc->nvEncCreateMVBuffer(encoder, &params);
+        if (ret != NV_ENC_SUCCESS) {
+            ffnv_me_session_uninit(s);
+            return ret;
+        }
+        s->mv_buffers[i] = params.mvBuffer;
+        s->depth = i + 1;
+    }
+
+    return NV_ENC_SUCCESS;
+}
+
+static inline int ffnv_me_session_full(const FFNVMESession *s)
+{
+    return s->submitted - s->retrieved >= (unsigned)s->depth;
+}
+
+static inline int ffnv_me_session_pending(const FFNVMESession *s)
+{
+    return (int)(s->submitted - s->retrieved);
+}
+
+/**
+ * Queue motion estimation of input against reference. tag is returned
+ * with the result. Returns NV_ENC_ERR_NOT_ENOUGH_BUFFER if the ring is full.
+ */
+static inline NVENCSTATUS ffnv_me_submit(FFNVMESession *s, NV_ENC_INPUT_PTR input,
+                                         NV_ENC_INPUT_PTR reference, void *tag)
+{
+    NV_ENC_MEONLY_PARAMS params;
+    int slot = s->submitted % s->depth;
+    NVENCSTATUS ret;
+
+    if (ffnv_me_session_full(s))
+        return NV_ENC_ERR_NOT_ENOUGH_BUFFER;
+
+    memset(&params, 0, sizeof(params));
+    params.version        = NV_ENC_MEONLY_PARAMS_VER;
+    params.inputWidth     = s->width;
+    params.inputHeight    = s->height;
+    params.inputBuffer    = input;
+    params.referenceFrame = reference;
+    params.mvBuffer       = s->mv_buffers[slot];
+    params.bufferFmt      = s->format;
+
+    ret = s->nvenc->nvEncRunMotionEstimationOnly(s->encoder, &params);
+    if (ret != NV_ENC_SUCCESS)
+        return ret;
+
+    s->tags[slot] = tag;
+    s->submitted++;
+    return NV_ENC_SUCCESS;
+}
+
+static inline void ffnv_me_fill(FFNVMEVectors *out, int x0, int y0, int w, int h,
+                                const NV_ENC_MVECTOR *mv, int intra)
+{
+    int x, y;
+
+    if (x0 + w > out->width_in_blocks)
+        w = out->width_in_blocks - x0;
+    if (y0 + h > out->height_in_blocks)
+        h = out->height_in_blocks - y0;
+
+    for (y = y0; y < y0 + h; y++) {
+        int off = y * out->width_in_blocks;
+        for (x = x0; x < x0 + w; x++) {
+            out->mvx[off + x] = mv->mvx;
+            out->mvy[off + x] = mv->mvy;
+            if (out->intra)
+                out->intra[off + x] = (uint8_t)intra;
+        }
+    }
+}
+
+/** Scatter H.264 per-macroblock MV data onto the 8x8 grid. */
+static inline void ffnv_me_convert_h264(FFNVMEVectors *out, const NV_ENC_H264_MV_DATA *data,
+                                        int width_in_mbs, int height_in_mbs)
+{
+    int mbx, mby;
+
+    for (mby = 0; mby < height_in_mbs; mby++) {
+        for (mbx = 0; mbx < width_in_mbs; mbx++) {
+            const NV_ENC_H264_MV_DATA *mb = &data[mby * width_in_mbs + mbx];
+            int intra = mb->mbType == 0 || mb->mbType == 2;
+            int x = mbx * 2, y = mby * 2;
+
+            switch (intra ? 0 : mb->partitionType) {
+            case 1: /* 8x8 */
+                ffnv_me_fill(out, x,     y,     1, 1, &mb->mv[0], intra);
+                ffnv_me_fill(out, x + 1, y,     1, 1, &mb->mv[1], intra);
+                ffnv_me_fill(out, x,     y + 1, 1, 1, &mb->mv[2], intra);
+                ffnv_me_fill(out, x + 1, y + 1, 1, 1, &mb->mv[3], intra);
+                break;
+            case 2: /* 16x8 */
+                ffnv_me_fill(out, x, y,     2, 1, &mb->mv[0], intra);
+                ffnv_me_fill(out, x, y + 1, 2, 1, &mb->mv[1], intra);
+                break;
+            case 3: /* 8x16 */
+                ffnv_me_fill(out, x,     y, 1, 2, &mb->mv[0], intra);
+                ffnv_me_fill(out, x + 1, y, 1, 2, &mb->mv[1], intra);
+                break;
+            default:
+                ffnv_me_fill(out, x, y, 2, 2, &mb->mv[0], intra);
+                break;
+            }
+        }
+    }
+}
+
+/* z-order index inside a CTB -> 8x8 block coordinates */
+static inline void ffnv_me_zorder(unsigned z, int *x, int *y)
+{
+    int i;
+
+    *x = *y = 0;
+    for (i = 0; i < 4; i++) {
+        *x |= ((z >> (2 * i))     & 1) << i;
+        *y |= ((z >> (2 * i + 1)) & 1) << i;
+    }
+}
+
+/**
+ * Scatter HEVC per-CU MV data onto the 8x8 grid. CUs come in z-scan order
+ * inside each CTB, with lastCUInCTB marking the end of a CTB. nb_cus is
+ * the number of entries available in data. Asymmetric partitions are
+ * rounded to 8x8 granularity.
+ */
+static inline void ffnv_me_convert_hevc(FFNVMEVectors *out, const NV_ENC_HEVC_MV_DATA *data,
+                                        int nb_cus, int ctb_size)
+{
+    const int ctb_blocks = ctb_size / 8;
+    const int width_in_ctbs = (out->width_in_blocks + ctb_blocks - 1) / ctb_blocks;
+    const int height_in_ctbs = (out->height_in_blocks + ctb_blocks - 1) / ctb_blocks;
+    int ctb = 0, i;
+    unsigned z = 0;
+
+    for (i = 0; i < nb_cus && ctb < width_in_ctbs * height_in_ctbs; i++) {
+        const NV_ENC_HEVC_MV_DATA *cu = &data[i];
+        int n = 1 << cu->cuSize; /* CU size in 8x8 blocks */
+        int intra = cu->cuType == 0;
+        int cx, cy, x, y, h = n / 2;
+
+        ffnv_me_zorder(z, &cx, &cy);
+        x = (ctb % width_in_ctbs) * ctb_blocks + cx;
+        y = (ctb / width_in_ctbs) * ctb_blocks + cy;
+
+        if (intra || n == 1 || cu->partitionMode == 0) {
+            ffnv_me_fill(out, x, y, n, n, &cu->mv[0], intra);
+        } else {
+            switch (cu->partitionMode) {
+            case 1: /* 2NxN */
+            case 4: /* 2NxnU */
+            case 5: /* 2NxnD */
+                if (cu->partitionMode == 4 && n >= 4) h = n / 4;
+                if (cu->partitionMode == 5 && n >= 4) h = n - n / 4;
+                ffnv_me_fill(out, x, y,     n, h,     &cu->mv[0], 0);
+                ffnv_me_fill(out, x, y + h, n, n - h, &cu->mv[1], 0);
+                break;
+            case 2: /* Nx2N */
+            case 6: /* nLx2N */
+            case 7: /* nRx2N */
+                if (cu->partitionMode == 6 && n >= 4) h = n / 4;
+                if (cu->partitionMode == 7 && n >= 4) h = n - n / 4;
+                ffnv_me_fill(out, x,     y, h,     n, &cu->mv[0], 0);
+                ffnv_me_fill(out, x + h, y, n - h, n, &cu->mv[1], 0);
+                break;
+            default: /* NxN */
+                ffnv_me_fill(out, x,     y,     h, h, &cu->mv[0], 0);
+                ffnv_me_fill(out, x + h, y,     h, h, &cu->mv[1], 0);
+                ffnv_me_fill(out, x,     y + h, h, h, &cu->mv[2], 0);
+                ffnv_me_fill(out, x + h, y + h, h, h, &cu->mv[3], 0);
+                break;
+            }
+        }
+
+        z += n * n;
+        if (cu->lastCUInCTB || z >= (unsigned)(ctb_blocks * ctb_blocks)) {
+            z = 0;
+            ctb++;
+        }
+    }
+}
+
+/**
+ * Wait for the oldest queued estimation and convert its vectors into out,
+ * which must cover at least (width + 7) / 8 x (height + 7) / 8 blocks.
+ * The submit tag is returned in tag if it is not NULL.
+ */
+static inline NVENCSTATUS ffnv_me_retrieve(FFNVMESession *s, FFNVMEVectors *out, void **tag)
+{
+    NV_ENC_LOCK_BITSTREAM lock;
+    int slot = s->retrieved % s->depth;
+    NVENCSTATUS ret;
+
+    if (!ffnv_me_session_pending(s))
+        return NV_ENC_ERR_NEED_MORE_INPUT;
+
+    memset(&lock, 0, sizeof(lock));
+    lock.version         = NV_ENC_LOCK_BITSTREAM_VER;
+    lock.outputBitstream = s->mv_buffers[slot];
+
+    if (tag)
+        *tag = s->tags[slot];
+    s->tags[slot] = NULL;
+
+    /* the slot is used up even on failure, or the ring would stall on it */
+    ret = s->nvenc->nvEncLockBitstream(s->encoder, &lock);
+    if (ret != NV_ENC_SUCCESS) {
+        s->retrieved++;
+        return ret;
+    }
+
+    if (s->hevc) {
+        ffnv_me_convert_hevc(out, (const NV_ENC_HEVC_MV_DATA*)lock.bitstreamBufferPtr,
+                             lock.bitstreamSizeInBytes / sizeof(NV_ENC_HEVC_MV_DATA),
+                             s->ctb_size);
+    } else {
+        ffnv_me_convert_h264(out, (const NV_ENC_H264_MV_DATA*)lock.bitstreamBufferPtr,
+                             (s->width + 15) / 16, (s->height + 15) / 16);
+    }
+
+    ret = s->nvenc->nvEncUnlockBitstream(s->encoder, s->mv_buffers[slot]);
+    s->retrieved++;
+    return ret;
+}
+
+typedef struct FFNVMEPair {
+    FFNVMESession *session;
+    NV_ENC_INPUT_PTR input;
+    NV_ENC_INPUT_PTR reference;
+    FFNVMEVectors *vectors; /**< receives the result */
+    NVENCSTATUS status;     /**< [out] */
+} FFNVMEPair;
+
+/**
+ * Run motion estimation for all pairs, which may belong to any number of
+ * sessions. All sessions must be idle on entry. Work for different
+ * sessions overlaps; a session only blocks once its MV buffer ring is
+ * full. Returns the first error encountered,
+ * per-pair status is stored in FFNVMEPair::status.
+ */
+static inline NVENCSTATUS ffnv_me_run_batch(FFNVMEPair *pairs, int nb_pairs)
+{
+    NVENCSTATUS ret = NV_ENC_SUCCESS;
+    int i;
+
+    for (i = 0; i < nb_pairs; i++)
+        pairs[i].status = NV_ENC_ERR_NEED_MORE_INPUT;
+
+    for (i = 0; i < nb_pairs; i++) {
+        FFNVMEPair *p = &pairs[i];
+        FFNVMESession *s = p->session;
+
+        while (ffnv_me_session_full(s)) {
+            FFNVMEPair *done;
+            NVENCSTATUS err;
+
+            done = (FFNVMEPair*)s->tags[s->retrieved % s->depth];
+            err = ffnv_me_retrieve(s, done->vectors, NULL);
+            done->status = err;
+            if (err != NV_ENC_SUCCESS && ret == NV_ENC_SUCCESS)
+                ret = err;
+        }
+
+        p->status = ffnv_me_submit(s, p->input, p->reference, p);
+        if (p->status != NV_ENC_SUCCESS) {
+            if (ret == NV_ENC_SUCCESS)
+                ret = p->status;
+            continue;
+        }
+        /* mark as in flight */
+        p->status = NV_ENC_ERR_ENCODER_BUSY;
+    }
+
+    /* per-session FIFO order matches submission order, the tag names the pair of each slot */
+    for (i = 0; i < nb_pairs; i++) {
+        FFNVMEPair *p = &pairs[i];
+        FFNVMESession *s = p->session;
+
+        while (p->status == NV_ENC_ERR_ENCODER_BUSY && ffnv_me_session_pending(s)) {
+            FFNVMEPair *done = (FFNVMEPair*)s->tags[s->retrieved % s->depth];
+            NVENCSTATUS err = ffnv_me_retrieve(s, done->vectors, NULL);
+
+            done->status = err;
+            if (err != NV_ENC_SUCCESS && ret == NV_ENC_SUCCESS)
+                ret = err;
+        }
+    }
+
+    return ret;
+}
+
+#endif
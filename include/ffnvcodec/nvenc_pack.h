@@ -0,0 +1,1067 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Packing of CPU frames into input buffers locked with
+ * NvEncLockInputBuffer, at the pitch returned in
+ * NV_ENC_LOCK_INPUT_BUFFER.pitch.
+ *
+ * Frames in I420, yuv420p10le or yuv444p go to any of the YUV buffer
+ * formats (NV12, YV12, IYUV, YUV444, YUV420_10BIT, YUV444_10BIT, AYUV),
+ * converting depth and chroma subsampling as needed. BGRA frames go to
+ * the RGB ones (ARGB, ABGR, ARGB10, ABGR10); there is no conversion
+ * between YUV and RGB, which the encoder does itself.
+ *
+ * Planes are copied, interleaved, shifted, swizzled or have their chroma
+ * doubled (4:2:0 to 4:4:4) by AVX2 or NEON kernels, the x86 ones writing
+ * the buffer with non-temporal stores as the CPU does not read it back.
+ * The rare remaining cases (4:4:4 to 4:2:0, 10 bit to AYUV or to 8 bit
+ * interleaved chroma) go through ffnv_pack_row_generic(), which is also
+ * the reference the kernels match. Rows are spread over the threads of
+ * an FFNVConvert. 16 bit source samples need not be aligned (planes of a
+ * Y4M file that is mapped in memory), so they are read as bytes.
+ */
+
+#ifndef FFNV_NVENC_PACK_H
+#define FFNV_NVENC_PACK_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "nvEncodeAPI.h"
+#include "ffnv_convert.h"
+
+#define FFNV_PACK_YUV420P   0  /**< 8 bit planar 4:2:0 (I420) */
+#define FFNV_PACK_YUV420P10 1  /**< 10 bit planar 4:2:0, little-endian, low bits (yuv420p10le) */
+#define FFNV_PACK_YUV444P   2  /**< 8 bit planar 4:4:4 */
+#define FFNV_PACK_BGRA      3  /**< packed B, G, R, A bytes */
+
+/* row kernels */
+#define FFNV_PACK_GENERIC   0
+#define FFNV_PACK_COPY      1  /* n bytes */
+#define FFNV_PACK_SHL8_16   2  /* n samples, 8 bit to 16 bit << arg */
+#define FFNV_PACK_SHL16     3  /* n samples, 16 bit << arg */
+#define FFNV_PACK_NARROW    4  /* n samples, 16 bit >> arg to 8 bit */
+#define FFNV_PACK_MERGE8    5  /* n pairs */
+#define FFNV_PACK_MERGE16   6  /* n pairs, 16 bit << arg */
+#define FFNV_PACK_MERGE8_16 7  /* n pairs, 8 bit to 16 bit << arg */
+#define FFNV_PACK_SWAP_RB   8  /* n pixels */
+#define FFNV_PACK_RGB10     9  /* n pixels, arg set for ABGR10 */
+#define FFNV_PACK_AYUV      10 /* n pixels from Y, U, V */
+#define FFNV_PACK_DUP8      11 /* n samples from n / 2, 4:2:0 to 4:4:4 chroma */
+#define FFNV_PACK_DUP8_16   12 /* same, 8 bit to 16 bit << arg */
+#define FFNV_PACK_DUP16     13 /* same, 16 bit << arg */
+#define FFNV_PACK_NB_KERNELS 14
+
+typedef void (*FFNVPackKernel)(const uint8_t * const *src, uint8_t *dst, int n, int arg);
+
+/* Source sample i of a 16 bit row, which may be unaligned. */
+static inline uint16_t ffnv_pack_rd16(const uint8_t *row, int i)
+{
+    uint16_t v;
+
+    memcpy(&v, row + 2 * (size_t)i, sizeof(v));
+    return v;
+}
+
+static inline void ffnv_pack_copy_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    (void)arg;
+    memcpy(dst, src[0], n);
+}
+
+static inline void ffnv_pack_shl8_16_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    uint16_t *d = (uint16_t*)dst;
+    int i;
+
+    for (i = 0; i < n; i++)
+        d[i] = (uint16_t)(src[0][i] << arg);
+}
+
+static inline void ffnv_pack_shl16_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    uint16_t *d = (uint16_t*)dst;
+    int i;
+
+    for (i = 0; i < n; i++)
+        d[i] = (uint16_t)(ffnv_pack_rd16(src[0], i) << arg);
+}
+
+static inline void ffnv_pack_narrow_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = (uint8_t)(ffnv_pack_rd16(src[0], i) >> arg);
+}
+
+static inline void ffnv_pack_merge8_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    int i;
+
+    (void)arg;
+    for (i = 0; i < n; i++) {
+        dst[2 * i]     = src[0][i];
+        dst[2 * i + 1] = src[1][i];
+    }
+}
+
+static inline void ffnv_pack_merge16_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    uint16_t *d = (uint16_t*)dst;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        d[2 * i]     = (uint16_t)(ffnv_pack_rd16(src[0], i) << arg);
+        d[2 * i + 1] = (uint16_t)(ffnv_pack_rd16(src[1], i) << arg);
+    }
+}
+
+static inline void ffnv_pack_merge8_16_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    uint16_t *d = (uint16_t*)dst;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        d[2 * i]     = (uint16_t)(src[0][i] << arg);
+        d[2 * i + 1] = (uint16_t)(src[1][i] << arg);
+    }
+}
+
+static inline void ffnv_pack_swap_rb_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const uint8_t *s = src[0];
+    int i;
+
+    (void)arg;
+    for (i = 0; i < n; i++) {
+        dst[4 * i]     = s[4 * i + 2];
+        dst[4 * i + 1] = s[4 * i + 1];
+        dst[4 * i + 2] = s[4 * i];
+        dst[4 * i + 3] = s[4 * i + 3];
+    }
+}
+
+/* 8 to 10 bit, replicating the high bits */
+static inline uint32_t ffnv_pack_rgb10_word(const uint8_t *bgra, int abgr)
+{
+    uint32_t b = bgra[0], g = bgra[1], r = bgra[2], a = bgra[3];
+    uint32_t lo, hi;
+
+    b  = b << 2 | b >> 6;
+    g  = g << 2 | g >> 6;
+    r  = r << 2 | r >> 6;
+    lo = abgr ? r : b;
+    hi = abgr ? b : r;
+    return (a >> 6) << 30 | hi << 20 | g << 10 | lo;
+}
+
+static inline void ffnv_pack_rgb10_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t w = ffnv_pack_rgb10_word(src[0] + 4 * i, arg);
+        memcpy(dst + 4 * i, &w, 4);
+    }
+}
+
+static inline void ffnv_pack_ayuv_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    int i;
+
+    (void)arg;
+    for (i = 0; i < n; i++) {
+        dst[4 * i]     = src[2][i];
+        dst[4 * i + 1] = src[1][i];
+        dst[4 * i + 2] = src[0][i];
+        dst[4 * i + 3] = 255;
+    }
+}
+
+static inline void ffnv_pack_dup8_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    int i;
+
+    (void)arg;
+    for (i = 0; i < n; i++)
+        dst[i] = src[0][i >> 1];
+}
+
+static inline void ffnv_pack_dup8_16_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    uint16_t *d = (uint16_t*)dst;
+    int i;
+
+    for (i = 0; i < n; i++)
+        d[i] = (uint16_t)(src[0][i >> 1] << arg);
+}
+
+static inline void ffnv_pack_dup16_c(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    uint16_t *d = (uint16_t*)dst;
+    int i;
+
+    for (i = 0; i < n; i++)
+        d[i] = (uint16_t)(ffnv_pack_rd16(src[0], i >> 1) << arg);
+}
+
+/* Advance the row pointers of a kernel by done elements, for the C tail. */
+static inline void ffnv_pack_advance(const uint8_t **s, const uint8_t * const *src, int kernel, int done)
+{
+    /* source bytes per element, halved for the doubling kernels */
+    static const uint8_t src_size[FFNV_PACK_NB_KERNELS] = { 0, 2, 2, 4, 4, 2, 4, 2, 8, 8, 2, 1, 1, 2 };
+    int i;
+
+    for (i = 0; i < 3; i++)
+        s[i] = src[i] ? src[i] + (size_t)done * src_size[kernel] / 2 : NULL;
+}
+
+#if defined(FFNV_CONVERT_X86)
+static inline FFNV_TARGET_AVX2 void ffnv_pack_store_avx2(uint8_t *p, __m256i x, int nt)
+{
+    if (nt)
+        _mm256_stream_si256((__m256i*)p, x);
+    else
+        _mm256_storeu_si256((__m256i*)p, x);
+}
+
+#define FFNV_PACK_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define FFNV_PACK_LOAD128(p) _mm_loadu_si128((const __m128i*)(p))
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_copy_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 64 <= n; i += 64) {
+        ffnv_pack_store_avx2(dst + i,      FFNV_PACK_LOAD(src[0] + i), nt);
+        ffnv_pack_store_avx2(dst + i + 32, FFNV_PACK_LOAD(src[0] + i + 32), nt);
+    }
+    memcpy(dst + i, src[0] + i, n - i);
+    (void)arg;
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_shl8_16_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m128i sh = _mm_cvtsi32_si128(arg);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m128i x0 = FFNV_PACK_LOAD128(src[0] + i), x1 = FFNV_PACK_LOAD128(src[0] + i + 16);
+
+        ffnv_pack_store_avx2(dst + 2 * i,      _mm256_sll_epi16(_mm256_cvtepu8_epi16(x0), sh), nt);
+        ffnv_pack_store_avx2(dst + 2 * i + 32, _mm256_sll_epi16(_mm256_cvtepu8_epi16(x1), sh), nt);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_SHL8_16, i);
+    ffnv_pack_shl8_16_c(s, dst + 2 * i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_shl16_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m128i sh = _mm_cvtsi32_si128(arg);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        ffnv_pack_store_avx2(dst + 2 * i,      _mm256_sll_epi16(FFNV_PACK_LOAD(src[0] + 2 * i), sh), nt);
+        ffnv_pack_store_avx2(dst + 2 * i + 32, _mm256_sll_epi16(FFNV_PACK_LOAD(src[0] + 2 * i + 32), sh), nt);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_SHL16, i);
+    ffnv_pack_shl16_c(s, dst + 2 * i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_narrow_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m128i sh = _mm_cvtsi32_si128(arg);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_srl_epi16(FFNV_PACK_LOAD(src[0] + 2 * i), sh);
+        __m256i b = _mm256_srl_epi16(FFNV_PACK_LOAD(src[0] + 2 * i + 32), sh);
+
+        ffnv_pack_store_avx2(dst + i, _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8), nt);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_NARROW, i);
+    ffnv_pack_narrow_c(s, dst + i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_merge8_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i u = FFNV_PACK_LOAD(src[0] + i), v = FFNV_PACK_LOAD(src[1] + i);
+        __m256i lo = _mm256_unpacklo_epi8(u, v), hi = _mm256_unpackhi_epi8(u, v);
+
+        ffnv_pack_store_avx2(dst + 2 * i,      _mm256_permute2x128_si256(lo, hi, 0x20), nt);
+        ffnv_pack_store_avx2(dst + 2 * i + 32, _mm256_permute2x128_si256(lo, hi, 0x31), nt);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_MERGE8, i);
+    ffnv_pack_merge8_c(s, dst + 2 * i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_merge16_store_avx2(uint8_t *dst, __m256i u, __m256i v, int nt)
+{
+    __m256i lo = _mm256_unpacklo_epi16(u, v), hi = _mm256_unpackhi_epi16(u, v);
+
+    ffnv_pack_store_avx2(dst,      _mm256_permute2x128_si256(lo, hi, 0x20), nt);
+    ffnv_pack_store_avx2(dst + 32, _mm256_permute2x128_si256(lo, hi, 0x31), nt);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_merge16_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m128i sh = _mm_cvtsi32_si128(arg);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+        ffnv_pack_merge16_store_avx2(dst + 4 * i, _mm256_sll_epi16(FFNV_PACK_LOAD(src[0] + 2 * i), sh),
+                                     _mm256_sll_epi16(FFNV_PACK_LOAD(src[1] + 2 * i), sh), nt);
+    ffnv_pack_advance(s, src, FFNV_PACK_MERGE16, i);
+    ffnv_pack_merge16_c(s, dst + 4 * i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_merge8_16_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m128i sh = _mm_cvtsi32_si128(arg);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+        ffnv_pack_merge16_store_avx2(dst + 4 * i,
+                                     _mm256_sll_epi16(_mm256_cvtepu8_epi16(FFNV_PACK_LOAD128(src[0] + i)), sh),
+                                     _mm256_sll_epi16(_mm256_cvtepu8_epi16(FFNV_PACK_LOAD128(src[1] + i)), sh), nt);
+    ffnv_pack_advance(s, src, FFNV_PACK_MERGE8_16, i);
+    ffnv_pack_merge8_16_c(s, dst + 4 * i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_swap_rb_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m256i order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                           2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        ffnv_pack_store_avx2(dst + 4 * i,      _mm256_shuffle_epi8(FFNV_PACK_LOAD(src[0] + 4 * i), order), nt);
+        ffnv_pack_store_avx2(dst + 4 * i + 32, _mm256_shuffle_epi8(FFNV_PACK_LOAD(src[0] + 4 * i + 32), order), nt);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_SWAP_RB, i);
+    ffnv_pack_swap_rb_c(s, dst + 4 * i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_rgb10_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m256i ff = _mm256_set1_epi32(0xff);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i x = FFNV_PACK_LOAD(src[0] + 4 * i);
+        __m256i b = _mm256_and_si256(x, ff);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(x, 8), ff);
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(x, 16), ff);
+        __m256i a = _mm256_slli_epi32(_mm256_srli_epi32(x, 30), 30);
+        __m256i lo, hi;
+
+        b  = _mm256_or_si256(_mm256_slli_epi32(b, 2), _mm256_srli_epi32(b, 6));
+        g  = _mm256_or_si256(_mm256_slli_epi32(g, 2), _mm256_srli_epi32(g, 6));
+        r  = _mm256_or_si256(_mm256_slli_epi32(r, 2), _mm256_srli_epi32(r, 6));
+        lo = arg ? r : b;
+        hi = arg ? b : r;
+        x  = _mm256_or_si256(_mm256_or_si256(a, _mm256_slli_epi32(hi, 20)),
+                             _mm256_or_si256(_mm256_slli_epi32(g, 10), lo));
+        ffnv_pack_store_avx2(dst + 4 * i, x, nt);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_RGB10, i);
+    ffnv_pack_rgb10_c(s, dst + 4 * i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_ayuv_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m128i alpha = _mm_set1_epi8(-1);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i y = FFNV_PACK_LOAD128(src[0] + i);
+        __m128i u = FFNV_PACK_LOAD128(src[1] + i);
+        __m128i v = FFNV_PACK_LOAD128(src[2] + i);
+        __m128i vu0 = _mm_unpacklo_epi8(v, u), vu1 = _mm_unpackhi_epi8(v, u);
+        __m128i ya0 = _mm_unpacklo_epi8(y, alpha), ya1 = _mm_unpackhi_epi8(y, alpha);
+        __m256i p0 = _mm256_castsi128_si256(_mm_unpacklo_epi16(vu0, ya0));
+        __m256i p1 = _mm256_castsi128_si256(_mm_unpacklo_epi16(vu1, ya1));
+
+        p0 = _mm256_inserti128_si256(p0, _mm_unpackhi_epi16(vu0, ya0), 1);
+        p1 = _mm256_inserti128_si256(p1, _mm_unpackhi_epi16(vu1, ya1), 1);
+        ffnv_pack_store_avx2(dst + 4 * i,      p0, nt);
+        ffnv_pack_store_avx2(dst + 4 * i + 32, p1, nt);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_AYUV, i);
+    ffnv_pack_ayuv_c(s, dst + 4 * i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_dup8_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 64 <= n; i += 64) {
+        __m256i x = FFNV_PACK_LOAD(src[0] + i / 2);
+        __m256i lo = _mm256_unpacklo_epi8(x, x), hi = _mm256_unpackhi_epi8(x, x);
+
+        ffnv_pack_store_avx2(dst + i,      _mm256_permute2x128_si256(lo, hi, 0x20), nt);
+        ffnv_pack_store_avx2(dst + i + 32, _mm256_permute2x128_si256(lo, hi, 0x31), nt);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_DUP8, i);
+    ffnv_pack_dup8_c(s, dst + i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_dup16_store_avx2(uint8_t *dst, __m256i x, int nt)
+{
+    __m256i lo = _mm256_unpacklo_epi16(x, x), hi = _mm256_unpackhi_epi16(x, x);
+
+    ffnv_pack_store_avx2(dst,      _mm256_permute2x128_si256(lo, hi, 0x20), nt);
+    ffnv_pack_store_avx2(dst + 32, _mm256_permute2x128_si256(lo, hi, 0x31), nt);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_dup8_16_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m128i sh = _mm_cvtsi32_si128(arg);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+        ffnv_pack_dup16_store_avx2(dst + 2 * i,
+                                   _mm256_sll_epi16(_mm256_cvtepu8_epi16(FFNV_PACK_LOAD128(src[0] + i / 2)), sh), nt);
+    ffnv_pack_advance(s, src, FFNV_PACK_DUP8_16, i);
+    ffnv_pack_dup8_16_c(s, dst + 2 * i, n - i, arg);
+}
+
+static inline FFNV_TARGET_AVX2 void ffnv_pack_dup16_avx2(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const __m128i sh = _mm_cvtsi32_si128(arg);
+    const uint8_t *s[3];
+    int nt = !((uintptr_t)dst & 31), i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+        ffnv_pack_dup16_store_avx2(dst + 2 * i, _mm256_sll_epi16(FFNV_PACK_LOAD(src[0] + i), sh), nt);
+    ffnv_pack_advance(s, src, FFNV_PACK_DUP16, i);
+    ffnv_pack_dup16_c(s, dst + 2 * i, n - i, arg);
+}
+
+#undef FFNV_PACK_LOAD
+#undef FFNV_PACK_LOAD128
+#endif
+
+#if defined(FFNV_CONVERT_NEON)
+/* byte loads, as vld1q_u16 may assume aligned samples */
+#define FFNV_PACK_LOAD16(p) vreinterpretq_u16_u8(vld1q_u8(p))
+
+static inline void ffnv_pack_shl8_16_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const int16x8_t sh = vdupq_n_s16((int16_t)arg);
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        vst1q_u16((uint16_t*)dst + i, vshlq_u16(vmovl_u8(vld1_u8(src[0] + i)), sh));
+    ffnv_pack_advance(s, src, FFNV_PACK_SHL8_16, i);
+    ffnv_pack_shl8_16_c(s, dst + 2 * i, n - i, arg);
+}
+
+static inline void ffnv_pack_shl16_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const int16x8_t sh = vdupq_n_s16((int16_t)arg);
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        vst1q_u16((uint16_t*)dst + i, vshlq_u16(FFNV_PACK_LOAD16(src[0] + 2 * i), sh));
+    ffnv_pack_advance(s, src, FFNV_PACK_SHL16, i);
+    ffnv_pack_shl16_c(s, dst + 2 * i, n - i, arg);
+}
+
+static inline void ffnv_pack_narrow_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const int16x8_t sh = vdupq_n_s16((int16_t)-arg);
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+        vst1_u8(dst + i, vmovn_u16(vshlq_u16(FFNV_PACK_LOAD16(src[0] + 2 * i), sh)));
+    ffnv_pack_advance(s, src, FFNV_PACK_NARROW, i);
+    ffnv_pack_narrow_c(s, dst + i, n - i, arg);
+}
+
+static inline void ffnv_pack_merge8_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x2_t x;
+
+        x.val[0] = vld1q_u8(src[0] + i);
+        x.val[1] = vld1q_u8(src[1] + i);
+        vst2q_u8(dst + 2 * i, x);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_MERGE8, i);
+    ffnv_pack_merge8_c(s, dst + 2 * i, n - i, arg);
+}
+
+static inline void ffnv_pack_merge16_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const int16x8_t sh = vdupq_n_s16((int16_t)arg);
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        uint16x8x2_t x;
+
+        x.val[0] = vshlq_u16(FFNV_PACK_LOAD16(src[0] + 2 * i), sh);
+        x.val[1] = vshlq_u16(FFNV_PACK_LOAD16(src[1] + 2 * i), sh);
+        vst2q_u16((uint16_t*)dst + 2 * i, x);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_MERGE16, i);
+    ffnv_pack_merge16_c(s, dst + 4 * i, n - i, arg);
+}
+
+static inline void ffnv_pack_merge8_16_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const int16x8_t sh = vdupq_n_s16((int16_t)arg);
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        uint16x8x2_t x;
+
+        x.val[0] = vshlq_u16(vmovl_u8(vld1_u8(src[0] + i)), sh);
+        x.val[1] = vshlq_u16(vmovl_u8(vld1_u8(src[1] + i)), sh);
+        vst2q_u16((uint16_t*)dst + 2 * i, x);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_MERGE8_16, i);
+    ffnv_pack_merge8_16_c(s, dst + 4 * i, n - i, arg);
+}
+
+static inline void ffnv_pack_swap_rb_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x4_t x = vld4q_u8(src[0] + 4 * i);
+        uint8x16_t t = x.val[0];
+
+        x.val[0] = x.val[2];
+        x.val[2] = t;
+        vst4q_u8(dst + 4 * i, x);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_SWAP_RB, i);
+    ffnv_pack_swap_rb_c(s, dst + 4 * i, n - i, arg);
+}
+
+static inline void ffnv_pack_ayuv_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16x4_t x;
+
+        x.val[0] = vld1q_u8(src[2] + i);
+        x.val[1] = vld1q_u8(src[1] + i);
+        x.val[2] = vld1q_u8(src[0] + i);
+        x.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst + 4 * i, x);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_AYUV, i);
+    ffnv_pack_ayuv_c(s, dst + 4 * i, n - i, arg);
+}
+static inline void ffnv_pack_dup8_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        uint8x16x2_t x = vzipq_u8(vld1q_u8(src[0] + i / 2), vld1q_u8(src[0] + i / 2));
+
+        vst1q_u8(dst + i,      x.val[0]);
+        vst1q_u8(dst + i + 16, x.val[1]);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_DUP8, i);
+    ffnv_pack_dup8_c(s, dst + i, n - i, arg);
+}
+
+static inline void ffnv_pack_dup8_16_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const int16x8_t sh = vdupq_n_s16((int16_t)arg);
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint16x8_t x = vshlq_u16(vmovl_u8(vld1_u8(src[0] + i / 2)), sh);
+        uint16x8x2_t z = vzipq_u16(x, x);
+
+        vst1q_u16((uint16_t*)dst + i,     z.val[0]);
+        vst1q_u16((uint16_t*)dst + i + 8, z.val[1]);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_DUP8_16, i);
+    ffnv_pack_dup8_16_c(s, dst + 2 * i, n - i, arg);
+}
+
+static inline void ffnv_pack_dup16_neon(const uint8_t * const *src, uint8_t *dst, int n, int arg)
+{
+    const int16x8_t sh = vdupq_n_s16((int16_t)arg);
+    const uint8_t *s[3];
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint16x8_t x = vshlq_u16(FFNV_PACK_LOAD16(src[0] + i), sh);
+        uint16x8x2_t z = vzipq_u16(x, x);
+
+        vst1q_u16((uint16_t*)dst + i,     z.val[0]);
+        vst1q_u16((uint16_t*)dst + i + 8, z.val[1]);
+    }
+    ffnv_pack_advance(s, src, FFNV_PACK_DUP16, i);
+    ffnv_pack_dup16_c(s, dst + 2 * i, n - i, arg);
+}
+
+#undef FFNV_PACK_LOAD16
+#endif
+
+typedef struct FFNVPackPlane {
+    uint8_t *dst;
+    int pitch;
+    int width, height;     /* in samples */
+    int chroma;            /* 1 for U (or interleaved UV), 2 for V */
+    int kernel;
+    int n, arg;
+    int src_plane[3];      /* source planes of the kernel */
+    int src_vshift;        /* source row of row y is y >> src_vshift */
+} FFNVPackPlane;
+
+typedef struct FFNVPackJob {
+    FFNVPlanes src;
+    int src_format;
+    NV_ENC_BUFFER_FORMAT format;
+    int width, height;
+    FFNVPackPlane planes[3];
+    int nb_planes;
+    FFNVPackKernel kernels[FFNV_PACK_NB_KERNELS];
+    int nt;                /* kernels may use non-temporal stores */
+} FFNVPackJob;
+
+static inline int ffnv_pack_is_rgb(NV_ENC_BUFFER_FORMAT format)
+{
+    return format == NV_ENC_BUFFER_FORMAT_ARGB   || format == NV_ENC_BUFFER_FORMAT_ABGR ||
+           format == NV_ENC_BUFFER_FORMAT_ARGB10 || format == NV_ENC_BUFFER_FORMAT_ABGR10;
+}
+
+static inline int ffnv_pack_is_yuv(NV_ENC_BUFFER_FORMAT format)
+{
+    return format == NV_ENC_BUFFER_FORMAT_NV12 || format == NV_ENC_BUFFER_FORMAT_YV12 ||
+           format == NV_ENC_BUFFER_FORMAT_IYUV || format == NV_ENC_BUFFER_FORMAT_YUV444 ||
+           format == NV_ENC_BUFFER_FORMAT_YUV420_10BIT || format == NV_ENC_BUFFER_FORMAT_YUV444_10BIT ||
+           format == NV_ENC_BUFFER_FORMAT_AYUV;
+}
+
+/** Whether frames of src_format can be packed into buffers of format. */
+static inline int ffnv_pack_supported(int src_format, NV_ENC_BUFFER_FORMAT format)
+{
+    if (src_format == FFNV_PACK_BGRA)
+        return ffnv_pack_is_rgb(format);
+    return src_format >= FFNV_PACK_YUV420P && src_format <= FFNV_PACK_YUV444P && ffnv_pack_is_yuv(format);
+}
+
+/* Source sample of plane p (0 Y, 1 U, 2 V) at (x, y) of a destination plane of that chroma subsampling. */
+static inline unsigned ffnv_pack_fetch(const FFNVPackJob *j, int p, int x, int y, int dst_sub)
+{
+    const FFNVPlanes *s = &j->src;
+    int src_sub = p && j->src_format != FFNV_PACK_YUV444P;
+    int wide = j->src_format == FFNV_PACK_YUV420P10;
+    int sw = src_sub ? (j->width + 1) >> 1 : j->width;
+    int sh = src_sub ? (j->height + 1) >> 1 : j->height;
+    unsigned sum = 0;
+    int xs[2], ys[2], a, b;
+
+    if (src_sub == dst_sub) {
+        xs[0] = xs[1] = x;
+        ys[0] = ys[1] = y;
+    } else if (src_sub) {
+        xs[0] = xs[1] = x >> 1;
+        ys[0] = ys[1] = y >> 1;
+    } else {
+        /* 4:4:4 to 4:2:0, mean of the 2x2 block */
+        xs[0] = 2 * x;
+        ys[0] = 2 * y;
+        xs[1] = xs[0] + 1 < sw ? xs[0] + 1 : xs[0];
+        ys[1] = ys[0] + 1 < sh ? ys[0] + 1 : ys[0];
+    }
+
+    for (a = 0; a < 2; a++) {
+        const uint8_t *row = s->data[p] + (size_t)ys[a] * s->pitch[p];
+
+        for (b = 0; b < 2; b++)
+            sum += wide ? ffnv_pack_rd16(row, xs[b]) : row[xs[b]];
+    }
+    return (sum + 2) >> 2;
+}
+
+/** Reference packing of row y of destination plane p, for any supported formats. */
+static inline void ffnv_pack_row_generic(const FFNVPackJob *j, int p, int y)
+{
+    const FFNVPackPlane *pl = &j->planes[p];
+    uint8_t *row = pl->dst + (size_t)y * pl->pitch;
+    NV_ENC_BUFFER_FORMAT f = j->format;
+    int dst16 = f == NV_ENC_BUFFER_FORMAT_YUV420_10BIT || f == NV_ENC_BUFFER_FORMAT_YUV444_10BIT;
+    int dst_sub = pl->chroma && f != NV_ENC_BUFFER_FORMAT_YUV444 && f != NV_ENC_BUFFER_FORMAT_YUV444_10BIT;
+    int inter = pl->chroma == 1 && (f == NV_ENC_BUFFER_FORMAT_NV12 || f == NV_ENC_BUFFER_FORMAT_YUV420_10BIT);
+    int wide = j->src_format == FFNV_PACK_YUV420P10;
+    int x;
+
+    if (ffnv_pack_is_rgb(f)) {
+        const uint8_t *s = j->src.data[0] + (size_t)y * j->src.pitch[0];
+
+        for (x = 0; x < pl->width; x++) {
+            const uint8_t *px = s + 4 * x;
+            uint32_t w;
+
+            if (f == NV_ENC_BUFFER_FORMAT_ARGB10 || f == NV_ENC_BUFFER_FORMAT_ABGR10) {
+                w = ffnv_pack_rgb10_word(px, f == NV_ENC_BUFFER_FORMAT_ABGR10);
+            } else {
+                uint32_t r = px[2], b = px[0];
+
+                if (f == NV_ENC_BUFFER_FORMAT_ABGR) {
+                    r = px[0];
+                    b = px[2];
+                }
+                w = (uint32_t)px[3] << 24 | r << 16 | (uint32_t)px[1] << 8 | b;
+            }
+            row[4 * x]     = (uint8_t)w;
+            row[4 * x + 1] = (uint8_t)(w >> 8);
+            row[4 * x + 2] = (uint8_t)(w >> 16);
+            row[4 * x + 3] = (uint8_t)(w >> 24);
+        }
+        return;
+    }
+
+    for (x = 0; x < pl->width; x++) {
+        unsigned v[3];
+        int c;
+
+        if (f == NV_ENC_BUFFER_FORMAT_AYUV) {
+            for (c = 0; c < 3; c++)
+                v[c] = ffnv_pack_fetch(j, c, x, y, 0) >> (wide ? 2 : 0);
+            row[4 * x]     = (uint8_t)v[2];
+            row[4 * x + 1] = (uint8_t)v[1];
+            row[4 * x + 2] = (uint8_t)v[0];
+            row[4 * x + 3] = 255;
+            continue;
+        }
+
+        /* interleaved planes carry U and V, the others one component */
+        for (c = 0; c < 1 + inter; c++) {
+            int comp = pl->chroma ? pl->chroma + c : 0;
+            unsigned s = ffnv_pack_fetch(j, comp, x, y, dst_sub);
+            int i = inter ? 2 * x + c : x;
+
+            if (dst16)
+                ((uint16_t*)row)[i] = (uint16_t)(s << (wide ? 6 : 8));
+            else
+                row[i] = (uint8_t)(wide ? s >> 2 : s);
+        }
+    }
+}
+
+/* Kernel packing plane p, if it needs no resampling. */
+static inline void ffnv_pack_pick_kernel(FFNVPackJob *j, FFNVPackPlane *pl)
+{
+    NV_ENC_BUFFER_FORMAT f = j->format;
+    int src8 = j->src_format != FFNV_PACK_YUV420P10;
+    int dst16 = f == NV_ENC_BUFFER_FORMAT_YUV420_10BIT || f == NV_ENC_BUFFER_FORMAT_YUV444_10BIT;
+    int src444 = j->src_format == FFNV_PACK_YUV444P;
+    int dst444 = f == NV_ENC_BUFFER_FORMAT_YUV444 || f == NV_ENC_BUFFER_FORMAT_YUV444_10BIT ||
+                 f == NV_ENC_BUFFER_FORMAT_AYUV;
+
+    pl->kernel = FFNV_PACK_GENERIC;
+    pl->n      = pl->width;
+    pl->src_plane[0] = pl->src_plane[1] = pl->src_plane[2] = -1;
+
+    switch (f) {
+    case NV_ENC_BUFFER_FORMAT_ARGB:
+        pl->kernel = FFNV_PACK_COPY;
+        pl->n      = 4 * pl->width;
+        break;
+    case NV_ENC_BUFFER_FORMAT_ABGR:
+        pl->kernel = FFNV_PACK_SWAP_RB;
+        break;
+    case NV_ENC_BUFFER_FORMAT_ARGB10:
+    case NV_ENC_BUFFER_FORMAT_ABGR10:
+        pl->kernel = FFNV_PACK_RGB10;
+        pl->arg    = f == NV_ENC_BUFFER_FORMAT_ABGR10;
+        break;
+    default:
+        break;
+    }
+    if (pl->kernel != FFNV_PACK_GENERIC) {
+        pl->src_plane[0] = 0;
+        return;
+    }
+
+    if (pl->chroma && src444 != dst444) {
+        /* 4:2:0 to 4:4:4 doubles the samples, 4:4:4 to 4:2:0 averages them in the generic path */
+        if (src444 || (!src8 && !dst16))
+            return;
+        pl->src_plane[0] = pl->chroma;
+        pl->src_vshift   = 1;
+        pl->kernel       = !src8 ? FFNV_PACK_DUP16 : dst16 ? FFNV_PACK_DUP8_16 : FFNV_PACK_DUP8;
+        pl->arg          = !src8 ? 6 : dst16 ? 8 : 0;
+        return;
+    }
+
+    if (f == NV_ENC_BUFFER_FORMAT_AYUV) {
+        if (src8 && src444) {
+            pl->kernel = FFNV_PACK_AYUV;
+            pl->src_plane[0] = 0;
+            pl->src_plane[1] = 1;
+            pl->src_plane[2] = 2;
+        }
+        return;
+    }
+
+    if (pl->chroma == 1 && (f == NV_ENC_BUFFER_FORMAT_NV12 || f == NV_ENC_BUFFER_FORMAT_YUV420_10BIT)) {
+        if (src8 == !dst16)
+            pl->kernel = src8 ? FFNV_PACK_MERGE8 : FFNV_PACK_MERGE16;
+        else if (src8)
+            pl->kernel = FFNV_PACK_MERGE8_16;
+        else
+            return;  /* 10 to 8 bit interleave */
+        pl->arg = src8 ? 8 : 6;
+        pl->src_plane[0] = 1;
+        pl->src_plane[1] = 2;
+        return;
+    }
+
+    pl->src_plane[0] = pl->chroma;
+    if (src8 && !dst16) {
+        pl->kernel = FFNV_PACK_COPY;
+    } else if (src8) {
+        pl->kernel = FFNV_PACK_SHL8_16;
+        pl->arg    = 8;
+    } else if (dst16) {
+        pl->kernel = FFNV_PACK_SHL16;
+        pl->arg    = 6;
+    } else {
+        pl->kernel = FFNV_PACK_NARROW;
+        pl->arg    = 2;
+    }
+}
+
+static inline void ffnv_pack_setup(FFNVConvert *c, FFNVPackJob *j)
+{
+    FFNVPackKernel *k = j->kernels;
+
+    k[FFNV_PACK_COPY]      = ffnv_pack_copy_c;
+    k[FFNV_PACK_SHL8_16]   = ffnv_pack_shl8_16_c;
+    k[FFNV_PACK_SHL16]     = ffnv_pack_shl16_c;
+    k[FFNV_PACK_NARROW]    = ffnv_pack_narrow_c;
+    k[FFNV_PACK_MERGE8]    = ffnv_pack_merge8_c;
+    k[FFNV_PACK_MERGE16]   = ffnv_pack_merge16_c;
+    k[FFNV_PACK_MERGE8_16] = ffnv_pack_merge8_16_c;
+    k[FFNV_PACK_SWAP_RB]   = ffnv_pack_swap_rb_c;
+    k[FFNV_PACK_RGB10]     = ffnv_pack_rgb10_c;
+    k[FFNV_PACK_AYUV]      = ffnv_pack_ayuv_c;
+    k[FFNV_PACK_DUP8]      = ffnv_pack_dup8_c;
+    k[FFNV_PACK_DUP8_16]   = ffnv_pack_dup8_16_c;
+    k[FFNV_PACK_DUP16]     = ffnv_pack_dup16_c;
+#if defined(FFNV_CONVERT_X86)
+    if (c->cpu_flags & FFNV_CPU_AVX2) {
+        k[FFNV_PACK_COPY]      = ffnv_pack_copy_avx2;
+        k[FFNV_PACK_SHL8_16]   = ffnv_pack_shl8_16_avx2;
+        k[FFNV_PACK_SHL16]     = ffnv_pack_shl16_avx2;
+        k[FFNV_PACK_NARROW]    = ffnv_pack_narrow_avx2;
+        k[FFNV_PACK_MERGE8]    = ffnv_pack_merge8_avx2;
+        k[FFNV_PACK_MERGE16]   = ffnv_pack_merge16_avx2;
+        k[FFNV_PACK_MERGE8_16] = ffnv_pack_merge8_16_avx2;
+        k[FFNV_PACK_SWAP_RB]   = ffnv_pack_swap_rb_avx2;
+        k[FFNV_PACK_RGB10]     = ffnv_pack_rgb10_avx2;
+        k[FFNV_PACK_AYUV]      = ffnv_pack_ayuv_avx2;
+        k[FFNV_PACK_DUP8]      = ffnv_pack_dup8_avx2;
+        k[FFNV_PACK_DUP8_16]   = ffnv_pack_dup8_16_avx2;
+        k[FFNV_PACK_DUP16]     = ffnv_pack_dup16_avx2;
+        j->nt = 1;
+    }
+#elif defined(FFNV_CONVERT_NEON)
+    if (c->cpu_flags & FFNV_CPU_NEON) {
+        k[FFNV_PACK_SHL8_16]   = ffnv_pack_shl8_16_neon;
+        k[FFNV_PACK_SHL16]     = ffnv_pack_shl16_neon;
+        k[FFNV_PACK_NARROW]    = ffnv_pack_narrow_neon;
+        k[FFNV_PACK_MERGE8]    = ffnv_pack_merge8_neon;
+        k[FFNV_PACK_MERGE16]   = ffnv_pack_merge16_neon;
+        k[FFNV_PACK_MERGE8_16] = ffnv_pack_merge8_16_neon;
+        k[FFNV_PACK_SWAP_RB]   = ffnv_pack_swap_rb_neon;
+        k[FFNV_PACK_AYUV]      = ffnv_pack_ayuv_neon;
+        k[FFNV_PACK_DUP8]      = ffnv_pack_dup8_neon;
+        k[FFNV_PACK_DUP8_16]   = ffnv_pack_dup8_16_neon;
+        k[FFNV_PACK_DUP16]     = ffnv_pack_dup16_neon;
+    }
+#else
+    (void)c;
+#endif
+}
+
+static inline void ffnv_pack_row(const FFNVPackJob *j, int p, int y)
+{
+    const FFNVPackPlane *pl = &j->planes[p];
+    const uint8_t *src[3];
+    int i;
+
+    if (pl->kernel == FFNV_PACK_GENERIC) {
+        ffnv_pack_row_generic(j, p, y);
+        return;
+    }
+
+    for (i = 0; i < 3; i++) {
+        int sp = pl->src_plane[i];
+        src[i] = sp < 0 ? NULL : j->src.data[sp] + (size_t)(y >> pl->src_vshift) * j->src.pitch[sp];
+    }
+    j->kernels[pl->kernel](src, pl->dst + (size_t)y * pl->pitch, pl->n, pl->arg);
+}
+
+/* Rows of all planes for luma row pairs [start, end). */
+static inline void ffnv_pack_band(void *arg, int start, int end)
+{
+    const FFNVPackJob *j = (const FFNVPackJob*)arg;
+    int p, y;
+
+    for (p = 0; p < j->nb_planes; p++) {
+        const FFNVPackPlane *pl = &j->planes[p];
+        int sub = pl->height < j->height;
+        int y0 = sub ? start : 2 * start;
+        int y1 = sub ? end : 2 * end;
+
+        for (y = y0; y < y1 && y < pl->height; y++)
+            ffnv_pack_row(j, p, y);
+    }
+
+#if defined(FFNV_CONVERT_X86)
+    /* order the non-temporal stores before the unlock of the buffer */
+    if (j->nt)
+        _mm_sfence();
+#endif
+}
+
+/*
+ * Plane layout of a buffer of format and kernel choice, as documented for
+ * NvEncLockInputBuffer. Returns -1 if the formats are not supported.
+ */
+static inline int ffnv_pack_init_job(FFNVPackJob *j, const FFNVPlanes *src, int src_format, void *buffer,
+                                     uint32_t pitch, NV_ENC_BUFFER_FORMAT format, int width, int height)
+{
+    uint8_t *buf = (uint8_t*)buffer;
+    int cw = (width + 1) >> 1, ch = (height + 1) >> 1;
+    int p;
+
+    if (!ffnv_pack_supported(src_format, format))
+        return -1;
+
+    memset(j, 0, sizeof(*j));
+    j->src        = *src;
+    j->src_format = src_format;
+    j->format     = format;
+    j->width      = width;
+    j->height     = height;
+
+    j->planes[0].dst    = buf;
+    j->planes[0].pitch  = pitch;
+    j->planes[0].width  = width;
+    j->planes[0].height = height;
+    j->nb_planes = 1;
+
+    switch (format) {
+    case NV_ENC_BUFFER_FORMAT_NV12:
+    case NV_ENC_BUFFER_FORMAT_YUV420_10BIT:
+        j->planes[1].dst    = buf + (size_t)pitch * height;
+        j->planes[1].pitch  = pitch;
+        j->planes[1].width  = cw;
+        j->planes[1].height = ch;
+        j->planes[1].chroma = 1;
+        j->nb_planes = 2;
+        break;
+    case NV_ENC_BUFFER_FORMAT_YV12:
+    case NV_ENC_BUFFER_FORMAT_IYUV:
+        for (p = 1; p < 3; p++) {
+            j->planes[p].dst    = buf + (size_t)pitch * height + (size_t)(p - 1) * ((pitch + 1) / 2) * ch;
+            j->planes[p].pitch  = (pitch + 1) / 2;
+            j->planes[p].width  = cw;
+            j->planes[p].height = ch;
+            j->planes[p].chroma = format == NV_ENC_BUFFER_FORMAT_YV12 ? 3 - p : p;
+        }
+        j->nb_planes = 3;
+        break;
+    case NV_ENC_BUFFER_FORMAT_YUV444:
+    case NV_ENC_BUFFER_FORMAT_YUV444_10BIT:
+        for (p = 1; p < 3; p++) {
+            j->planes[p]        = j->planes[0];
+            j->planes[p].dst    = buf + (size_t)pitch * height * p;
+            j->planes[p].chroma = p;
+        }
+        j->nb_planes = 3;
+        break;
+    default:
+        break;
+    }
+
+    for (p = 0; p < j->nb_planes; p++)
+        ffnv_pack_pick_kernel(j, &j->planes[p]);
+    return 0;
+}
+
+/**
+ * Pack a width x height frame into buffer, the bufferDataPtr of an
+ * input buffer of format created with that height, at pitch. Returns 0
+ * on success, -1 if the formats are not supported.
+ */
+static inline int ffnv_pack_frame(FFNVConvert *c, const FFNVPlanes *src, int src_format, void *buffer,
+                                  uint32_t pitch, NV_ENC_BUFFER_FORMAT format, int width, int height)
+{
+    FFNVPackJob j;
+
+    if (ffnv_pack_init_job(&j, src, src_format, buffer, pitch, format, width, height) < 0)
+        return -1;
+    ffnv_pack_setup(c, &j);
+
+    ffnv_convert_run(c, ffnv_pack_band, &j, (height + 1) >> 1, FFNV_CONVERT_MIN_BAND / 2);
+    return 0;
+}
+
+#endif
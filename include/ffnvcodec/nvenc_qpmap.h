@@ -0,0 +1,297 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Region-of-interest QP delta map generator for NV_ENC_PIC_PARAMS::qpDeltaMap.
+ *
+ * ROI rectangles are given in pixels and rasterized into one int8_t value
+ * per block (16x16 macroblocks for H.264, CTUs for HEVC). Each ROI can be
+ * feathered so its delta falls off linearly over a border of the given
+ * width. Maps are double-buffered: the map handed to the encoder is left
+ * untouched until the ROI set actually changes.
+ */
+
+#ifndef FFNV_NVENC_QPMAP_H
+#define FFNV_NVENC_QPMAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvEncodeAPI.h"
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE4_1__)
+# include <smmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#endif
+
+#define FFNV_QPMAP_MAX_ROIS 64
+
+#define FFNV_QPMAP_BLOCK_H264     16
+#define FFNV_QPMAP_BLOCK_HEVC_16  16
+#define FFNV_QPMAP_BLOCK_HEVC_32  32
+#define FFNV_QPMAP_BLOCK_HEVC_64  64
+
+#define FFNV_QPMAP_MIN_DELTA -51
+#define FFNV_QPMAP_MAX_DELTA  51
+
+typedef struct FFNVQPMapROI {
+    int x, y;          /**< top-left corner in pixels */
+    int width, height; /**< size in pixels */
+    int qp_delta;      /**< QP delta inside the ROI, negative values raise quality */
+    int feather;       /**< width in pixels of the linear falloff around the ROI, 0 for a hard edge */
+} FFNVQPMapROI;
+
+typedef struct FFNVQPMap {
+    int block_size;
+    int width_in_blocks;
+    int height_in_blocks;
+    int size;
+
+    int8_t *maps[2];
+    int8_t *row;
+    int cur;
+    int valid;
+
+    FFNVQPMapROI rois[FFNV_QPMAP_MAX_ROIS];
+    int nb_rois;
+} FFNVQPMap;
+
+static inline void ffnv_qpmap_uninit(FFNVQPMap *m)
+{
+    free(m->maps[0]);
+    free(m->maps[1]);
+    free(m->row);
+    memset(m, 0, sizeof(*m));
+}
+
+/**
+ * Allocate the maps for a width x height picture. block_size is 16 for
+ * H.264 and the CTU size for HEVC. Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_qpmap_init(FFNVQPMap *m, int width, int height, int block_size)
+{
+    memset(m, 0, sizeof(*m));
+
+    if (width <= 0 || height <= 0 ||
+        (block_size != 16 && block_size != 32 && block_size != 64))
+        return -1;
+
+    m->block_size       = block_size;
+    m->width_in_blocks  = (width  + block_size - 1) / block_size;
+    m->height_in_blocks = (height + block_size - 1) / block_size;
+    m->size             = m->width_in_blocks * m->height_in_blocks;
+
+    m->maps[0] = (int8_t*)calloc(m->size, 1);
+    m->maps[1] = (int8_t*)calloc(m->size, 1);
+    m->row     = (int8_t*)calloc(m->width_in_blocks, 1);
+    if (!m->maps[0] || !m->maps[1] || !m->row) {
+        ffnv_qpmap_uninit(m);
+        return -1;
+    }
+
+    m->valid = 1;
+    return 0;
+}
+
+/* take_min merges boosts, otherwise penalties are merged where dst is not boosted */
+static inline void ffnv_qpmap_merge_row(int8_t *dst, const int8_t *src, int n, int take_min)
+{
+    int i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+        a = take_min ? _mm256_min_epi8(a, b)
+                     : _mm256_blendv_epi8(_mm256_max_epi8(a, b), a,
+                                          _mm256_cmpgt_epi8(_mm256_setzero_si256(), a));
+        _mm256_storeu_si256((__m256i*)(dst + i), a);
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE4_1__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+        a = take_min ? _mm_min_epi8(a, b)
+                     : _mm_blendv_epi8(_mm_max_epi8(a, b), a,
+                                       _mm_cmplt_epi8(a, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i*)(dst + i), a);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 16 <= n; i += 16) {
+        int8x16_t a = vld1q_s8(dst + i);
+        int8x16_t b = vld1q_s8(src + i);
+        vst1q_s8(dst + i, take_min ? vminq_s8(a, b)
+                                   : vbslq_s8(vcltq_s8(a, vdupq_n_s8(0)), a, vmaxq_s8(a, b)));
+    }
+#endif
+    for (; i < n; i++) {
+        if (take_min ? src[i] < dst[i] : dst[i] >= 0 && src[i] > dst[i])
+            dst[i] = src[i];
+    }
+}
+
+static inline int ffnv_qpmap_clip_delta(int v)
+{
+    return v < FFNV_QPMAP_MIN_DELTA ? FFNV_QPMAP_MIN_DELTA :
+           v > FFNV_QPMAP_MAX_DELTA ? FFNV_QPMAP_MAX_DELTA : v;
+}
+
+/* Feathered delta at distance d (pixels) outside the ROI edge. */
+static inline int ffnv_qpmap_feather(int delta, int feather, int d)
+{
+    int num;
+
+    if (d <= 0)
+        return delta;
+    if (d >= feather)
+        return 0;
+
+    num = delta * (feather - d);
+    return (num + (num < 0 ? -feather : feather) / 2) / feather;
+}
+
+static inline int ffnv_qpmap_edge_dist(int c, int lo, int hi)
+{
+    if (c < lo)
+        return lo - c;
+    if (c >= hi)
+        return c - hi + 1;
+    return 0;
+}
+
+static inline void ffnv_qpmap_draw_roi(FFNVQPMap *m, int8_t *map, const FFNVQPMapROI *r)
+{
+    const int bs      = m->block_size;
+    const int delta   = ffnv_qpmap_clip_delta(r->qp_delta);
+    const int feather = r->feather > 0 ? r->feather : 0;
+    const int x0 = r->x - feather, x1 = r->x + r->width  + feather;
+    const int y0 = r->y - feather, y1 = r->y + r->height + feather;
+    int bx0, bx1, by0, by1, bx, by;
+
+    if (!delta || r->width <= 0 || r->height <= 0)
+        return;
+
+    /* blocks whose center lies inside the feathered rectangle */
+    bx0 = (x0 - bs / 2 + bs - 1) / bs;
+    bx1 = (x1 - bs / 2 + bs - 1) / bs;
+    by0 = (y0 - bs / 2 + bs - 1) / bs;
+    by1 = (y1 - bs / 2 + bs - 1) / bs;
+    if (x0 - bs / 2 < 0) bx0 = 0;
+    if (y0 - bs / 2 < 0) by0 = 0;
+    if (bx1 > m->width_in_blocks)  bx1 = m->width_in_blocks;
+    if (by1 > m->height_in_blocks) by1 = m->height_in_blocks;
+    if (bx0 >= bx1 || by0 >= by1)
+        return;
+
+    for (by = by0; by < by1; by++) {
+        int dy = ffnv_qpmap_edge_dist(by * bs + bs / 2, r->y, r->y + r->height);
+        int row_delta = ffnv_qpmap_feather(delta, feather, dy);
+
+        if (!row_delta)
+            continue;
+
+        for (bx = bx0; bx < bx1; bx++) {
+            int dx = ffnv_qpmap_edge_dist(bx * bs + bs / 2, r->x, r->x + r->width);
+            m->row[bx] = (int8_t)(dx ? ffnv_qpmap_feather(delta, feather, dx > dy ? dx : dy) : row_delta);
+        }
+
+        ffnv_qpmap_merge_row(map + by * m->width_in_blocks + bx0, m->row + bx0,
+                             bx1 - bx0, delta < 0);
+    }
+}
+
+/**
+ * Rebuild the back map from the given ROI list and flip it to the front.
+ * Overlapping ROIs keep the strongest delta of each sign. If the list is
+ * identical to the one the current map was built from, nothing is done.
+ * Returns 1 if the map was rebuilt, 0 if unchanged, -1 on error.
+ */
+static inline int ffnv_qpmap_update(FFNVQPMap *m, const FFNVQPMapROI *rois, int nb_rois)
+{
+    int8_t *map;
+    int i, has_pos = 0;
+
+    if (!m->valid || nb_rois < 0 || nb_rois > FFNV_QPMAP_MAX_ROIS)
+        return -1;
+
+    if (nb_rois == m->nb_rois &&
+        (!nb_rois || !memcmp(rois, m->rois, nb_rois * sizeof(*rois))))
+        return 0;
+
+    map = m->maps[!m->cur];
+    memset(map, 0, m->size);
+
+    /* negative deltas first, positive ones are never merged over a boost */
+    for (i = 0; i < nb_rois; i++) {
+        if (rois[i].qp_delta < 0)
+            ffnv_qpmap_draw_roi(m, map, &rois[i]);
+        else if (rois[i].qp_delta > 0)
+            has_pos = 1;
+    }
+    if (has_pos) {
+        for (i = 0; i < nb_rois; i++) {
+            if (rois[i].qp_delta > 0)
+                ffnv_qpmap_draw_roi(m, map, &rois[i]);
+        }
+    }
+
+    if (nb_rois)
+        memcpy(m->rois, rois, nb_rois * sizeof(*rois));
+    m->nb_rois = nb_rois;
+    m->cur = !m->cur;
+
+    return 1;
+}
+
+/** Current front map, valid until the second next map rebuild. */
+static inline const int8_t *ffnv_qpmap_get(const FFNVQPMap *m)
+{
+    return m->maps[m->cur];
+}
+
+/**
+ * Point pic_params at the current map. The session must have been
+ * initialized with NV_ENC_RC_PARAMS::qpMapMode = NV_ENC_QP_MAP_DELTA.
+ */
+static inline void ffnv_qpmap_apply(const FFNVQPMap *m, NV_ENC_PIC_PARAMS *pic_params)
+{
+    if (!m->nb_rois) {
+        pic_params->qpDeltaMap     = NULL;
+        pic_params->qpDeltaMapSize = 0;
+        return;
+    }
+
+    pic_params->qpDeltaMap     = m->maps[m->cur];
+    pic_params->qpDeltaMapSize = m->size;
+}
+
+#endif
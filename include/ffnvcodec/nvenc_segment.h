@@ -0,0 +1,346 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Segmented encode of one input on several NVENC sessions at once.
+ *
+ * ffnv_segment_plan() splits the input frames into segments, preferably
+ * at scene cuts, and ffnv_segment_distribute() shares the bit budget
+ * between them by complexity. Every segment is encoded by a session of
+ * its own, opened with the same NV_ENC_INITIALIZE_PARAMS apart from the
+ * rate control target, and starts with a forced IDR carrying the
+ * parameter sets. As no segment references another, the stitched stream
+ * is the concatenation of the segment bitstreams in order, provided all
+ * sessions produce the same sequence header, which
+ * ffnv_segment_check_headers() verifies through NvEncGetSequenceParams.
+ */
+
+#ifndef FFNV_NVENC_SEGMENT_H
+#define FFNV_NVENC_SEGMENT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvEncodeAPI.h"
+#include "ffnv_thread.h"
+
+#define FFNV_SEGMENT_MAX_HEADER 1024
+
+typedef struct FFNVSegment {
+    int first_frame;
+    int nb_frames;
+    uint64_t target_bits;  /**< share of the bit budget */
+    uint32_t bitrate;      /**< averageBitRate matching target_bits */
+    uint64_t out_bytes;    /**< size of the encoded segment, set by the stitcher */
+} FFNVSegment;
+
+/**
+ * Split nb_frames frames into segments of min_len to max_len frames. A
+ * segment ends before the last scene cut it can end at, or after max_len
+ * frames if there is none. scene_cut holds one flag per frame, set if the
+ * frame starts a new scene, and may be NULL for fixed length segments.
+ * A remainder shorter than min_len is merged into the last segment.
+ * Returns the number of segments, or -1 if more than max_segs are needed.
+ */
+static inline int ffnv_segment_plan(const uint8_t *scene_cut, int nb_frames, int min_len, int max_len,
+                                    FFNVSegment *segs, int max_segs)
+{
+    int start = 0, n = 0;
+
+    if (min_len < 1)
+        min_len = 1;
+    if (max_len < min_len)
+        max_len = min_len;
+
+    while (start < nb_frames) {
+        int end = nb_frames - start > max_len ? start + max_len : nb_frames;
+        int i;
+
+        if (end < nb_frames && scene_cut) {
+            for (i = end; i >= start + min_len; i--) {
+                if (scene_cut[i]) {
+                    end = i;
+                    break;
+                }
+            }
+        }
+        if (nb_frames - end < min_len)
+            end = nb_frames;
+
+        if (n >= max_segs)
+            return -1;
+        memset(&segs[n], 0, sizeof(segs[n]));
+        segs[n].first_frame = start;
+        segs[n].nb_frames   = end - start;
+        n++;
+        start = end;
+    }
+
+    return n;
+}
+
+/**
+ * Share total_bits between the segments in proportion to the summed
+ * complexity of their frames (e.g. lookahead costs), or to their length
+ * if complexity is NULL, and set the matching average bitrates.
+ */
+static inline void ffnv_segment_distribute(FFNVSegment *segs, int nb_segs, uint64_t total_bits,
+                                           const float *complexity,
+                                           uint32_t frame_rate_num, uint32_t frame_rate_den)
+{
+    double sum = 0, weight;
+    int i, j;
+
+    for (i = 0; i < nb_segs; i++) {
+        if (!complexity) {
+            sum += segs[i].nb_frames;
+            continue;
+        }
+        for (j = 0; j < segs[i].nb_frames; j++)
+            sum += complexity[segs[i].first_frame + j];
+    }
+
+    for (i = 0; i < nb_segs; i++) {
+        if (!complexity) {
+            weight = segs[i].nb_frames;
+        } else {
+            weight = 0;
+            for (j = 0; j < segs[i].nb_frames; j++)
+                weight += complexity[segs[i].first_frame + j];
+        }
+
+        segs[i].target_bits = sum > 0 ? (uint64_t)(total_bits * (weight / sum)) : 0;
+        segs[i].bitrate     = segs[i].nb_frames && frame_rate_den ?
+            (uint32_t)((double)segs[i].target_bits * frame_rate_num /
+                       ((double)frame_rate_den * segs[i].nb_frames)) : 0;
+    }
+}
+
+/**
+ * Adjust a config shared by all segment sessions: HRD SEI is disabled
+ * so the sequence header does not depend on the bitrate of a segment.
+ */
+static inline void ffnv_segment_config(NV_ENC_CONFIG *config, GUID codec)
+{
+    if (!memcmp(&codec, &NV_ENC_CODEC_HEVC_GUID, sizeof(codec))) {
+        config->encodeCodecConfig.hevcConfig.outputBufferingPeriodSEI = 0;
+        config->encodeCodecConfig.hevcConfig.outputPictureTimingSEI   = 0;
+    } else {
+        config->encodeCodecConfig.h264Config.outputBufferingPeriodSEI = 0;
+        config->encodeCodecConfig.h264Config.outputPictureTimingSEI   = 0;
+    }
+}
+
+/** Set the rate control target of the session encoding seg. */
+static inline void ffnv_segment_rc_params(NV_ENC_RC_PARAMS *rc, const FFNVSegment *seg)
+{
+    rc->averageBitRate = seg->bitrate;
+    if (rc->maxBitRate && rc->maxBitRate < seg->bitrate)
+        rc->maxBitRate = seg->bitrate;
+    /* each segment starts with a full buffer, as after any IDR */
+    if (rc->vbvBufferSize)
+        rc->vbvInitialDelay = rc->vbvBufferSize;
+}
+
+/** encodePicFlags for frame (a global frame number) of seg. */
+static inline uint32_t ffnv_segment_pic_flags(const FFNVSegment *seg, int frame)
+{
+    if (frame == seg->first_frame)
+        return NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
+    return 0;
+}
+
+/** Sequence header of a session, buf must hold FFNV_SEGMENT_MAX_HEADER bytes. */
+static inline NVENCSTATUS ffnv_segment_get_header(NV_ENCODE_API_FUNCTION_LIST *nvenc, void *encoder,
+                                                  uint8_t *buf, uint32_t *size)
+{
+    NV_ENC_SEQUENCE_PARAM_PAYLOAD payload;
+
+    memset(&payload, 0, sizeof(payload));
+    payload.version              = NV_ENC_SEQUENCE_PARAM_PAYLOAD_VER;
+    payload.inBufferSize         = FFNV_SEGMENT_MAX_HEADER;
+    payload.spsppsBuffer         = buf;
+    payload.outSPSPPSPayloadSize = size;
+
+    *size = 0;
+    return nvenc->nvEncGetSequenceParams(encoder, &payload);
+}
+
+/**
+ * Compare the sequence headers of nb_encoders sessions. Returns 0 if they
+ * are all the same, the index of the first session differing from the
+ * first one, or -1 on error.
+ */
+static inline int ffnv_segment_check_headers(NV_ENCODE_API_FUNCTION_LIST *nvenc, void **encoders,
+                                             int nb_encoders)
+{
+    uint8_t ref[FFNV_SEGMENT_MAX_HEADER], cur[FFNV_SEGMENT_MAX_HEADER];
+    uint32_t ref_size, cur_size;
+    int i;
+
+    if (nb_encoders < 1 ||
+        ffnv_segment_get_header(nvenc, encoders[0], ref, &ref_size) != NV_ENC_SUCCESS)
+        return -1;
+
+    for (i = 1; i < nb_encoders; i++) {
+        if (ffnv_segment_get_header(nvenc, encoders[i], cur, &cur_size) != NV_ENC_SUCCESS)
+            return -1;
+        if (cur_size != ref_size || memcmp(cur, ref, ref_size))
+            return i;
+    }
+    return 0;
+}
+
+typedef struct FFNVSegmentBuffer {
+    uint8_t *data;
+    size_t size;
+    size_t alloc;
+    int done;
+} FFNVSegmentBuffer;
+
+/*
+ * Collects the bitstreams of segments encoded concurrently and hands them
+ * out in order. Segments may be added from different threads.
+ */
+typedef struct FFNVSegmentStitcher {
+    FFNVMutex lock;
+    FFNVSegment *segs;
+    FFNVSegmentBuffer *bufs;
+    int nb_segs;
+    int out_seg; /* next segment to hand out */
+    uint64_t total_bytes;
+} FFNVSegmentStitcher;
+
+static inline void ffnv_segment_stitch_uninit(FFNVSegmentStitcher *st)
+{
+    int i;
+
+    if (st->bufs) {
+        for (i = 0; i < st->nb_segs; i++)
+            free(st->bufs[i].data);
+        ffnv_mutex_destroy(&st->lock);
+    }
+    free(st->bufs);
+    memset(st, 0, sizeof(*st));
+}
+
+/** Returns 0 on success, -1 on error. */
+static inline int ffnv_segment_stitch_init(FFNVSegmentStitcher *st, FFNVSegment *segs, int nb_segs)
+{
+    memset(st, 0, sizeof(*st));
+
+    if (nb_segs < 1)
+        return -1;
+
+    st->bufs = (FFNVSegmentBuffer*)calloc(nb_segs, sizeof(*st->bufs));
+    if (!st->bufs)
+        return -1;
+    if (ffnv_mutex_init(&st->lock) < 0) {
+        free(st->bufs);
+        st->bufs = NULL;
+        return -1;
+    }
+
+    st->segs    = segs;
+    st->nb_segs = nb_segs;
+    return 0;
+}
+
+/**
+ * Append the output of one NvEncLockBitstream() call of segment seg.
+ * Returns 0 on success, -1 on error.
+ */
+static inline int ffnv_segment_stitch_add(FFNVSegmentStitcher *st, int seg, const void *data, size_t size)
+{
+    FFNVSegmentBuffer *b = &st->bufs[seg];
+    int ret = 0;
+
+    ffnv_mutex_lock(&st->lock);
+    if (b->done) {
+        ret = -1;
+    } else if (b->size + size > b->alloc) {
+        size_t alloc = b->alloc ? b->alloc : 1 << 20;
+        uint8_t *tmp;
+
+        while (alloc < b->size + size)
+            alloc *= 2;
+        tmp = (uint8_t*)realloc(b->data, alloc);
+        if (tmp) {
+            b->data  = tmp;
+            b->alloc = alloc;
+        } else {
+            ret = -1;
+        }
+    }
+    if (!ret) {
+        memcpy(b->data + b->size, data, size);
+        b->size += size;
+    }
+    ffnv_mutex_unlock(&st->lock);
+    return ret;
+}
+
+/** Mark segment seg as fully encoded. */
+static inline void ffnv_segment_stitch_finish(FFNVSegmentStitcher *st, int seg)
+{
+    ffnv_mutex_lock(&st->lock);
+    st->bufs[seg].done      = 1;
+    st->segs[seg].out_bytes = st->bufs[seg].size;
+    ffnv_mutex_unlock(&st->lock);
+}
+
+/**
+ * Get the bitstream of the next segment in order once it is finished.
+ * Returns 1 if data and size were set, valid until the next call, 0 if
+ * the next segment is not finished yet and -1 once all were handed out.
+ */
+static inline int ffnv_segment_stitch_next(FFNVSegmentStitcher *st, const uint8_t **data, size_t *size)
+{
+    int ret = 0;
+
+    ffnv_mutex_lock(&st->lock);
+    /* the previous segment was written out */
+    if (st->out_seg > 0 && st->bufs[st->out_seg - 1].data) {
+        free(st->bufs[st->out_seg - 1].data);
+        st->bufs[st->out_seg - 1].data = NULL;
+    }
+
+    if (st->out_seg >= st->nb_segs) {
+        ret = -1;
+    } else if (st->bufs[st->out_seg].done) {
+        *data = st->bufs[st->out_seg].data;
+        *size = st->bufs[st->out_seg].size;
+        st->total_bytes += *size;
+        st->out_seg++;
+        ret = 1;
+    }
+    ffnv_mutex_unlock(&st->lock);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,389 @@
+/*
+ * This copyright notice applies to this header file only:
+ *
+ * Copyright (c) 2018
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the software, and to permit persons to whom the
+ * software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Virtual encode sessions: many logical streams time-sharing a few
+ * physical NVENC sessions, for GPUs capping the number of concurrent
+ * sessions.
+ *
+ * A physical session encodes one chunk of a logical stream at a time.
+ * When it moves to another stream it is reconfigured with that stream's
+ * NV_ENC_INITIALIZE_PARAMS through NvEncReconfigureEncoder, resetting the
+ * encoder state. A chunk starts with an IDR carrying the parameter sets
+ * only when the encoder does not hold the stream's previous chunk (the
+ * session was switched, or the previous chunk ran on another session),
+ * so the output of a logical stream is the concatenation of its chunks
+ * and a stream that stays on its session keeps its GOP. The price is one
+ * IDR and a rate control restart per switch.
+ *
+ * Streams are served by weighted fair queueing over the frames encoded:
+ * the stream with the lowest virtual time goes next, and a session keeps
+ * its current stream while that one is within a chunk of the lowest
+ * virtual time, to save switches. A stream is only served once it has
+ * chunk_frames queued or its oldest queued frame waited max_wait, so
+ * low frame rate streams are encoded in chunks of several frames instead
+ * of being switched in for every frame. Times are in any unit the caller
+ * likes, as long as the now arguments and max_wait agree.
+ *
+ * All sessions must be initialized with maxEncodeWidth/maxEncodeHeight
+ * covering every stream, and the streams must share the codec, GOP
+ * structure and sync/async mode, which NvEncReconfigureEncoder cannot
+ * change. The last frame of a chunk must be followed by an
+ * NV_ENC_PIC_FLAG_EOS picture so the session is drained before it is
+ * released.
+ */
+
+#ifndef FFNV_NVENC_VSESSION_H
+#define FFNV_NVENC_VSESSION_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "nvEncodeAPI.h"
+#include "ffnv_thread.h"
+
+#define FFNV_VSESSION_MAX_SESSIONS 8
+#define FFNV_VSESSION_MAX_STREAMS 64
+
+typedef struct FFNVVSessionStream {
+    int active;
+    NV_ENC_INITIALIZE_PARAMS params;
+    NV_ENC_CONFIG config;  /**< params.encodeConfig points here */
+    double weight;
+    double vtime;          /**< frames encoded divided by weight, plus the time spent idle */
+    int queued;            /**< frames waiting to be encoded */
+    int64_t wait_start;    /* when the oldest of the queued frames was queued */
+    int session;           /* session that encoded the last chunk, -1 if none */
+    int busy;              /**< a session encodes a chunk of this stream */
+    uint64_t frames;       /**< frames encoded */
+    uint64_t chunks;
+} FFNVVSessionStream;
+
+typedef struct FFNVVSession {
+    void *encoder;
+    int stream;            /**< stream the encoder is configured for, -1 if none */
+    int busy;
+} FFNVVSession;
+
+typedef struct FFNVVSessionMux {
+    FFNVMutex lock;
+    NV_ENCODE_API_FUNCTION_LIST *nvenc;
+    FFNVVSession sessions[FFNV_VSESSION_MAX_SESSIONS];
+    int nb_sessions;
+    FFNVVSessionStream streams[FFNV_VSESSION_MAX_STREAMS];
+    int chunk_frames;      /**< maximum frames per chunk */
+    int64_t max_wait;      /**< longest a queued frame waits for a chunk to fill */
+    double vclock;         /**< virtual time of the last chunk started */
+    uint64_t switches;     /**< reconfigurations to another stream */
+} FFNVVSessionMux;
+
+/** A chunk of one stream on one physical session, see ffnv_vsession_acquire(). */
+typedef struct FFNVVSessionSlot {
+    int session;
+    int stream;
+    void *encoder;
+    int nb_frames;         /**< frames of the stream to encode in this chunk */
+    int switched;          /**< the encoder was reconfigured for the stream */
+    int idr;               /**< the chunk starts with an IDR, see ffnv_vsession_pic_flags() */
+} FFNVVSessionSlot;
+
+/** Returns 0 on success, -1 on error. */
+static inline int ffnv_vsession_init(FFNVVSessionMux *m, NV_ENCODE_API_FUNCTION_LIST *nvenc, int chunk_frames,
+                                     int64_t max_wait)
+{
+    memset(m, 0, sizeof(*m));
+
+    if (chunk_frames < 1 || ffnv_mutex_init(&m->lock) < 0)
+        return -1;
+
+    m->nvenc        = nvenc;
+    m->chunk_frames = chunk_frames;
+    m->max_wait     = max_wait > 0 ? max_wait : 0;
+    return 0;
+}
+
+/** The encoders are not destroyed, they belong to the caller. */
+static inline void ffnv_vsession_uninit(FFNVVSessionMux *m)
+{
+    if (m->nvenc)
+        ffnv_mutex_destroy(&m->lock);
+    memset(m, 0, sizeof(*m));
+}
+
+/**
+ * Add an initialized physical session. The number of sessions added is
+ * the session cap. Returns the session index, or -1 if
+ * FFNV_VSESSION_MAX_SESSIONS are already in use.
+ */
+static inline int ffnv_vsession_add_session(FFNVVSessionMux *m, void *encoder)
+{
+    int ret = -1;
+
+    ffnv_mutex_lock(&m->lock);
+    if (m->nb_sessions < FFNV_VSESSION_MAX_SESSIONS) {
+        ret = m->nb_sessions++;
+        m->sessions[ret].encoder = encoder;
+        m->sessions[ret].stream  = -1;
+        m->sessions[ret].busy    = 0;
+    }
+    ffnv_mutex_unlock(&m->lock);
+    return ret;
+}
+
+/**
+ * Add a logical stream encoded with params and the config it points to,
+ * which are copied. weight scales its share of the encode time, 1.0 for
+ * an equal share. Returns the stream index, or -1 if there is no room.
+ */
+static inline int ffnv_vsession_add_stream(FFNVVSessionMux *m, const NV_ENC_INITIALIZE_PARAMS *params,
+                                           double weight)
+{
+    FFNVVSessionStream *st;
+    int i, ret = -1;
+
+    ffnv_mutex_lock(&m->lock);
+    for (i = 0; i < FFNV_VSESSION_MAX_STREAMS; i++) {
+        if (!m->streams[i].active) {
+            ret = i;
+            break;
+        }
+    }
+    if (ret >= 0) {
+        st = &m->streams[ret];
+        memset(st, 0, sizeof(*st));
+        st->active = 1;
+        st->params = *params;
+        if (params->encodeConfig) {
+            st->config = *params->encodeConfig;
+            st->params.encodeConfig = &st->config;
+        }
+        st->weight  = weight > 0 ? weight : 1.0;
+        st->vtime   = m->vclock;
+        st->session = -1;
+    }
+    ffnv_mutex_unlock(&m->lock);
+    return ret;
+}
+
+/**
+ * Remove a stream. Returns 0 on success, -1 if a chunk of it is being
+ * encoded.
+ */
+static inline int ffnv_vsession_remove_stream(FFNVVSessionMux *m, int stream)
+{
+    int i, ret = -1;
+
+    ffnv_mutex_lock(&m->lock);
+    if (!m->streams[stream].busy) {
+        m->streams[stream].active = 0;
+        for (i = 0; i < m->nb_sessions; i++)
+            if (m->sessions[i].stream == stream)
+                m->sessions[i].stream = -1;
+        ret = 0;
+    }
+    ffnv_mutex_unlock(&m->lock);
+    return ret;
+}
+
+/** Report nb_frames more frames of stream ready to be encoded at time now. */
+static inline void ffnv_vsession_queue(FFNVVSessionMux *m, int stream, int nb_frames, int64_t now)
+{
+    FFNVVSessionStream *st = &m->streams[stream];
+
+    ffnv_mutex_lock(&m->lock);
+    if (!st->queued) {
+        st->wait_start = now;
+        /* a stream coming back from idle gets no credit for the time it had nothing to encode */
+        if (!st->busy && st->vtime < m->vclock)
+            st->vtime = m->vclock;
+    }
+    st->queued += nb_frames;
+    ffnv_mutex_unlock(&m->lock);
+}
+
+/* Whether a chunk of st can start: a full one, or one whose frames waited long enough. */
+static inline int ffnv_vsession_ready(const FFNVVSessionMux *m, const FFNVVSessionStream *st, int64_t now)
+{
+    return st->active && !st->busy && st->queued > 0 &&
+           (st->queued >= m->chunk_frames || now - st->wait_start >= m->max_wait);
+}
+
+/* Pick the stream for session s, -1 if none is ready. */
+static inline int ffnv_vsession_pick(FFNVVSessionMux *m, const FFNVVSession *s, int64_t now)
+{
+    int i, best = -1;
+
+    for (i = 0; i < FFNV_VSESSION_MAX_STREAMS; i++) {
+        const FFNVVSessionStream *st = &m->streams[i];
+
+        if (!ffnv_vsession_ready(m, st, now))
+            continue;
+        if (best < 0 || st->vtime < m->streams[best].vtime)
+            best = i;
+    }
+
+    if (best >= 0 && s->stream >= 0 && s->stream != best) {
+        const FFNVVSessionStream *cur = &m->streams[s->stream];
+
+        if (ffnv_vsession_ready(m, cur, now) &&
+            cur->vtime - m->streams[best].vtime < m->chunk_frames / cur->weight)
+            best = s->stream;
+    }
+    return best;
+}
+
+/**
+ * Start a chunk on an idle session, reconfiguring it if it moves to
+ * another stream. The first picture of the chunk must be encoded with
+ * ffnv_vsession_pic_flags() and the chunk ended with
+ * ffnv_vsession_release(). now is the current time, in the unit of
+ * max_wait. Returns NV_ENC_SUCCESS with slot filled,
+ * NV_ENC_ERR_ENCODER_BUSY if all sessions are in use,
+ * NV_ENC_ERR_NEED_MORE_INPUT if no stream is ready, or the
+ * NvEncReconfigureEncoder error, after which the session is idle again.
+ */
+static inline NVENCSTATUS ffnv_vsession_acquire(FFNVVSessionMux *m, FFNVVSessionSlot *slot, int64_t now)
+{
+    NV_ENC_RECONFIGURE_PARAMS reconf;
+    FFNVVSession *s = NULL;
+    FFNVVSessionStream *st;
+    NVENCSTATUS err;
+    int i = 0, j, stream = -1, idle = 0, best = -1;
+
+    ffnv_mutex_lock(&m->lock);
+    /*
+     * Among the idle sessions, prefer one going on with its own stream,
+     * then one configured for no stream, then one whose stream has
+     * nothing queued, to keep the streams on their sessions.
+     */
+    for (j = 0; j < m->nb_sessions; j++) {
+        const FFNVVSession *cand = &m->sessions[j];
+        int pick, score;
+
+        if (cand->busy)
+            continue;
+        idle = 1;
+        pick = ffnv_vsession_pick(m, cand, now);
+        if (pick < 0)
+            continue;
+
+        if (pick == cand->stream && m->streams[pick].session == j)
+            score = 3;
+        else if (cand->stream < 0)
+            score = 2;
+        else
+            score = !m->streams[cand->stream].queued;
+
+        if (score > best) {
+            s      = &m->sessions[j];
+            i      = j;
+            stream = pick;
+            best   = score;
+        }
+    }
+    if (!s) {
+        ffnv_mutex_unlock(&m->lock);
+        return idle ? NV_ENC_ERR_NEED_MORE_INPUT : NV_ENC_ERR_ENCODER_BUSY;
+    }
+
+    st = &m->streams[stream];
+    s->busy  = 1;
+    st->busy = 1;
+    if (st->vtime > m->vclock)
+        m->vclock = st->vtime;
+
+    memset(slot, 0, sizeof(*slot));
+    slot->session   = i;
+    slot->stream    = stream;
+    slot->encoder   = s->encoder;
+    slot->nb_frames = st->queued < m->chunk_frames ? st->queued : m->chunk_frames;
+    slot->switched  = s->stream != stream;
+    slot->idr       = slot->switched || st->session != i;
+    if (slot->switched)
+        m->switches++;
+    ffnv_mutex_unlock(&m->lock);
+
+    /* the session is ours now, the stream parameters only change under busy */
+    memset(&reconf, 0, sizeof(reconf));
+    reconf.version            = NV_ENC_RECONFIGURE_PARAMS_VER;
+    reconf.reInitEncodeParams = st->params;
+    reconf.resetEncoder       = 1;
+    reconf.forceIDR           = 1;
+
+    err = slot->switched ? m->nvenc->nvEncReconfigureEncoder(s->encoder, &reconf) : NV_ENC_SUCCESS;
+
+    ffnv_mutex_lock(&m->lock);
+    if (err != NV_ENC_SUCCESS) {
+        s->busy   = 0;
+        s->stream = -1;
+        st->busy  = 0;
+    } else {
+        s->stream = stream;
+    }
+    ffnv_mutex_unlock(&m->lock);
+    return err;
+}
+
+/**
+ * encodePicFlags for picture index (0 for the first) of the chunk in
+ * slot: an IDR with the parameter sets if the encoder does not hold the
+ * previous chunk of the stream, nothing otherwise.
+ */
+static inline uint32_t ffnv_vsession_pic_flags(const FFNVVSessionSlot *slot, int index)
+{
+    if (!index && slot->idr)
+        return NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
+    return 0;
+}
+
+/**
+ * End the chunk in slot once the session is drained, nb_encoded being
+ * the frames actually encoded, which are charged to the stream. now is
+ * the current time, the frames still queued wait for the next chunk from
+ * then on.
+ */
+static inline void ffnv_vsession_release(FFNVVSessionMux *m, const FFNVVSessionSlot *slot, int nb_encoded,
+                                         int64_t now)
+{
+    FFNVVSessionStream *st = &m->streams[slot->stream];
+
+    ffnv_mutex_lock(&m->lock);
+    st->queued -= nb_encoded;
+    if (st->queued < 0)
+        st->queued = 0;
+    if (st->queued)
+        st->wait_start = now;
+    st->vtime  += nb_encoded / st->weight;
+    st->frames += nb_encoded;
+    st->chunks++;
+    st->session = nb_encoded > 0 ? slot->session : -1;
+    st->busy = 0;
+    m->sessions[slot->session].busy = 0;
+    ffnv_mutex_unlock(&m->lock);
+}
+
+#endif